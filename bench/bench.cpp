@@ -0,0 +1,328 @@
+/* -----------------------------------------------------------------------------
+ * The Cyberiada GraphML C++ library implemention
+ *
+ * The benchmark suite
+ *
+ * Copyright (C) 2025 Alexey Fedoseev <aleksey@fedoseev.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see https://www.gnu.org/licenses/
+ * ----------------------------------------------------------------------------- */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <stdlib.h>
+#include "cyberiadamlpp.h"
+#include "generator.h"
+
+using namespace Cyberiada;
+using namespace CyberiadaBench;
+using namespace std;
+
+static const size_t FIND_LOOKUPS = 1000;
+
+struct BenchResult {
+	string  benchmark;
+	size_t  elements;
+	size_t  repetitions;
+	double  min_ms;
+	double  median_ms;
+};
+
+void usage(const char* program)
+{
+	cerr << program << " [-s <size1,size2,...>] [-r <repetitions>] [-g <none|yed|cyberiada|qt>] [--seed <seed>]" << endl;
+	cerr << "\t\t[-f <csv|json>] [-o <results-file>] [-t <temporary-graphml-file>]" << endl;
+	cerr << "\tRun the benchmarks on the generated documents of the given sizes (in elements)" << endl;
+	cerr << "\t(10,100,1000,10000,100000 by default, up to 1000000) and write the results" << endl;
+	exit(1);
+}
+
+static vector<size_t> parse_sizes(const string& s)
+{
+	vector<size_t> sizes;
+	stringstream ss(s);
+	string item;
+	while (getline(ss, item, ',')) {
+		long long n = atoll(item.c_str());
+		if (n <= 0) {
+			return vector<size_t>();
+		}
+		sizes.push_back(size_t(n));
+	}
+	return sizes;
+}
+
+class Stopwatch {
+public:
+	void   start() { started = chrono::steady_clock::now(); }
+	double stop() const { return chrono::duration<double, milli>(chrono::steady_clock::now() - started).count(); }
+
+private:
+	chrono::steady_clock::time_point started;
+};
+
+static void add_result(vector<BenchResult>& results, const string& benchmark, size_t elements, vector<double> times)
+{
+	if (times.empty()) {
+		return ;
+	}
+	sort(times.begin(), times.end());
+	BenchResult r;
+	r.benchmark = benchmark;
+	r.elements = elements;
+	r.repetitions = times.size();
+	r.min_ms = times.front();
+	r.median_ms = times[times.size() / 2];
+	results.push_back(r);
+	cerr << benchmark << " " << elements << ": " << r.median_ms << " ms" << endl;
+}
+
+static DocumentGeometryFormat next_geometry_format(DocumentGeometryFormat gf)
+{
+	return gf == geometryFormatQt ? geometryFormatCyberiada10 : geometryFormatQt;
+}
+
+static void run_benchmarks(size_t size, size_t repetitions, const GeneratorOptions& options,
+						   const string& tmp_file, vector<BenchResult>& results)
+{
+	Stopwatch sw;
+	vector<double> generate, save, open, save_snapshot, load_snapshot, encode_json, decode_json, find, dump, copy, convert, isomorphism;
+	for (size_t rep = 0; rep < repetitions; rep++) {
+		Document d;
+		sw.start();
+		generate_document(d, options);
+		generate.push_back(sw.stop());
+
+		try {
+			LocalDocument ld(d, tmp_file);
+			sw.start();
+			ld.save();
+			save.push_back(sw.stop());
+		} catch (const Cyberiada::Exception& e) {
+			cerr << "save " << size << ": " << e.str() << endl;
+		}
+
+		try {
+			LocalDocument ld;
+			sw.start();
+			ld.open(tmp_file, formatDetect, options.geometry == geometryFormatNone ? geometryFormatNone : options.geometry);
+			open.push_back(sw.stop());
+		} catch (const Cyberiada::Exception& e) {
+			cerr << "open " << size << ": " << e.str() << endl;
+		}
+
+		try {
+			String snapshot;
+			sw.start();
+			d.save_snapshot(snapshot);
+			save_snapshot.push_back(sw.stop());
+			Document loaded;
+			sw.start();
+			loaded.load_snapshot(snapshot);
+			load_snapshot.push_back(sw.stop());
+		} catch (const Cyberiada::Exception& e) {
+			cerr << "snapshot " << size << ": " << e.str() << endl;
+		}
+
+		try {
+			String json;
+			sw.start();
+			d.encode_json(json);
+			encode_json.push_back(sw.stop());
+			Document decoded;
+			sw.start();
+			decoded.decode_json(json);
+			decode_json.push_back(sw.stop());
+		} catch (const Cyberiada::Exception& e) {
+			cerr << "json " << size << ": " << e.str() << endl;
+		}
+
+		vector<ID> ids;
+		ConstStateMachineList sms = static_cast<const Document&>(d).get_state_machines();
+		for (ConstStateMachineList::const_iterator i = sms.begin(); i != sms.end(); i++) {
+			ConstElementList elements = (*i)->find_elements_by_types({elementSimpleState, elementCompositeState,
+																	   elementTransition, elementComment});
+			for (ConstElementList::const_iterator e = elements.begin(); e != elements.end(); e++) {
+				ids.push_back((*e)->get_id());
+			}
+		}
+		Random random(options.seed);
+		vector<ID> lookups;
+		for (size_t i = 0; i < FIND_LOOKUPS && !ids.empty(); i++) {
+			lookups.push_back(ids[random.below(ids.size())]);
+		}
+		sw.start();
+		for (vector<ID>::const_iterator i = lookups.begin(); i != lookups.end(); i++) {
+			if (!d.find_element_by_id(*i)) {
+				cerr << "find " << size << ": element " << *i << " not found" << endl;
+			}
+		}
+		find.push_back(sw.stop());
+
+		sw.start();
+		Document c(d);
+		copy.push_back(sw.stop());
+
+		sw.start();
+		String text = d.dump_to_str();
+		dump.push_back(sw.stop());
+
+		if (options.geometry != geometryFormatNone) {
+			try {
+				sw.start();
+				c.convert_geometry(next_geometry_format(options.geometry));
+				convert.push_back(sw.stop());
+			} catch (const Cyberiada::Exception& e) {
+				cerr << "convert-geometry " << size << ": " << e.str() << endl;
+			}
+		}
+
+		try {
+			Document other(d);
+			const StateMachine* sm1 = sms.front();
+			const StateMachine* sm2 = static_cast<const Document&>(other).get_state_machines().front();
+			sw.start();
+			sm1->check_isomorphism(*sm2);
+			isomorphism.push_back(sw.stop());
+		} catch (const Cyberiada::Exception& e) {
+			cerr << "isomorphism " << size << ": " << e.str() << endl;
+		}
+	}
+
+	Document d;
+	generate_document(d, options);
+	size_t elements = d.elements_count();
+	add_result(results, "generate", elements, generate);
+	add_result(results, "save", elements, save);
+	add_result(results, "open", elements, open);
+	add_result(results, "save-snapshot", elements, save_snapshot);
+	add_result(results, "load-snapshot", elements, load_snapshot);
+	add_result(results, "encode-json", elements, encode_json);
+	add_result(results, "decode-json", elements, decode_json);
+	add_result(results, "find-" + to_string(FIND_LOOKUPS), elements, find);
+	add_result(results, "copy", elements, copy);
+	add_result(results, "dump", elements, dump);
+	add_result(results, "convert-geometry", elements, convert);
+	add_result(results, "isomorphism", elements, isomorphism);
+}
+
+static void write_csv(ostream& os, const vector<BenchResult>& results)
+{
+	os << "benchmark,elements,repetitions,min_ms,median_ms" << endl;
+	for (vector<BenchResult>::const_iterator i = results.begin(); i != results.end(); i++) {
+		os << i->benchmark << "," << i->elements << "," << i->repetitions << ","
+		   << i->min_ms << "," << i->median_ms << endl;
+	}
+}
+
+static void write_json(ostream& os, const vector<BenchResult>& results)
+{
+	os << "{" << endl << "  \"results\": [" << endl;
+	for (vector<BenchResult>::const_iterator i = results.begin(); i != results.end(); i++) {
+		os << "    {\"benchmark\": \"" << i->benchmark << "\", \"elements\": " << i->elements
+		   << ", \"repetitions\": " << i->repetitions << ", \"min_ms\": " << i->min_ms
+		   << ", \"median_ms\": " << i->median_ms << "}";
+		if (i + 1 != results.end()) {
+			os << ",";
+		}
+		os << endl;
+	}
+	os << "  ]" << endl << "}" << endl;
+}
+
+int main(int argc, char** argv)
+{
+	vector<size_t> sizes = {10, 100, 1000, 10000, 100000};
+	size_t repetitions = 3;
+	unsigned long long seed = 1;
+	DocumentGeometryFormat geometry = geometryFormatQt;
+	string output_format = "csv", output_file, tmp_file = "cyberiadabench.graphml";
+
+	for (int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		if (i + 1 >= argc) {
+			usage(argv[0]);
+		}
+		string value = argv[++i];
+		if (arg == "-s") {
+			sizes = parse_sizes(value);
+			if (sizes.empty()) {
+				usage(argv[0]);
+			}
+		} else if (arg == "-r") {
+			int n = atoi(value.c_str());
+			if (n <= 0) {
+				usage(argv[0]);
+			}
+			repetitions = size_t(n);
+		} else if (arg == "-g") {
+			if (value == "none") {
+				geometry = geometryFormatNone;
+			} else if (value == "yed") {
+				geometry = geometryFormatLegacyYED;
+			} else if (value == "cyberiada") {
+				geometry = geometryFormatCyberiada10;
+			} else if (value == "qt") {
+				geometry = geometryFormatQt;
+			} else {
+				usage(argv[0]);
+			}
+		} else if (arg == "--seed") {
+			seed = strtoull(value.c_str(), NULL, 10);
+		} else if (arg == "-f") {
+			if (value != "csv" && value != "json") {
+				usage(argv[0]);
+			}
+			output_format = value;
+		} else if (arg == "-o") {
+			output_file = value;
+		} else if (arg == "-t") {
+			tmp_file = value;
+		} else {
+			usage(argv[0]);
+		}
+	}
+
+	vector<BenchResult> results;
+	try {
+		for (vector<size_t>::const_iterator i = sizes.begin(); i != sizes.end(); i++) {
+			GeneratorOptions options = options_for_size(*i, seed);
+			options.geometry = geometry;
+			run_benchmarks(*i, repetitions, options, tmp_file, results);
+		}
+	} catch (const Cyberiada::Exception& e) {
+		cerr << "Benchmark error: " << e.str() << endl;
+		return 2;
+	}
+
+	ofstream file;
+	if (!output_file.empty()) {
+		file.open(output_file);
+		if (!file.is_open()) {
+			cerr << "Cannot open file " << output_file << endl;
+			return 2;
+		}
+	}
+	ostream& os = output_file.empty() ? cout : file;
+	if (output_format == "json") {
+		write_json(os, results);
+	} else {
+		write_csv(os, results);
+	}
+	return 0;
+}
@@ -0,0 +1,328 @@
+/* -----------------------------------------------------------------------------
+ * The Cyberiada GraphML C++ library implemention
+ *
+ * The complexity regression benchmarks of the document editing API
+ *
+ * Copyright (C) 2025 Alexey Fedoseev <aleksey@fedoseev.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see https://www.gnu.org/licenses/
+ * ----------------------------------------------------------------------------- */
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <chrono>
+#include <math.h>
+#include <stdlib.h>
+#include "cyberiadamlpp.h"
+#include "generator.h"
+
+using namespace Cyberiada;
+using namespace CyberiadaBench;
+using namespace std;
+
+// the bound of the growth exponent of the total time of n operations on the document growing
+// up to n elements; the cache misses on the large documents add about 0.3 to the exponent of
+// n log n (1.1 for the default sizes), the quadratic operations give 1.8 and more and fail
+static const double BOUND_N_LOG_N = 1.5;
+
+static const size_t NESTED_FANOUT = 8;
+static const size_t CHOICE_RATIO = 10;
+
+struct Operation {
+	string                                                name;
+	string                                                bound_name;
+	double                                                bound;
+	// build the document of the given size and return the time of the measured phase in ms
+	function<double(size_t n, unsigned long long seed)>   run;
+};
+
+void usage(const char* program)
+{
+	cerr << program << " [-s <size1,size2,...>] [-r <repetitions>] [--seed <seed>] [-b <operation>=<exponent>]..." << endl;
+	cerr << "\tBuild the documents of the given sizes (1000,10000,100000 by default) with the editing API," << endl;
+	cerr << "\tfit the growth exponent of each operation and fail if it exceeds the bound" << endl;
+	exit(1);
+}
+
+static vector<size_t> parse_sizes(const string& s)
+{
+	vector<size_t> sizes;
+	stringstream ss(s);
+	string item;
+	while (getline(ss, item, ',')) {
+		long long n = atoll(item.c_str());
+		if (n <= 0) {
+			return vector<size_t>();
+		}
+		sizes.push_back(size_t(n));
+	}
+	return sizes;
+}
+
+class Stopwatch {
+public:
+	void   start() { started = chrono::steady_clock::now(); }
+	double stop() const { return chrono::duration<double, milli>(chrono::steady_clock::now() - started).count(); }
+
+private:
+	chrono::steady_clock::time_point started;
+};
+
+static vector<State*> new_flat_states(Document& d, StateMachine* sm, size_t n)
+{
+	vector<State*> states;
+	for (size_t i = 0; i < n; i++) {
+		states.push_back(d.new_state(sm, "State"));
+	}
+	return states;
+}
+
+static vector<Operation> operations()
+{
+	vector<Operation> ops;
+
+	ops.push_back({"new-state", "n log n", BOUND_N_LOG_N, [](size_t n, unsigned long long) {
+		Document d;
+		StateMachine* sm = d.new_state_machine("SM");
+		Stopwatch sw;
+		sw.start();
+		new_flat_states(d, sm, n);
+		return sw.stop();
+	}});
+
+	ops.push_back({"new-state-nested", "n log n", BOUND_N_LOG_N, [](size_t n, unsigned long long) {
+		Document d;
+		StateMachine* sm = d.new_state_machine("SM");
+		vector<State*> states;
+		Stopwatch sw;
+		sw.start();
+		for (size_t i = 0; i < n; i++) {
+			ElementCollection* parent = sm;
+			if (i > 0) {
+				parent = states[(i - 1) / NESTED_FANOUT];
+			}
+			states.push_back(d.new_state(parent, "State"));
+		}
+		return sw.stop();
+	}});
+
+	ops.push_back({"new-state-with-id", "n log n", BOUND_N_LOG_N, [](size_t n, unsigned long long) {
+		Document d;
+		StateMachine* sm = d.new_state_machine("SM");
+		vector<ID> ids;
+		for (size_t i = 0; i < n; i++) {
+			ids.push_back("state-" + to_string(i));
+		}
+		Stopwatch sw;
+		sw.start();
+		for (size_t i = 0; i < n; i++) {
+			d.new_state(sm, ids[i], "State");
+		}
+		return sw.stop();
+	}});
+
+	ops.push_back({"new-transition", "n log n", BOUND_N_LOG_N, [](size_t n, unsigned long long seed) {
+		Document d;
+		StateMachine* sm = d.new_state_machine("SM");
+		vector<State*> states = new_flat_states(d, sm, n);
+		Random random(seed);
+		Stopwatch sw;
+		sw.start();
+		for (size_t i = 0; i < n; i++) {
+			d.new_transition(sm, transitionExternal,
+							 states[random.below(n)], states[random.below(n)], Action("EVENT"));
+		}
+		return sw.stop();
+	}});
+
+	// the new state is inserted before the transitions, so they are moved in the children list:
+	// quadratic now and reported as failed until add_element is fixed
+	ops.push_back({"new-state-after-transitions", "n log n", BOUND_N_LOG_N, [](size_t n, unsigned long long) {
+		Document d;
+		StateMachine* sm = d.new_state_machine("SM");
+		State* s = d.new_state(sm, "State");
+		for (size_t i = 0; i < n; i++) {
+			d.new_transition(sm, transitionExternal, s, s, Action("EVENT"));
+		}
+		Stopwatch sw;
+		sw.start();
+		new_flat_states(d, sm, n);
+		return sw.stop();
+	}});
+
+	ops.push_back({"find-element", "n log n", BOUND_N_LOG_N, [](size_t n, unsigned long long seed) {
+		Document d;
+		StateMachine* sm = d.new_state_machine("SM");
+		vector<State*> states = new_flat_states(d, sm, n);
+		Random random(seed);
+		vector<ID> lookups;
+		for (size_t i = 0; i < n; i++) {
+			lookups.push_back(states[random.below(n)]->get_id());
+		}
+		Stopwatch sw;
+		sw.start();
+		for (vector<ID>::const_iterator i = lookups.begin(); i != lookups.end(); i++) {
+			if (!d.find_element_by_id(*i)) {
+				throw NotFoundException("Element " + *i + " not found");
+			}
+		}
+		return sw.stop();
+	}});
+
+	// the children are searched by ID and erased from the middle of the list: quadratic now and
+	// reported as failed until remove_element is fixed
+	ops.push_back({"remove-element", "n log n", BOUND_N_LOG_N, [](size_t n, unsigned long long seed) {
+		Document d;
+		StateMachine* sm = d.new_state_machine("SM");
+		vector<State*> states = new_flat_states(d, sm, n);
+		Random random(seed);
+		for (size_t i = states.size(); i > 1; i--) {
+			swap(states[i - 1], states[random.below(i)]);
+		}
+		Stopwatch sw;
+		sw.start();
+		for (vector<State*>::const_iterator i = states.begin(); i != states.end(); i++) {
+			sm->remove_element((*i)->get_id());
+			delete *i;
+		}
+		return sw.stop();
+	}});
+
+	// every choice check scans the transitions of the state machine: quadratic now and reported
+	// as failed until check_transition_target is fixed
+	ops.push_back({"choice-target", "n log n", BOUND_N_LOG_N, [](size_t n, unsigned long long) {
+		Document d;
+		StateMachine* sm = d.new_state_machine("SM");
+		State* s = d.new_state(sm, "State");
+		Stopwatch sw;
+		sw.start();
+		for (size_t i = 0; i < n / CHOICE_RATIO; i++) {
+			d.new_transition(sm, transitionExternal, s, d.new_choice(sm), Action("EVENT"));
+		}
+		return sw.stop();
+	}});
+
+	return ops;
+}
+
+// the least squares slope of log(time) by log(size)
+static double growth_exponent(const vector<size_t>& sizes, const vector<double>& times)
+{
+	double sx = 0, sy = 0, sxx = 0, sxy = 0;
+	size_t k = sizes.size();
+	for (size_t i = 0; i < k; i++) {
+		double x = log(double(sizes[i]));
+		double y = log(max(times[i], 1e-6));
+		sx += x;
+		sy += y;
+		sxx += x * x;
+		sxy += x * y;
+	}
+	return (k * sxy - sx * sy) / (k * sxx - sx * sx);
+}
+
+int main(int argc, char** argv)
+{
+	vector<size_t> sizes = {1000, 10000, 100000};
+	size_t repetitions = 3;
+	unsigned long long seed = 1;
+	vector<Operation> ops = operations();
+
+	for (int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		if (i + 1 >= argc) {
+			usage(argv[0]);
+		}
+		string value = argv[++i];
+		if (arg == "-s") {
+			sizes = parse_sizes(value);
+			if (sizes.size() < 2) {
+				usage(argv[0]);
+			}
+		} else if (arg == "-r") {
+			int n = atoi(value.c_str());
+			if (n <= 0) {
+				usage(argv[0]);
+			}
+			repetitions = size_t(n);
+		} else if (arg == "--seed") {
+			seed = strtoull(value.c_str(), NULL, 10);
+		} else if (arg == "-b") {
+			size_t eq = value.find('=');
+			if (eq == string::npos) {
+				usage(argv[0]);
+			}
+			string name = value.substr(0, eq);
+			double bound = atof(value.substr(eq + 1).c_str());
+			bool found = false;
+			for (vector<Operation>::iterator op = ops.begin(); op != ops.end(); op++) {
+				if (op->name == name) {
+					op->bound = bound;
+					op->bound_name = value.substr(eq + 1);
+					found = true;
+				}
+			}
+			if (!found || bound <= 0) {
+				usage(argv[0]);
+			}
+		} else {
+			usage(argv[0]);
+		}
+	}
+
+	bool failed = false;
+	cout << left << setw(30) << "operation";
+	for (vector<size_t>::const_iterator s = sizes.begin(); s != sizes.end(); s++) {
+		cout << setw(12) << ("n=" + to_string(*s));
+	}
+	cout << setw(10) << "exponent" << setw(16) << "bound" << "result" << endl;
+	for (vector<Operation>::const_iterator op = ops.begin(); op != ops.end(); op++) {
+		vector<double> times;
+		try {
+			for (vector<size_t>::const_iterator s = sizes.begin(); s != sizes.end(); s++) {
+				double best = 0;
+				for (size_t rep = 0; rep < repetitions; rep++) {
+					double t = op->run(*s, seed);
+					if (rep == 0 || t < best) {
+						best = t;
+					}
+				}
+				times.push_back(best);
+			}
+		} catch (const Cyberiada::Exception& e) {
+			cerr << op->name << ": " << e.str() << endl;
+			failed = true;
+			continue;
+		}
+		double exponent = growth_exponent(sizes, times);
+		bool ok = exponent <= op->bound;
+		failed = failed || !ok;
+		cout << left << setw(30) << op->name;
+		for (vector<double>::const_iterator t = times.begin(); t != times.end(); t++) {
+			ostringstream ms;
+			ms << fixed << setprecision(2) << *t << "ms";
+			cout << setw(12) << ms.str();
+		}
+		ostringstream bound;
+		bound << op->bound_name << " (" << op->bound << ")";
+		cout << setw(10) << fixed << setprecision(2) << exponent << setw(16) << bound.str()
+			 << (ok ? "OK" : "FAILED") << endl;
+		cout.unsetf(ios::fixed);
+	}
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,196 @@
+/* -----------------------------------------------------------------------------
+ * The Cyberiada GraphML C++ library implemention
+ *
+ * The synthetic document generator for the benchmarks
+ *
+ * Copyright (C) 2025 Alexey Fedoseev <aleksey@fedoseev.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see https://www.gnu.org/licenses/
+ * ----------------------------------------------------------------------------- */
+
+#include <math.h>
+#include <string>
+#include <vector>
+#include "generator.h"
+
+using namespace Cyberiada;
+using namespace CyberiadaBench;
+
+static const float STATE_WIDTH = 160.0;
+static const float STATE_HEIGHT = 80.0;
+static const float COMMENT_WIDTH = 120.0;
+static const float COMMENT_HEIGHT = 60.0;
+static const float GAP = 40.0;
+static const float PADDING = 40.0;
+
+unsigned long long Random::next()
+{
+	state ^= state >> 12;
+	state ^= state << 25;
+	state ^= state >> 27;
+	return state * 2685821657736338717ULL;
+}
+
+GeneratorOptions CyberiadaBench::options_for_size(size_t elements, unsigned long long seed)
+{
+	GeneratorOptions o;
+	o.seed = seed;
+	// every state brings an entry action, the transitions and a share of the initial
+	// pseudostates and the comments: about 3 elements per state in total
+	o.states = elements / 3;
+	if (o.states == 0) {
+		o.states = 1;
+	}
+	o.comments = o.states / 20;
+	o.state_machines = 1 + o.states / 100000;
+	return o;
+}
+
+// lay out the children on a grid in the local left-top coordinates, return the size of the collection
+static Rect layout(ElementCollection* collection)
+{
+	const ElementList& children = collection->get_children();
+	std::vector<Rect> sizes;
+	std::vector<Element*> boxes;
+	for (ElementList::const_iterator i = children.begin(); i != children.end(); i++) {
+		Element* e = *i;
+		if (e->get_type() == elementSimpleState || e->get_type() == elementCompositeState) {
+			if (e->has_children()) {
+				sizes.push_back(layout(static_cast<ElementCollection*>(e)));
+			} else {
+				sizes.push_back(Rect(0, 0, STATE_WIDTH, STATE_HEIGHT));
+			}
+			boxes.push_back(e);
+		} else if (e->get_type() == elementComment) {
+			sizes.push_back(Rect(0, 0, COMMENT_WIDTH, COMMENT_HEIGHT));
+			boxes.push_back(e);
+		} else if (e->get_type() == elementInitial) {
+			static_cast<Vertex*>(e)->update_geometry(Point(PADDING / 2, PADDING / 2));
+		}
+	}
+
+	if (boxes.empty()) {
+		return Rect(0, 0, STATE_WIDTH, STATE_HEIGHT);
+	}
+
+	size_t cols = size_t(ceil(sqrt(double(boxes.size()))));
+	size_t rows = (boxes.size() + cols - 1) / cols;
+	float cell_width = 0, cell_height = 0;
+	for (std::vector<Rect>::const_iterator i = sizes.begin(); i != sizes.end(); i++) {
+		if (i->width > cell_width) cell_width = i->width;
+		if (i->height > cell_height) cell_height = i->height;
+	}
+	for (size_t i = 0; i < boxes.size(); i++) {
+		Rect r(PADDING + (i % cols) * (cell_width + GAP),
+			   PADDING + (i / cols) * (cell_height + GAP),
+			   sizes[i].width, sizes[i].height);
+		if (boxes[i]->get_type() == elementComment) {
+			static_cast<Comment*>(boxes[i])->update_geometry(r);
+		} else {
+			static_cast<ElementCollection*>(boxes[i])->update_geometry(r);
+		}
+	}
+	return Rect(0, 0,
+				2 * PADDING + cols * cell_width + (cols - 1) * GAP,
+				2 * PADDING + rows * cell_height + (rows - 1) * GAP);
+}
+
+void CyberiadaBench::generate_document(Document& d, const GeneratorOptions& o)
+{
+	Random random(o.seed);
+	size_t next_id = 0;
+
+	d.reset(o.geometry == geometryFormatNone ? geometryFormatNone : geometryFormatCyberiada10);
+
+	size_t sm_count = o.state_machines ? o.state_machines : 1;
+	std::vector<StateMachine*> sms;
+	for (size_t n = 0; n < sm_count; n++) {
+		sms.push_back(d.new_state_machine("G" + std::to_string(n), "SM " + std::to_string(n)));
+	}
+
+	for (size_t n = 0; n < sm_count; n++) {
+		StateMachine* sm = sms[n];
+		size_t states = o.states / sm_count + (n < o.states % sm_count ? 1 : 0);
+		size_t comments = o.comments / sm_count + (n < o.comments % sm_count ? 1 : 0);
+		std::vector<State*> sm_states;
+		std::vector<ElementCollection*> collections(1, sm);
+
+		// the states are added to the collections round by round, fanout at once
+		std::vector<std::pair<ElementCollection*, size_t>> parents(1, std::make_pair(sm, size_t(0)));
+		size_t p = 0;
+		while (sm_states.size() < states) {
+			if (p == parents.size()) {
+				p = 0;
+			}
+			ElementCollection* parent = parents[p].first;
+			size_t depth = parents[p].second;
+			p++;
+
+			size_t count = o.fanout ? o.fanout : 1;
+			if (count > states - sm_states.size()) {
+				count = states - sm_states.size();
+			}
+			InitialPseudostate* init = NULL;
+			if (!parent->has_initial()) {
+				init = new InitialPseudostate(parent, "i" + std::to_string(next_id++));
+				parent->add_element(init);
+			}
+			for (size_t i = 0; i < count; i++) {
+				ID id = "n" + std::to_string(next_id++);
+				State* state = new State(parent, id, "State " + id);
+				state->add_action(Action(actionEntry, "enter_" + id + "();"));
+				parent->add_element(state);
+				sm_states.push_back(state);
+				if (init && i == 0) {
+					sm->add_element(new Transition(sm, transitionExternal, "t" + std::to_string(next_id++),
+												   init->get_id(), id, Action()));
+				}
+				if (depth + 1 < o.max_depth) {
+					parents.push_back(std::make_pair(state, depth + 1));
+					collections.push_back(state);
+				}
+			}
+		}
+
+		size_t transitions = size_t(o.transition_density * sm_states.size() + 0.5);
+		for (size_t i = 0; i < transitions; i++) {
+			const State* source = sm_states[random.below(sm_states.size())];
+			const State* target = sm_states[random.below(sm_states.size())];
+			String event = "EV" + std::to_string(random.below(16));
+			String guard = random.below(4) == 0 ? "x > " + std::to_string(random.below(100)) : String();
+			String behavior = random.below(2) == 0 ? "act_" + std::to_string(random.below(32)) + "();" : String();
+			sm->add_element(new Transition(sm, transitionExternal, "t" + std::to_string(next_id++),
+										   source->get_id(), target->get_id(), Action(event, guard, behavior)));
+		}
+
+		for (size_t i = 0; i < comments; i++) {
+			ElementCollection* parent = collections[random.below(collections.size())];
+			ID id = "c" + std::to_string(next_id++);
+			Comment* comment = new Comment(parent, id, "Comment " + id);
+			parent->add_element(comment);
+			if (!sm_states.empty() && random.unit() < 0.5) {
+				comment->add_subject(CommentSubject("s" + std::to_string(next_id++),
+													sm_states[random.below(sm_states.size())]));
+			}
+		}
+
+		if (o.geometry != geometryFormatNone) {
+			layout(sm);
+		}
+	}
+
+	if (o.geometry != geometryFormatNone && o.geometry != geometryFormatCyberiada10) {
+		d.convert_geometry(o.geometry);
+	}
+}
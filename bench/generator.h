@@ -0,0 +1,65 @@
+/* -----------------------------------------------------------------------------
+ * The Cyberiada GraphML C++ library implemention
+ *
+ * The synthetic document generator for the benchmarks
+ *
+ * Copyright (C) 2025 Alexey Fedoseev <aleksey@fedoseev.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see https://www.gnu.org/licenses/
+ * ----------------------------------------------------------------------------- */
+
+#ifndef __CYBERIADA_BENCH_GENERATOR_H
+#define __CYBERIADA_BENCH_GENERATOR_H
+
+#include "cyberiadamlpp.h"
+
+namespace CyberiadaBench {
+
+	// the deterministic pseudo-random numbers (xorshift64*), the same on every platform
+	class Random {
+	public:
+		explicit Random(unsigned long long seed): state(seed ? seed : 0x9e3779b97f4a7c15ULL) {}
+
+		unsigned long long next();
+		size_t             below(size_t n) { return n ? size_t(next() % n) : 0; }
+		double             unit() { return double(next() >> 11) / 9007199254740992.0; }
+
+	private:
+		unsigned long long state;
+	};
+
+	struct GeneratorOptions {
+		GeneratorOptions():
+			seed(1), state_machines(1), states(10), max_depth(3), fanout(4),
+			transition_density(1.5), comments(0), geometry(Cyberiada::geometryFormatQt) {}
+
+		unsigned long long                 seed;
+		size_t                             state_machines;     // the number of SMs
+		size_t                             states;             // the total number of states
+		size_t                             max_depth;          // the maximal nesting level of the states (1 = flat)
+		size_t                             fanout;             // the number of children added to a composite state at once
+		double                             transition_density; // the average number of outgoing transitions per state
+		size_t                             comments;           // the total number of comments
+		Cyberiada::DocumentGeometryFormat  geometry;
+	};
+
+	// the options to generate the document of the given number of elements
+	GeneratorOptions options_for_size(size_t elements, unsigned long long seed = 1);
+
+	// fill the document with the generated state machines; the elements are created
+	// directly with the unique IDs, so the generation time is linear in the size
+	void generate_document(Cyberiada::Document& d, const GeneratorOptions& options);
+}
+
+#endif
@@ -24,9 +24,31 @@
 #include <sstream>
 #include <fstream>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <atomic>
+#include <functional>
+#include <exception>
 #include <math.h>
+#include <errno.h>
+#include <locale.h>
+#include <stdint.h>
+#include <string.h>
+#include <zlib.h>
 #include "cyberiadamlpp.h"
 
+#ifdef CYBERIADAMLPP_USDT
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+// the semaphores are set by the tracers attached to the probes
+__extension__ unsigned short cyberiadamlpp_phase__begin_semaphore __attribute__((unused)) __attribute__((section(".probes")));
+__extension__ unsigned short cyberiadamlpp_phase__end_semaphore __attribute__((unused)) __attribute__((section(".probes")));
+#define CYB_PROBE_ENABLED(name) (*(volatile unsigned short*)&cyberiadamlpp_##name##_semaphore != 0)
+#endif
+
 #define CYB_CHECK_RESULT(r) this->check_cyberiada_error((r), std::string(__FILE__) + ":" + std::to_string(__LINE__))
 
 #ifdef __DEBUG__
@@ -60,2403 +82,6720 @@ namespace Cyberiada {
 	static const String TRANTISION_ID_SEP = "-";
 	static const String TRANTISION_ID_NUM_SEP = "#"; 
 	static const std::string tab = "\t";
-    static DocumentGeometryFormat DEFAULT_REAL_GEOMETRY_FORMAT = geometryFormatQt;
+	static const DocumentGeometryFormat DEFAULT_REAL_GEOMETRY_FORMAT = geometryFormatQt;
 };
 	
 using namespace Cyberiada;
 
 // -----------------------------------------------------------------------------
-// Element
+// Worker threads
 // -----------------------------------------------------------------------------	
 
-Element::Element(Element* _parent, ElementType _type, const ID& _id):
-	type(_type), id(_id), name_is_set(false), formal_name_is_set(false), parent(_parent)
+static unsigned int threads_number(unsigned int threads)
 {
+	if (threads == 0) {
+		threads = std::thread::hardware_concurrency();
+		if (threads == 0) {
+			threads = 1;
+		}
+	}
+	return threads;
 }
 
-Element::Element(Element* _parent, ElementType _type, const ID& _id, const Name& _name):
-	type(_type), id(_id), formal_name_is_set(false), parent(_parent)
-{
-	set_name(_name);
-}
+// the worker is started for every PARALLEL_MIN_ELEMENTS elements at most, so the smaller
+// documents are converted serially instead of paying for the thread start (about 20us each)
+static const size_t PARALLEL_MIN_ELEMENTS = 1024;
 
-Element::Element(const Element& e):
-	type(e.type), id(e.id), name(e.name), name_is_set(e.name_is_set),
-	formal_name(e.formal_name), formal_name_is_set(e.formal_name_is_set), parent(e.parent)
+static unsigned int threads_for_elements(unsigned int threads, size_t elements)
 {
+	threads = threads_number(threads);
+	if (threads > 1 && threads > elements / PARALLEL_MIN_ELEMENTS) {
+		threads = elements < 2 * PARALLEL_MIN_ELEMENTS ? 1 : (unsigned int)(elements / PARALLEL_MIN_ELEMENTS);
+	}
+	return threads;
 }
 
-int Element::index() const
+// run job(0) ... job(count - 1) on the worker threads; the exception of the job
+// with the lowest index (if any) is rethrown after all workers are finished
+static void parallel_for(size_t count, unsigned int threads, const std::function<void(size_t)>& job)
 {
-	if (parent) {
-		const ElementCollection* collection = static_cast<const ElementCollection*>(parent);
-		CYB_ASSERT(collection);
-		return collection->element_index(this);
-	} else {
-		return 0;
+	threads = threads_number(threads);
+	if (threads > count) {
+		threads = (unsigned int)count;
+	}
+	if (threads <= 1) {
+		for (size_t i = 0; i < count; i++) {
+			job(i);
+		}
+		return ;
+	}
+	std::atomic<size_t> next(0);
+	std::vector<std::exception_ptr> errors(count);
+	std::vector<std::thread> workers;
+	for (unsigned int t = 0; t < threads; t++) {
+		workers.push_back(std::thread([&]() {
+			for (size_t i = next++; i < count; i = next++) {
+				try {
+					job(i);
+				} catch (...) {
+					errors[i] = std::current_exception();
+				}
+			}
+		}));
+	}
+	for (std::vector<std::thread>::iterator i = workers.begin(); i != workers.end(); i++) {
+		i->join();
+	}
+	for (std::vector<std::exception_ptr>::const_iterator i = errors.begin(); i != errors.end(); i++) {
+		if (*i) {
+			std::rethrow_exception(*i);
+		}
 	}
 }
 
-void Element::set_name(const Name& n)
-{
-	name = n;
-	name_is_set = true;
-}
+// -----------------------------------------------------------------------------
+// Load statistics
+// -----------------------------------------------------------------------------	
 
-void Element::set_formal_name(const Name& n)
-{
-	formal_name = n;
-	formal_name_is_set = true;
-	if (!has_name()) {
-		set_name(formal_name);
+// add the time of the phase in ms to the target; the clock is not read without the target
+class PhaseTimer {
+public:
+	explicit PhaseTimer(double* target) { start(target); }
+	~PhaseTimer() { stop(); }
+
+	void start(double* new_target)
+	{
+		target = new_target;
+		if (target) {
+			started = std::chrono::steady_clock::now();
+		}
 	}
-}
 
-void Element::set_id(const ID& _id)
+	void stop()
+	{
+		if (target) {
+			*target += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count();
+			target = NULL;
+		}
+	}
+
+private:
+	double*                               target;
+	std::chrono::steady_clock::time_point started;
+};
+
+// -----------------------------------------------------------------------------
+// Tracing
+// -----------------------------------------------------------------------------	
+
+static TraceCallback trace_callback;
+static std::atomic<bool> trace_callback_set(false);
+
+void Cyberiada::set_trace_callback(const TraceCallback& callback)
 {
-	id = _id;
+	trace_callback = callback;
+	trace_callback_set = bool(callback);
 }
 
-bool Element::has_qualified_name() const
+const char* Cyberiada::trace_phase_name(TracePhase phase)
 {
-	return is_root() || name_is_set || parent->has_qualified_name();
+	switch (phase) {
+	case tracePhaseDecode:              return "decode";
+	case tracePhaseEncode:              return "encode";
+	case tracePhaseToDocument:          return "to_document";
+	case tracePhaseUpdateFromDocument:  return "update_from_document";
+	case tracePhaseConvertGeometry:     return "convert_geometry";
+	case tracePhaseReconstructGeometry: return "reconstruct_geometry";
+	case tracePhaseCheckIsomorphism:    return "check_isomorphism";
+	case tracePhaseOpen:                return "open";
+	case tracePhaseSave:                return "save";
+	default:                            return "unknown";
+	}
 }
 
-QualifiedName Element::qualified_name() const
+// somebody listens to the trace events
+static bool trace_enabled()
 {
-	if (is_root() || parent->is_root() || parent->parent->is_root()) {
-		return name;
-	} else {
-		return parent->qualified_name() + QUALIFIED_NAME_SEPARATOR + name;
+#ifdef CYBERIADAMLPP_USDT
+	if (CYB_PROBE_ENABLED(phase__begin) || CYB_PROBE_ENABLED(phase__end)) {
+		return true;
 	}
+#endif
+	return trace_callback_set;
 }
 
-QualifiedName Element::full_qualified_name() const
+static size_t trace_nodes_size(const CyberiadaNode* nodes)
 {
-	if (is_root()) {
-		return name;
-	} else {
-		if (parent->is_root()) {
-			return name;
-		} else {
-			return parent->full_qualified_name() + QUALIFIED_NAME_SEPARATOR + name;
-		}
+	size_t size = 0;
+	for (; nodes; nodes = nodes->next) {
+		size += 1 + trace_nodes_size(nodes->children);
 	}
+	return size;
 }
 
-Element* Element::find_root()
+// the number of the nodes and the edges of the C-level document
+static size_t trace_document_size(const CyberiadaDocument* doc)
 {
-	if (!parent) {
-		return this;
-	} else {
-		return parent->find_root();
+	size_t size = 0;
+	for (const CyberiadaSM* sm = doc->state_machines; sm; sm = sm->next) {
+		size += trace_nodes_size(sm->nodes);
+		for (const CyberiadaEdge* e = sm->edges; e; e = e->next) {
+			size++;
+		}
 	}
+	return size;
 }
 
-CyberiadaNode* Element::to_node() const
+// the size of the file on disk, 0 if the file cannot be read
+static size_t trace_file_size(const String& path)
 {
-	CyberiadaNode* node = cyberiada_new_node(get_id().c_str());
-	switch (type) {
-	case elementSM:             node->type = cybNodeSM; break;
-	case elementSimpleState:    node->type = cybNodeSimpleState; break;
-	case elementCompositeState: node->type = cybNodeCompositeState; break;
-	case elementComment:        node->type = cybNodeComment; break;
-	case elementFormalComment:  node->type = cybNodeFormalComment; break;
-	case elementInitial:        node->type = cybNodeInitial; break;
-	case elementFinal:          node->type = cybNodeFinal; break;
-	case elementChoice:         node->type = cybNodeChoice; break;
-	case elementTerminate:      node->type = cybNodeTerminate; break;
-	default:
-		std::cerr << id << " " << type << std::endl;
-		CYB_ASSERT(false);
-	}	
-	if (has_name()) {
-		cyberiada_copy_string(&(node->title), &(node->title_len),
-							  get_name().c_str());
+	std::ifstream file(path.c_str(), std::ios::binary | std::ios::ate);
+	std::streamoff size = file ? std::streamoff(file.tellg()) : 0;
+	return size > 0 ? size_t(size) : 0;
+}
+
+// fire the begin event on construction and the end event on destruction (even by an exception);
+// the element-based phases report the element count at the moment of the event (computed only if
+// somebody listens), the load phases report the size of their input for both events
+class TraceScope {
+public:
+	TraceScope(TracePhase _phase, const Element* _element): phase(_phase), element(_element), size(0)
+	{
+		fire(traceBegin);
 	}
-	if (has_formal_name()) {
-		cyberiada_copy_string(&(node->formal_title), &(node->formal_title_len),
-							  get_formal_name().c_str());
+
+	TraceScope(TracePhase _phase, size_t input_size): phase(_phase), element(NULL), size(input_size)
+	{
+		fire(traceBegin);
 	}
-	return node;
-}
 
-std::string Element::dump_to_str() const
+	~TraceScope()
+	{
+		fire(traceEnd);
+	}
+
+private:
+	size_t event_size() const
+	{
+		return element ? element->elements_count() : size;
+	}
+
+	void fire(TraceEvent event)
+	{
+#ifdef CYBERIADAMLPP_USDT
+		bool probe = event == traceBegin ? CYB_PROBE_ENABLED(phase__begin) : CYB_PROBE_ENABLED(phase__end);
+		if (!probe && !trace_callback_set) {
+			return ;
+		}
+		size_t current = event_size();
+		if (probe) {
+			if (event == traceBegin) {
+				DTRACE_PROBE2(cyberiadamlpp, phase__begin, trace_phase_name(phase), current);
+			} else {
+				DTRACE_PROBE2(cyberiadamlpp, phase__end, trace_phase_name(phase), current);
+			}
+		}
+		if (trace_callback_set) {
+			trace_callback(phase, event, current);
+		}
+#else
+		if (trace_callback_set) {
+			trace_callback(phase, event, event_size());
+		}
+#endif
+	}
+
+	TracePhase     phase;
+	const Element* element;
+	size_t         size;
+};
+
+// -----------------------------------------------------------------------------
+// Operation counters
+// -----------------------------------------------------------------------------	
+
+#ifdef CYBERIADAMLPP_COUNTERS
+
+struct AtomicOperationCounter {
+	std::atomic<size_t>             calls;
+	std::atomic<size_t>             visited;
+	std::atomic<unsigned long long> time_ns;
+};
+
+static AtomicOperationCounter operation_counters[countOperationsNumber];
+static thread_local unsigned int operation_depth[countOperationsNumber];
+
+// count the call and the time of the outermost call of the operation in the current thread
+class OperationScope {
+public:
+	explicit OperationScope(CountedOperation _op): op(_op), outermost(operation_depth[_op]++ == 0)
+	{
+		if (outermost) {
+			operation_counters[op].calls.fetch_add(1, std::memory_order_relaxed);
+			started = std::chrono::steady_clock::now();
+		}
+	}
+
+	~OperationScope()
+	{
+		operation_depth[op]--;
+		if (outermost) {
+			std::chrono::nanoseconds ns = std::chrono::steady_clock::now() - started;
+			operation_counters[op].time_ns.fetch_add((unsigned long long)ns.count(),
+													 std::memory_order_relaxed);
+		}
+	}
+
+private:
+	CountedOperation                      op;
+	bool                                  outermost;
+	std::chrono::steady_clock::time_point started;
+};
+
+#define CYB_COUNT_SCOPE(op) OperationScope operation_scope(op)
+#define CYB_COUNT_VISIT(op) operation_counters[op].visited.fetch_add(1, std::memory_order_relaxed)
+
+#else
+
+#define CYB_COUNT_SCOPE(op)
+#define CYB_COUNT_VISIT(op)
+
+#endif
+
+bool Cyberiada::operation_counters_enabled()
 {
-	std::ostringstream s;
-	dump(s);
-	return s.str();
+#ifdef CYBERIADAMLPP_COUNTERS
+	return true;
+#else
+	return false;
+#endif
 }
 
-std::ostream& Element::dump(std::ostream& os) const
+OperationCounter Cyberiada::get_operation_counter(CountedOperation op)
 {
-	String type_str;
-	switch (type) {
-	case elementRoot:           type_str = "Document"; break;
-	case elementSM:             type_str = "State Machine"; break;
-	case elementSimpleState:    type_str = "Simple State"; break;
-	case elementCompositeState: type_str = "Composite State"; break;
-	case elementComment:        type_str = "Comment"; break;
-	case elementFormalComment:  type_str = "Formal Comment"; break;
-	case elementInitial:        type_str = "Initial"; break;
-	case elementFinal:          type_str = "Final"; break;
-	case elementChoice:         type_str = "Choice"; break;
-	case elementTerminate:      type_str = "Terminate"; break;
-	case elementTransition:     type_str = "Transition"; break;
-	default:
-		CYB_ASSERT(false);
-	}
-	os << type_str << ": {id: '" << id << "'";
-	if (name_is_set) {
-		os << ", name: '" << name << "'";
-	}
-	if (formal_name_is_set) {
-		os << ", formal name: '" << formal_name << "'";
+	OperationCounter result;
+	if (op < 0 || op >= countOperationsNumber) {
+		throw ParametersException("Bad operation counter");
 	}
-	return os;
+#ifdef CYBERIADAMLPP_COUNTERS
+	result.calls = operation_counters[op].calls.load(std::memory_order_relaxed);
+	result.visited = operation_counters[op].visited.load(std::memory_order_relaxed);
+	result.time_ms = operation_counters[op].time_ns.load(std::memory_order_relaxed) / 1e6;
+#endif
+	return result;
 }
 
-std::ostream& Cyberiada::operator<<(std::ostream& os, const Element& e)
+void Cyberiada::reset_operation_counters()
 {
-	e.dump(os);
-	return os;
+#ifdef CYBERIADAMLPP_COUNTERS
+	for (size_t i = 0; i < countOperationsNumber; i++) {
+		operation_counters[i].calls = 0;
+		operation_counters[i].visited = 0;
+		operation_counters[i].time_ns = 0;
+	}
+#endif
 }
 
-void Element::check_cyberiada_error(int res, const String& msg) const
+const char* Cyberiada::counted_operation_name(CountedOperation op)
 {
-	switch (res) {
-	case CYBERIADA_XML_ERROR: throw XMLException(msg);
-	case CYBERIADA_FORMAT_ERROR: throw CybMLException(msg);
-	case CYBERIADA_ACTION_FORMAT_ERROR: throw ActionException(msg);
-	case CYBERIADA_METADATA_FORMAT_ERROR: throw MetainformationException(msg);
-	case CYBERIADA_NOT_FOUND: throw NotFoundException(msg);
-	case CYBERIADA_BAD_PARAMETER: throw ParametersException(msg);
-    case CYBERIADA_ASSERT: throw AssertException(msg);
-    case CYBERIADA_NOT_IMPLEMENTED: throw NotImplementedException(msg);
-	default:
-		break;
+	switch (op) {
+	case countFindElementById:    return "find_element_by_id";
+	case countFindElementsByType: return "find_elements_by_type";
+	case countGetBoundRect:       return "get_bound_rect";
+	case countQualifiedName:      return "qualified_name";
+	case countToNode:             return "to_node";
+	case countToSM:               return "to_sm";
+	case countToEdge:             return "to_edge";
+	default:                      return "unknown";
 	}
 }
 
 // -----------------------------------------------------------------------------
-// Geometry
+// Hashing
 // -----------------------------------------------------------------------------	
 
-static double round_num(double n)
+static ContentHash hash_mix(ContentHash h, ContentHash v)
 {
-//	return int(::round(n * 1000)) / 1000.0;
-	return int(n);//::round(n);
+	h ^= v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+	h ^= h >> 30;
+	h *= 0xbf58476d1ce4e5b9ULL;
+	h ^= h >> 27;
+	h *= 0x94d049bb133111ebULL;
+	h ^= h >> 31;
+	return h;
 }
 
-Point::Point(CyberiadaPoint* p)
+static ContentHash hash_string(const String& s)
 {
-	if (p) {
-		valid = true;
-		x = p->x;
-		y = p->y;
-	} else {
-		valid = false;
+	ContentHash h = 0xcbf29ce484222325ULL;
+	for (String::const_iterator i = s.begin(); i != s.end(); i++) {
+		h ^= (unsigned char)*i;
+		h *= 0x100000001b3ULL;
 	}
+	return h;
 }
 
-CyberiadaPoint* Point::c_point() const
+static ContentHash hash_action(const Action& a)
 {
-	if (valid) {
-		CyberiadaPoint* p = htree_new_point();
-		p->x = x;
-		p->y = y;
-		return p;
-	} else {
-		return NULL;
-	}
+	ContentHash h = hash_mix(ContentHash(a.get_type()), hash_string(a.get_trigger()));
+	h = hash_mix(h, hash_string(a.get_guard()));
+	return hash_mix(h, hash_string(a.get_behavior()));
 }
 
-void Point::round()
+static ContentHash hash_float(ContentHash h, float f)
 {
-	if (valid) {
-		x = round_num(x);
-		y = round_num(y);
-	}
+	unsigned int bits = 0;
+	memcpy(&bits, &f, sizeof(f) < sizeof(bits) ? sizeof(f) : sizeof(bits));
+	return hash_mix(h, bits);
 }
 
-Point Point::round() const
+static ContentHash hash_point(ContentHash h, const Point& p)
 {
-	Point p;
-	if (valid) {
-		p.x = round_num(x);
-		p.y = round_num(y);
+	h = hash_mix(h, p.valid);
+	if (p.valid) {
+		h = hash_float(h, p.x);
+		h = hash_float(h, p.y);
 	}
-	return p;
+	return h;
 }
 
-String Point::to_str() const
+static ContentHash hash_rect(ContentHash h, const Rect& r)
 {
-	std::ostringstream s;
-	s << *this;
-	return s.str();
+	h = hash_mix(h, r.valid);
+	if (r.valid) {
+		h = hash_float(h, r.x);
+		h = hash_float(h, r.y);
+		h = hash_float(h, r.width);
+		h = hash_float(h, r.height);
+	}
+	return h;
 }
 
-Rect::Rect(CyberiadaRect* r)
+static ContentHash hash_polyline(ContentHash h, const Polyline& pl)
 {
-	if (r) {
-		valid = true;
-		x = r->x;
-		y = r->y;
-		width = r->width;
-		height = r->height;
-	} else {
-		valid = false;
+	h = hash_mix(h, pl.size());
+	for (Polyline::const_iterator i = pl.begin(); i != pl.end(); i++) {
+		h = hash_point(h, *i);
 	}
+	return h;
 }
 
-CyberiadaRect* Rect::c_rect() const
+// -----------------------------------------------------------------------------
+// Memory usage
+// -----------------------------------------------------------------------------	
+
+// the heap bytes of the string, the short strings are kept inside the object
+static size_t string_heap_bytes(const String& str)
 {
-	if (valid) {
-		CyberiadaRect* r = htree_new_rect();
-		r->x = x;
-		r->y = y;
-		r->width = width;
-		r->height = height;
-		return r;
-	} else {
-		return NULL;
+	const char* data = str.data();
+	const char* object = reinterpret_cast<const char*>(&str);
+	if (data >= object && data < object + sizeof(String)) {
+		return 0;
 	}
+	return str.capacity() + 1;
 }
 
-String Rect::to_str() const
+static size_t action_heap_bytes(const Action& a)
 {
-	std::ostringstream s;
-	s << *this;
-	return s.str();
+	return (string_heap_bytes(a.get_trigger()) +
+			string_heap_bytes(a.get_guard()) +
+			string_heap_bytes(a.get_behavior()));
 }
 
-CyberiadaPolyline* Polyline::c_polyline() const
+static size_t polyline_heap_bytes(const Polyline& pl)
 {
-	CyberiadaPolyline* result = NULL;
-	for (Polyline::const_iterator i = begin(); i != end(); i++) {
-		const Point& point = *i;
-		CyberiadaPolyline* pl = htree_new_polyline();
-		pl->point.x = point.x;
-		pl->point.y = point.y;
-		if (result) {
-			CyberiadaPolyline* last_pl = result;
-			while (last_pl->next) last_pl = last_pl->next;
-			last_pl->next = pl;
-		} else {
-			result = pl;
-		}
-	}
-	return result;
+	return pl.capacity() * sizeof(Point);
 }
 
-String Polyline::to_str()
+// the geometry fields are counted apart from the rest of the object
+static void add_geometry_usage(MemoryUsage& usage, size_t bytes)
 {
-	std::ostringstream s;
-	s << *this;
-	return s.str();	
+	usage.geometry += bytes;
+	usage.objects -= bytes;
 }
 
-bool Rect::operator==(const Rect& r) const
+// the size of the element object by its type
+static size_t element_object_size(const Element* e)
 {
-	if (!valid && !r.valid) return true;
-	if (!valid || !r.valid) return false;
-	return x == r.x && y == r.y && width == r.width && height == r.height;
+	switch (e->get_type()) {
+	case elementRoot:           return sizeof(Document);
+	case elementSM:             return sizeof(StateMachine);
+	case elementSimpleState:
+	case elementCompositeState: return sizeof(State);
+	case elementComment:
+	case elementFormalComment:  return sizeof(Comment);
+	case elementInitial:        return sizeof(InitialPseudostate);
+	case elementFinal:          return sizeof(FinalState);
+	case elementChoice:         return sizeof(ChoicePseudostate);
+	case elementTerminate:      return sizeof(TerminatePseudostate);
+	case elementTransition:     return sizeof(Transition);
+	default:                    return sizeof(Element);
+	}
 }
 
-bool Rect::operator!=(const Rect& r) const
-{
-	return !(*this == r);
-}
+// -----------------------------------------------------------------------------
+// Lazy loading
+// -----------------------------------------------------------------------------	
 
-bool Rect::almost_equal(const Rect& r) const
+// the decoded document shared by the lazily loaded state machines
+class Cyberiada::LazyDocument {
+public:
+	LazyDocument(): pending(0), ids_built(false)
+	{
+		int res = cyberiada_init_sm_document(&doc);
+		CYB_ASSERT(res == CYBERIADA_NO_ERROR);
+	}
+
+	~LazyDocument()
+	{
+		cyberiada_cleanup_sm_document(&doc);
+	}
+
+	CyberiadaDocument                           doc;
+	// serializes the import of the content and the ID index updates while some content is pending
+	std::mutex                                  mutex;
+	std::atomic<size_t>                         pending;
+
+	void add(LazyContent* content);
+	// the following functions are called with the mutex locked
+	void release(LazyContent* content);
+	void find(const ID& id, std::vector<const ElementCollection*>& owners);
+
+private:
+	std::unordered_set<LazyContent*>            contents;
+	// ID -> the content with the element, built on the first lookup of an ID missing in the index
+	std::unordered_multimap<ID, LazyContent*>   ids;
+	bool                                        ids_built;
+};
+
+struct Cyberiada::LazyContent {
+	LazyContent(const std::shared_ptr<LazyDocument>& _source, const ElementCollection* _owner, CyberiadaSM* _sm,
+				bool _trusted);
+
+	std::shared_ptr<LazyDocument>               source;
+	const ElementCollection*                    owner;
+	CyberiadaSM*                                sm;       // NULL after the import
+	size_t                                      elements; // the number of the elements in the content
+	bool                                        trusted;
+	std::atomic<bool>                           loaded;
+};
+
+// the IDs of the nodes and the transitions imported as the elements
+static void lazy_node_ids(const CyberiadaNode* nodes, std::vector<const char*>& ids)
 {
-	if (!valid && !r.valid) return true;
-	if (!valid || !r.valid) return false;
-	return (abs(x - r.x) < EQUAL_DIFF &&
-			abs(y - r.y) < EQUAL_DIFF &&
-			abs(width - r.width) < EQUAL_DIFF &&
-			abs(height - r.height) < EQUAL_DIFF);
+	for (const CyberiadaNode* n = nodes; n; n = n->next) {
+		if (n->type != cybNodeRegion) {
+			ids.push_back(n->id);
+		}
+		lazy_node_ids(n->children, ids);
+	}
 }
 
-Rect Rect::round() const
+static std::vector<const char*> lazy_element_ids(const CyberiadaSM* sm)
 {
-	Rect r;
-	if (valid) {
-		r.valid = true;
-		r.x = round_num(x);
-		r.y = round_num(y);
-		r.width = round_num(width);
-		r.height = round_num(height);
+	std::vector<const char*> ids;
+	if (sm->nodes) {
+		lazy_node_ids(sm->nodes->children, ids);
 	}
-	return r;
+	for (const CyberiadaEdge* e = sm->edges; e; e = e->next) {
+		if (e->type == cybEdgeExternalTransition || e->type == cybEdgeLocalTransition) {
+			ids.push_back(e->id);
+		}
+	}
+	return ids;
 }
 
-void Rect::round()
+LazyContent::LazyContent(const std::shared_ptr<LazyDocument>& _source, const ElementCollection* _owner, CyberiadaSM* _sm,
+						 bool _trusted):
+	source(_source), owner(_owner), sm(_sm), elements(lazy_element_ids(_sm).size()), trusted(_trusted), loaded(false)
 {
-	if (valid) {
-		x = round_num(x);
-		y = round_num(y);
-		width = round_num(width);
-		height = round_num(height);
-	}
 }
 
-void Polyline::round()
+void LazyDocument::add(LazyContent* content)
 {
-	for (Polyline::iterator i = begin(); i != end(); i++) {
-		i->round();
-	}
+	contents.insert(content);
+	pending++;
 }
 
-void Rect::expand(const Point& p, const Document& d)
+void LazyDocument::release(LazyContent* content)
 {
-	if (p.valid) {
-		if (valid) {
-			if (d.get_geometry_format() == geometryFormatQt) {
-				double half_w = width / 2.0;
-				double half_h = height / 2.0;
-				double delta;
-				if (p.x < x - half_w) {
-					delta = x - half_w - p.x;
-					width += delta;
-					x -= delta / 2.0;
-				} else if (p.x > x + half_w) {
-					delta = p.x - x - half_w;
-					width += delta;
-					x += delta / 2.0;
-				}
-				if (p.y < y - half_h) {
-					delta = y - half_h - p.y;
-					height += delta;
-					y -= delta / 2.0;
-				} else if (p.y > y + half_h) {
-					delta = p.y - y - half_h;
-					height += delta;
-					y += delta / 2.0;
-				}
-			} else {
-				if (p.x < x) {
-					width += x - p.x;
-					x = p.x;
-				} else if (p.x > x + width) {
-					width = p.x - x;
-				}
-				if (p.y < y) {
-					height += y - p.y;
-					y = p.y;
-				} else if (p.y > y + height) {
-					height = p.y - y;
+	if (contents.erase(content) == 0) {
+		return ;
+	}
+	if (ids_built) {
+		std::vector<const char*> content_ids = lazy_element_ids(content->sm);
+		for (std::vector<const char*>::const_iterator i = content_ids.begin(); i != content_ids.end(); i++) {
+			std::pair<std::unordered_multimap<ID, LazyContent*>::iterator,
+					  std::unordered_multimap<ID, LazyContent*>::iterator> range = ids.equal_range(*i);
+			for (std::unordered_multimap<ID, LazyContent*>::iterator j = range.first; j != range.second; j++) {
+				if (j->second == content) {
+					ids.erase(j);
+					break;
 				}
 			}
-		} else {
-			valid = true;
-			x = p.x;
-			y = p.y;
-			width = height = 0.0;
 		}
 	}
+	// the C-level content is not needed any more
+	for (CyberiadaSM** sm = &(doc.state_machines); *sm; sm = &((*sm)->next)) {
+		if (*sm == content->sm) {
+			*sm = content->sm->next;
+			content->sm->next = NULL;
+			cyberiada_destroy_sm(content->sm);
+			break;
+		}
+	}
+	content->sm = NULL;
+	pending--;
 }
 
-void Rect::expand(const Rect& r, const Document& d)
+void LazyDocument::find(const ID& id, std::vector<const ElementCollection*>& owners)
 {
-	if (r.valid) {
-		if (valid) {
-			if (d.get_geometry_format() == geometryFormatQt) {
-				expand(Point(r.x - r.width / 2.0, r.y - r.height / 2.0), d);
-				expand(Point(r.x + r.width / 2.0, r.y + r.height / 2.0), d);				
-			} else {
-				expand(Point(r.x, r.y), d);
-				expand(Point(r.x + r.width, r.y + r.height), d);
+	if (!ids_built) {
+		for (std::unordered_set<LazyContent*>::const_iterator c = contents.begin(); c != contents.end(); c++) {
+			std::vector<const char*> content_ids = lazy_element_ids((*c)->sm);
+			for (std::vector<const char*>::const_iterator i = content_ids.begin(); i != content_ids.end(); i++) {
+				ids.insert(std::make_pair(ID(*i), *c));
 			}
-		} else {
-			*this = r;
 		}
+		ids_built = true;
+	}
+	std::pair<std::unordered_multimap<ID, LazyContent*>::const_iterator,
+			  std::unordered_multimap<ID, LazyContent*>::const_iterator> range = ids.equal_range(id);
+	for (std::unordered_multimap<ID, LazyContent*>::const_iterator i = range.first; i != range.second; i++) {
+		owners.push_back(i->second->owner);
 	}
 }
 
-void Rect::expand(const Polyline& pl, const Document& d)
+// the state machine with the content not imported yet
+static bool is_lazy(const Element* e)
 {
-	if (pl.size() > 0) {
-		for (Polyline::const_iterator i = pl.begin(); i != pl.end(); i++) {
-			expand(*i, d);
+	return e->get_type() == elementSM && !static_cast<const ElementCollection*>(e)->is_loaded();
+}
+
+// -----------------------------------------------------------------------------
+// Selective loading
+// -----------------------------------------------------------------------------	
+
+// the C-level state machines not imported by the selective load
+class Cyberiada::SkippedStateMachines {
+public:
+	~SkippedStateMachines()
+	{
+		for (std::vector<Entry>::iterator i = sms.begin(); i != sms.end(); i++) {
+			cyberiada_destroy_sm(i->sm);
 		}
 	}
-}
 
-std::ostream& Cyberiada::operator<<(std::ostream& os, const Point& p)
-{
-	if (!p.valid) {
-		os << "()";
-	} else {
-		os << "(" << p.x << "; " << p.y << ")";
+	struct Entry {
+		CyberiadaSM*                            sm;
+		ID                                      before;  // the next imported state machine ID (empty for the last ones)
+		Rect                                    bound_rect;
+	};
+
+	std::vector<Entry>                          sms;
+	// the IDs of the nodes and the edges of the skipped state machines reserved in the document
+	std::unordered_set<ID>                      ids;
+	// the state machines are linked to one encoded document at a time
+	std::mutex                                  mutex;
+
+	// the following functions are called with the mutex locked
+	void link(CyberiadaDocument* doc) const;
+	void unlink(CyberiadaDocument* doc) const;
+};
+
+void SkippedStateMachines::link(CyberiadaDocument* doc) const
+{
+	std::vector<CyberiadaSM*> result;
+	std::vector<bool> linked(sms.size(), false);
+	for (CyberiadaSM* sm = doc->state_machines; sm; sm = sm->next) {
+		if (sm->nodes && sm->nodes->id) {
+			String id = sm->nodes->id;
+			for (size_t i = 0; i < sms.size(); i++) {
+				if (!linked[i] && sms[i].before == id) {
+					result.push_back(sms[i].sm);
+					linked[i] = true;
+				}
+			}
+		}
+		result.push_back(sm);
+	}
+	// the state machines were placed before the removed ones or after the last one
+	for (size_t i = 0; i < sms.size(); i++) {
+		if (!linked[i]) {
+			result.push_back(sms[i].sm);
+		}
+	}
+	doc->state_machines = NULL;
+	for (std::vector<CyberiadaSM*>::reverse_iterator i = result.rbegin(); i != result.rend(); i++) {
+		(*i)->next = doc->state_machines;
+		doc->state_machines = *i;
 	}
-	return os;
 }
 
-std::ostream& Cyberiada::operator<<(std::ostream& os, const Rect& r)
+void SkippedStateMachines::unlink(CyberiadaDocument* doc) const
 {
-	if (!r.valid) {
-		os << "()";
-	} else {
-		os << "(" << r.x << "; " << r.y << "; " << r.width << "; " << r.height << ")";
+	CyberiadaSM** link = &(doc->state_machines);
+	while (*link) {
+		CyberiadaSM* sm = *link;
+		bool skipped = false;
+		for (std::vector<Entry>::const_iterator i = sms.begin(); i != sms.end(); i++) {
+			if (i->sm == sm) {
+				skipped = true;
+				break;
+			}
+		}
+		if (skipped) {
+			*link = sm->next;
+			sm->next = NULL;
+		} else {
+			link = &(sm->next);
+		}
 	}
-	return os;
 }
 
-std::ostream& Cyberiada::operator<<(std::ostream& os, const Polyline& pl)
+// the state machine has the metainformation node
+static bool has_meta_node(const CyberiadaSM* sm)
 {
-	os << "[ ";
-	for (Polyline::const_iterator i = pl.begin(); i != pl.end(); i++) {	
-		os << *i;
-		if (std::next(i) != pl.end()) {
-			os << ", ";
+	for (const CyberiadaNode* n = sm->nodes->children; n; n = n->next) {
+		if (n->type == cybNodeFormalComment && n->title && String(n->title) == META_NODE_NAME) {
+			return true;
 		}
 	}
-	os << " ]";
-	return os;
+	return false;
 }
 
 // -----------------------------------------------------------------------------
-// Action
+// Binary snapshot
 // -----------------------------------------------------------------------------	
 
-Action::Action(ActionType _type, const Behavior& _behavior):
-	type(_type), behavior(_behavior)
-{
-}
+// The snapshot is the header followed by the sections of the fixed-size records in the host
+// byte order aligned to 4 bytes: the string offsets, the string bytes, the metainformation
+// strings, the elements in the tree preorder, the actions, the comment subjects and the geometry
+// floats. The records refer to each other by index, so the loader reads them in place.
+
+static const char     SNAPSHOT_MAGIC[8] = {'C', 'Y', 'B', 'S', 'N', 'A', 'P', '\0'};
+static const uint32_t SNAPSHOT_VERSION = 1;
+static const uint32_t SNAPSHOT_BYTE_ORDER = 0x01020304;
+static const uint32_t SNAPSHOT_NONE = 0xFFFFFFFF;
+
+enum SnapshotFlags {
+	snapshotNameSet = 1,
+	snapshotFormalNameSet = 2,
+	snapshotCollapsed = 4,
+	snapshotHumanReadable = 8,
+	snapshotLocalTransition = 16,
+	snapshotFragment = 32,
+	snapshotCenterPoint = 64,
+	snapshotTransitionOrder = 128,
+	snapshotEventPropagation = 256
+};
 
-Action::Action(const Event& _trigger, const Guard& _guard, const Behavior& _behavior):
-	type(actionTransition), trigger(_trigger), guard(_guard), behavior(_behavior)
-{
-}
+struct SnapshotHeader {
+	char     magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint32_t geometry_format;
+	uint32_t flags;
+	float    center_x;
+	float    center_y;
+	uint32_t name;
+	uint32_t standard_version;
+	uint32_t meta_element;      // the metainformation comment (SNAPSHOT_NONE if absent)
+	uint32_t strings;
+	uint32_t string_bytes;
+	uint32_t meta_strings;
+	uint32_t elements;
+	uint32_t actions;
+	uint32_t subjects;
+	uint32_t floats;
+};
 
-void Action::update(const Behavior& _behavior)
-{
-	behavior = _behavior;
-}
+struct SnapshotElement {
+	uint32_t type;
+	uint32_t flags;
+	uint32_t parent;            // SNAPSHOT_NONE for the state machines
+	uint32_t id;
+	uint32_t name;
+	uint32_t formal_name;
+	uint32_t color;
+	uint32_t text[2];           // the comment body and markup or the transition source and target
+	uint32_t geometry;          // the first geometry float
+	uint32_t geometry_mask;     // the valid points and rects in the order of the element type
+	uint32_t polyline;          // the number of the polyline points after them
+	uint32_t first_action;
+	uint32_t actions;
+	uint32_t first_subject;
+	uint32_t subjects;
+};
 
-void Action::update(const Event& _trigger, const Guard& _guard, const Behavior& _behavior)
+struct SnapshotAction {
+	uint32_t type;
+	uint32_t trigger;
+	uint32_t guard;
+	uint32_t behavior;
+};
+
+struct SnapshotSubject {
+	uint32_t type;
+	uint32_t flags;
+	uint32_t id;
+	uint32_t element;           // SNAPSHOT_NONE if the subject has no element
+	uint32_t fragment;
+	uint32_t geometry;
+	uint32_t geometry_mask;
+	uint32_t polyline;
+};
+
+static_assert(sizeof(SnapshotHeader) % 4 == 0 && sizeof(SnapshotElement) % 4 == 0 && sizeof(float) == 4,
+			  "Unexpected snapshot record layout");
+
+class SnapshotWriter {
+public:
+	SnapshotWriter(size_t elements_count)
+	{
+		string_ids.reserve(elements_count);
+		element_ids.reserve(elements_count);
+		elements.reserve(elements_count);
+		string(String());
+	}
+
+	uint32_t string(const String& s);
+	void     element(const Element* e, uint32_t parent);
+	void     resolve_subjects();
+	uint32_t element_index(const Element* e) const;
+	void     write(SnapshotHeader& header, String& buffer) const;
+
+	std::vector<uint32_t>                        meta_strings;
+
+private:
+	void     point(const Point& p, uint32_t& mask, int slot);
+	void     rect(const Rect& r, uint32_t& mask, int slot);
+	uint32_t polyline(const Polyline& pl);
+	uint32_t action(const Action& a);
+
+	std::vector<uint32_t>                        string_offsets;
+	std::vector<char>                            string_bytes;
+	std::unordered_map<String, uint32_t>         string_ids;
+	std::vector<SnapshotElement>                 elements;
+	std::vector<SnapshotAction>                  actions;
+	std::vector<SnapshotSubject>                 subjects;
+	std::vector<float>                           floats;
+	std::unordered_map<const Element*, uint32_t> element_ids;
+	// the comments with their element indexes, the subjects are written after all the elements
+	std::vector<std::pair<const Comment*, uint32_t>> comments;
+
+};
+
+uint32_t SnapshotWriter::string(const String& s)
 {
-	if (type == actionTransition && _trigger.size() == 0) {
-		return ;
+	std::unordered_map<String, uint32_t>::const_iterator i = string_ids.find(s);
+	if (i != string_ids.end()) {
+		return i->second;
 	}
-	trigger = _trigger;
-	guard = _guard;
-	behavior = _behavior;
+	uint32_t index = uint32_t(string_offsets.size());
+	string_offsets.push_back(uint32_t(string_bytes.size()));
+	string_bytes.insert(string_bytes.end(), s.begin(), s.end());
+	string_ids.insert(std::make_pair(s, index));
+	return index;
 }
 
-void Action::clear()
+void SnapshotWriter::point(const Point& p, uint32_t& mask, int slot)
 {
-	if (type == actionTransition) {
-		trigger = guard = behavior = "";
-	} else {
-		guard = behavior = "";
+	if (p.valid) {
+		floats.push_back(p.x);
+		floats.push_back(p.y);
+		mask |= 1u << slot;
 	}
 }
 
-String Action::to_str() const
+void SnapshotWriter::rect(const Rect& r, uint32_t& mask, int slot)
 {
-	std::ostringstream s;
-	s << *this;
-	return s.str();	
-}
+	if (r.valid) {
+		floats.push_back(r.x);
+		floats.push_back(r.y);
+		floats.push_back(r.width);
+		floats.push_back(r.height);
+		mask |= 1u << slot;
+	}
+}
+
+uint32_t SnapshotWriter::polyline(const Polyline& pl)
+{
+	for (Polyline::const_iterator i = pl.begin(); i != pl.end(); i++) {
+		floats.push_back(i->x);
+		floats.push_back(i->y);
+	}
+	return uint32_t(pl.size());
+}
+
+uint32_t SnapshotWriter::action(const Action& a)
+{
+	SnapshotAction r;
+	r.type = uint32_t(a.get_type());
+	r.trigger = string(a.get_trigger());
+	r.guard = string(a.get_guard());
+	r.behavior = string(a.get_behavior());
+	actions.push_back(r);
+	return 1;
+}
+
+void SnapshotWriter::element(const Element* e, uint32_t parent)
+{
+	SnapshotElement r;
+	memset(&r, 0, sizeof(r));
+	r.type = uint32_t(e->get_type());
+	r.parent = parent;
+	r.id = string(e->get_id());
+	if (e->has_name()) {
+		r.flags |= snapshotNameSet;
+		r.name = string(e->get_name());
+	}
+	if (e->has_formal_name()) {
+		r.flags |= snapshotFormalNameSet;
+		r.formal_name = string(e->get_formal_name());
+	}
+	r.geometry = uint32_t(floats.size());
+	r.first_action = uint32_t(actions.size());
+
+	uint32_t index = uint32_t(elements.size());
+	const ElementCollection* collection = NULL;
+	switch (e->get_type()) {
+	case elementSM:
+	case elementSimpleState:
+	case elementCompositeState:
+		collection = static_cast<const ElementCollection*>(e);
+		rect(collection->get_geometry_rect(), r.geometry_mask, 0);
+		r.color = string(collection->get_color());
+		if (e->get_type() != elementSM) {
+			const State* s = static_cast<const State*>(e);
+			rect(s->get_region_geometry_rect(), r.geometry_mask, 1);
+			if (s->is_collapsed()) {
+				r.flags |= snapshotCollapsed;
+			}
+			const std::vector<Action>& state_actions = s->get_actions();
+			for (std::vector<Action>::const_iterator i = state_actions.begin(); i != state_actions.end(); i++) {
+				r.actions += action(*i);
+			}
+		}
+		break;
 
-std::ostream& Action::dump(std::ostream& os) const
-{
-	if (type != actionTransition) {
-		if (type == actionEntry) {
-			os << ACTION_ENTRY_TRIGGER;
-		} else {
-			CYB_ASSERT(type == actionExit);
-			os << ACTION_EXIT_TRIGGER;
+	case elementComment:
+	case elementFormalComment: {
+		const Comment* c = static_cast<const Comment*>(e);
+		rect(c->get_geometry_rect(), r.geometry_mask, 0);
+		r.color = string(c->get_color());
+		r.text[0] = string(c->get_body());
+		r.text[1] = string(c->get_markup());
+		if (c->is_human_readable()) {
+			r.flags |= snapshotHumanReadable;
 		}
-	} else if (!trigger.empty()) {
-		os << "trigger: '" << trigger << "'";
-	}
-	if (!guard.empty()) {
-		if (type != actionTransition || !trigger.empty()) {
-			os << ", ";
+		if (c->has_subjects()) {
+			comments.push_back(std::make_pair(c, index));
 		}
-		os << "guard: '" << guard << "'";
+		break;
 	}
-	if (!behavior.empty()) {
-		if (type != actionTransition || !trigger.empty() || !guard.empty()) {
-			os << ", ";
+
+	case elementInitial:
+	case elementFinal:
+	case elementTerminate:
+		point(static_cast<const Vertex*>(e)->get_geometry_point(), r.geometry_mask, 0);
+		break;
+
+	case elementChoice: {
+		const ChoicePseudostate* c = static_cast<const ChoicePseudostate*>(e);
+		rect(c->get_geometry_rect(), r.geometry_mask, 0);
+		r.color = string(c->get_color());
+		break;
+	}
+
+	case elementTransition: {
+		const Transition* t = static_cast<const Transition*>(e);
+		if (t->get_transition_type() == transitionLocal) {
+			r.flags |= snapshotLocalTransition;
 		}
-		os << "behavior: '" << behavior << "'";
+		r.text[0] = string(t->source_element_id());
+		r.text[1] = string(t->target_element_id());
+		r.color = string(t->get_color());
+		point(t->get_source_point(), r.geometry_mask, 0);
+		point(t->get_target_point(), r.geometry_mask, 1);
+		point(t->get_label_point(), r.geometry_mask, 2);
+		rect(t->get_label_rect(), r.geometry_mask, 3);
+		r.polyline = polyline(t->get_geometry_polyline());
+		r.actions = action(t->get_action());
+		break;
 	}
-	return os;
-}
 
-// -----------------------------------------------------------------------------
-// Comment
-// -----------------------------------------------------------------------------
+	default:
+		throw ParametersException("Bad element type " + std::to_string(int(e->get_type())));
+	}
 
-CommentSubject::CommentSubject(const ID& _id, Element* _element,
-							   const Point& source, const Point& target, const Polyline& pl):
-	type(commentSubjectElement), id(_id), element(_element), has_frag(false), source_point(source), target_point(target), polyline(pl)
-{
+	element_ids[e] = index;
+	elements.push_back(r);
+	if (collection) {
+		ConstElementList children = collection->get_children();
+		for (ConstElementList::const_iterator i = children.begin(); i != children.end(); i++) {
+			element(*i, index);
+		}
+	}
 }
 
-CommentSubject::CommentSubject(const ID& _id, Element* _element, CommentSubjectType _type, const String& _fragment,
-							   const Point& source, const Point& target, const Polyline& pl):
-	type(_type), id(_id), element(_element), has_frag(true), fragment(_fragment), source_point(source), target_point(target), polyline(pl)
+uint32_t SnapshotWriter::element_index(const Element* e) const
 {
+	std::unordered_map<const Element*, uint32_t>::const_iterator i = element_ids.find(e);
+	return i == element_ids.end() ? SNAPSHOT_NONE : i->second;
 }
 
-CommentSubject::CommentSubject(const CommentSubject& cs):
-	type(cs.type), id(cs.id), element(cs.element), has_frag(cs.has_frag), fragment(cs.fragment),
-	source_point(cs.source_point), target_point(cs.target_point), polyline(cs.polyline)	
+void SnapshotWriter::resolve_subjects()
 {
+	for (size_t i = 0; i < comments.size(); i++) {
+		SnapshotElement& r = elements[comments[i].second];
+		const std::vector<CommentSubject>& comment_subjects = comments[i].first->get_subjects();
+		r.first_subject = uint32_t(subjects.size());
+		r.subjects = uint32_t(comment_subjects.size());
+		for (std::vector<CommentSubject>::const_iterator cs = comment_subjects.begin(); cs != comment_subjects.end(); cs++) {
+			SnapshotSubject s;
+			memset(&s, 0, sizeof(s));
+			s.type = uint32_t(cs->get_type());
+			s.id = string(cs->get_id());
+			s.element = SNAPSHOT_NONE;
+			if (cs->get_element()) {
+				s.element = element_index(cs->get_element());
+				if (s.element == SNAPSHOT_NONE) {
+					throw ParametersException("The subject of the comment " + comments[i].first->get_id() +
+											  " is not in the document");
+				}
+			}
+			if (cs->has_fragment()) {
+				s.flags |= snapshotFragment;
+				s.fragment = string(cs->get_fragment());
+			}
+			s.geometry = uint32_t(floats.size());
+			point(cs->get_geometry_source_point(), s.geometry_mask, 0);
+			point(cs->get_geometry_target_point(), s.geometry_mask, 1);
+			s.polyline = polyline(cs->get_geometry_polyline());
+			subjects.push_back(s);
+		}
+	}
 }
 
-CommentSubject& CommentSubject::operator=(const CommentSubject& cs)
+// append the section bytes padded to 4 bytes
+static char* write_snapshot_section(char* p, const void* data, size_t size)
+{
+	if (size > 0) {
+		memcpy(p, data, size);
+	}
+	size_t padded = (size + 3) & ~size_t(3);
+	memset(p + size, 0, padded - size);
+	return p + padded;
+}
+
+void SnapshotWriter::write(SnapshotHeader& header, String& buffer) const
+{
+	std::vector<uint32_t> offsets(string_offsets);
+	offsets.push_back(uint32_t(string_bytes.size()));
+	header.strings = uint32_t(string_offsets.size());
+	header.string_bytes = uint32_t(string_bytes.size());
+	header.meta_strings = uint32_t(meta_strings.size() / 2);
+	header.elements = uint32_t(elements.size());
+	header.actions = uint32_t(actions.size());
+	header.subjects = uint32_t(subjects.size());
+	header.floats = uint32_t(floats.size());
+
+	size_t size = sizeof(header) + offsets.size() * sizeof(uint32_t) + ((string_bytes.size() + 3) & ~size_t(3)) +
+		meta_strings.size() * sizeof(uint32_t) + elements.size() * sizeof(SnapshotElement) +
+		actions.size() * sizeof(SnapshotAction) + subjects.size() * sizeof(SnapshotSubject) +
+		floats.size() * sizeof(float);
+	buffer.assign(size, '\0');
+	char* p = &(buffer[0]);
+	p = write_snapshot_section(p, &header, sizeof(header));
+	p = write_snapshot_section(p, offsets.data(), offsets.size() * sizeof(uint32_t));
+	p = write_snapshot_section(p, string_bytes.data(), string_bytes.size());
+	p = write_snapshot_section(p, meta_strings.data(), meta_strings.size() * sizeof(uint32_t));
+	p = write_snapshot_section(p, elements.data(), elements.size() * sizeof(SnapshotElement));
+	p = write_snapshot_section(p, actions.data(), actions.size() * sizeof(SnapshotAction));
+	p = write_snapshot_section(p, subjects.data(), subjects.size() * sizeof(SnapshotSubject));
+	p = write_snapshot_section(p, floats.data(), floats.size() * sizeof(float));
+	CYB_ASSERT(p == buffer.data() + buffer.size());
+}
+
+// the bounds-checked access to the snapshot sections
+class SnapshotReader {
+public:
+	SnapshotReader(const char* data, size_t size);
+
+	const SnapshotHeader& header() const { return h; }
+	String                string(uint32_t index) const;
+	std::pair<String, String> meta_string(uint32_t index) const;
+	SnapshotElement       element(uint32_t index) const;
+	SnapshotAction        action(uint32_t first, uint32_t count, uint32_t index) const;
+	SnapshotSubject       subject(uint32_t first, uint32_t count, uint32_t index) const;
+	// the geometry is read in the order of the slots starting from the cursor
+	Point                 point(uint32_t& cursor, uint32_t mask, int slot) const;
+	Rect                  rect(uint32_t& cursor, uint32_t mask, int slot) const;
+	Polyline              polyline(uint32_t& cursor, uint32_t points) const;
+
+private:
+	const char*           section(size_t count, size_t record_size);
+	uint32_t              u32(const char* p) const { uint32_t v; memcpy(&v, p, sizeof(v)); return v; }
+	const float*          geometry(uint32_t& cursor, uint32_t n) const;
+	void                  check_range(uint32_t first, uint32_t count, uint32_t index, uint32_t total) const;
+
+	const char*           data;
+	size_t                size;
+	size_t                offset;
+	SnapshotHeader        h;
+	const char*           offsets;
+	const char*           string_bytes;
+	const char*           meta;
+	const char*           elements;
+	const char*           actions;
+	const char*           subjects;
+	std::vector<float>    floats;
+};
+
+SnapshotReader::SnapshotReader(const char* _data, size_t _size):
+	data(_data), size(_size), offset(0)
 {
-	type = cs.type;
-	id = cs.id;
-	element = cs.element;
-	has_frag = cs.has_frag;
-	fragment = cs.fragment;
-	source_point = cs.source_point;
-	target_point = cs.target_point;
-	polyline = cs.polyline;
-	return *this;
+	if (!data || size < sizeof(h)) {
+		throw FormatException("Bad snapshot: no header");
+	}
+	memcpy(&h, data, sizeof(h));
+	offset = sizeof(h);
+	if (memcmp(h.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0) {
+		throw FormatException("Bad snapshot: wrong magic");
+	}
+	if (h.version != SNAPSHOT_VERSION) {
+		throw FormatException("Unsupported snapshot version " + std::to_string(h.version));
+	}
+	if (h.byte_order != SNAPSHOT_BYTE_ORDER) {
+		throw FormatException("Bad snapshot: wrong byte order");
+	}
+	offsets = section(size_t(h.strings) + 1, sizeof(uint32_t));
+	string_bytes = section(h.string_bytes, 1);
+	offset = std::min(size, (offset + 3) & ~size_t(3));
+	meta = section(size_t(h.meta_strings) * 2, sizeof(uint32_t));
+	elements = section(h.elements, sizeof(SnapshotElement));
+	actions = section(h.actions, sizeof(SnapshotAction));
+	subjects = section(h.subjects, sizeof(SnapshotSubject));
+	const char* float_data = section(h.floats, sizeof(float));
+	// the floats are copied once to avoid the unaligned access
+	floats.resize(h.floats);
+	if (h.floats > 0) {
+		memcpy(floats.data(), float_data, size_t(h.floats) * sizeof(float));
+	}
 }
 
-Rect CommentSubject::get_bound_rect(const Document& d) const
+const char* SnapshotReader::section(size_t count, size_t record_size)
 {
-	Rect r;
-	if (has_geometry() && has_polyline()) {
-		r.expand(polyline, d);
+	if (count > (size - offset) / record_size) {
+		throw FormatException("Bad snapshot: truncated data");
 	}
-	return r;
+	const char* p = data + offset;
+	offset += count * record_size;
+	return p;
 }
 
-std::ostream& Cyberiada::operator<<(std::ostream& os, const CommentSubject& cs)
+void SnapshotReader::check_range(uint32_t first, uint32_t count, uint32_t index, uint32_t total) const
 {
-	cs.dump(os);
-	return os;
+	if (first > total || count > total - first || index >= count) {
+		throw FormatException("Bad snapshot: record index out of range");
+	}
 }
 
-String CommentSubject::to_str() const
+String SnapshotReader::string(uint32_t index) const
 {
-	std::ostringstream s;
-	s << *this;
-	return s.str();	
+	if (index >= h.strings) {
+		throw FormatException("Bad snapshot: string index out of range");
+	}
+	uint32_t begin = u32(offsets + size_t(index) * sizeof(uint32_t));
+	uint32_t end = u32(offsets + (size_t(index) + 1) * sizeof(uint32_t));
+	if (begin > end || end > h.string_bytes) {
+		throw FormatException("Bad snapshot: bad string offset");
+	}
+	return String(string_bytes + begin, end - begin);
 }
 
-void CommentSubject::clean_geometry()
+std::pair<String, String> SnapshotReader::meta_string(uint32_t index) const
 {
-	source_point = Point();
-	target_point = Point();
-	polyline.clear();
-	CYB_ASSERT(!has_geometry());
+	check_range(0, h.meta_strings, index, h.meta_strings);
+	const char* p = meta + size_t(index) * 2 * sizeof(uint32_t);
+	return std::make_pair(string(u32(p)), string(u32(p + sizeof(uint32_t))));
 }
 
-void CommentSubject::round_geometry()
+SnapshotElement SnapshotReader::element(uint32_t index) const
 {
-	if (has_geometry()) {
-		source_point.round();
-		target_point.round();
-		polyline.round();
-	}
+	check_range(0, h.elements, index, h.elements);
+	SnapshotElement r;
+	memcpy(&r, elements + size_t(index) * sizeof(r), sizeof(r));
+	return r;
 }
 
-std::ostream& CommentSubject::dump(std::ostream& os) const
+SnapshotAction SnapshotReader::action(uint32_t first, uint32_t count, uint32_t index) const
 {
-	String type_str;
-	if (type == commentSubjectElement) {
-		type_str = "element";
-	} else if (type == commentSubjectName) {
-		type_str = "name";
-	} else {
-		CYB_ASSERT(type == commentSubjectData);
-		type_str = "data";
-	}
-	os << "{id: '" << id << "'";
-	os << ", type: " << type_str;
-	if (element) {
-		os << ", to: '" << element->get_id() << "'";
-		if (has_frag) {
-			os << ", fragment: '" << fragment << "'";
-		}
-		if (source_point.valid) {
-			os << ", source point: " << source_point;
-		}
-		if (target_point.valid) {
-			os << ", target point: " << target_point;
-		}
-		if (!polyline.empty()) {
-			os << ", polyline: " << polyline;
-		}
-	}
-	os << "}";
-	return os;
+	check_range(first, count, index, h.actions);
+	SnapshotAction r;
+	memcpy(&r, actions + (size_t(first) + index) * sizeof(r), sizeof(r));
+	return r;
 }
 
-Comment::Comment(Element* _parent, const ID& _id, const String& _body, bool _human_readable,
-				 const String& _markup, const Rect& rect, const Color& _color):
-	Element(_parent, elementComment, _id), body(_body), markup(_markup),
-	human_readable(_human_readable), geometry_rect(rect), color(_color)
+SnapshotSubject SnapshotReader::subject(uint32_t first, uint32_t count, uint32_t index) const
 {
-	update_comment_type();
+	check_range(first, count, index, h.subjects);
+	SnapshotSubject r;
+	memcpy(&r, subjects + (size_t(first) + index) * sizeof(r), sizeof(r));
+	return r;
 }
 
-Comment::Comment(Element* _parent, const ID& _id, const String& _body, const Name& _name, bool _human_readable,
-				 const String& _markup, const Rect& rect, const Color& _color):
-	Element(_parent, elementComment, _id, _name), body(_body), markup(_markup),
-	human_readable(_human_readable), geometry_rect(rect), color(_color)
+const float* SnapshotReader::geometry(uint32_t& cursor, uint32_t n) const
 {
-	update_comment_type();
+	if (cursor > h.floats || n > h.floats - cursor) {
+		throw FormatException("Bad snapshot: geometry out of range");
+	}
+	const float* p = floats.data() + cursor;
+	cursor += n;
+	return p;
 }
 
-Comment::Comment(const Comment& c):
-	Element(c), body(c.body), markup(c.markup), human_readable(c.human_readable),
-	geometry_rect(c.geometry_rect), subjects(c.subjects), color(c.color)
+Point SnapshotReader::point(uint32_t& cursor, uint32_t mask, int slot) const
 {
+	if (!(mask & (1u << slot))) {
+		return Point();
+	}
+	const float* p = geometry(cursor, 2);
+	return Point(p[0], p[1]);
 }
 
-Element* Comment::copy(Element* _parent) const
+Rect SnapshotReader::rect(uint32_t& cursor, uint32_t mask, int slot) const
 {
-	Comment* c;
-	if (has_name()) {
-		c = new Comment(_parent, get_id(), body, get_name(), human_readable, markup, geometry_rect, color);
-	} else {
-		c = new Comment(_parent, get_id(), body, human_readable, markup, geometry_rect, color);
+	if (!(mask & (1u << slot))) {
+		return Rect();
 	}
-	c->subjects = subjects;
-	return c;
+	const float* p = geometry(cursor, 4);
+	return Rect(p[0], p[1], p[2], p[3]);
 }
 
-const CommentSubject& Comment::add_subject(const CommentSubject& s)
+Polyline SnapshotReader::polyline(uint32_t& cursor, uint32_t points) const
 {
-	subjects.push_back(s);
-	return subjects.back();
+	Polyline pl;
+	if (points > h.floats / 2) {
+		throw FormatException("Bad snapshot: geometry out of range");
+	}
+	const float* p = geometry(cursor, points * 2);
+	pl.reserve(points);
+	for (uint32_t i = 0; i < points; i++) {
+		pl.push_back(Point(p[2 * i], p[2 * i + 1]));
+	}
+	return pl;
 }
 
-void Comment::remove_subject(CommentSubjectType _type, const String& fragment)
+// the element fields read by the snapshot and JSON loaders
+struct LoadedElement {
+	LoadedElement(ElementType t):
+		type(t), named(false), formal_named(false), collapsed(false), human_readable(true), local(false) {}
+
+	ElementType         type;
+	ID                  id;
+	bool                named;
+	Name                name;
+	bool                formal_named;
+	Name                formal_name;
+	Color               color;
+	Rect                rect;
+	Rect                region;
+	Point               point;
+	bool                collapsed;
+	bool                human_readable;
+	String              body;
+	String              markup;
+	bool                local;
+	ID                  source;
+	ID                  target;
+	Point               source_point;
+	Point               target_point;
+	Point               label_point;
+	Rect                label_rect;
+	Polyline            polyline;
+	std::vector<Action> actions;
+};
+
+// build the element and add it to the parent; the state machines are created detached
+static Element* new_loaded_element(ElementCollection* parent, const LoadedElement& le)
 {
-	for (std::vector<CommentSubject>::iterator i = subjects.begin(); i != subjects.end(); i++) {
-		if (i->get_type() == _type &&
-			i->has_fragment()
-			&& i->get_fragment() == fragment) {
-			
-			subjects.erase(i);
-			break;
+	Element* e = NULL;
+	switch (le.type) {
+	case elementSM:
+		CYB_ASSERT(!parent);
+		e = new StateMachine(NULL, le.id, le.name, le.rect);
+		break;
+
+	case elementSimpleState:
+	case elementCompositeState: {
+		State* s = new State(parent, le.id, le.name, le.rect, le.region, le.color);
+		parent->add_element(s);
+		if (le.collapsed) {
+			s->set_collapsed(true);
+		}
+		for (std::vector<Action>::const_iterator a = le.actions.begin(); a != le.actions.end(); a++) {
+			s->add_action(*a);
+		}
+		e = s;
+		break;
+	}
+
+	case elementComment:
+	case elementFormalComment:
+		if (le.named) {
+			e = new Comment(parent, le.id, le.body, le.name, le.human_readable, le.markup, le.rect, le.color);
+		} else {
+			e = new Comment(parent, le.id, le.body, le.human_readable, le.markup, le.rect, le.color);
+		}
+		parent->add_element(e);
+		break;
+
+	case elementInitial:
+		e = le.named ? new InitialPseudostate(parent, le.id, le.name, le.point) : new InitialPseudostate(parent, le.id, le.point);
+		parent->add_element(e);
+		break;
+
+	case elementFinal:
+		e = le.named ? new FinalState(parent, le.id, le.name, le.point) : new FinalState(parent, le.id, le.point);
+		parent->add_element(e);
+		break;
+
+	case elementTerminate:
+		e = le.named ? new TerminatePseudostate(parent, le.id, le.name, le.point) : new TerminatePseudostate(parent, le.id, le.point);
+		parent->add_element(e);
+		break;
+
+	case elementChoice:
+		if (le.named) {
+			e = new ChoicePseudostate(parent, le.id, le.name, le.rect, le.color);
+		} else {
+			e = new ChoicePseudostate(parent, le.id, le.rect, le.color);
 		}
+		parent->add_element(e);
+		break;
+
+	case elementTransition:
+		e = new Transition(parent, le.local ? transitionLocal : transitionExternal, le.id, le.source, le.target,
+						   le.actions.empty() ? Action() : le.actions.front(), le.polyline,
+						   le.source_point, le.target_point, le.label_point, le.label_rect, le.color);
+		parent->add_element(e);
+		break;
+
+	default:
+		CYB_ASSERT(false);
+	}
+	if (le.named && !e->has_name()) {
+		e->set_name(le.name);
+	}
+	if (le.formal_named) {
+		e->set_formal_name(le.formal_name);
 	}
+	return e;
 }
 
-void Comment::update_comment_type()
+static Action snapshot_action(const SnapshotReader& r, const SnapshotAction& a)
 {
-	if (human_readable) {
-		this->set_type(elementComment);
-	} else {
-		this->set_type(elementFormalComment);
+	if (a.type == actionTransition) {
+		return Action(r.string(a.trigger), r.string(a.guard), r.string(a.behavior));
+	} else if (a.type == actionEntry || a.type == actionExit) {
+		return Action(ActionType(a.type), r.string(a.behavior));
 	}
+	throw FormatException("Bad snapshot: action type " + std::to_string(a.type));
 }
 
-CyberiadaNode* Comment::to_node() const
+void Document::save_snapshot(String& buffer) const
 {
-	CyberiadaNode* node = Element::to_node();
-	CyberiadaCommentData* data = cyberiada_new_comment_data();
-	if (!body.empty()) {
-		cyberiada_copy_string(&(data->body), &(data->body_len), body.c_str());
+	if (skipped_sms) {
+		throw ParametersException("The document with skipped state machines cannot be saved to the snapshot");
 	}
-	if (!markup.empty()) {
-		cyberiada_copy_string(&(data->markup), &(data->markup_len), markup.c_str());
+	load_state_machines();
+
+	SnapshotWriter w(elements_count());
+	SnapshotHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+	header.version = SNAPSHOT_VERSION;
+	header.byte_order = SNAPSHOT_BYTE_ORDER;
+	header.geometry_format = uint32_t(geometry_format);
+	if (center_point.valid) {
+		header.flags |= snapshotCenterPoint;
+		header.center_x = center_point.x;
+		header.center_y = center_point.y;
 	}
-	node->comment_data = data;
-	if (has_geometry()) {
-		node->geometry_rect = geometry_rect.c_rect();
-		if (has_color()) {
-			cyberiada_copy_string(&(node->color), &(node->color_len), color.c_str());
-		}
+	if (has_name()) {
+		header.flags |= snapshotNameSet;
+		header.name = w.string(get_name());
 	}
-	return node;
+	if (metainfo.transition_order_flag) {
+		header.flags |= snapshotTransitionOrder;
+	}
+	if (metainfo.event_propagation_flag) {
+		header.flags |= snapshotEventPropagation;
+	}
+	header.standard_version = w.string(metainfo.standard_version);
+	for (std::vector<std::pair<String, String>>::const_iterator i = metainfo.strings.begin();
+		 i != metainfo.strings.end(); i++) {
+		w.meta_strings.push_back(w.string(i->first));
+		w.meta_strings.push_back(w.string(i->second));
+	}
+
+	header.meta_element = SNAPSHOT_NONE;
+	for (ElementList::const_iterator i = children.begin(); i != children.end(); i++) {
+		w.element(*i, SNAPSHOT_NONE);
+	}
+	w.resolve_subjects();
+	if (metainfo_element) {
+		header.meta_element = w.element_index(metainfo_element);
+	}
+	w.write(header, buffer);
 }
 
-CyberiadaEdge* Comment::subjects_to_edges() const
+void Document::load_snapshot(const char* data, size_t size)
 {
-	CyberiadaEdge* result = NULL;
-	if (has_subjects()) {
-		for (std::vector<CommentSubject>::const_iterator i = subjects.begin(); i != subjects.end(); i++) {
-			CyberiadaEdge *edge = cyberiada_new_edge(i->get_id().c_str(),
-													 get_id().c_str(),
-													 i->get_element()->get_id().c_str(), 0);
-			edge->type = cybEdgeComment;
-			CyberiadaCommentSubjectType t;
-			if (i->get_type() == commentSubjectElement) {
-				t = cybCommentSubjectNode;
-			} else if (i->get_type() == commentSubjectName) {
-				t = cybCommentSubjectNameFragment;
-			} else {
-				CYB_ASSERT(i->get_type() == commentSubjectData);
-				t = cybCommentSubjectDataFragment;
-			}
-			CyberiadaCommentSubject* cs = cyberiada_new_comment_subject(t);
-			
-			if (i->has_fragment()) {
-				cyberiada_copy_string(&(cs->fragment), &(cs->fragment_len), i->get_fragment().c_str());			
-			}
-			edge->comment_subject = cs;
+	SnapshotReader r(data, size);
+	const SnapshotHeader& h = r.header();
+	if (h.geometry_format > uint32_t(geometryFormatQt)) {
+		throw FormatException("Bad snapshot: geometry format " + std::to_string(h.geometry_format));
+	}
 
-			if (i->has_geometry()) {
-				if (i->get_geometry_source_point().valid) {
-					edge->geometry_source_point = i->get_geometry_source_point().c_point();
+	reset();
+	std::vector<Element*> elements(h.elements, NULL);
+	// the state machines are built detached and added to the document at once
+	std::vector<StateMachine*> sms;
+	try {
+		metainfo.standard_version = r.string(h.standard_version);
+		metainfo.transition_order_flag = (h.flags & snapshotTransitionOrder) != 0;
+		metainfo.event_propagation_flag = (h.flags & snapshotEventPropagation) != 0;
+		metainfo.strings.clear();
+		for (uint32_t i = 0; i < h.meta_strings; i++) {
+			metainfo.strings.push_back(r.meta_string(i));
+		}
+		if (h.flags & snapshotNameSet) {
+			Element::set_name(r.string(h.name));
+		}
+
+		for (uint32_t i = 0; i < h.elements; i++) {
+			SnapshotElement rec = r.element(i);
+			ElementCollection* parent = NULL;
+			if (rec.type == elementSM) {
+				if (rec.parent != SNAPSHOT_NONE) {
+					throw FormatException("Bad snapshot: nested state machine " + std::to_string(i));
 				}
-				if (i->get_geometry_target_point().valid) {
-					edge->geometry_target_point = i->get_geometry_target_point().c_point();
+			} else {
+				if (rec.parent >= i) {
+					throw FormatException("Bad snapshot: bad parent of element " + std::to_string(i));
 				}
-				if (i->has_polyline()) {
-					edge->geometry_polyline = i->get_geometry_polyline().c_polyline();
+				ElementType pt = elements[rec.parent]->get_type();
+				if (pt != elementSM && pt != elementSimpleState && pt != elementCompositeState) {
+					throw FormatException("Bad snapshot: bad parent of element " + std::to_string(i));
 				}
+				if (rec.type == elementTransition && pt != elementSM) {
+					throw FormatException("Bad snapshot: transition " + std::to_string(i) + " outside the state machine");
+				}
+				parent = static_cast<ElementCollection*>(elements[rec.parent]);
+			}
+			if (rec.subjects > 0 && rec.type != elementComment && rec.type != elementFormalComment) {
+				throw FormatException("Bad snapshot: subjects of element " + std::to_string(i));
 			}
 
-			if (result) {
-				CyberiadaEdge* e = result;
-				while (e->next) e = e->next;
-				e->next = edge;
-			} else {
-				result = edge;
+			LoadedElement le(ElementType(rec.type));
+			le.id = r.string(rec.id);
+			le.named = (rec.flags & snapshotNameSet) != 0;
+			le.name = r.string(rec.name);
+			le.formal_named = (rec.flags & snapshotFormalNameSet) != 0;
+			le.formal_name = r.string(rec.formal_name);
+			le.color = r.string(rec.color);
+			le.collapsed = (rec.flags & snapshotCollapsed) != 0;
+			le.human_readable = (rec.flags & snapshotHumanReadable) != 0;
+			le.local = (rec.flags & snapshotLocalTransition) != 0;
+			uint32_t cursor = rec.geometry;
+			switch (rec.type) {
+			case elementSM:
+			case elementComment:
+			case elementFormalComment:
+			case elementChoice:
+				le.rect = r.rect(cursor, rec.geometry_mask, 0);
+				break;
+
+			case elementSimpleState:
+			case elementCompositeState:
+				le.rect = r.rect(cursor, rec.geometry_mask, 0);
+				le.region = r.rect(cursor, rec.geometry_mask, 1);
+				break;
+
+			case elementInitial:
+			case elementFinal:
+			case elementTerminate:
+				le.point = r.point(cursor, rec.geometry_mask, 0);
+				break;
+
+			case elementTransition:
+				le.source_point = r.point(cursor, rec.geometry_mask, 0);
+				le.target_point = r.point(cursor, rec.geometry_mask, 1);
+				le.label_point = r.point(cursor, rec.geometry_mask, 2);
+				le.label_rect = r.rect(cursor, rec.geometry_mask, 3);
+				le.polyline = r.polyline(cursor, rec.polyline);
+				break;
+
+			default:
+				throw FormatException("Bad snapshot: element type " + std::to_string(rec.type));
+			}
+			if (rec.type == elementComment || rec.type == elementFormalComment) {
+				le.body = r.string(rec.text[0]);
+				le.markup = r.string(rec.text[1]);
+			} else if (rec.type == elementTransition) {
+				le.source = r.string(rec.text[0]);
+				le.target = r.string(rec.text[1]);
+			}
+			for (uint32_t k = 0; k < rec.actions; k++) {
+				le.actions.push_back(snapshot_action(r, r.action(rec.first_action, rec.actions, k)));
+			}
+
+			Element* e = new_loaded_element(parent, le);
+			if (rec.type == elementSM) {
+				sms.push_back(static_cast<StateMachine*>(e));
 			}
+			elements[i] = e;
 		}
-	}
-	return result;
-}
 
-Rect Comment::get_bound_rect(const Document& d) const
-{
-	Rect r, parent;
-	if (has_geometry()) {
-		parent = r = geometry_rect;
-	}
-	if (has_geometry() && has_subjects()) {
-		for (std::vector<CommentSubject>::const_iterator i = subjects.begin(); i != subjects.end(); i++) {
-			if (!i->get_element() || !i->get_element()->has_geometry()) {
+		// the subjects refer to any elements, so they are added after all of them
+		for (uint32_t i = 0; i < h.elements; i++) {
+			SnapshotElement rec = r.element(i);
+			if (rec.subjects == 0) {
 				continue;
 			}
-			Rect ch_r = i->get_bound_rect(d);
-			if (d.get_geometry_format() == geometryFormatCyberiada10 ||
-				d.get_geometry_format() == geometryFormatQt) {
-				ch_r.x += parent.x;
-				ch_r.y += parent.y;
+			Comment* comment = static_cast<Comment*>(elements[i]);
+			for (uint32_t k = 0; k < rec.subjects; k++) {
+				SnapshotSubject s = r.subject(rec.first_subject, rec.subjects, k);
+				Element* target = NULL;
+				if (s.element != SNAPSHOT_NONE) {
+					if (s.element >= h.elements) {
+						throw FormatException("Bad snapshot: subject of element " + std::to_string(i));
+					}
+					target = elements[s.element];
+				}
+				uint32_t cursor = s.geometry;
+				Point sp = r.point(cursor, s.geometry_mask, 0);
+				Point tp = r.point(cursor, s.geometry_mask, 1);
+				Polyline pl = r.polyline(cursor, s.polyline);
+				if (s.flags & snapshotFragment) {
+					if (s.type != commentSubjectName && s.type != commentSubjectData) {
+						throw FormatException("Bad snapshot: subject type " + std::to_string(s.type));
+					}
+					comment->add_subject(CommentSubject(r.string(s.id), target, CommentSubjectType(s.type),
+														r.string(s.fragment), sp, tp, pl));
+				} else {
+					comment->add_subject(CommentSubject(r.string(s.id), target, sp, tp, pl));
+				}
+			}
+		}
+
+		if (h.meta_element != SNAPSHOT_NONE) {
+			if (h.meta_element >= h.elements || elements[h.meta_element]->get_type() != elementFormalComment) {
+				throw FormatException("Bad snapshot: metainformation element");
 			}
-			r.expand(ch_r, d);
 		}
+	} catch (const Exception&) {
+		for (std::vector<StateMachine*>::iterator i = sms.begin(); i != sms.end(); i++) {
+			delete *i;
+		}
+		reset();
+		throw;
 	}
-	return r;
+
+	// the index is filled at once without rehashing
+	id_index.reserve(h.elements);
+	indexed_elements.reserve(h.elements);
+	for (std::vector<StateMachine*>::iterator i = sms.begin(); i != sms.end(); i++) {
+		(*i)->update_parent(this);
+		add_element(*i);
+	}
+	if (h.meta_element != SNAPSHOT_NONE) {
+		metainfo_element = static_cast<Comment*>(elements[h.meta_element]);
+	}
+	geometry_format = DocumentGeometryFormat(h.geometry_format);
+	center_point = (h.flags & snapshotCenterPoint) ? Point(h.center_x, h.center_y) : Point();
 }
 
-void Comment::clean_geometry()
-{
-	geometry_rect = Rect();
-	if (has_subjects()) {
-		for (std::vector<CommentSubject>::iterator i = subjects.begin(); i != subjects.end(); i++) {
-			i->clean_geometry();
-		}
-	}	
-	CYB_ASSERT(!has_geometry());
+// -----------------------------------------------------------------------------
+// JSON
+// -----------------------------------------------------------------------------
+
+// The JSON form keeps the document fields, the metainformation and the state machines
+// as the nested element objects. The writer appends to the buffer directly and the parser
+// builds the elements in one pass with the keys in any order: the element is built when its
+// children start and the keys that follow are applied to it afterwards.
+
+static const String JSON_FORMAT = "Cyberiada-JSON";
+static const unsigned int JSON_VERSION = 1;
+static const size_t JSON_MAX_DEPTH = 4096;
+
+static const char* json_element_type(ElementType t)
+{
+	switch (t) {
+	case elementSM:             return "stateMachine";
+	case elementSimpleState:    return "simpleState";
+	case elementCompositeState: return "compositeState";
+	case elementComment:        return "comment";
+	case elementFormalComment:  return "formalComment";
+	case elementInitial:        return "initial";
+	case elementFinal:          return "final";
+	case elementChoice:         return "choice";
+	case elementTerminate:      return "terminate";
+	case elementTransition:     return "transition";
+	default:
+		throw ParametersException("Bad element type " + std::to_string(int(t)));
+	}
 }
 
-void Comment::round_geometry()
+static const char* json_geometry_format(DocumentGeometryFormat f)
 {
-	if (has_geometry()) {
-		geometry_rect.round();
-		if (has_subjects()) {
-			for (std::vector<CommentSubject>::iterator i = subjects.begin(); i != subjects.end(); i++) {
-				i->round_geometry();
-			}
-		}
+	switch (f) {
+	case geometryFormatNone:        return "none";
+	case geometryFormatLegacyYED:   return "yed";
+	case geometryFormatCyberiada10: return "cyberiada";
+	case geometryFormatQt:          return "qt";
+	default:
+		throw ParametersException("Bad geometry format " + std::to_string(int(f)));
 	}
 }
 
-std::ostream& Comment::dump(std::ostream& os) const
+static const char* json_action_type(ActionType t)
 {
-	Element::dump(os);
-	os << ", body: '" << body << "'";
-	if (has_geometry()) {
-		os << ", geometry: " << geometry_rect;
-	}
-	if (has_subjects()) {
-		os << ", subjects: {";
-		for (std::vector<CommentSubject>::const_iterator i = subjects.begin(); i != subjects.end(); i++) {
-			os << *i;
-			if(std::next(i) != subjects.end()) {
-				os << ", ";
-			}
-		}
-		os << "}";
+	switch (t) {
+	case actionTransition: return "transition";
+	case actionEntry:      return "entry";
+	case actionExit:       return "exit";
+	default:
+		throw ParametersException("Bad action type " + std::to_string(int(t)));
 	}
-	os << "}";
-	return os;
 }
 
-// -----------------------------------------------------------------------------
-// Vertex
-// -----------------------------------------------------------------------------
-
-Vertex::Vertex(Element* _parent, ElementType _type, const ID& _id, const Point& pos):
-	Element(_parent, _type, _id), geometry_point(pos)
+static const char* json_subject_type(CommentSubjectType t)
 {
+	switch (t) {
+	case commentSubjectElement: return "element";
+	case commentSubjectName:    return "name";
+	case commentSubjectData:    return "data";
+	default:
+		throw ParametersException("Bad comment subject type " + std::to_string(int(t)));
+	}
 }
 
-Vertex::Vertex(Element* _parent, ElementType _type, const ID& _id, const Name& _name, const Point& pos):
-	Element(_parent, _type, _id, _name), geometry_point(pos)
+// the decimal point of the C locale used by snprintf and strtod; the numbers are written and
+// read with the dot whatever the locale is
+static char c_decimal_point()
 {
+	const struct lconv* lc = localeconv();
+	return (lc && lc->decimal_point && lc->decimal_point[0]) ? lc->decimal_point[0] : '.';
 }
 
-Vertex::Vertex(const Vertex& v):
-	Element(v), geometry_point(v.geometry_point)
+class JsonWriter {
+public:
+	JsonWriter(String& _out): out(_out), separated(true), decimal_point(c_decimal_point()) {}
+
+	void begin_object() { separator(); out += '{'; separated = true; }
+	void end_object() { out += '}'; separated = false; }
+	void begin_array() { separator(); out += '['; separated = true; }
+	void end_array() { out += ']'; separated = false; }
+	void key(const char* k);
+	void value(const String& s);
+	void value(const char* s);
+	void value(bool b) { separator(); out += b ? "true" : "false"; }
+	void value(unsigned int n) { separator(); out += std::to_string(n); }
+	void value(float f);
+
+	template<class T> void field(const char* k, const T& v) { key(k); value(v); }
+	void point(const char* k, const Point& p);
+	void rect(const char* k, const Rect& r);
+	void polyline(const char* k, const Polyline& pl);
+	void action(const Action& a);
+
+private:
+	void separator() { if (!separated) out += ','; separated = false; }
+
+	String& out;
+	bool    separated;
+	char    decimal_point;
+};
+
+void JsonWriter::key(const char* k)
 {
+	value(k);
+	out += ':';
+	separated = true;
 }
 
-Rect Vertex::get_bound_rect(const Document& d) const
+void JsonWriter::value(const char* s)
 {
-	Rect r;
-	if (has_geometry()) {
-		r.expand(geometry_point, d);
+	separator();
+	out += '"';
+	for (const char* c = s; *c; c++) {
+		switch (*c) {
+		case '"':  out += "\\\""; break;
+		case '\\': out += "\\\\"; break;
+		case '\n': out += "\\n"; break;
+		case '\r': out += "\\r"; break;
+		case '\t': out += "\\t"; break;
+		default:
+			if ((unsigned char)*c < 0x20) {
+				char buffer[8];
+				snprintf(buffer, sizeof(buffer), "\\u%04x", (unsigned int)(unsigned char)*c);
+				out += buffer;
+			} else {
+				out += *c;
+			}
+		}
 	}
-	return r;
+	out += '"';
 }
 
-void Vertex::clean_geometry()
+void JsonWriter::value(const String& s)
 {
-	geometry_point = Point();
-	CYB_ASSERT(!has_geometry());
+	if (s.find('\0') != String::npos) {
+		throw ParametersException("Cannot write the string with the zero byte to JSON");
+	}
+	value(s.c_str());
 }
 
-void Vertex::round_geometry()
+void JsonWriter::value(float f)
 {
-	if (has_geometry()) {
-		geometry_point.round();
+	if (!std::isfinite(f)) {
+		throw ParametersException("Cannot write the non-finite number to JSON");
+	}
+	separator();
+	// 9 significant digits restore the same float
+	char buffer[32];
+	int n = snprintf(buffer, sizeof(buffer), "%.9g", double(f));
+	if (decimal_point != '.') {
+		std::replace(buffer, buffer + n, decimal_point, '.');
 	}
+	out.append(buffer, n);
 }
 
-std::ostream& Vertex::dump(std::ostream& os) const
+void JsonWriter::point(const char* k, const Point& p)
 {
-	Element::dump(os);
-	if (has_geometry()) {
-		os << ", geometry: " << geometry_point;
+	if (!p.valid) {
+		return ;
 	}
-	os << "}";	
-	return os;
+	key(k);
+	begin_object();
+	field("x", p.x);
+	field("y", p.y);
+	end_object();
 }
 
-CyberiadaNode* Vertex::to_node() const
+void JsonWriter::rect(const char* k, const Rect& r)
 {
-	CyberiadaNode* node = Element::to_node();
-	if (has_geometry()) {
-		node->geometry_point = geometry_point.c_point();
+	if (!r.valid) {
+		return ;
 	}
-	return node;
+	key(k);
+	begin_object();
+	field("x", r.x);
+	field("y", r.y);
+	field("width", r.width);
+	field("height", r.height);
+	end_object();
 }
 
-// -----------------------------------------------------------------------------
-// Collection of Elements
-// -----------------------------------------------------------------------------
-
-ElementCollection::ElementCollection(Element* _parent, ElementType _type, const ID& _id, const Name& _name,
-									 const Rect& rect, const Color& _color):
-	Element(_parent, _type, _id, _name), geometry_rect(rect), color(_color)
+void JsonWriter::polyline(const char* k, const Polyline& pl)
 {
+	if (pl.empty()) {
+		return ;
+	}
+	key(k);
+	begin_array();
+	for (Polyline::const_iterator i = pl.begin(); i != pl.end(); i++) {
+		begin_object();
+		field("x", i->x);
+		field("y", i->y);
+		end_object();
+	}
+	end_array();
 }
 
-ElementCollection::ElementCollection(const ElementCollection& ec):
-	Element(ec), geometry_rect(ec.geometry_rect), color(ec.color)
+void JsonWriter::action(const Action& a)
 {
-	copy_elements(ec);
+	begin_object();
+	field("type", json_action_type(a.get_type()));
+	if (a.has_trigger()) {
+		field("trigger", a.get_trigger());
+	}
+	if (a.has_guard()) {
+		field("guard", a.get_guard());
+	}
+	if (a.has_behavior()) {
+		field("behavior", a.get_behavior());
+	}
+	end_object();
 }
 
-ElementCollection::~ElementCollection()
+static void json_write_element(JsonWriter& w, const Element* e)
 {
-	clear();
-}
+	w.begin_object();
+	w.field("type", json_element_type(e->get_type()));
+	w.field("id", e->get_id());
+	if (e->has_name()) {
+		w.field("name", e->get_name());
+	}
+	if (e->has_formal_name()) {
+		w.field("formalName", e->get_formal_name());
+	}
 
-const Element* ElementCollection::find_element_by_id(const ID& _id) const
-{
-	for (ElementList::const_iterator i = children.begin(); i != children.end(); i++) {
-		const Element* e = *i;
-		if (e->get_id() == _id) {
-			return e;
-		} else if (e->has_children()) {
-			const ElementCollection* c = static_cast<const ElementCollection*>(e);
-			e = c->find_element_by_id(_id);
-			if (e) {
-				return e;
+	const ElementCollection* collection = NULL;
+	switch (e->get_type()) {
+	case elementSM:
+	case elementSimpleState:
+	case elementCompositeState:
+		collection = static_cast<const ElementCollection*>(e);
+		w.rect("rect", collection->get_geometry_rect());
+		if (!collection->get_color().empty()) {
+			w.field("color", collection->get_color());
+		}
+		if (e->get_type() != elementSM) {
+			const State* s = static_cast<const State*>(e);
+			w.rect("region", s->get_region_geometry_rect());
+			if (s->is_collapsed()) {
+				w.field("collapsed", true);
+			}
+			const std::vector<Action>& actions = s->get_actions();
+			if (!actions.empty()) {
+				w.key("actions");
+				w.begin_array();
+				for (std::vector<Action>::const_iterator i = actions.begin(); i != actions.end(); i++) {
+					w.action(*i);
+				}
+				w.end_array();
 			}
 		}
-	}
-	return NULL;
-}
+		break;
 
-Element* ElementCollection::find_element_by_id(const ID& _id)
-{
-	for (ElementList::iterator i = children.begin(); i != children.end(); i++) {
-		Element* e = *i;
-		if (e->get_id() == _id) {
-			return e;
-		} else if (e->has_children()) {
-			ElementCollection* c = static_cast<ElementCollection*>(e);
-			e = c->find_element_by_id(_id);
-			if (e) {
-				return e;
+	case elementComment:
+	case elementFormalComment: {
+		const Comment* c = static_cast<const Comment*>(e);
+		w.rect("rect", c->get_geometry_rect());
+		if (!c->get_color().empty()) {
+			w.field("color", c->get_color());
+		}
+		w.field("body", c->get_body());
+		if (!c->get_markup().empty()) {
+			w.field("markup", c->get_markup());
+		}
+		w.field("humanReadable", c->is_human_readable());
+		if (c->has_subjects()) {
+			w.key("subjects");
+			w.begin_array();
+			const std::vector<CommentSubject>& subjects = c->get_subjects();
+			for (std::vector<CommentSubject>::const_iterator cs = subjects.begin(); cs != subjects.end(); cs++) {
+				w.begin_object();
+				w.field("id", cs->get_id());
+				w.field("type", json_subject_type(cs->get_type()));
+				if (cs->get_element()) {
+					w.field("element", cs->get_element()->get_id());
+				}
+				if (cs->has_fragment()) {
+					w.field("fragment", cs->get_fragment());
+				}
+				w.point("sourcePoint", cs->get_geometry_source_point());
+				w.point("targetPoint", cs->get_geometry_target_point());
+				w.polyline("polyline", cs->get_geometry_polyline());
+				w.end_object();
 			}
+			w.end_array();
 		}
+		break;
 	}
-	return NULL;
-}
 
-ConstElementList ElementCollection::find_elements_by_type(ElementType _type) const
-{
-	ConstElementList result;
-	for (ElementList::const_iterator i = children.begin(); i != children.end(); i++) {
-		const Element* e = *i;
-		if (e->get_type() == _type) {
-			result.push_back(e);
-		}
-		if (e->has_children()) {
-			const ElementCollection* c = static_cast<const ElementCollection*>(e);
-			ConstElementList r = c->find_elements_by_type(_type);
-			result.insert(result.end(), r.begin(), r.end());
-		}
-	}	
-	return result;
-}
+	case elementInitial:
+	case elementFinal:
+	case elementTerminate:
+		w.point("point", static_cast<const Vertex*>(e)->get_geometry_point());
+		break;
 
-ConstElementList ElementCollection::find_elements_by_types(const ElementTypes& types) const
-{
-	ConstElementList result;
-	for (ElementList::const_iterator i = children.begin(); i != children.end(); i++) {
-		const Element* e = *i;
-		if (std::find(types.begin(), types.end(), e->get_type()) != types.end()) {
-			result.push_back(e);
-		}
-		if (e->has_children()) {
-			const ElementCollection* c = static_cast<const ElementCollection*>(e);
-			ConstElementList r = c->find_elements_by_types(types);
-			result.insert(result.end(), r.begin(), r.end());
+	case elementChoice: {
+		const ChoicePseudostate* c = static_cast<const ChoicePseudostate*>(e);
+		w.rect("rect", c->get_geometry_rect());
+		if (!c->get_color().empty()) {
+			w.field("color", c->get_color());
 		}
-	}	
-	return result;
-}
+		break;
+	}
 
-ElementList ElementCollection::find_elements_by_type(ElementType _type)
-{
-	ElementList result;
-	for (ElementList::iterator i = children.begin(); i != children.end(); i++) {
-		Element* e = *i;
-		if (e->get_type() == _type) {
-			result.push_back(e);
+	case elementTransition: {
+		const Transition* t = static_cast<const Transition*>(e);
+		if (t->get_transition_type() == transitionLocal) {
+			w.field("local", true);
 		}
-		if (e->has_children()) {
-			ElementCollection* c = static_cast<ElementCollection*>(e);
-			ElementList r = c->find_elements_by_type(_type);
-			result.insert(result.end(), r.begin(), r.end());
+		w.field("source", t->source_element_id());
+		w.field("target", t->target_element_id());
+		if (!t->get_action().is_empty_transition()) {
+			w.key("action");
+			w.action(t->get_action());
+		}
+		if (!t->get_color().empty()) {
+			w.field("color", t->get_color());
 		}
+		w.point("sourcePoint", t->get_source_point());
+		w.point("targetPoint", t->get_target_point());
+		w.point("labelPoint", t->get_label_point());
+		w.rect("labelRect", t->get_label_rect());
+		w.polyline("polyline", t->get_geometry_polyline());
+		break;
 	}
-	return result;
+
+	default:
+		CYB_ASSERT(false);
+	}
+
+	if (collection && collection->has_children()) {
+		w.key("children");
+		w.begin_array();
+		ConstElementList children = collection->get_children();
+		for (ConstElementList::const_iterator i = children.begin(); i != children.end(); i++) {
+			json_write_element(w, *i);
+		}
+		w.end_array();
+	}
+	w.end_object();
+}
+
+// the pull parser of the JSON text; the objects and arrays are iterated by the keys and items
+class JsonReader {
+public:
+	JsonReader(const String& _text): text(_text), pos(0), first(true), decimal_point(c_decimal_point()) {}
+
+	void   begin_object() { expect('{'); first = true; }
+	// read the next key of the current object, false at its end
+	bool   next_key(String& key);
+	void   begin_array() { expect('['); first = true; }
+	// skip to the next item of the current array, false at its end
+	bool   next_item();
+	String string();
+	float  number();
+	bool   boolean();
+	void   skip_value(size_t depth = 0);
+	void   end();
+	void   error(const String& message) const;
+
+	Point  point();
+	Rect   rect();
+	Polyline polyline();
+	Action action();
+
+private:
+	void   skip_spaces();
+	void   expect(char c);
+	char   peek() { skip_spaces(); return pos < text.size() ? text[pos] : '\0'; }
+	void   append_utf8(String& s, unsigned long code);
+	unsigned long hex4();
+
+	const String& text;
+	size_t        pos;
+	bool          first;
+	char          decimal_point;
+};
+
+void JsonReader::error(const String& message) const
+{
+	throw FormatException("Bad JSON: " + message + " at offset " + std::to_string(pos));
 }
 
-ElementList ElementCollection::find_elements_by_types(const ElementTypes& types)
+void JsonReader::skip_spaces()
 {
-	ElementList result;
-	for (ElementList::iterator i = children.begin(); i != children.end(); i++) {
-		Element* e = *i;
-		if (std::find(types.begin(), types.end(), e->get_type()) != types.end()) {
-			result.push_back(e);
-		}
-		if (e->has_children()) {
-			ElementCollection* c = static_cast<ElementCollection*>(e);
-			ElementList r = c->find_elements_by_types(types);
-			result.insert(result.end(), r.begin(), r.end());
-		}
-	}	
-	return result;	
+	while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\t' || text[pos] == '\n' || text[pos] == '\r')) {
+		pos++;
+	}
 }
 
-size_t  ElementCollection::elements_count() const
+void JsonReader::expect(char c)
 {
-	size_t count = 1;
-	for (ElementList::const_iterator i = children.begin(); i != children.end(); i++) {
-		count += (*i)->elements_count();
+	if (peek() != c) {
+		error(String("expected '") + c + "'");
 	}
-	return count;
+	pos++;
 }
 
-bool ElementCollection::has_initial() const
+bool JsonReader::next_key(String& key)
 {
-	for (ElementList::const_iterator i = children.begin(); i != children.end(); i++) {
-		if ((*i)->get_type() == elementInitial) {
-			return true;
-		}
+	if (peek() == '}') {
+		pos++;
+		first = false;
+		return false;
 	}
-	return false;
+	if (!first) {
+		expect(',');
+	}
+	first = false;
+	key = string();
+	expect(':');
+	return true;
 }
 
-int ElementCollection::element_index(const Element* e) const
+bool JsonReader::next_item()
 {
-	CYB_ASSERT(e);
-	int index = 0;
-	for (ElementList::const_iterator i = children.begin(); i != children.end(); i++, index++) {
-		if (*i == e) {
-			return index;
-		}
+	if (peek() == ']') {
+		pos++;
+		first = false;
+		return false;
 	}
-	return -1;
+	if (!first) {
+		expect(',');
+	}
+	first = false;
+	return true;
 }
 
-void ElementCollection::add_element(Element* e)
+unsigned long JsonReader::hex4()
 {
-	CYB_ASSERT(e);
-	CYB_ASSERT(e->get_parent() == this);
-	if (e->get_type() == elementTransition) {
-		children.push_back(e);
-	} else {
-		ElementList::iterator i;
-		for (i = children.begin(); i != children.end(); i++) {
-			if ((*i)->get_type() == elementTransition) {
-				break;
-			}
+	unsigned long code = 0;
+	for (int i = 0; i < 4; i++, pos++) {
+		char c = pos < text.size() ? text[pos] : '\0';
+		code <<= 4;
+		if (c >= '0' && c <= '9') {
+			code |= c - '0';
+		} else if (c >= 'a' && c <= 'f') {
+			code |= c - 'a' + 10;
+		} else if (c >= 'A' && c <= 'F') {
+			code |= c - 'A' + 10;
+		} else {
+			error("bad unicode escape");
 		}
-		children.insert(i, e);
 	}
+	return code;
 }
 
-void ElementCollection::add_first_element(Element* e)
+void JsonReader::append_utf8(String& s, unsigned long code)
 {
-	CYB_ASSERT(e);
-	CYB_ASSERT(e->get_parent() == this);
-	children.insert(children.begin(), e);
+	if (code < 0x80) {
+		s += char(code);
+	} else if (code < 0x800) {
+		s += char(0xC0 | (code >> 6));
+		s += char(0x80 | (code & 0x3F));
+	} else if (code < 0x10000) {
+		s += char(0xE0 | (code >> 12));
+		s += char(0x80 | ((code >> 6) & 0x3F));
+		s += char(0x80 | (code & 0x3F));
+	} else {
+		s += char(0xF0 | (code >> 18));
+		s += char(0x80 | ((code >> 12) & 0x3F));
+		s += char(0x80 | ((code >> 6) & 0x3F));
+		s += char(0x80 | (code & 0x3F));
+	}
 }
 
-void ElementCollection::remove_element(const ID& _id)
+String JsonReader::string()
 {
-	for (ElementList::iterator i = children.begin(); i != children.end(); i++) {
-		if ((*i)->get_id() == _id) {
-			children.erase(i);
+	expect('"');
+	String s;
+	for (;;) {
+		// the plain characters are copied at once
+		size_t begin = pos;
+		while (pos < text.size() && text[pos] != '"' && text[pos] != '\\' && (unsigned char)text[pos] >= 0x20) {
+			pos++;
+		}
+		s.append(text, begin, pos - begin);
+		if (pos >= text.size()) {
+			error("unterminated string");
+		}
+		char c = text[pos++];
+		if (c == '"') {
+			return s;
+		} else if (c != '\\') {
+			pos--;
+			error("control character in string");
+		}
+		c = pos < text.size() ? text[pos++] : '\0';
+		switch (c) {
+		case '"':  s += '"'; break;
+		case '\\': s += '\\'; break;
+		case '/':  s += '/'; break;
+		case 'b':  s += '\b'; break;
+		case 'f':  s += '\f'; break;
+		case 'n':  s += '\n'; break;
+		case 'r':  s += '\r'; break;
+		case 't':  s += '\t'; break;
+		case 'u': {
+			unsigned long code = hex4();
+			if (code >= 0xD800 && code < 0xDC00) {
+				if (text.compare(pos, 2, "\\u") != 0) {
+					error("unpaired surrogate");
+				}
+				pos += 2;
+				unsigned long low = hex4();
+				if (low < 0xDC00 || low >= 0xE000) {
+					error("unpaired surrogate");
+				}
+				code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+			} else if (code >= 0xDC00 && code < 0xE000) {
+				error("unpaired surrogate");
+			} else if (code == 0) {
+				error("zero character in string");
+			}
+			append_utf8(s, code);
 			break;
 		}
+		default:
+			error("bad escape");
+		}
 	}
 }
 
-void ElementCollection::clear()
+float JsonReader::number()
 {
-	for (ElementList::iterator i = children.begin(); i != children.end(); i++) {
-		Element* e = *i;
-		delete e;
+	skip_spaces();
+	size_t begin = pos;
+	if (pos < text.size() && text[pos] == '-') {
+		pos++;
 	}
-	children.clear();
+	if (pos >= text.size() || text[pos] < '0' || text[pos] > '9') {
+		error("expected number");
+	}
+	while (pos < text.size() && ((text[pos] >= '0' && text[pos] <= '9') || text[pos] == '.' ||
+								 text[pos] == 'e' || text[pos] == 'E' || text[pos] == '+' || text[pos] == '-')) {
+		pos++;
+	}
+	if (pos - begin >= 64) {
+		error("number is too long");
+	}
+	char buffer[64];
+	memcpy(buffer, text.data() + begin, pos - begin);
+	buffer[pos - begin] = '\0';
+	if (decimal_point != '.') {
+		std::replace(buffer, buffer + (pos - begin), '.', decimal_point);
+	}
+	char* end = NULL;
+	double value = strtod(buffer, &end);
+	if (end != buffer + (pos - begin) || !std::isfinite(float(value))) {
+		error("bad number");
+	}
+	return float(value);
 }
 
-std::vector<const Vertex*> ElementCollection::get_vertexes() const
+bool JsonReader::boolean()
 {
-	ElementTypes types = { elementSimpleState,
-						   elementCompositeState,
-						   elementInitial,
-						   elementFinal,
-						   elementChoice,
-						   elementTerminate};
-	std::vector<const Vertex*> result;
-	ConstElementList vertexes = find_elements_by_types(types);
-	for (ConstElementList::const_iterator i = vertexes.begin(); i != vertexes.end(); i++) {
-		result.push_back(static_cast<const Vertex*>(*i));
+	skip_spaces();
+	if (text.compare(pos, 4, "true") == 0) {
+		pos += 4;
+		return true;
+	} else if (text.compare(pos, 5, "false") == 0) {
+		pos += 5;
+		return false;
 	}
-	return result;
+	error("expected boolean");
+	return false;
 }
 
-std::vector<Vertex*> ElementCollection::get_vertexes()
+void JsonReader::skip_value(size_t depth)
 {
-	ElementTypes types = { elementComment,
-						   elementFormalComment,
-						   elementSimpleState,
-						   elementCompositeState,
-						   elementInitial,
-						   elementFinal,
-						   elementChoice,
-						   elementTerminate};
-	std::vector<Vertex*> result;
-	ElementList vertexes = find_elements_by_types(types);
-	for (ElementList::const_iterator i =  vertexes.begin(); i != vertexes.end(); i++) {
-		result.push_back(static_cast<Vertex*>(*i));
+	if (depth > JSON_MAX_DEPTH) {
+		error("nesting is too deep");
+	}
+	String key;
+	switch (peek()) {
+	case '{':
+		begin_object();
+		while (next_key(key)) {
+			skip_value(depth + 1);
+		}
+		break;
+	case '[':
+		begin_array();
+		while (next_item()) {
+			skip_value(depth + 1);
+		}
+		break;
+	case '"':
+		string();
+		break;
+	case 't':
+	case 'f':
+		boolean();
+		break;
+	case 'n':
+		if (text.compare(pos, 4, "null") != 0) {
+			error("unexpected value");
+		}
+		pos += 4;
+		break;
+	default:
+		number();
 	}
-	return result;
 }
 
-const Element* ElementCollection::first_element() const
+void JsonReader::end()
 {
-	if (has_children()) {
-		const Element* element = *(children.begin());
-		return element;
-	} else {
-		return NULL;
+	if (peek() != '\0' || pos != text.size()) {
+		error("unexpected data after the document");
 	}
 }
 
-Element* ElementCollection::first_element()
+Point JsonReader::point()
 {
-	if (has_children()) {
-		Element* element = *(children.begin());
-		return element;
-	} else {
-		return NULL;
+	Point p(0, 0);
+	String key;
+	begin_object();
+	while (next_key(key)) {
+		if (key == "x") {
+			p.x = number();
+		} else if (key == "y") {
+			p.y = number();
+		} else {
+			skip_value();
+		}
 	}
+	return p;
 }
 
-const Element* ElementCollection::get_element(int index) const
+Rect JsonReader::rect()
+{
+	Rect r(0, 0, 0, 0);
+	String key;
+	begin_object();
+	while (next_key(key)) {
+		if (key == "x") {
+			r.x = number();
+		} else if (key == "y") {
+			r.y = number();
+		} else if (key == "width") {
+			r.width = number();
+		} else if (key == "height") {
+			r.height = number();
+		} else {
+			skip_value();
+		}
+	}
+	return r;
+}
+
+Polyline JsonReader::polyline()
 {
-	int idx = 0;
-	if (has_children()) {
-		for (ElementList::const_iterator i = children.begin(); i != children.end(); i++, idx++) {
-			if (idx == index) {
-				return *i;
-			}
+	Polyline pl;
+	begin_array();
+	while (next_item()) {
+		pl.push_back(point());
+	}
+	return pl;
+}
+
+Action JsonReader::action()
+{
+	String type = "transition", trigger, guard, behavior, key;
+	begin_object();
+	while (next_key(key)) {
+		if (key == "type") {
+			type = string();
+		} else if (key == "trigger") {
+			trigger = string();
+		} else if (key == "guard") {
+			guard = string();
+		} else if (key == "behavior") {
+			behavior = string();
+		} else {
+			skip_value();
 		}
 	}
-	return NULL;
+	if (type == "transition") {
+		return Action(trigger, guard, behavior);
+	} else if (type == "entry") {
+		return Action(actionEntry, behavior);
+	} else if (type == "exit") {
+		return Action(actionExit, behavior);
+	}
+	error("bad action type " + type);
+	return Action();
 }
 
-Element* ElementCollection::get_element(int index)
+static ElementType json_parse_element_type(const JsonReader& r, const String& type)
 {
-	int idx = 0;
-	if (has_children()) {
-		for (ElementList::iterator i = children.begin(); i != children.end(); i++, idx++) {
-			if (idx == index) {
-				return *i;
+	static const ElementType types[] = {elementSM, elementSimpleState, elementCompositeState, elementComment,
+										elementFormalComment, elementInitial, elementFinal, elementChoice,
+										elementTerminate, elementTransition};
+	for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+		if (type == json_element_type(types[i])) {
+			return types[i];
+		}
+	}
+	r.error("bad element type " + type);
+	return elementRoot;
+}
+
+struct JsonSubject {
+	JsonSubject(): type(commentSubjectElement), has_element(false), has_fragment(false) {}
+
+	ID                 id;
+	CommentSubjectType type;
+	bool               has_element;
+	ID                 element;
+	bool               has_fragment;
+	String             fragment;
+	Point              source_point;
+	Point              target_point;
+	Polyline           polyline;
+};
+
+// the state of the document being parsed: the subjects and the metainformation element refer
+// to the element IDs and are resolved after all the elements are built
+struct JsonLoad {
+	std::vector<StateMachine*>                               sms;
+	std::vector<Element*>                                    elements;
+	std::vector<std::pair<Comment*, std::vector<JsonSubject>>> subjects;
+};
+
+static JsonSubject json_parse_subject(JsonReader& r)
+{
+	JsonSubject s;
+	String key;
+	r.begin_object();
+	while (r.next_key(key)) {
+		if (key == "id") {
+			s.id = r.string();
+		} else if (key == "type") {
+			String type = r.string();
+			if (type == "element") {
+				s.type = commentSubjectElement;
+			} else if (type == "name") {
+				s.type = commentSubjectName;
+			} else if (type == "data") {
+				s.type = commentSubjectData;
+			} else {
+				r.error("bad comment subject type " + type);
 			}
+		} else if (key == "element") {
+			s.has_element = true;
+			s.element = r.string();
+		} else if (key == "fragment") {
+			s.has_fragment = true;
+			s.fragment = r.string();
+		} else if (key == "sourcePoint") {
+			s.source_point = r.point();
+		} else if (key == "targetPoint") {
+			s.target_point = r.point();
+		} else if (key == "polyline") {
+			s.polyline = r.polyline();
+		} else {
+			r.skip_value();
 		}
 	}
-	return NULL;	
+	if (s.has_fragment && s.type == commentSubjectElement) {
+		r.error("fragment of the element subject " + s.id);
+	}
+	return s;
 }
 
-CyberiadaNode* ElementCollection::to_node() const
+static void json_parse_element(JsonReader& r, ElementCollection* parent, JsonLoad& load, size_t depth);
+
+static void json_check_element(const JsonReader& r, ElementCollection* parent, const LoadedElement& le,
+							   bool children, const std::vector<JsonSubject>& subjects)
 {
-	CyberiadaNode* node = Element::to_node();
-	if (has_geometry()) {
-		node->geometry_rect = geometry_rect.c_rect();
+	if (le.type == elementSM) {
+		if (parent) {
+			r.error("nested state machine " + le.id);
+		}
+	} else if (!parent) {
+		r.error("element " + le.id + " outside the state machine");
+	} else if (le.type == elementTransition && parent->get_type() != elementSM) {
+		r.error("transition " + le.id + " outside the state machine");
 	}
-	if (has_color()) {
-		cyberiada_copy_string(&(node->color), &(node->color_len), color.c_str());
+	if (!subjects.empty() && le.type != elementComment && le.type != elementFormalComment) {
+		r.error("subjects of element " + le.id);
 	}
-	for (ElementList::const_iterator i = children.begin(); i != children.end(); i++) {
-		const Element* e = *i;
-		CYB_ASSERT(e);
-		if (e->get_type() == elementTransition) {
-			continue;
+	if (children && le.type != elementSM && le.type != elementSimpleState && le.type != elementCompositeState) {
+		r.error("children of element " + le.id);
+	}
+}
+
+// build the element when its children start or its object ends
+static Element* json_build_element(ElementCollection* parent, LoadedElement& le, bool human_readable_set,
+								   std::vector<JsonSubject>& subjects, JsonLoad& load)
+{
+	if (!human_readable_set) {
+		le.human_readable = le.type != elementFormalComment;
+	}
+	Element* e = new_loaded_element(parent, le);
+	if (le.type == elementSM) {
+		load.sms.push_back(static_cast<StateMachine*>(e));
+	}
+	load.elements.push_back(e);
+	if (!subjects.empty()) {
+		load.subjects.push_back(std::make_pair(static_cast<Comment*>(e), std::vector<JsonSubject>()));
+		load.subjects.back().second.swap(subjects);
+	}
+	return e;
+}
+
+// apply the keys that follow the children to the state machine or the state built before them
+static void json_update_element(Element* e, const LoadedElement& le, size_t built_actions)
+{
+	if (e->get_id() != le.id) {
+		e->set_id(le.id);
+	}
+	if (le.named && (!e->has_name() || e->get_name() != le.name)) {
+		e->set_name(le.name);
+	}
+	if (le.formal_named && (!e->has_formal_name() || e->get_formal_name() != le.formal_name)) {
+		e->set_formal_name(le.formal_name);
+	}
+	ElementCollection* ec = static_cast<ElementCollection*>(e);
+	if (le.rect != ec->get_geometry_rect()) {
+		ec->update_geometry(le.rect);
+	}
+	if (e->get_type() == elementSM) {
+		return;
+	}
+	State* s = static_cast<State*>(e);
+	if (le.color != s->get_color()) {
+		s->update_color(le.color);
+	}
+	if (le.region != s->get_region_geometry_rect()) {
+		s->update_region_geometry_rect(le.region);
+	}
+	if (le.collapsed != s->is_collapsed()) {
+		s->set_collapsed(le.collapsed);
+	}
+	for (size_t i = built_actions; i < le.actions.size(); i++) {
+		s->add_action(le.actions[i]);
+	}
+}
+
+// The parser is single-pass: the element is built from the keys seen so far when its children
+// start (the type is implied by the parent if it is not known yet) and the keys that follow the
+// children are applied to the built element and checked when the object ends.
+static void json_parse_element(JsonReader& r, ElementCollection* parent, JsonLoad& load, size_t depth)
+{
+	if (depth > JSON_MAX_DEPTH) {
+		r.error("nesting is too deep");
+	}
+	LoadedElement le(elementRoot);
+	bool typed = false, human_readable_set = false, late_keys = false;
+	size_t built_actions = 0;
+	std::vector<JsonSubject> subjects;
+	Element* e = NULL;
+	String key;
+	r.begin_object();
+	while (r.next_key(key)) {
+		if (e) {
+			late_keys = true;
 		}
-		CyberiadaNode* child = e->to_node();
-		CYB_ASSERT(child);
-		child->parent = node;
-		if (node->children) {
-			CyberiadaNode* n = node->children;
-			while (n->next) n = n->next;
-			n->next = child;
+		if (key == "type") {
+			le.type = json_parse_element_type(r, r.string());
+			typed = true;
+		} else if (key == "id") {
+			le.id = r.string();
+		} else if (key == "name") {
+			le.named = true;
+			le.name = r.string();
+		} else if (key == "formalName") {
+			le.formal_named = true;
+			le.formal_name = r.string();
+		} else if (key == "color") {
+			le.color = r.string();
+		} else if (key == "rect") {
+			le.rect = r.rect();
+		} else if (key == "region") {
+			le.region = r.rect();
+		} else if (key == "point") {
+			le.point = r.point();
+		} else if (key == "collapsed") {
+			le.collapsed = r.boolean();
+		} else if (key == "actions") {
+			r.begin_array();
+			while (r.next_item()) {
+				le.actions.push_back(r.action());
+			}
+		} else if (key == "body") {
+			le.body = r.string();
+		} else if (key == "markup") {
+			le.markup = r.string();
+		} else if (key == "humanReadable") {
+			le.human_readable = r.boolean();
+			human_readable_set = true;
+		} else if (key == "subjects") {
+			r.begin_array();
+			while (r.next_item()) {
+				subjects.push_back(json_parse_subject(r));
+			}
+		} else if (key == "local") {
+			le.local = r.boolean();
+		} else if (key == "source") {
+			le.source = r.string();
+		} else if (key == "target") {
+			le.target = r.string();
+		} else if (key == "action") {
+			le.actions.assign(1, r.action());
+		} else if (key == "sourcePoint") {
+			le.source_point = r.point();
+		} else if (key == "targetPoint") {
+			le.target_point = r.point();
+		} else if (key == "labelPoint") {
+			le.label_point = r.point();
+		} else if (key == "labelRect") {
+			le.label_rect = r.rect();
+		} else if (key == "polyline") {
+			le.polyline = r.polyline();
+		} else if (key == "children") {
+			if (e) {
+				r.error("duplicated children of element " + le.id);
+			}
+			if (typed) {
+				json_check_element(r, parent, le, true, subjects);
+			} else {
+				le.type = parent ? elementCompositeState : elementSM;
+			}
+			e = json_build_element(parent, le, human_readable_set, subjects, load);
+			built_actions = le.actions.size();
+			r.begin_array();
+			while (r.next_item()) {
+				json_parse_element(r, static_cast<ElementCollection*>(e), load, depth + 1);
+			}
 		} else {
-			node->children = child;
+			r.skip_value();
 		}
 	}
-	return node;
+	if (!typed) {
+		r.error("element without type");
+	}
+	if (!e) {
+		json_check_element(r, parent, le, false, subjects);
+		json_build_element(parent, le, human_readable_set, subjects, load);
+	} else if (late_keys) {
+		json_check_element(r, parent, le, true, subjects);
+		json_update_element(e, le, built_actions);
+	}
 }
 
-ConstElementList ElementCollection::get_children() const
+void Document::encode_json(String& buffer) const
 {
-	ConstElementList result;
+	if (skipped_sms) {
+		throw ParametersException("The document with skipped state machines cannot be encoded to JSON");
+	}
+	load_state_machines();
+
+	buffer.clear();
+	JsonWriter w(buffer);
+	w.begin_object();
+	w.field("format", JSON_FORMAT);
+	w.field("version", JSON_VERSION);
+	if (has_name()) {
+		w.field("name", get_name());
+	}
+	w.field("geometryFormat", json_geometry_format(geometry_format));
+	w.point("centerPoint", center_point);
+
+	w.key("meta");
+	w.begin_object();
+	w.field("standardVersion", metainfo.standard_version);
+	w.field("transitionOrder", metainfo.transition_order_flag);
+	w.field("eventPropagation", metainfo.event_propagation_flag);
+	w.key("strings");
+	w.begin_array();
+	for (std::vector<std::pair<String, String>>::const_iterator i = metainfo.strings.begin();
+		 i != metainfo.strings.end(); i++) {
+		w.begin_object();
+		w.field("name", i->first);
+		w.field("value", i->second);
+		w.end_object();
+	}
+	w.end_array();
+	if (metainfo_element) {
+		w.field("element", metainfo_element->get_id());
+	}
+	w.end_object();
+
+	w.key("stateMachines");
+	w.begin_array();
 	for (ElementList::const_iterator i = children.begin(); i != children.end(); i++) {
-		result.push_back(static_cast<const Element*>(*i));
+		json_write_element(w, *i);
 	}
-	return result;
+	w.end_array();
+	w.end_object();
 }
 
-Rect ElementCollection::get_bound_rect(const Document& d) const
+void Document::decode_json(const String& buffer)
 {
-	Rect r, parent;
-	if (has_geometry()) {
-		parent = geometry_rect;
-		r.expand(geometry_rect, d);
-	}
-	if (has_children()) {
-		for (ElementList::const_iterator i = children.begin(); i != children.end(); i++) {
-			CYB_ASSERT(*i);
-			Rect ch_r = (*i)->get_bound_rect(d);
-			if ((*i)->get_type() == elementTransition) {
-				continue;
-				const Transition* t = static_cast<const Transition*>(*i);
-				const Element* source = d.find_element_by_id(t->source_element_id());
-				const Element* target = d.find_element_by_id(t->target_element_id());
-				if (!source || !source->has_geometry() || !target || !target->has_geometry()) {
-					continue;
+	JsonReader r(buffer);
+	JsonLoad load;
+	DocumentGeometryFormat format = geometryFormatNone;
+	Point center;
+	bool has_meta_element = false;
+	ID meta_element;
+	Comment* meta_comment = NULL;
+
+	reset();
+	try {
+		String key;
+		r.begin_object();
+		while (r.next_key(key)) {
+			if (key == "format") {
+				if (r.string() != JSON_FORMAT) {
+					r.error("unknown format");
 				}
-				Rect source_rect = source->get_bound_rect(d);
-				if (d.get_geometry_format() == geometryFormatCyberiada10 ||
-					d.get_geometry_format() == geometryFormatQt) {
-					ch_r.x += source_rect.x;
-					ch_r.y += source_rect.y;
+			} else if (key == "version") {
+				float version = r.number();
+				if (version != float(JSON_VERSION)) {
+					throw FormatException("Unsupported JSON version " + std::to_string(version));
+				}
+			} else if (key == "name") {
+				Element::set_name(r.string());
+			} else if (key == "geometryFormat") {
+				String f = r.string();
+				if (f == "none") {
+					format = geometryFormatNone;
+				} else if (f == "yed") {
+					format = geometryFormatLegacyYED;
+				} else if (f == "cyberiada") {
+					format = geometryFormatCyberiada10;
+				} else if (f == "qt") {
+					format = geometryFormatQt;
+				} else {
+					r.error("bad geometry format " + f);
+				}
+			} else if (key == "centerPoint") {
+				center = r.point();
+			} else if (key == "meta") {
+				String meta_key;
+				r.begin_object();
+				while (r.next_key(meta_key)) {
+					if (meta_key == "standardVersion") {
+						metainfo.standard_version = r.string();
+					} else if (meta_key == "transitionOrder") {
+						metainfo.transition_order_flag = r.boolean();
+					} else if (meta_key == "eventPropagation") {
+						metainfo.event_propagation_flag = r.boolean();
+					} else if (meta_key == "strings") {
+						metainfo.strings.clear();
+						r.begin_array();
+						while (r.next_item()) {
+							String name, value, string_key;
+							r.begin_object();
+							while (r.next_key(string_key)) {
+								if (string_key == "name") {
+									name = r.string();
+								} else if (string_key == "value") {
+									value = r.string();
+								} else {
+									r.skip_value();
+								}
+							}
+							metainfo.strings.push_back(std::make_pair(name, value));
+						}
+					} else if (meta_key == "element") {
+						has_meta_element = true;
+						meta_element = r.string();
+					} else {
+						r.skip_value();
+					}
+				}
+			} else if (key == "stateMachines") {
+				r.begin_array();
+				while (r.next_item()) {
+					json_parse_element(r, NULL, load, 0);
 				}
 			} else {
-				if (d.get_geometry_format() == geometryFormatCyberiada10 ||
-					d.get_geometry_format() == geometryFormatQt) {
-					ch_r.x += parent.x;
-					ch_r.y += parent.y;
+				r.skip_value();
+			}
+		}
+		r.end();
+
+		// the duplicated IDs are resolved to the first element in the tree order
+		std::unordered_map<ID, Element*> ids;
+		ids.reserve(load.elements.size());
+		for (std::vector<Element*>::const_iterator i = load.elements.begin(); i != load.elements.end(); i++) {
+			ids.insert(std::make_pair((*i)->get_id(), *i));
+		}
+		for (size_t i = 0; i < load.subjects.size(); i++) {
+			Comment* comment = load.subjects[i].first;
+			const std::vector<JsonSubject>& subjects = load.subjects[i].second;
+			for (std::vector<JsonSubject>::const_iterator s = subjects.begin(); s != subjects.end(); s++) {
+				Element* target = NULL;
+				if (s->has_element) {
+					std::unordered_map<ID, Element*>::const_iterator t = ids.find(s->element);
+					if (t == ids.end()) {
+						throw FormatException("Bad JSON: unknown subject " + s->element + " of comment " + comment->get_id());
+					}
+					target = t->second;
+				}
+				if (s->has_fragment) {
+					comment->add_subject(CommentSubject(s->id, target, s->type, s->fragment,
+														s->source_point, s->target_point, s->polyline));
+				} else {
+					comment->add_subject(CommentSubject(s->id, target, s->source_point, s->target_point, s->polyline));
 				}
 			}
-			r.expand(ch_r, d);
 		}
+		if (has_meta_element) {
+			std::unordered_map<ID, Element*>::const_iterator m = ids.find(meta_element);
+			if (m == ids.end() || m->second->get_type() != elementFormalComment) {
+				throw FormatException("Bad JSON: metainformation element " + meta_element);
+			}
+			meta_comment = static_cast<Comment*>(m->second);
+		}
+	} catch (const Exception&) {
+		for (std::vector<StateMachine*>::iterator i = load.sms.begin(); i != load.sms.end(); i++) {
+			delete *i;
+		}
+		reset();
+		throw;
 	}
-	//std::cerr << "element " << get_id() << " " << get_name() << " } rect " << r << std::endl;
-	return r;
+
+	id_index.reserve(load.elements.size());
+	indexed_elements.reserve(load.elements.size());
+	for (std::vector<StateMachine*>::iterator i = load.sms.begin(); i != load.sms.end(); i++) {
+		(*i)->update_parent(this);
+		add_element(*i);
+	}
+	metainfo_element = meta_comment;
+	geometry_format = format;
+	center_point = center;
 }
 
-void ElementCollection::clean_geometry()
+// -----------------------------------------------------------------------------
+// Dump buffer
+// -----------------------------------------------------------------------------
+
+// The text dump is appended to the growing string without the stream insertions; the numbers
+// are formatted as the default std::ostream does (%g) with the dot as the decimal point.
+// The dump to a stream with the other precision, flags or locale formats the numbers by
+// the stream rules as the element dump stream does. The elements are printed by the virtual
+// Element::dump() to the element dump stream that appends to the same buffer, so the dump()
+// overrides of the derived classes are called for the nested elements as well.
+class Cyberiada::DumpBuffer {
+public:
+	DumpBuffer(): format(NULL), decimal_point(c_decimal_point()) {}
+	DumpBuffer(const std::ostream& os): format(default_format(os) ? NULL : &os),
+										decimal_point(c_decimal_point()) {}
+
+	DumpBuffer&   operator<<(const char* s) { text.append(s); return *this; }
+	DumpBuffer&   operator<<(const String& s) { text.append(s); return *this; }
+	DumpBuffer&   operator<<(float f);
+	DumpBuffer&   operator<<(const Point& p);
+	DumpBuffer&   operator<<(const Rect& r);
+	DumpBuffer&   operator<<(const Polyline& pl);
+	DumpBuffer&   operator<<(const Action& a) { a.print(*this); return *this; }
+	DumpBuffer&   operator<<(const CommentSubject& cs) { cs.print(*this); return *this; }
+	DumpBuffer&   operator<<(const Element& e) { e.dump(stream()); return *this; }
+
+	void          write(std::ostream& os) const { os.write(text.data(), text.size()); os.width(0); }
+	String        release() { String result; result.swap(text); return result; }
+
+	// the buffer of the element dump stream or NULL for the other streams
+	static DumpBuffer* attached(std::ostream& os);
+
+private:
+	class StreamBuf: public std::streambuf {
+	public:
+		StreamBuf(DumpBuffer& _owner): owner(_owner) {}
+		DumpBuffer&       owner;
+	protected:
+		int_type          overflow(int_type c) override;
+		std::streamsize   xsputn(const char* s, std::streamsize n) override;
+	};
+	struct Stream {
+		Stream(DumpBuffer& owner): buf(owner), os(&buf) {}
+		StreamBuf         buf;
+		std::ostream      os;
+	};
+
+	static bool   default_format(const std::ostream& os);
+	std::ostream& stream();
+
+	String                  text;
+	const std::ostream*     format;
+	char                    decimal_point;
+	std::unique_ptr<Stream> element_stream;
+};
+
+DumpBuffer::StreamBuf::int_type DumpBuffer::StreamBuf::overflow(int_type c)
 {
-	geometry_rect = Rect();
-	if (has_children()) {
-		for (ElementList::iterator i = children.begin(); i != children.end(); i++) {
-			(*i)->clean_geometry();
-		}
+	if (!traits_type::eq_int_type(c, traits_type::eof())) {
+		owner.text.push_back(traits_type::to_char_type(c));
 	}
-	CYB_ASSERT(!has_geometry());
+	return traits_type::not_eof(c);
 }
 
-void ElementCollection::round_geometry()
+std::streamsize DumpBuffer::StreamBuf::xsputn(const char* s, std::streamsize n)
 {
-	if (has_geometry()) {
-		geometry_rect.round();
-	};
-	if (has_children()) {
-		for (ElementList::iterator i = children.begin(); i != children.end(); i++) {
-			(*i)->round_geometry();
-		}
-	}
+	owner.text.append(s, size_t(n));
+	return n;
 }
 
-void ElementCollection::copy_elements(const ElementCollection& source)
+bool DumpBuffer::default_format(const std::ostream& os)
 {
-	CYB_ASSERT(children.empty());
-	for (ElementList::const_iterator i = source.children.begin(); i != source.children.end(); i++) {
-		const Element* e = *i;
-		Element* new_e = e->copy(this);
-		children.push_back(new_e);
+	const std::ios_base::fmtflags number_flags = std::ios_base::floatfield | std::ios_base::showpoint |
+		std::ios_base::showpos | std::ios_base::uppercase;
+	if ((os.flags() & number_flags) || os.precision() != 6) {
+		return false;
 	}
+	const std::numpunct<char>& punct = std::use_facet<std::numpunct<char> >(os.getloc());
+	return punct.decimal_point() == '.' && punct.grouping().empty();
 }
 
-void ElementCollection::import_nodes_recursively(CyberiadaNode* nodes, Element** metainfo_element)
+DumpBuffer* DumpBuffer::attached(std::ostream& os)
 {
-	ElementType t = get_type();
-
-	for (CyberiadaNode* n = nodes; n; n = n->next) {
-		Element* element = NULL;
-		State* state = NULL;
-
-		CYB_ASSERT(n->id);
+	StreamBuf* buf = dynamic_cast<StreamBuf*>(os.rdbuf());
+	return buf ? &buf->owner : NULL;
+}
 
-		Point  point;
-		Rect   rect;
-		Color  _color;
-		String comment_body;
-		String comment_markup;
-
-		if (n->geometry_rect) {
-			rect = Rect(n->geometry_rect);
-		}
-		if (n->geometry_point) {
-			point = Point(n->geometry_point);
-		}
-		if (n->color) {
-			_color = Color(n->color);
+std::ostream& DumpBuffer::stream()
+{
+	if (!element_stream) {
+		element_stream.reset(new Stream(*this));
+		if (format) {
+			element_stream->os.copyfmt(*format);
+			element_stream->os.width(0);
 		}
-		
-		switch (n->type) {
-		case cybNodeRegion:
-			if (t != elementSimpleState &&
-				t != elementCompositeState) {
-					
-				throw CybMLException("Children region node " + std::string(n->id) +
-									 " inside element with type " +
-									 std::to_string(t));
-			}
-			if (n->next) {
-				throw CybMLException("More than one region node for node " + get_id() + " are not supported");
-			}
-			// no new element actually			
-			break;
-			
-		case cybNodeSimpleState:
-		case cybNodeCompositeState:
-			if (!n->title) {
-				throw CybMLException("State element w/o title");
-			}
-			state = new State(this, n->id, n->title, rect, Rect(), _color);
-			CYB_ASSERT(state);
-
-			if (n->collapsed_flag) {
-				state->set_collapsed(true);
-			}
-			
-			for (CyberiadaAction* a = n->actions; a; a = a->next) {
-				if (a->type == cybActionTransition) {
-					state->add_action(Action(a->trigger, a->guard, a->behavior));
-				} else {
-					ActionType at;
-					if (a->type == cybActionEntry) {
-						at = actionEntry;
-					} else if (a->type == cybActionExit) {
-						at = actionExit;
-					} else {
-						throw CybMLException("Unsupported action type " + std::to_string(a->type));
-					}
-					if (a->guard && *(a->guard)) {
-						// guard is not empty
-						throw CybMLException("Guards are not allowed in entry/exit actions");
-					}
-					state->add_action(Action(at, a->behavior));
-				}
-			}
-			
-			element = state;
-			
-			break;
-
-		case cybNodeComment:
-		case cybNodeFormalComment:
-			if (!n->comment_data) {
-				throw CybMLException("No comment data in Comment element");
-			}
-	
-			if (n->comment_data->body) { 
-				comment_body = n->comment_data->body;
-			}
-			if (n->comment_data->markup) {
-				comment_markup = n->comment_data->markup;
-			}
-
-			if (n->title) {
-				Comment* comment = new Comment(this, n->id, comment_body, n->title,
-											   n->type == cybNodeComment, comment_markup, rect, _color);
-				element = comment;
-				if (metainfo_element && n->type == cybNodeFormalComment && String(n->title) == META_NODE_NAME) {
-					CYB_ASSERT(!*metainfo_element);
-					*metainfo_element = comment;
-				}
-			} else {
-				element = new Comment(this, n->id, comment_body, n->type == cybNodeComment,
-									  comment_markup, rect, _color);
-			}
-			break;
-
-		case cybNodeChoice:
-			if (n->title) {
-				element = new ChoicePseudostate(this, n->id, n->title, rect, _color);
-			} else {
-				element = new ChoicePseudostate(this, n->id, rect, _color);
-			}
-			break;
-			
-		case cybNodeInitial:
-			if (n->title) {
-				element = new InitialPseudostate(this, n->id, n->title, point);
-			} else {
-				element = new InitialPseudostate(this, n->id, point);
-			}
-
-			break;
-
-		case cybNodeTerminate:
-			if (n->title) {
-				element = new TerminatePseudostate(this, n->id, n->title, point);
-			} else {
-				element = new TerminatePseudostate(this, n->id, point);
-			}
-
-			break;
-			
-		case cybNodeFinal:
-			if (n->title) {
-				element = new FinalState(this, n->id, n->title, point);
-			} else {
-				element = new FinalState(this, n->id, point);
-			}
+	}
+	return element_stream->os;
+}
 
-			break;
-	
-		default:
-			throw CybMLException("Unsupported node type " + std::to_string(n->type));
+DumpBuffer& DumpBuffer::operator<<(float f)
+{
+	if (format) {
+		stream() << f;
+		return *this;
+	}
+	// the integral coordinates below 10^6 are printed by %g without the exponent
+	if (f > -1e6f && f < 1e6f && f == float(int(f)) && !(f == 0 && std::signbit(f))) {
+		char digits[16];
+		char* p = digits + sizeof(digits);
+		int n = int(f);
+		unsigned int u = n < 0 ? 0u - unsigned(n) : unsigned(n);
+		do {
+			*--p = char('0' + u % 10);
+			u /= 10;
+		} while (u);
+		if (n < 0) {
+			*--p = '-';
 		}
+		text.append(p, digits + sizeof(digits) - p);
+		return *this;
+	}
+	char buffer[32];
+	int n = snprintf(buffer, sizeof(buffer), "%g", double(f));
+	if (decimal_point != '.') {
+		std::replace(buffer, buffer + n, decimal_point, '.');
+	}
+	text.append(buffer, n);
+	return *this;
+}
 
-		if (element != NULL) {
-			if (n->formal_title) {
-				element->set_formal_name(n->formal_title);
-			}
-			
-			add_element(element);
-			
-			if (n->children) {
-				t = get_type();
-				if (t != elementSM &&
-					t != elementSimpleState &&
-					t != elementCompositeState) {
-					
-					throw CybMLException("Children nodes inside element with type " + std::to_string(t));
-				}
-			
-				static_cast<ElementCollection*>(element)->import_nodes_recursively(n->children, metainfo_element);
-			}
-		} else {
-			// region node
-			if (rect.valid) {
-				(static_cast<State*>(this))->update_region_geometry_rect(rect);
-			}
-
-			if (n->children) {
-				import_nodes_recursively(n->children, metainfo_element);
-			}
-		}
+DumpBuffer& DumpBuffer::operator<<(const Point& p)
+{
+	if (!p.valid) {
+		text.append("()");
+	} else {
+		*this << "(" << p.x << "; " << p.y << ")";
 	}
+	return *this;
 }
 
-std::ostream& ElementCollection::dump(std::ostream& os) const
+DumpBuffer& DumpBuffer::operator<<(const Rect& r)
 {
-	if (has_geometry() && geometry_rect.valid) {
-		os << ", geometry: " << geometry_rect;
-		if (has_color()) {
-			os << ", color: " << color;
-		}
+	if (!r.valid) {
+		text.append("()");
+	} else {
+		*this << "(" << r.x << "; " << r.y << "; " << r.width << "; " << r.height << ")";
 	}
-	if (has_children()) {
-		os << ", elements: {";
-		for (ElementList::const_iterator i = children.begin(); i != children.end(); i++) {
-			const Element* e = *i;
-			CYB_ASSERT(e);
-			os << *e;
-			if (std::next(i) != children.end()) {
-				os << ", ";
-			}
+	return *this;
+}
+
+DumpBuffer& DumpBuffer::operator<<(const Polyline& pl)
+{
+	text.append("[ ");
+	for (Polyline::const_iterator i = pl.begin(); i != pl.end(); i++) {
+		*this << *i;
+		if (std::next(i) != pl.end()) {
+			text.append(", ");
 		}
-		os << "}";
 	}
-	return os;
+	text.append(" ]");
+	return *this;
 }
 
 // -----------------------------------------------------------------------------
-// Pseudostate
+// Status
 // -----------------------------------------------------------------------------
 
-Pseudostate::Pseudostate(Element* _parent, ElementType _type, const ID& _id, const Point& p):
-	Vertex(_parent, _type, _id, p)
+// the unknown codes are not errors to match the former exception checks
+static StatusCode cyberiada_status_code(int res)
 {
+	switch (res) {
+	case CYBERIADA_XML_ERROR: return statusXMLError;
+	case CYBERIADA_FORMAT_ERROR: return statusFormatError;
+	case CYBERIADA_ACTION_FORMAT_ERROR: return statusActionError;
+	case CYBERIADA_METADATA_FORMAT_ERROR: return statusMetainformationError;
+	case CYBERIADA_NOT_FOUND: return statusNotFound;
+	case CYBERIADA_BAD_PARAMETER: return statusParametersError;
+	case CYBERIADA_ASSERT: return statusAssert;
+	case CYBERIADA_NOT_IMPLEMENTED: return statusNotImplemented;
+	default:
+		return statusOK;
+	}
+}
+
+// the derived exception classes are checked before their bases
+static Status exception_status(const Exception& e)
+{
+	StatusCode code = statusError;
+	if (dynamic_cast<const XMLException*>(&e)) {
+		code = statusXMLError;
+	} else if (dynamic_cast<const ActionException*>(&e)) {
+		code = statusActionError;
+	} else if (dynamic_cast<const MetainformationException*>(&e)) {
+		code = statusMetainformationError;
+	} else if (dynamic_cast<const FormatException*>(&e)) {
+		code = statusFormatError;
+	} else if (dynamic_cast<const NotFoundException*>(&e)) {
+		code = statusNotFound;
+	} else if (dynamic_cast<const ParametersException*>(&e)) {
+		code = statusParametersError;
+	} else if (dynamic_cast<const AssertException*>(&e)) {
+		code = statusAssert;
+	} else if (dynamic_cast<const NotImplementedException*>(&e)) {
+		code = statusNotImplemented;
+	} else if (dynamic_cast<const FileException*>(&e)) {
+		code = statusFileError;
+	}
+	return Status(code, e.str());
+}
+
+void Cyberiada::throw_status(const Status& s)
+{
+	switch (s.code) {
+	case statusOK: return;
+	case statusXMLError: throw XMLException(s.message);
+	case statusFormatError: throw CybMLException(s.message);
+	case statusActionError: throw ActionException(s.message);
+	case statusMetainformationError: throw MetainformationException(s.message);
+	case statusNotFound: throw NotFoundException(s.message);
+	case statusParametersError: throw ParametersException(s.message);
+	case statusAssert: throw AssertException(s.message);
+	case statusNotImplemented: throw NotImplementedException(s.message);
+	case statusFileError: throw FileException(s.message);
+	default:
+		throw Exception(s.message);
+	}
 }
 
-Pseudostate::Pseudostate(Element* _parent, ElementType _type, const ID& _id, const Name& _name, const Point& p):
-	Vertex(_parent, _type, _id, _name, p)
+// -----------------------------------------------------------------------------
+// Element
+// -----------------------------------------------------------------------------	
+
+Element::Element(Element* _parent, ElementType _type, const ID& _id):
+	type(_type), id(_id), name_is_set(false), formal_name_is_set(false), parent(_parent), revision(0),
+	content_exposed(false), content_hash_cache(0), content_hash_revision(0)
 {
 }
 
-// -----------------------------------------------------------------------------
-// Initial pseudostate
-// -----------------------------------------------------------------------------
-
-InitialPseudostate::InitialPseudostate(Element* _parent, const ID& _id, const Point& p):
-	Pseudostate(_parent, elementInitial, _id, p)
+Element::Element(Element* _parent, ElementType _type, const ID& _id, const Name& _name):
+	type(_type), id(_id), formal_name_is_set(false), parent(_parent), revision(0),
+	content_exposed(false), content_hash_cache(0), content_hash_revision(0)
 {
+	set_name(_name);
 }
 
-InitialPseudostate::InitialPseudostate(Element* _parent, const ID& _id, const Name& _name, const Point& p):
-	Pseudostate(_parent, elementInitial, _id, _name, p)
+Element::Element(const Element& e):
+	type(e.type), id(e.id), name(e.name), name_is_set(e.name_is_set),
+	formal_name(e.formal_name), formal_name_is_set(e.formal_name_is_set), parent(e.parent), revision(0),
+	content_exposed(false), content_hash_cache(0), content_hash_revision(0)
 {
 }
 
-Element* InitialPseudostate::copy(Element* parent) const
+int Element::index() const
 {
-	if (has_name()) {
-		return new InitialPseudostate(parent, get_id(), get_name(), get_geometry_point());
+	if (parent) {
+		const ElementCollection* collection = static_cast<const ElementCollection*>(parent);
+		CYB_ASSERT(collection);
+		return collection->element_index(this);
 	} else {
-		return new InitialPseudostate(parent, get_id(), get_geometry_point());
+		return 0;
 	}
 }
 
-// -----------------------------------------------------------------------------
-// Terminate pseudostate
-// -----------------------------------------------------------------------------
-
-TerminatePseudostate::TerminatePseudostate(Element* _parent, const ID& _id, const Point& p):
-	Pseudostate(_parent, elementTerminate, _id, p)
+void Element::set_name(const Name& n)
 {
+	name = n;
+	name_is_set = true;
+	modified();
 }
 
-TerminatePseudostate::TerminatePseudostate(Element* _parent, const ID& _id, const Name& _name, const Point& p):
-	Pseudostate(_parent, elementTerminate, _id, _name, p)
+void Element::set_formal_name(const Name& n)
 {
+	formal_name = n;
+	formal_name_is_set = true;
+	if (!has_name()) {
+		set_name(formal_name);
+	}
+	modified();
 }
 
-Element* TerminatePseudostate::copy(Element* parent) const
+void Element::set_id(const ID& _id)
 {
-	if (has_name()) {
-		return new TerminatePseudostate(parent, get_id(), get_name(), get_geometry_point());
-	} else {
-		return new TerminatePseudostate(parent, get_id(), get_geometry_point());
+	ID old_id = id;
+	id = _id;
+	if (parent) {
+		find_root()->index_id_changed(this, old_id);
 	}
+	modified();
 }
 
-// -----------------------------------------------------------------------------
-// Choice pseudostate
-// -----------------------------------------------------------------------------
-
-ChoicePseudostate::ChoicePseudostate(Element* _parent, const ID& _id, const Rect& r, const Color& _color):
-	Pseudostate(_parent, elementChoice, _id), geometry_rect(r), color(_color)
+void Element::modified()
 {
+	for (Element* e = this; e; e = e->parent) {
+		e->revision++;
+	}
 }
 
-ChoicePseudostate::ChoicePseudostate(Element* _parent, const ID& _id, const Name& _name, const Rect& r, const Color& _color):
-	Pseudostate(_parent, elementChoice, _id, _name), geometry_rect(r), color(_color)
+void Element::exposed()
 {
+	// the caches of the ancestors are invalidated here, the new ones are not stored
+	content_exposed = true;
+	modified();
 }
 
-ChoicePseudostate::ChoicePseudostate(const ChoicePseudostate& cp):
-	Pseudostate(cp), geometry_rect(cp.geometry_rect), color(cp.color)
+void Element::elements_attached(Element* e)
 {
+	find_root()->index_elements(e, true);
 }
 
-CyberiadaNode* ChoicePseudostate::to_node() const
+void Element::elements_detached(Element* e)
 {
-	CyberiadaNode* node = Element::to_node();
-	if (has_geometry()) {
-		node->geometry_rect = geometry_rect.c_rect();
-		if (has_color()) {
-			cyberiada_copy_string(&(node->color), &(node->color_len), color.c_str());
+	find_root()->index_elements(e, false);
+}
+
+ContentHash Element::content_hash() const
+{
+	bool cacheable = true;
+	return content_hash(cacheable);
+}
+
+ContentHash Element::content_hash(bool& cacheable) const
+{
+	// the concurrent readers compute the same value for the same revision,
+	// so the cache is published after the hash and checked before it
+	if (content_hash_revision.load() != revision + 1) {
+		bool own_cacheable = !content_exposed;
+		ContentHash h = children_content_hash(own_content_hash(), own_cacheable);
+		if (own_cacheable) {
+			content_hash_cache.store(h);
+			content_hash_revision.store(revision + 1);
+		} else {
+			cacheable = false;
 		}
+		return h;
 	}
-	return node;
+	return content_hash_cache.load();
 }
 
-Rect ChoicePseudostate::get_bound_rect(const Document&) const
+ContentHash Element::own_content_hash() const
 {
-	Rect r;
-	if (has_geometry()) {
-		r = geometry_rect;
-	}
-	return r;
+	ContentHash h = hash_mix(0, type);
+	h = hash_mix(h, hash_string(id));
+	h = hash_mix(h, name_is_set);
+	h = hash_mix(h, hash_string(name));
+	h = hash_mix(h, formal_name_is_set);
+	return hash_mix(h, hash_string(formal_name));
 }
 
-void ChoicePseudostate::clean_geometry()
+void Element::add_memory_usage(MemoryUsage& usage) const
 {
-	geometry_rect = Rect();
-	CYB_ASSERT(!has_geometry());
+	usage.objects += element_object_size(this);
+	usage.strings += string_heap_bytes(id) + string_heap_bytes(name) + string_heap_bytes(formal_name);
 }
 
-void ChoicePseudostate::round_geometry()
+void Element::content_diff(const Element& e, std::vector<ID>& ids) const
 {
-	if (has_geometry()) {
-		geometry_rect.round();
+	if (content_hash() != e.content_hash()) {
+		ids.push_back(get_id());
 	}
 }
 
-Element* ChoicePseudostate::copy(Element* parent) const
+bool Element::has_qualified_name() const
 {
-	if (has_name()) {
-		return new ChoicePseudostate(parent, get_id(), get_name(), get_geometry_rect(), color);
+	return is_root() || name_is_set || parent->has_qualified_name();
+}
+
+QualifiedName Element::qualified_name() const
+{
+	CYB_COUNT_SCOPE(countQualifiedName);
+	CYB_COUNT_VISIT(countQualifiedName);
+	if (is_root() || parent->is_root() || parent->parent->is_root()) {
+		return name;
 	} else {
-		return new ChoicePseudostate(parent, get_id(), get_geometry_rect(), color);
+		return parent->qualified_name() + QUALIFIED_NAME_SEPARATOR + name;
 	}
 }
 
-std::ostream& ChoicePseudostate::dump(std::ostream& os) const
+QualifiedName Element::full_qualified_name() const
 {
-	Element::dump(os);
-	if (has_geometry()) {
-		os << ", geometry: " << geometry_rect;
-		if (has_color()) {
-			os << ", color: " << color;
+	if (is_root()) {
+		return name;
+	} else {
+		if (parent->is_root()) {
+			return name;
+		} else {
+			return parent->full_qualified_name() + QUALIFIED_NAME_SEPARATOR + name;
 		}
-	}		
-	os << "}";
-	return os;
+	}
 }
 
-// -----------------------------------------------------------------------------
-// Final state
-// -----------------------------------------------------------------------------
+Element* Element::find_root()
+{
+	if (!parent) {
+		return this;
+	} else {
+		return parent->find_root();
+	}
+}
 
-FinalState::FinalState(Element* _parent, const ID& _id, const Point& p):
-	Vertex(_parent, elementFinal, _id, p)
+CyberiadaNode* Element::to_node() const
 {
+	CYB_COUNT_SCOPE(countToNode);
+	CYB_COUNT_VISIT(countToNode);
+	CyberiadaNode* node = cyberiada_new_node(get_id().c_str());
+	switch (type) {
+	case elementSM:             node->type = cybNodeSM; break;
+	case elementSimpleState:    node->type = cybNodeSimpleState; break;
+	case elementCompositeState: node->type = cybNodeCompositeState; break;
+	case elementComment:        node->type = cybNodeComment; break;
+	case elementFormalComment:  node->type = cybNodeFormalComment; break;
+	case elementInitial:        node->type = cybNodeInitial; break;
+	case elementFinal:          node->type = cybNodeFinal; break;
+	case elementChoice:         node->type = cybNodeChoice; break;
+	case elementTerminate:      node->type = cybNodeTerminate; break;
+	default:
+		std::cerr << id << " " << type << std::endl;
+		CYB_ASSERT(false);
+	}	
+	if (has_name()) {
+		cyberiada_copy_string(&(node->title), &(node->title_len),
+							  get_name().c_str());
+	}
+	if (has_formal_name()) {
+		cyberiada_copy_string(&(node->formal_title), &(node->formal_title_len),
+							  get_formal_name().c_str());
+	}
+	return node;
 }
 
-FinalState::FinalState(Element* _parent, const ID& _id, const Name& _name, const Point& p):
-	Vertex(_parent, elementFinal, _id, _name, p)
+std::string Element::dump_to_str() const
 {
+	DumpBuffer b;
+	print(b);
+	return b.release();
 }
 
-Element* FinalState::copy(Element* parent) const
+std::ostream& Element::dump(std::ostream& os) const
 {
-	if (has_name()) {
-		return new FinalState(parent, get_id(), get_name(), get_geometry_point());
+	DumpBuffer* nested = DumpBuffer::attached(os);
+	if (nested) {
+		print(*nested);
 	} else {
-		return new FinalState(parent, get_id(), get_geometry_point());
+		DumpBuffer b(os);
+		print(b);
+		b.write(os);
 	}
+	return os;
 }
 
-// -----------------------------------------------------------------------------
-// State
-// -----------------------------------------------------------------------------
+void Element::print(DumpBuffer& b) const
+{
+	const char* type_str = NULL;
+	switch (type) {
+	case elementRoot:           type_str = "Document"; break;
+	case elementSM:             type_str = "State Machine"; break;
+	case elementSimpleState:    type_str = "Simple State"; break;
+	case elementCompositeState: type_str = "Composite State"; break;
+	case elementComment:        type_str = "Comment"; break;
+	case elementFormalComment:  type_str = "Formal Comment"; break;
+	case elementInitial:        type_str = "Initial"; break;
+	case elementFinal:          type_str = "Final"; break;
+	case elementChoice:         type_str = "Choice"; break;
+	case elementTerminate:      type_str = "Terminate"; break;
+	case elementTransition:     type_str = "Transition"; break;
+	default:
+		CYB_ASSERT(false);
+	}
+	b << type_str << ": {id: '" << id << "'";
+	if (name_is_set) {
+		b << ", name: '" << name << "'";
+	}
+	if (formal_name_is_set) {
+		b << ", formal name: '" << formal_name << "'";
+	}
+}
 
-std::ostream& Cyberiada::operator<<(std::ostream& os, const Action& a)
+std::ostream& Cyberiada::operator<<(std::ostream& os, const Element& e)
 {
-	a.dump(os);
+	e.dump(os);
 	return os;
 }
 
-State::State(Element* _parent, const ID& _id, const Name& _name, const Rect& r, const Rect& region, const Color& c):
-	ElementCollection(_parent, elementSimpleState, _id, _name, r, c), collapsed(false), region_rect(region) 
+void Element::check_cyberiada_error(int res, const String& msg) const
 {
+	throw_status(Status(cyberiada_status_code(res), msg));
 }
 
-State::State(const State& s):
-	ElementCollection(s), collapsed(s.collapsed), region_rect(s.region_rect), actions(s.actions)
+// -----------------------------------------------------------------------------
+// Geometry
+// -----------------------------------------------------------------------------	
+
+static double round_num(double n)
 {
+//	return int(::round(n * 1000)) / 1000.0;
+	return int(n);//::round(n);
 }
 
-void State::add_element(Element* e)
+Point::Point(CyberiadaPoint* p)
 {
-	ElementCollection::add_element(e);
-	update_state_type();
+	if (p) {
+		valid = true;
+		x = p->x;
+		y = p->y;
+	} else {
+		valid = false;
+	}
 }
 
-void State::remove_element(const ID& _id)
+CyberiadaPoint* Point::c_point() const
 {
-	ElementCollection::remove_element(_id);
-	update_state_type();
+	if (valid) {
+		CyberiadaPoint* p = htree_new_point();
+		p->x = x;
+		p->y = y;
+		return p;
+	} else {
+		return NULL;
+	}
 }
 
-void State::add_action(const Action& a)
+void Point::round()
 {
-	if (a.is_empty_transition()) {
-		throw ParametersException("Empty transition action is not allowed");
-	}
-	if (a.get_type() != actionTransition && a.has_guard()) {
-		throw ParametersException("Guards are not allowed for entry/exit activities");
+	if (valid) {
+		x = round_num(x);
+		y = round_num(y);
 	}
-	actions.push_back(a);
 }
 
-std::vector<const State*> State::get_substates() const
+Point Point::round() const
 {
-	ElementTypes types = { elementSimpleState,
-						   elementCompositeState };
-	std::vector<const State*> result;
-	ConstElementList states = find_elements_by_types(types);
-	for (ConstElementList::const_iterator i = states.begin(); i != states.end(); i++) {
-		result.push_back(static_cast<const State*>(*i));
+	Point p;
+	if (valid) {
+		p.x = round_num(x);
+		p.y = round_num(y);
 	}
-	return result;
+	return p;
 }
 
-std::vector<State*> State::get_substates()
+String Point::to_str() const
 {
-	ElementTypes types = { elementSimpleState,
-						   elementCompositeState };
-	std::vector<State*> result;
-	ElementList states = find_elements_by_types(types);
-	for (ElementList::const_iterator i = states.begin(); i != states.end(); i++) {
-		result.push_back(static_cast<State*>(*i));
-	}
-	return result;
+	std::ostringstream s;
+	s << *this;
+	return s.str();
 }
 
-void State::update_state_type()
+Rect::Rect(CyberiadaRect* r)
 {
-	if (has_children()) {
-		this->set_type(elementCompositeState);
+	if (r) {
+		valid = true;
+		x = r->x;
+		y = r->y;
+		width = r->width;
+		height = r->height;
 	} else {
-		this->set_type(elementSimpleState);
+		valid = false;
 	}
 }
 
-static CyberiadaAction* to_action(const Action& a)
+CyberiadaRect* Rect::c_rect() const
 {
-	if (!a.is_empty_transition()) {
-		CyberiadaActionType at;
-		if (a.get_type() == actionEntry) {
-			at = cybActionEntry;
-		} else if (a.get_type() == actionExit) {
-			at = cybActionExit;
-		} else {
-			CYB_ASSERT(a.get_type() == actionTransition);
-			at = cybActionTransition;
-		}
-		CyberiadaAction* action = cyberiada_new_action(at,
-													   a.get_trigger().c_str(),
-													   a.get_guard().c_str(),
-													   a.get_behavior().c_str());
-		return action;
+	if (valid) {
+		CyberiadaRect* r = htree_new_rect();
+		r->x = x;
+		r->y = y;
+		r->width = width;
+		r->height = height;
+		return r;
+	} else {
+		return NULL;
 	}
-	return NULL;
 }
 
-static CyberiadaAction* to_action(const std::vector<Action>& actions)
+String Rect::to_str() const
 {
-	CyberiadaAction* node_actions = NULL;
-	if (actions.size() > 0) {
-		for (std::vector<Action>::const_iterator i = actions.begin(); i != actions.end(); i++) {
-			const Action& a = *i;
-			CyberiadaActionType at;
-			if (a.get_type() == actionEntry) {
-				at = cybActionEntry;
-			} else if (a.get_type() == actionExit) {
-				at = cybActionExit;
-			} else {
-				CYB_ASSERT(a.get_type() == actionTransition);
-				at = cybActionTransition;
+	std::ostringstream s;
+	s << *this;
+	return s.str();
+}
+
+CyberiadaPolyline* Polyline::c_polyline() const
+{
+	CyberiadaPolyline* result = NULL;
+	for (Polyline::const_iterator i = begin(); i != end(); i++) {
+		const Point& point = *i;
+		CyberiadaPolyline* pl = htree_new_polyline();
+		pl->point.x = point.x;
+		pl->point.y = point.y;
+		if (result) {
+			CyberiadaPolyline* last_pl = result;
+			while (last_pl->next) last_pl = last_pl->next;
+			last_pl->next = pl;
+		} else {
+			result = pl;
+		}
+	}
+	return result;
+}
+
+String Polyline::to_str()
+{
+	std::ostringstream s;
+	s << *this;
+	return s.str();	
+}
+
+bool Rect::operator==(const Rect& r) const
+{
+	if (!valid && !r.valid) return true;
+	if (!valid || !r.valid) return false;
+	return x == r.x && y == r.y && width == r.width && height == r.height;
+}
+
+bool Rect::operator!=(const Rect& r) const
+{
+	return !(*this == r);
+}
+
+bool Rect::almost_equal(const Rect& r) const
+{
+	if (!valid && !r.valid) return true;
+	if (!valid || !r.valid) return false;
+	return (abs(x - r.x) < EQUAL_DIFF &&
+			abs(y - r.y) < EQUAL_DIFF &&
+			abs(width - r.width) < EQUAL_DIFF &&
+			abs(height - r.height) < EQUAL_DIFF);
+}
+
+Rect Rect::round() const
+{
+	Rect r;
+	if (valid) {
+		r.valid = true;
+		r.x = round_num(x);
+		r.y = round_num(y);
+		r.width = round_num(width);
+		r.height = round_num(height);
+	}
+	return r;
+}
+
+void Rect::round()
+{
+	if (valid) {
+		x = round_num(x);
+		y = round_num(y);
+		width = round_num(width);
+		height = round_num(height);
+	}
+}
+
+void Polyline::round()
+{
+	for (Polyline::iterator i = begin(); i != end(); i++) {
+		i->round();
+	}
+}
+
+void Rect::expand(const Point& p, const Document& d)
+{
+	if (p.valid) {
+		if (valid) {
+			if (d.get_geometry_format() == geometryFormatQt) {
+				double half_w = width / 2.0;
+				double half_h = height / 2.0;
+				double delta;
+				if (p.x < x - half_w) {
+					delta = x - half_w - p.x;
+					width += delta;
+					x -= delta / 2.0;
+				} else if (p.x > x + half_w) {
+					delta = p.x - x - half_w;
+					width += delta;
+					x += delta / 2.0;
+				}
+				if (p.y < y - half_h) {
+					delta = y - half_h - p.y;
+					height += delta;
+					y -= delta / 2.0;
+				} else if (p.y > y + half_h) {
+					delta = p.y - y - half_h;
+					height += delta;
+					y += delta / 2.0;
+				}
+			} else {
+				if (p.x < x) {
+					width += x - p.x;
+					x = p.x;
+				} else if (p.x > x + width) {
+					width = p.x - x;
+				}
+				if (p.y < y) {
+					height += y - p.y;
+					y = p.y;
+				} else if (p.y > y + height) {
+					height = p.y - y;
+				}
+			}
+		} else {
+			valid = true;
+			x = p.x;
+			y = p.y;
+			width = height = 0.0;
+		}
+	}
+}
+
+void Rect::expand(const Rect& r, const Document& d)
+{
+	if (r.valid) {
+		if (valid) {
+			if (d.get_geometry_format() == geometryFormatQt) {
+				expand(Point(r.x - r.width / 2.0, r.y - r.height / 2.0), d);
+				expand(Point(r.x + r.width / 2.0, r.y + r.height / 2.0), d);				
+			} else {
+				expand(Point(r.x, r.y), d);
+				expand(Point(r.x + r.width, r.y + r.height), d);
+			}
+		} else {
+			*this = r;
+		}
+	}
+}
+
+void Rect::expand(const Polyline& pl, const Document& d)
+{
+	if (pl.size() > 0) {
+		for (Polyline::const_iterator i = pl.begin(); i != pl.end(); i++) {
+			expand(*i, d);
+		}
+	}
+}
+
+std::ostream& Cyberiada::operator<<(std::ostream& os, const Point& p)
+{
+	if (!p.valid) {
+		os << "()";
+	} else {
+		os << "(" << p.x << "; " << p.y << ")";
+	}
+	return os;
+}
+
+std::ostream& Cyberiada::operator<<(std::ostream& os, const Rect& r)
+{
+	if (!r.valid) {
+		os << "()";
+	} else {
+		os << "(" << r.x << "; " << r.y << "; " << r.width << "; " << r.height << ")";
+	}
+	return os;
+}
+
+std::ostream& Cyberiada::operator<<(std::ostream& os, const Polyline& pl)
+{
+	os << "[ ";
+	for (Polyline::const_iterator i = pl.begin(); i != pl.end(); i++) {	
+		os << *i;
+		if (std::next(i) != pl.end()) {
+			os << ", ";
+		}
+	}
+	os << " ]";
+	return os;
+}
+
+// -----------------------------------------------------------------------------
+// Action
+// -----------------------------------------------------------------------------	
+
+Action::Action(ActionType _type, const Behavior& _behavior):
+	type(_type), behavior(_behavior)
+{
+}
+
+Action::Action(const Event& _trigger, const Guard& _guard, const Behavior& _behavior):
+	type(actionTransition), trigger(_trigger), guard(_guard), behavior(_behavior)
+{
+}
+
+void Action::update(const Behavior& _behavior)
+{
+	behavior = _behavior;
+}
+
+void Action::update(const Event& _trigger, const Guard& _guard, const Behavior& _behavior)
+{
+	if (type == actionTransition && _trigger.size() == 0) {
+		return ;
+	}
+	trigger = _trigger;
+	guard = _guard;
+	behavior = _behavior;
+}
+
+void Action::clear()
+{
+	if (type == actionTransition) {
+		trigger = guard = behavior = "";
+	} else {
+		guard = behavior = "";
+	}
+}
+
+String Action::to_str() const
+{
+	DumpBuffer b;
+	print(b);
+	return b.release();
+}
+
+void Action::print(DumpBuffer& b) const
+{
+	if (type != actionTransition) {
+		if (type == actionEntry) {
+			b << ACTION_ENTRY_TRIGGER;
+		} else {
+			CYB_ASSERT(type == actionExit);
+			b << ACTION_EXIT_TRIGGER;
+		}
+	} else if (!trigger.empty()) {
+		b << "trigger: '" << trigger << "'";
+	}
+	if (!guard.empty()) {
+		if (type != actionTransition || !trigger.empty()) {
+			b << ", ";
+		}
+		b << "guard: '" << guard << "'";
+	}
+	if (!behavior.empty()) {
+		if (type != actionTransition || !trigger.empty() || !guard.empty()) {
+			b << ", ";
+		}
+		b << "behavior: '" << behavior << "'";
+	}
+}
+
+// -----------------------------------------------------------------------------
+// Comment
+// -----------------------------------------------------------------------------
+
+CommentSubject::CommentSubject(const ID& _id, Element* _element,
+							   const Point& source, const Point& target, const Polyline& pl):
+	type(commentSubjectElement), id(_id), element(_element), has_frag(false), source_point(source), target_point(target), polyline(pl)
+{
+}
+
+CommentSubject::CommentSubject(const ID& _id, Element* _element, CommentSubjectType _type, const String& _fragment,
+							   const Point& source, const Point& target, const Polyline& pl):
+	type(_type), id(_id), element(_element), has_frag(true), fragment(_fragment), source_point(source), target_point(target), polyline(pl)
+{
+}
+
+CommentSubject::CommentSubject(const CommentSubject& cs):
+	type(cs.type), id(cs.id), element(cs.element), has_frag(cs.has_frag), fragment(cs.fragment),
+	source_point(cs.source_point), target_point(cs.target_point), polyline(cs.polyline)	
+{
+}
+
+CommentSubject& CommentSubject::operator=(const CommentSubject& cs)
+{
+	type = cs.type;
+	id = cs.id;
+	element = cs.element;
+	has_frag = cs.has_frag;
+	fragment = cs.fragment;
+	source_point = cs.source_point;
+	target_point = cs.target_point;
+	polyline = cs.polyline;
+	return *this;
+}
+
+Rect CommentSubject::get_bound_rect(const Document& d) const
+{
+	Rect r;
+	if (has_geometry() && has_polyline()) {
+		r.expand(polyline, d);
+	}
+	return r;
+}
+
+std::ostream& Cyberiada::operator<<(std::ostream& os, const CommentSubject& cs)
+{
+	DumpBuffer b(os);
+	cs.print(b);
+	b.write(os);
+	return os;
+}
+
+String CommentSubject::to_str() const
+{
+	DumpBuffer b;
+	print(b);
+	return b.release();
+}
+
+void CommentSubject::clean_geometry()
+{
+	source_point = Point();
+	target_point = Point();
+	polyline.clear();
+	CYB_ASSERT(!has_geometry());
+}
+
+void CommentSubject::round_geometry()
+{
+	if (has_geometry()) {
+		source_point.round();
+		target_point.round();
+		polyline.round();
+	}
+}
+
+void CommentSubject::print(DumpBuffer& b) const
+{
+	const char* type_str;
+	if (type == commentSubjectElement) {
+		type_str = "element";
+	} else if (type == commentSubjectName) {
+		type_str = "name";
+	} else {
+		CYB_ASSERT(type == commentSubjectData);
+		type_str = "data";
+	}
+	b << "{id: '" << id << "'";
+	b << ", type: " << type_str;
+	if (element) {
+		b << ", to: '" << element->get_id() << "'";
+		if (has_frag) {
+			b << ", fragment: '" << fragment << "'";
+		}
+		if (source_point.valid) {
+			b << ", source point: " << source_point;
+		}
+		if (target_point.valid) {
+			b << ", target point: " << target_point;
+		}
+		if (!polyline.empty()) {
+			b << ", polyline: " << polyline;
+		}
+	}
+	b << "}";
+}
+
+Comment::Comment(Element* _parent, const ID& _id, const String& _body, bool _human_readable,
+				 const String& _markup, const Rect& rect, const Color& _color):
+	Element(_parent, elementComment, _id), body(_body), markup(_markup),
+	human_readable(_human_readable), geometry_rect(rect), color(_color)
+{
+	update_comment_type();
+}
+
+Comment::Comment(Element* _parent, const ID& _id, const String& _body, const Name& _name, bool _human_readable,
+				 const String& _markup, const Rect& rect, const Color& _color):
+	Element(_parent, elementComment, _id, _name), body(_body), markup(_markup),
+	human_readable(_human_readable), geometry_rect(rect), color(_color)
+{
+	update_comment_type();
+}
+
+Comment::Comment(const Comment& c):
+	Element(c), body(c.body), markup(c.markup), human_readable(c.human_readable),
+	geometry_rect(c.geometry_rect), subjects(c.subjects), color(c.color)
+{
+}
+
+Element* Comment::copy(Element* _parent) const
+{
+	Comment* c;
+	if (has_name()) {
+		c = new Comment(_parent, get_id(), body, get_name(), human_readable, markup, geometry_rect, color);
+	} else {
+		c = new Comment(_parent, get_id(), body, human_readable, markup, geometry_rect, color);
+	}
+	c->subjects = subjects;
+	return c;
+}
+
+const CommentSubject& Comment::add_subject(const CommentSubject& s)
+{
+	subjects.push_back(s);
+	modified();
+	return subjects.back();
+}
+
+void Comment::remove_subject(CommentSubjectType _type, const String& fragment)
+{
+	for (std::vector<CommentSubject>::iterator i = subjects.begin(); i != subjects.end(); i++) {
+		if (i->get_type() == _type &&
+			i->has_fragment()
+			&& i->get_fragment() == fragment) {
+			
+			subjects.erase(i);
+			modified();
+			break;
+		}
+	}
+}
+
+void Comment::update_comment_type()
+{
+	if (human_readable) {
+		this->set_type(elementComment);
+	} else {
+		this->set_type(elementFormalComment);
+	}
+}
+
+CyberiadaNode* Comment::to_node() const
+{
+	CYB_COUNT_SCOPE(countToNode);
+	CyberiadaNode* node = Element::to_node();
+	CyberiadaCommentData* data = cyberiada_new_comment_data();
+	if (!body.empty()) {
+		cyberiada_copy_string(&(data->body), &(data->body_len), body.c_str());
+	}
+	if (!markup.empty()) {
+		cyberiada_copy_string(&(data->markup), &(data->markup_len), markup.c_str());
+	}
+	node->comment_data = data;
+	if (has_geometry()) {
+		node->geometry_rect = geometry_rect.c_rect();
+		if (has_color()) {
+			cyberiada_copy_string(&(node->color), &(node->color_len), color.c_str());
+		}
+	}
+	return node;
+}
+
+CyberiadaEdge* Comment::subjects_to_edges() const
+{
+	CyberiadaEdge* result = NULL;
+	if (has_subjects()) {
+		for (std::vector<CommentSubject>::const_iterator i = subjects.begin(); i != subjects.end(); i++) {
+			CyberiadaEdge *edge = cyberiada_new_edge(i->get_id().c_str(),
+													 get_id().c_str(),
+													 i->get_element()->get_id().c_str(), 0);
+			edge->type = cybEdgeComment;
+			CyberiadaCommentSubjectType t;
+			if (i->get_type() == commentSubjectElement) {
+				t = cybCommentSubjectNode;
+			} else if (i->get_type() == commentSubjectName) {
+				t = cybCommentSubjectNameFragment;
+			} else {
+				CYB_ASSERT(i->get_type() == commentSubjectData);
+				t = cybCommentSubjectDataFragment;
+			}
+			CyberiadaCommentSubject* cs = cyberiada_new_comment_subject(t);
+			
+			if (i->has_fragment()) {
+				cyberiada_copy_string(&(cs->fragment), &(cs->fragment_len), i->get_fragment().c_str());			
+			}
+			edge->comment_subject = cs;
+
+			if (i->has_geometry()) {
+				if (i->get_geometry_source_point().valid) {
+					edge->geometry_source_point = i->get_geometry_source_point().c_point();
+				}
+				if (i->get_geometry_target_point().valid) {
+					edge->geometry_target_point = i->get_geometry_target_point().c_point();
+				}
+				if (i->has_polyline()) {
+					edge->geometry_polyline = i->get_geometry_polyline().c_polyline();
+				}
+			}
+
+			if (result) {
+				CyberiadaEdge* e = result;
+				while (e->next) e = e->next;
+				e->next = edge;
+			} else {
+				result = edge;
+			}
+		}
+	}
+	return result;
+}
+
+Rect Comment::get_bound_rect(const Document& d) const
+{
+	CYB_COUNT_SCOPE(countGetBoundRect);
+	CYB_COUNT_VISIT(countGetBoundRect);
+	Rect r, parent;
+	if (has_geometry()) {
+		parent = r = geometry_rect;
+	}
+	if (has_geometry() && has_subjects()) {
+		for (std::vector<CommentSubject>::const_iterator i = subjects.begin(); i != subjects.end(); i++) {
+			if (!i->get_element() || !i->get_element()->has_geometry()) {
+				continue;
+			}
+			Rect ch_r = i->get_bound_rect(d);
+			if (d.get_geometry_format() == geometryFormatCyberiada10 ||
+				d.get_geometry_format() == geometryFormatQt) {
+				ch_r.x += parent.x;
+				ch_r.y += parent.y;
+			}
+			r.expand(ch_r, d);
+		}
+	}
+	return r;
+}
+
+void Comment::clean_geometry()
+{
+	geometry_rect = Rect();
+	if (has_subjects()) {
+		for (std::vector<CommentSubject>::iterator i = subjects.begin(); i != subjects.end(); i++) {
+			i->clean_geometry();
+		}
+	}	
+	modified();
+	CYB_ASSERT(!has_geometry());
+}
+
+void Comment::round_geometry()
+{
+	if (has_geometry()) {
+		geometry_rect.round();
+		if (has_subjects()) {
+			for (std::vector<CommentSubject>::iterator i = subjects.begin(); i != subjects.end(); i++) {
+				i->round_geometry();
+			}
+		}
+		modified();
+	}
+}
+
+ContentHash Comment::own_content_hash() const
+{
+	ContentHash h = Element::own_content_hash();
+	h = hash_mix(h, hash_string(body));
+	h = hash_mix(h, hash_string(markup));
+	h = hash_mix(h, human_readable);
+	h = hash_rect(h, geometry_rect);
+	h = hash_mix(h, hash_string(color));
+	h = hash_mix(h, subjects.size());
+	for (std::vector<CommentSubject>::const_iterator i = subjects.begin(); i != subjects.end(); i++) {
+		const CommentSubject& cs = *i;
+		h = hash_mix(h, cs.get_type());
+		h = hash_mix(h, hash_string(cs.get_id()));
+		h = hash_mix(h, cs.get_element() ? hash_string(cs.get_element()->get_id()) : 0);
+		h = hash_mix(h, cs.has_fragment());
+		h = hash_mix(h, hash_string(cs.get_fragment()));
+		h = hash_point(h, cs.get_geometry_source_point());
+		h = hash_point(h, cs.get_geometry_target_point());
+		h = hash_polyline(h, cs.get_geometry_polyline());
+	}
+	return h;
+}
+
+void Comment::add_memory_usage(MemoryUsage& usage) const
+{
+	Element::add_memory_usage(usage);
+	usage.strings += string_heap_bytes(body) + string_heap_bytes(markup) + string_heap_bytes(color);
+	add_geometry_usage(usage, sizeof(geometry_rect));
+	usage.objects += subjects.capacity() * sizeof(CommentSubject);
+	for (std::vector<CommentSubject>::const_iterator i = subjects.begin(); i != subjects.end(); i++) {
+		usage.strings += string_heap_bytes(i->get_id()) + string_heap_bytes(i->get_fragment());
+		add_geometry_usage(usage, 2 * sizeof(Point));
+		usage.polylines += polyline_heap_bytes(i->get_geometry_polyline());
+	}
+}
+
+void Comment::print(DumpBuffer& b) const
+{
+	Element::print(b);
+	b << ", body: '" << body << "'";
+	if (has_geometry()) {
+		b << ", geometry: " << geometry_rect;
+	}
+	if (has_subjects()) {
+		b << ", subjects: {";
+		for (std::vector<CommentSubject>::const_iterator i = subjects.begin(); i != subjects.end(); i++) {
+			b << *i;
+			if(std::next(i) != subjects.end()) {
+				b << ", ";
+			}
+		}
+		b << "}";
+	}
+	b << "}";
+}
+
+// -----------------------------------------------------------------------------
+// Vertex
+// -----------------------------------------------------------------------------
+
+Vertex::Vertex(Element* _parent, ElementType _type, const ID& _id, const Point& pos):
+	Element(_parent, _type, _id), geometry_point(pos)
+{
+}
+
+Vertex::Vertex(Element* _parent, ElementType _type, const ID& _id, const Name& _name, const Point& pos):
+	Element(_parent, _type, _id, _name), geometry_point(pos)
+{
+}
+
+Vertex::Vertex(const Vertex& v):
+	Element(v), geometry_point(v.geometry_point)
+{
+}
+
+Rect Vertex::get_bound_rect(const Document& d) const
+{
+	CYB_COUNT_SCOPE(countGetBoundRect);
+	CYB_COUNT_VISIT(countGetBoundRect);
+	Rect r;
+	if (has_geometry()) {
+		r.expand(geometry_point, d);
+	}
+	return r;
+}
+
+void Vertex::clean_geometry()
+{
+	geometry_point = Point();
+	modified();
+	CYB_ASSERT(!has_geometry());
+}
+
+void Vertex::round_geometry()
+{
+	if (has_geometry()) {
+		geometry_point.round();
+		modified();
+	}
+}
+
+ContentHash Vertex::own_content_hash() const
+{
+	return hash_point(Element::own_content_hash(), geometry_point);
+}
+
+void Vertex::add_memory_usage(MemoryUsage& usage) const
+{
+	Element::add_memory_usage(usage);
+	add_geometry_usage(usage, sizeof(geometry_point));
+}
+
+void Vertex::print(DumpBuffer& b) const
+{
+	Element::print(b);
+	if (has_geometry()) {
+		b << ", geometry: " << geometry_point;
+	}
+	b << "}";	
+}
+
+CyberiadaNode* Vertex::to_node() const
+{
+	CYB_COUNT_SCOPE(countToNode);
+	CyberiadaNode* node = Element::to_node();
+	if (has_geometry()) {
+		node->geometry_point = geometry_point.c_point();
+	}
+	return node;
+}
+
+// -----------------------------------------------------------------------------
+// Collection of Elements
+// -----------------------------------------------------------------------------
+
+ElementCollection::ElementCollection(Element* _parent, ElementType _type, const ID& _id, const Name& _name,
+									 const Rect& rect, const Color& _color):
+	Element(_parent, _type, _id, _name), geometry_rect(rect), color(_color), lazy_content(NULL)
+{
+}
+
+ElementCollection::ElementCollection(const ElementCollection& ec):
+	Element(ec), geometry_rect(ec.geometry_rect), color(ec.color), lazy_content(NULL)
+{
+	copy_elements(ec);
+}
+
+ElementCollection::~ElementCollection()
+{
+	clear();
+	delete lazy_content;
+}
+
+bool ElementCollection::is_loaded() const
+{
+	return !lazy_content || lazy_content->loaded.load(std::memory_order_acquire);
+}
+
+const CyberiadaSM* ElementCollection::lazy_source() const
+{
+	return is_loaded() ? NULL : lazy_content->sm;
+}
+
+void ElementCollection::import_lazy_content() const
+{
+	LazyContent* l = lazy_content;
+	if (l->loaded.load(std::memory_order_acquire)) {
+		return ;
+	}
+	std::shared_ptr<LazyDocument> source = l->source;
+	std::lock_guard<std::mutex> lock(source->mutex);
+	if (l->loaded.load(std::memory_order_relaxed)) {
+		// imported by another thread
+		return ;
+	}
+	CYB_ASSERT(get_type() == elementSM);
+	// the content is built apart and moved here, so the import is not a modification
+	StateMachine content(NULL, get_id());
+	try {
+		content.from_sm(l->sm, NULL, l->trusted);
+	} catch (const CybMLException& e) {
+		throw CybMLException(e.str());
+	} catch (const Exception& e) {
+		throw AssertException("Internal load error: " + e.str());
+	}
+	ElementCollection* self = const_cast<ElementCollection*>(this);
+	ElementList& imported = static_cast<ElementCollection&>(content).children;
+	CYB_ASSERT(children.empty());
+	self->children.swap(imported);
+	for (ElementList::const_iterator i = children.begin(); i != children.end(); i++) {
+		(*i)->update_parent(self);
+		self->elements_attached(*i);
+	}
+	source->release(l);
+	l->loaded.store(true, std::memory_order_release);
+}
+
+void ElementCollection::drop_lazy_content()
+{
+	if (!is_loaded()) {
+		std::lock_guard<std::mutex> lock(lazy_content->source->mutex);
+		lazy_content->source->release(lazy_content);
+		lazy_content->loaded.store(true, std::memory_order_release);
+	}
+}
+
+const Element* ElementCollection::find_element_by_id(const ID& _id) const
+{
+	load_content();
+	CYB_COUNT_SCOPE(countFindElementById);
+	for (ElementList::const_iterator i = children.begin(); i != children.end(); i++) {
+		const Element* e = *i;
+		CYB_COUNT_VISIT(countFindElementById);
+		if (e->get_id() == _id) {
+			return e;
+		} else if (e->has_children()) {
+			const ElementCollection* c = static_cast<const ElementCollection*>(e);
+			e = c->find_element_by_id(_id);
+			if (e) {
+				return e;
+			}
+		}
+	}
+	return NULL;
+}
+
+Element* ElementCollection::find_element_by_id(const ID& _id)
+{
+	load_content();
+	CYB_COUNT_SCOPE(countFindElementById);
+	for (ElementList::iterator i = children.begin(); i != children.end(); i++) {
+		Element* e = *i;
+		CYB_COUNT_VISIT(countFindElementById);
+		if (e->get_id() == _id) {
+			return e;
+		} else if (e->has_children()) {
+			ElementCollection* c = static_cast<ElementCollection*>(e);
+			e = c->find_element_by_id(_id);
+			if (e) {
+				return e;
+			}
+		}
+	}
+	return NULL;
+}
+
+ConstElementList ElementCollection::find_elements_by_type(ElementType _type) const
+{
+	load_content();
+	CYB_COUNT_SCOPE(countFindElementsByType);
+	ConstElementList result;
+	for (ElementList::const_iterator i = children.begin(); i != children.end(); i++) {
+		const Element* e = *i;
+		CYB_COUNT_VISIT(countFindElementsByType);
+		if (e->get_type() == _type) {
+			result.push_back(e);
+		}
+		if (e->has_children()) {
+			const ElementCollection* c = static_cast<const ElementCollection*>(e);
+			ConstElementList r = c->find_elements_by_type(_type);
+			result.insert(result.end(), r.begin(), r.end());
+		}
+	}	
+	return result;
+}
+
+ConstElementList ElementCollection::find_elements_by_types(const ElementTypes& types) const
+{
+	load_content();
+	CYB_COUNT_SCOPE(countFindElementsByType);
+	ConstElementList result;
+	for (ElementList::const_iterator i = children.begin(); i != children.end(); i++) {
+		const Element* e = *i;
+		CYB_COUNT_VISIT(countFindElementsByType);
+		if (std::find(types.begin(), types.end(), e->get_type()) != types.end()) {
+			result.push_back(e);
+		}
+		if (e->has_children()) {
+			const ElementCollection* c = static_cast<const ElementCollection*>(e);
+			ConstElementList r = c->find_elements_by_types(types);
+			result.insert(result.end(), r.begin(), r.end());
+		}
+	}	
+	return result;
+}
+
+ElementList ElementCollection::find_elements_by_type(ElementType _type)
+{
+	load_content();
+	CYB_COUNT_SCOPE(countFindElementsByType);
+	ElementList result;
+	for (ElementList::iterator i = children.begin(); i != children.end(); i++) {
+		Element* e = *i;
+		CYB_COUNT_VISIT(countFindElementsByType);
+		if (e->get_type() == _type) {
+			result.push_back(e);
+		}
+		if (e->has_children()) {
+			ElementCollection* c = static_cast<ElementCollection*>(e);
+			ElementList r = c->find_elements_by_type(_type);
+			result.insert(result.end(), r.begin(), r.end());
+		}
+	}
+	return result;
+}
+
+ElementList ElementCollection::find_elements_by_types(const ElementTypes& types)
+{
+	load_content();
+	CYB_COUNT_SCOPE(countFindElementsByType);
+	ElementList result;
+	for (ElementList::iterator i = children.begin(); i != children.end(); i++) {
+		Element* e = *i;
+		CYB_COUNT_VISIT(countFindElementsByType);
+		if (std::find(types.begin(), types.end(), e->get_type()) != types.end()) {
+			result.push_back(e);
+		}
+		if (e->has_children()) {
+			ElementCollection* c = static_cast<ElementCollection*>(e);
+			ElementList r = c->find_elements_by_types(types);
+			result.insert(result.end(), r.begin(), r.end());
+		}
+	}	
+	return result;	
+}
+
+size_t  ElementCollection::elements_count() const
+{
+	if (!is_loaded()) {
+		// counted without the import
+		return 1 + lazy_content->elements;
+	}
+	size_t count = 1;
+	for (ElementList::const_iterator i = children.begin(); i != children.end(); i++) {
+		count += (*i)->elements_count();
+	}
+	return count;
+}
+
+bool ElementCollection::has_initial() const
+{
+	load_content();
+	for (ElementList::const_iterator i = children.begin(); i != children.end(); i++) {
+		if ((*i)->get_type() == elementInitial) {
+			return true;
+		}
+	}
+	return false;
+}
+
+int ElementCollection::element_index(const Element* e) const
+{
+	load_content();
+	CYB_ASSERT(e);
+	int index = 0;
+	for (ElementList::const_iterator i = children.begin(); i != children.end(); i++, index++) {
+		if (*i == e) {
+			return index;
+		}
+	}
+	return -1;
+}
+
+void ElementCollection::add_element(Element* e)
+{
+	load_content();
+	CYB_ASSERT(e);
+	CYB_ASSERT(e->get_parent() == this);
+	if (e->get_type() == elementTransition) {
+		children.push_back(e);
+	} else {
+		// the transitions are kept after the other elements
+		ElementList::iterator i = std::partition_point(children.begin(), children.end(),
+													   [](const Element* c) { return c->get_type() != elementTransition; });
+		children.insert(i, e);
+	}
+	elements_attached(e);
+	modified();
+}
+
+void ElementCollection::add_first_element(Element* e)
+{
+	load_content();
+	CYB_ASSERT(e);
+	CYB_ASSERT(e->get_parent() == this);
+	children.insert(children.begin(), e);
+	elements_attached(e);
+	modified();
+}
+
+void ElementCollection::remove_element(const ID& _id)
+{
+	load_content();
+	// the recently added elements are removed more often, so the search starts from the end
+	for (ElementList::reverse_iterator i = children.rbegin(); i != children.rend(); i++) {
+		if ((*i)->get_id() == _id) {
+			Element* e = *i;
+			children.erase(std::next(i).base());
+			elements_detached(e);
+			modified();
+			break;
+		}
+	}
+}
+
+void ElementCollection::clear()
+{
+	drop_lazy_content();
+	for (ElementList::iterator i = children.begin(); i != children.end(); i++) {
+		Element* e = *i;
+		elements_detached(e);
+		delete e;
+	}
+	children.clear();
+	modified();
+}
+
+std::vector<const Vertex*> ElementCollection::get_vertexes() const
+{
+	ElementTypes types = { elementSimpleState,
+						   elementCompositeState,
+						   elementInitial,
+						   elementFinal,
+						   elementChoice,
+						   elementTerminate};
+	std::vector<const Vertex*> result;
+	ConstElementList vertexes = find_elements_by_types(types);
+	for (ConstElementList::const_iterator i = vertexes.begin(); i != vertexes.end(); i++) {
+		result.push_back(static_cast<const Vertex*>(*i));
+	}
+	return result;
+}
+
+std::vector<Vertex*> ElementCollection::get_vertexes()
+{
+	ElementTypes types = { elementComment,
+						   elementFormalComment,
+						   elementSimpleState,
+						   elementCompositeState,
+						   elementInitial,
+						   elementFinal,
+						   elementChoice,
+						   elementTerminate};
+	std::vector<Vertex*> result;
+	ElementList vertexes = find_elements_by_types(types);
+	for (ElementList::const_iterator i =  vertexes.begin(); i != vertexes.end(); i++) {
+		result.push_back(static_cast<Vertex*>(*i));
+	}
+	return result;
+}
+
+const Element* ElementCollection::first_element() const
+{
+	if (has_children()) {
+		const Element* element = *(children.begin());
+		return element;
+	} else {
+		return NULL;
+	}
+}
+
+Element* ElementCollection::first_element()
+{
+	if (has_children()) {
+		Element* element = *(children.begin());
+		return element;
+	} else {
+		return NULL;
+	}
+}
+
+const Element* ElementCollection::get_element(int index) const
+{
+	int idx = 0;
+	if (has_children()) {
+		for (ElementList::const_iterator i = children.begin(); i != children.end(); i++, idx++) {
+			if (idx == index) {
+				return *i;
+			}
+		}
+	}
+	return NULL;
+}
+
+Element* ElementCollection::get_element(int index)
+{
+	int idx = 0;
+	if (has_children()) {
+		for (ElementList::iterator i = children.begin(); i != children.end(); i++, idx++) {
+			if (idx == index) {
+				return *i;
+			}
+		}
+	}
+	return NULL;	
+}
+
+CyberiadaNode* ElementCollection::to_node() const
+{
+	load_content();
+	CYB_COUNT_SCOPE(countToNode);
+	CyberiadaNode* node = Element::to_node();
+	if (has_geometry()) {
+		node->geometry_rect = geometry_rect.c_rect();
+	}
+	if (has_color()) {
+		cyberiada_copy_string(&(node->color), &(node->color_len), color.c_str());
+	}
+	for (ElementList::const_iterator i = children.begin(); i != children.end(); i++) {
+		const Element* e = *i;
+		CYB_ASSERT(e);
+		if (e->get_type() == elementTransition) {
+			continue;
+		}
+		CyberiadaNode* child = e->to_node();
+		CYB_ASSERT(child);
+		child->parent = node;
+		if (node->children) {
+			CyberiadaNode* n = node->children;
+			while (n->next) n = n->next;
+			n->next = child;
+		} else {
+			node->children = child;
+		}
+	}
+	return node;
+}
+
+ConstElementList ElementCollection::get_children() const
+{
+	load_content();
+	ConstElementList result;
+	for (ElementList::const_iterator i = children.begin(); i != children.end(); i++) {
+		result.push_back(static_cast<const Element*>(*i));
+	}
+	return result;
+}
+
+Rect ElementCollection::get_bound_rect(const Document& d) const
+{
+	load_content();
+	CYB_COUNT_SCOPE(countGetBoundRect);
+	CYB_COUNT_VISIT(countGetBoundRect);
+	Rect r, parent;
+	if (has_geometry()) {
+		parent = geometry_rect;
+		r.expand(geometry_rect, d);
+	}
+	if (has_children()) {
+		for (ElementList::const_iterator i = children.begin(); i != children.end(); i++) {
+			CYB_ASSERT(*i);
+			Rect ch_r = (*i)->get_bound_rect(d);
+			if ((*i)->get_type() == elementTransition) {
+				continue;
+				const Transition* t = static_cast<const Transition*>(*i);
+				const Element* source = d.find_element_by_id(t->source_element_id());
+				const Element* target = d.find_element_by_id(t->target_element_id());
+				if (!source || !source->has_geometry() || !target || !target->has_geometry()) {
+					continue;
+				}
+				Rect source_rect = source->get_bound_rect(d);
+				if (d.get_geometry_format() == geometryFormatCyberiada10 ||
+					d.get_geometry_format() == geometryFormatQt) {
+					ch_r.x += source_rect.x;
+					ch_r.y += source_rect.y;
+				}
+			} else {
+				if (d.get_geometry_format() == geometryFormatCyberiada10 ||
+					d.get_geometry_format() == geometryFormatQt) {
+					ch_r.x += parent.x;
+					ch_r.y += parent.y;
+				}
+			}
+			r.expand(ch_r, d);
+		}
+	}
+	//std::cerr << "element " << get_id() << " " << get_name() << " } rect " << r << std::endl;
+	return r;
+}
+
+void ElementCollection::clean_geometry()
+{
+	geometry_rect = Rect();
+	if (has_children()) {
+		for (ElementList::iterator i = children.begin(); i != children.end(); i++) {
+			(*i)->clean_geometry();
+		}
+	}
+	modified();
+	CYB_ASSERT(!has_geometry());
+}
+
+void ElementCollection::round_geometry()
+{
+	if (has_geometry()) {
+		geometry_rect.round();
+		modified();
+	};
+	if (has_children()) {
+		for (ElementList::iterator i = children.begin(); i != children.end(); i++) {
+			(*i)->round_geometry();
+		}
+	}
+}
+
+void ElementCollection::copy_elements(const ElementCollection& source)
+{
+	CYB_ASSERT(children.empty());
+	source.load_content();
+	for (ElementList::const_iterator i = source.children.begin(); i != source.children.end(); i++) {
+		const Element* e = *i;
+		Element* new_e = e->copy(this);
+		children.push_back(new_e);
+	}
+}
+
+void ElementCollection::import_nodes_recursively(CyberiadaNode* nodes, Element** metainfo_element)
+{
+	ElementType t = get_type();
+
+	for (CyberiadaNode* n = nodes; n; n = n->next) {
+		Element* element = NULL;
+		State* state = NULL;
+
+		CYB_ASSERT(n->id);
+
+		Point  point;
+		Rect   rect;
+		Color  _color;
+		String comment_body;
+		String comment_markup;
+
+		if (n->geometry_rect) {
+			rect = Rect(n->geometry_rect);
+		}
+		if (n->geometry_point) {
+			point = Point(n->geometry_point);
+		}
+		if (n->color) {
+			_color = Color(n->color);
+		}
+		
+		switch (n->type) {
+		case cybNodeRegion:
+			if (t != elementSimpleState &&
+				t != elementCompositeState) {
+					
+				throw CybMLException("Children region node " + std::string(n->id) +
+									 " inside element with type " +
+									 std::to_string(t));
+			}
+			if (n->next) {
+				throw CybMLException("More than one region node for node " + get_id() + " are not supported");
+			}
+			// no new element actually			
+			break;
+			
+		case cybNodeSimpleState:
+		case cybNodeCompositeState:
+			if (!n->title) {
+				throw CybMLException("State element w/o title");
+			}
+			state = new State(this, n->id, n->title, rect, Rect(), _color);
+			CYB_ASSERT(state);
+
+			if (n->collapsed_flag) {
+				state->set_collapsed(true);
+			}
+			
+			for (CyberiadaAction* a = n->actions; a; a = a->next) {
+				if (a->type == cybActionTransition) {
+					state->add_action(Action(a->trigger, a->guard, a->behavior));
+				} else {
+					ActionType at;
+					if (a->type == cybActionEntry) {
+						at = actionEntry;
+					} else if (a->type == cybActionExit) {
+						at = actionExit;
+					} else {
+						throw CybMLException("Unsupported action type " + std::to_string(a->type));
+					}
+					if (a->guard && *(a->guard)) {
+						// guard is not empty
+						throw CybMLException("Guards are not allowed in entry/exit actions");
+					}
+					state->add_action(Action(at, a->behavior));
+				}
+			}
+			
+			element = state;
+			
+			break;
+
+		case cybNodeComment:
+		case cybNodeFormalComment:
+			if (!n->comment_data) {
+				throw CybMLException("No comment data in Comment element");
+			}
+	
+			if (n->comment_data->body) { 
+				comment_body = n->comment_data->body;
+			}
+			if (n->comment_data->markup) {
+				comment_markup = n->comment_data->markup;
+			}
+
+			if (n->title) {
+				Comment* comment = new Comment(this, n->id, comment_body, n->title,
+											   n->type == cybNodeComment, comment_markup, rect, _color);
+				element = comment;
+				if (metainfo_element && n->type == cybNodeFormalComment && String(n->title) == META_NODE_NAME) {
+					CYB_ASSERT(!*metainfo_element);
+					*metainfo_element = comment;
+				}
+			} else {
+				element = new Comment(this, n->id, comment_body, n->type == cybNodeComment,
+									  comment_markup, rect, _color);
+			}
+			break;
+
+		case cybNodeChoice:
+			if (n->title) {
+				element = new ChoicePseudostate(this, n->id, n->title, rect, _color);
+			} else {
+				element = new ChoicePseudostate(this, n->id, rect, _color);
+			}
+			break;
+			
+		case cybNodeInitial:
+			if (n->title) {
+				element = new InitialPseudostate(this, n->id, n->title, point);
+			} else {
+				element = new InitialPseudostate(this, n->id, point);
+			}
+
+			break;
+
+		case cybNodeTerminate:
+			if (n->title) {
+				element = new TerminatePseudostate(this, n->id, n->title, point);
+			} else {
+				element = new TerminatePseudostate(this, n->id, point);
+			}
+
+			break;
+			
+		case cybNodeFinal:
+			if (n->title) {
+				element = new FinalState(this, n->id, n->title, point);
+			} else {
+				element = new FinalState(this, n->id, point);
+			}
+
+			break;
+	
+		default:
+			throw CybMLException("Unsupported node type " + std::to_string(n->type));
+		}
+
+		if (element != NULL) {
+			if (n->formal_title) {
+				element->set_formal_name(n->formal_title);
+			}
+			
+			add_element(element);
+			
+			if (n->children) {
+				t = get_type();
+				if (t != elementSM &&
+					t != elementSimpleState &&
+					t != elementCompositeState) {
+					
+					throw CybMLException("Children nodes inside element with type " + std::to_string(t));
+				}
+			
+				static_cast<ElementCollection*>(element)->import_nodes_recursively(n->children, metainfo_element);
+			}
+		} else {
+			// region node
+			if (rect.valid) {
+				(static_cast<State*>(this))->update_region_geometry_rect(rect);
+			}
+
+			if (n->children) {
+				import_nodes_recursively(n->children, metainfo_element);
+			}
+		}
+	}
+}
+
+ContentHash ElementCollection::own_content_hash() const
+{
+	ContentHash h = Element::own_content_hash();
+	h = hash_rect(h, geometry_rect);
+	return hash_mix(h, hash_string(color));
+}
+
+void ElementCollection::add_memory_usage(MemoryUsage& usage) const
+{
+	Element::add_memory_usage(usage);
+	usage.strings += string_heap_bytes(color);
+	add_geometry_usage(usage, sizeof(geometry_rect));
+	usage.children += children.capacity() * sizeof(Element*);
+}
+
+ContentHash ElementCollection::children_content_hash(ContentHash h, bool& cacheable) const
+{
+	load_content();
+	h = hash_mix(h, children.size());
+	for (ElementList::const_iterator i = children.begin(); i != children.end(); i++) {
+		h = hash_mix(h, (*i)->content_hash(cacheable));
+	}
+	return h;
+}
+
+void ElementCollection::content_diff(const Element& e, std::vector<ID>& ids) const
+{
+	if (content_hash() == e.content_hash()) {
+		return ;
+	}
+	if (e.get_type() != get_type()) {
+		ids.push_back(get_id());
+		return ;
+	}
+	const ElementCollection& ec = static_cast<const ElementCollection&>(e);
+	if (own_content_hash() != ec.own_content_hash() || children.size() != ec.children.size()) {
+		ids.push_back(get_id());
+		return ;
+	}
+	for (size_t i = 0; i < children.size(); i++) {
+		const Element* child = children[i];
+		const Element* other_child = ec.children[i];
+		if (child->get_type() != other_child->get_type()) {
+			if (child->content_hash() != other_child->content_hash()) {
+				ids.push_back(child->get_id());
+			}
+		} else {
+			child->content_diff(*other_child, ids);
+		}
+	}
+}
+
+void ElementCollection::print(DumpBuffer& b) const
+{
+	if (has_geometry() && geometry_rect.valid) {
+		b << ", geometry: " << geometry_rect;
+		if (has_color()) {
+			b << ", color: " << color;
+		}
+	}
+	if (has_children()) {
+		b << ", elements: {";
+		for (ElementList::const_iterator i = children.begin(); i != children.end(); i++) {
+			const Element* e = *i;
+			CYB_ASSERT(e);
+			b << *e;
+			if (std::next(i) != children.end()) {
+				b << ", ";
+			}
+		}
+		b << "}";
+	}
+}
+
+// -----------------------------------------------------------------------------
+// Pseudostate
+// -----------------------------------------------------------------------------
+
+Pseudostate::Pseudostate(Element* _parent, ElementType _type, const ID& _id, const Point& p):
+	Vertex(_parent, _type, _id, p)
+{
+}
+
+Pseudostate::Pseudostate(Element* _parent, ElementType _type, const ID& _id, const Name& _name, const Point& p):
+	Vertex(_parent, _type, _id, _name, p)
+{
+}
+
+// -----------------------------------------------------------------------------
+// Initial pseudostate
+// -----------------------------------------------------------------------------
+
+InitialPseudostate::InitialPseudostate(Element* _parent, const ID& _id, const Point& p):
+	Pseudostate(_parent, elementInitial, _id, p)
+{
+}
+
+InitialPseudostate::InitialPseudostate(Element* _parent, const ID& _id, const Name& _name, const Point& p):
+	Pseudostate(_parent, elementInitial, _id, _name, p)
+{
+}
+
+Element* InitialPseudostate::copy(Element* parent) const
+{
+	if (has_name()) {
+		return new InitialPseudostate(parent, get_id(), get_name(), get_geometry_point());
+	} else {
+		return new InitialPseudostate(parent, get_id(), get_geometry_point());
+	}
+}
+
+// -----------------------------------------------------------------------------
+// Terminate pseudostate
+// -----------------------------------------------------------------------------
+
+TerminatePseudostate::TerminatePseudostate(Element* _parent, const ID& _id, const Point& p):
+	Pseudostate(_parent, elementTerminate, _id, p)
+{
+}
+
+TerminatePseudostate::TerminatePseudostate(Element* _parent, const ID& _id, const Name& _name, const Point& p):
+	Pseudostate(_parent, elementTerminate, _id, _name, p)
+{
+}
+
+Element* TerminatePseudostate::copy(Element* parent) const
+{
+	if (has_name()) {
+		return new TerminatePseudostate(parent, get_id(), get_name(), get_geometry_point());
+	} else {
+		return new TerminatePseudostate(parent, get_id(), get_geometry_point());
+	}
+}
+
+// -----------------------------------------------------------------------------
+// Choice pseudostate
+// -----------------------------------------------------------------------------
+
+ChoicePseudostate::ChoicePseudostate(Element* _parent, const ID& _id, const Rect& r, const Color& _color):
+	Pseudostate(_parent, elementChoice, _id), geometry_rect(r), color(_color)
+{
+}
+
+ChoicePseudostate::ChoicePseudostate(Element* _parent, const ID& _id, const Name& _name, const Rect& r, const Color& _color):
+	Pseudostate(_parent, elementChoice, _id, _name), geometry_rect(r), color(_color)
+{
+}
+
+ChoicePseudostate::ChoicePseudostate(const ChoicePseudostate& cp):
+	Pseudostate(cp), geometry_rect(cp.geometry_rect), color(cp.color)
+{
+}
+
+CyberiadaNode* ChoicePseudostate::to_node() const
+{
+	CYB_COUNT_SCOPE(countToNode);
+	CyberiadaNode* node = Element::to_node();
+	if (has_geometry()) {
+		node->geometry_rect = geometry_rect.c_rect();
+		if (has_color()) {
+			cyberiada_copy_string(&(node->color), &(node->color_len), color.c_str());
+		}
+	}
+	return node;
+}
+
+Rect ChoicePseudostate::get_bound_rect(const Document&) const
+{
+	CYB_COUNT_SCOPE(countGetBoundRect);
+	CYB_COUNT_VISIT(countGetBoundRect);
+	Rect r;
+	if (has_geometry()) {
+		r = geometry_rect;
+	}
+	return r;
+}
+
+void ChoicePseudostate::clean_geometry()
+{
+	geometry_rect = Rect();
+	modified();
+	CYB_ASSERT(!has_geometry());
+}
+
+void ChoicePseudostate::round_geometry()
+{
+	if (has_geometry()) {
+		geometry_rect.round();
+		modified();
+	}
+}
+
+Element* ChoicePseudostate::copy(Element* parent) const
+{
+	if (has_name()) {
+		return new ChoicePseudostate(parent, get_id(), get_name(), get_geometry_rect(), color);
+	} else {
+		return new ChoicePseudostate(parent, get_id(), get_geometry_rect(), color);
+	}
+}
+
+ContentHash ChoicePseudostate::own_content_hash() const
+{
+	ContentHash h = Vertex::own_content_hash();
+	h = hash_rect(h, geometry_rect);
+	return hash_mix(h, hash_string(color));
+}
+
+void ChoicePseudostate::add_memory_usage(MemoryUsage& usage) const
+{
+	Vertex::add_memory_usage(usage);
+	usage.strings += string_heap_bytes(color);
+	add_geometry_usage(usage, sizeof(geometry_rect));
+}
+
+void ChoicePseudostate::print(DumpBuffer& b) const
+{
+	Element::print(b);
+	if (has_geometry()) {
+		b << ", geometry: " << geometry_rect;
+		if (has_color()) {
+			b << ", color: " << color;
+		}
+	}		
+	b << "}";
+}
+
+// -----------------------------------------------------------------------------
+// Final state
+// -----------------------------------------------------------------------------
+
+FinalState::FinalState(Element* _parent, const ID& _id, const Point& p):
+	Vertex(_parent, elementFinal, _id, p)
+{
+}
+
+FinalState::FinalState(Element* _parent, const ID& _id, const Name& _name, const Point& p):
+	Vertex(_parent, elementFinal, _id, _name, p)
+{
+}
+
+Element* FinalState::copy(Element* parent) const
+{
+	if (has_name()) {
+		return new FinalState(parent, get_id(), get_name(), get_geometry_point());
+	} else {
+		return new FinalState(parent, get_id(), get_geometry_point());
+	}
+}
+
+// -----------------------------------------------------------------------------
+// State
+// -----------------------------------------------------------------------------
+
+std::ostream& Cyberiada::operator<<(std::ostream& os, const Action& a)
+{
+	DumpBuffer b(os);
+	a.print(b);
+	b.write(os);
+	return os;
+}
+
+State::State(Element* _parent, const ID& _id, const Name& _name, const Rect& r, const Rect& region, const Color& c):
+	ElementCollection(_parent, elementSimpleState, _id, _name, r, c), collapsed(false), region_rect(region) 
+{
+}
+
+State::State(const State& s):
+	ElementCollection(s), collapsed(s.collapsed), region_rect(s.region_rect), actions(s.actions)
+{
+}
+
+void State::add_element(Element* e)
+{
+	ElementCollection::add_element(e);
+	update_state_type();
+}
+
+void State::remove_element(const ID& _id)
+{
+	ElementCollection::remove_element(_id);
+	update_state_type();
+}
+
+void State::add_action(const Action& a)
+{
+	if (a.is_empty_transition()) {
+		throw ParametersException("Empty transition action is not allowed");
+	}
+	if (a.get_type() != actionTransition && a.has_guard()) {
+		throw ParametersException("Guards are not allowed for entry/exit activities");
+	}
+	actions.push_back(a);
+	modified();
+}
+
+std::vector<const State*> State::get_substates() const
+{
+	ElementTypes types = { elementSimpleState,
+						   elementCompositeState };
+	std::vector<const State*> result;
+	ConstElementList states = find_elements_by_types(types);
+	for (ConstElementList::const_iterator i = states.begin(); i != states.end(); i++) {
+		result.push_back(static_cast<const State*>(*i));
+	}
+	return result;
+}
+
+std::vector<State*> State::get_substates()
+{
+	ElementTypes types = { elementSimpleState,
+						   elementCompositeState };
+	std::vector<State*> result;
+	ElementList states = find_elements_by_types(types);
+	for (ElementList::const_iterator i = states.begin(); i != states.end(); i++) {
+		result.push_back(static_cast<State*>(*i));
+	}
+	return result;
+}
+
+void State::update_state_type()
+{
+	if (has_children()) {
+		this->set_type(elementCompositeState);
+	} else {
+		this->set_type(elementSimpleState);
+	}
+}
+
+static CyberiadaAction* to_action(const Action& a)
+{
+	if (!a.is_empty_transition()) {
+		CyberiadaActionType at;
+		if (a.get_type() == actionEntry) {
+			at = cybActionEntry;
+		} else if (a.get_type() == actionExit) {
+			at = cybActionExit;
+		} else {
+			CYB_ASSERT(a.get_type() == actionTransition);
+			at = cybActionTransition;
+		}
+		CyberiadaAction* action = cyberiada_new_action(at,
+													   a.get_trigger().c_str(),
+													   a.get_guard().c_str(),
+													   a.get_behavior().c_str());
+		return action;
+	}
+	return NULL;
+}
+
+static CyberiadaAction* to_action(const std::vector<Action>& actions)
+{
+	CyberiadaAction* node_actions = NULL;
+	if (actions.size() > 0) {
+		for (std::vector<Action>::const_iterator i = actions.begin(); i != actions.end(); i++) {
+			const Action& a = *i;
+			CyberiadaActionType at;
+			if (a.get_type() == actionEntry) {
+				at = cybActionEntry;
+			} else if (a.get_type() == actionExit) {
+				at = cybActionExit;
+			} else {
+				CYB_ASSERT(a.get_type() == actionTransition);
+				at = cybActionTransition;
+			}
+			CyberiadaAction* action = cyberiada_new_action(at,
+														   a.get_trigger().c_str(),
+														   a.get_guard().c_str(),
+														   a.get_behavior().c_str());
+			if (node_actions) {
+				CyberiadaAction* last_a = node_actions;
+				while (last_a->next) last_a = last_a->next;
+				last_a->next = action;
+			} else {
+				node_actions = action;
+			}
+		}
+	}
+	return node_actions;
+}
+
+template<typename T>
+static
+ActionsDiffFlags compare_two_actions(const T& a1, const T& a2)
+{
+	CyberiadaAction* this_a = to_action(a1);
+	CyberiadaAction* comp_a = to_action(a2);
+
+	int flags = 0;
+	int result = cyberiada_compare_node_actions(this_a, comp_a, &flags);
+	if (result != CYBERIADA_NO_ERROR) {
+		if (this_a) cyberiada_destroy_action(this_a);
+		if (comp_a) cyberiada_destroy_action(comp_a);
+		throw CybMLException("Error while comparing actions, res: " +
+							 std::to_string(result));
+	}
+	if (this_a) cyberiada_destroy_action(this_a);
+	if (comp_a) cyberiada_destroy_action(comp_a);
+	return ActionsDiffFlags(flags);
+}
+
+ActionsDiffFlags State::compare_actions(const State& s) const
+{
+	return compare_two_actions(actions, s.get_actions());
+}
+
+CyberiadaNode* State::to_node() const
+{
+	CYB_COUNT_SCOPE(countToNode);
+	CyberiadaNode* node = ElementCollection::to_node();
+
+	if (has_actions()) {
+		node->actions = to_action(actions);
+	}
+
+	if (is_collapsed()) {
+		node->collapsed_flag = 1;
+	}
+	
+	if (node->children) {
+		std::string region_node_id = get_id() + REGION_NAME_SUFFIX;
+		CyberiadaNode* region_node = cyberiada_new_node(region_node_id.c_str());
+		region_node->type = cybNodeRegion;
+		region_node->children = node->children;
+		region_node->parent = node;
+		if (region_rect.valid) {
+			region_node->geometry_rect = region_rect.c_rect();
+		}
+		for (CyberiadaNode* n = region_node->children; n; n = n->next) {
+			n->parent = region_node;
+		}
+		node->children = region_node;
+	}
+	
+	return node;
+}
+
+Element* State::copy(Element* parent) const
+{
+	State* s = new State(parent, get_id(), get_name(), get_geometry_rect(), get_region_geometry_rect(), get_color());
+	s->copy_elements(*this);
+	s->actions = actions;
+	s->update_state_type();
+	return s;
+}
+
+ContentHash State::own_content_hash() const
+{
+	ContentHash h = ElementCollection::own_content_hash();
+	h = hash_mix(h, collapsed);
+	h = hash_rect(h, region_rect);
+	h = hash_mix(h, actions.size());
+	for (std::vector<Action>::const_iterator i = actions.begin(); i != actions.end(); i++) {
+		h = hash_mix(h, hash_action(*i));
+	}
+	return h;
+}
+
+void State::add_memory_usage(MemoryUsage& usage) const
+{
+	ElementCollection::add_memory_usage(usage);
+	add_geometry_usage(usage, sizeof(region_rect));
+	usage.objects += actions.capacity() * sizeof(Action);
+	for (std::vector<Action>::const_iterator i = actions.begin(); i != actions.end(); i++) {
+		usage.strings += action_heap_bytes(*i);
+	}
+}
+
+void State::print(DumpBuffer& b) const
+{
+	Element::print(b);
+	if (has_actions()) {
+		b << ", actions: {";
+		for (std::vector<Action>::const_iterator i = actions.begin(); i != actions.end(); i++) {
+			b << "a {" << *i << "}";
+			if (std::next(i) != actions.end()) {
+				b << ", ";
+			}
+		}
+		b << "}";
+	}
+	ElementCollection::print(b);
+	if (region_rect.valid) {
+		b << ", region: " << region_rect;
+	}
+	b << "}";
+}
+
+// -----------------------------------------------------------------------------
+// Transition
+// -----------------------------------------------------------------------------
+
+Transition::Transition(Element* _parent, TransitionType ttype,
+					   const ID& _id, const ID& _source_id, const ID& _target_id,
+					   const Action& _action, const Polyline& pl, const Point& sp, const Point& tp,
+					   const Point& label_p, const Rect& label_r, const Color& c):
+	Element(_parent, elementTransition, _id), transition_type(ttype), source_id(_source_id), target_id(_target_id), action(_action),
+	source_point(sp), target_point(tp), label_point(label_p), label_rect(label_r), polyline(pl), color(c)
+{
+}
+
+Transition::Transition(const Transition& t):
+	Element(t), transition_type(t.transition_type), source_id(t.source_id), target_id(t.target_id), action(t.action),
+	source_point(t.source_point), target_point(t.target_point), label_point(t.label_point),
+	label_rect(t.label_rect), polyline(t.polyline), color(t.color)
+{
+}
+
+CyberiadaEdge* Transition::to_edge() const
+{
+	CYB_COUNT_SCOPE(countToEdge);
+	CYB_COUNT_VISIT(countToEdge);
+	CYB_ASSERT(!source_id.empty());
+	CYB_ASSERT(!target_id.empty());
+	CyberiadaEdge* edge = cyberiada_new_edge(get_id().c_str(),
+											 source_id.c_str(),
+											 target_id.c_str(),
+											 transition_type == transitionExternal);
+	edge->type = cybEdgeLocalTransition;
+	if (has_action()) {
+		edge->action = to_action(action);
+	}
+	if (has_geometry()) {
+		if (source_point.valid) {
+			edge->geometry_source_point = source_point.c_point();
+		}
+		if (target_point.valid) {
+			edge->geometry_target_point = target_point.c_point();
+		}
+		if (label_point.valid) {
+			edge->geometry_label_point = label_point.c_point();
+		}
+		if (label_rect.valid) {
+			edge->geometry_label_rect = label_rect.c_rect();
+		}
+		if (has_polyline()) {
+			edge->geometry_polyline = polyline.c_polyline();
+		}
+		if (has_color()) {
+			cyberiada_copy_string(&(edge->color), &(edge->color_len), color.c_str());
+		}		
+	}
+	return edge;
+}
+
+Rect Transition::get_bound_rect(const Document& d) const
+{
+	CYB_COUNT_SCOPE(countGetBoundRect);
+	CYB_COUNT_VISIT(countGetBoundRect);
+	Rect r;
+	if (has_geometry() && has_polyline()) {
+		r.expand(polyline, d);
+	}
+	return r;
+}
+
+void Transition::update(const Point &source, const Point &target)
+{
+    source_point = source;
+    target_point = target;
+	modified();
+}
+
+void Transition::update(const Polyline &pl)
+{
+    polyline = pl;
+	modified();
+}
+
+void Transition::update(const ID &source, const ID &target)
+{
+    source_id = source;
+    target_id = target;
+	modified();
+}
+
+void Transition::clean_geometry()
+{
+	source_point = Point();
+	target_point = Point();
+	label_point = Point();
+	label_rect = Rect();
+	polyline.clear();
+	modified();
+	CYB_ASSERT(!has_geometry());
+}
+
+void Transition::round_geometry()
+{
+	if (has_geometry()) {
+		source_point.round();
+		target_point.round();
+		label_point.round();
+		label_rect.round();
+		polyline.round();
+		modified();
+	}
+}
+
+ActionsDiffFlags Transition::compare_actions(const Transition& t) const
+{
+	return compare_two_actions(action, t.get_action());
+}
+
+Element* Transition::copy(Element* parent) const
+{
+	return new Transition(parent, transition_type, get_id(), source_id, target_id, action,
+						  polyline, source_point, target_point, label_point,
+						  label_rect, get_color());
+}
+
+ContentHash Transition::own_content_hash() const
+{
+	ContentHash h = Element::own_content_hash();
+	h = hash_mix(h, transition_type);
+	h = hash_mix(h, hash_string(source_id));
+	h = hash_mix(h, hash_string(target_id));
+	h = hash_mix(h, hash_action(action));
+	h = hash_point(h, source_point);
+	h = hash_point(h, target_point);
+	h = hash_point(h, label_point);
+	h = hash_rect(h, label_rect);
+	h = hash_polyline(h, polyline);
+	return hash_mix(h, hash_string(color));
+}
+
+void Transition::add_memory_usage(MemoryUsage& usage) const
+{
+	Element::add_memory_usage(usage);
+	usage.strings += (string_heap_bytes(source_id) + string_heap_bytes(target_id) +
+					  action_heap_bytes(action) + string_heap_bytes(color));
+	add_geometry_usage(usage, sizeof(source_point) + sizeof(target_point) + sizeof(label_point) + sizeof(label_rect));
+	usage.polylines += polyline_heap_bytes(polyline);
+}
+
+void Transition::print(DumpBuffer& b) const
+{
+	Element::print(b);
+	b << ", type: " << (transition_type == transitionExternal ? "ext" : "loc");
+	b << ", source: '" << source_id << "'";
+	b << ", target: '" << target_id << "'";
+	if (has_action()) {
+		b << ", action: {";
+		b << action;
+		b << "}";
+	}
+	if (has_geometry()) {
+		if (source_point.valid) {
+			b << ", sp: " << source_point;
+		}
+		if (target_point.valid) {
+			b << ", tp: " << target_point;
+		}
+		if (label_point.valid) {
+			b << ", label: " << label_point;
+		} else if (label_rect.valid) {
+			b << ", rect: " << label_rect;
+		}
+		if (has_polyline()) {
+			b << ", polyline: " << polyline;
+		}
+		if (has_color()) {
+			b << ", color: " << color;
+		}
+	}
+	b << "}";
+}
+
+// -----------------------------------------------------------------------------
+// State Machine
+// -----------------------------------------------------------------------------
+StateMachine::StateMachine(Element* _parent, const ID& _id, const Name& _name, const Rect& r):
+	ElementCollection(_parent, elementSM, _id, _name, r)
+{	
+}
+
+StateMachine::StateMachine(const StateMachine& sm):
+	ElementCollection(sm)
+{
+}
+
+std::vector<const Comment*> StateMachine::get_comments() const
+{
+	ElementTypes types = { elementComment,
+						   elementFormalComment };
+	std::vector<const Comment*> result;
+	ConstElementList comments = find_elements_by_types(types);
+	for (ConstElementList::const_iterator i = comments.begin(); i != comments.end(); i++) {
+		result.push_back(static_cast<const Comment*>(*i));
+	}
+	return result;
+}
+
+std::vector<Comment*> StateMachine::get_comments()
+{
+	ElementTypes types = { elementComment,
+						   elementFormalComment };
+	std::vector<Comment*> result;
+	ElementList comments = find_elements_by_types(types);
+	for (ElementList::iterator i = comments.begin(); i != comments.end(); i++) {
+		result.push_back(static_cast<Comment*>(*i));
+	}
+	return result;
+}
+
+std::vector<const Transition*> StateMachine::get_transitions() const
+{
+	std::vector<const Transition*> result;
+	ConstElementList transitions = find_elements_by_type(elementTransition);
+	for (ConstElementList::const_iterator i = transitions.begin(); i != transitions.end(); i++) {
+		result.push_back(static_cast<const Transition*>(*i));
+	}
+	return result;
+}
+
+std::vector<Transition*> StateMachine::get_transitions()
+{
+	std::vector<Transition*> result;
+	ElementList transitions = find_elements_by_type(elementTransition);
+	for (ElementList::iterator i = transitions.begin(); i != transitions.end(); i++) {
+		result.push_back(static_cast<Transition*>(*i));
+	}
+	return result;
+}
+
+// Rect StateMachine::get_bound_rect(const Document& d) const
+// {
+// 	Rect r;
+// 	if (has_geometry()) {
+// 		r = ElementCollection::get_bound_rect(d);
+// 	} else if (has_children()) {
+// 		for (ElementList::const_iterator i = children.begin(); i != children.end(); i++) {
+// 			r.expand((*i)->get_bound_rect(d), d);
+// 		}
+// 	}
+// 	return r;
+// }
+
+void StateMachine::from_sm(const CyberiadaSM* sm, Element** metainfo_element, bool trusted)
+{
+	if (sm) {
+		if (sm->nodes && sm->nodes->children) {
+			import_nodes_recursively(sm->nodes->children, metainfo_element);
+		}
+		if (sm->edges) { 
+			import_edges(sm->edges, trusted);
+		}
+	}
+}
+
+CyberiadaSM* StateMachine::to_sm() const
+{
+	CYB_COUNT_SCOPE(countToSM);
+	CYB_COUNT_VISIT(countToSM);
+	CyberiadaSM* new_sm = cyberiada_new_sm();
+	new_sm->nodes = to_node(Point(0.0, 0.0)); // center_point ?
+	export_edges(&(new_sm->edges), new_sm);
+	return new_sm;
+}
+
+CyberiadaNode* StateMachine::to_node(const Point& center) const
+{
+	CYB_COUNT_SCOPE(countToNode);
+	CyberiadaNode* node = ElementCollection::to_node();
+	CYB_ASSERT(node != NULL);
+	if (node->geometry_rect) {
+		return node;
+	}
+	// move center only if SM has no geometry
+	for (CyberiadaNode* n = node->children; n; n = n->next) {
+		if (n->geometry_point) {
+			n->geometry_point->x += center.x;
+			n->geometry_point->y += center.y;			
+		}
+		if (n->geometry_rect) {
+			n->geometry_rect->x += center.x;
+			n->geometry_rect->y += center.y;			
+		}		
+	}
+	return node;
+}
+
+Element* StateMachine::copy(Element* parent) const
+{
+	 StateMachine* sm = new StateMachine(*this);
+	 sm->update_parent(parent);
+	 return sm;
+}
+
+void StateMachine::print(DumpBuffer& b) const
+{
+	Element::print(b);
+	ElementCollection::print(b);
+	b << "}";
+}
+
+void StateMachine::import_edges(CyberiadaEdge* edges, bool trusted)
+{
+	for (CyberiadaEdge* e = edges; e; e = e->next) {
+		CYB_ASSERT(e->id);
+
+		Element* element = NULL;
+		Point    source_point, target_point, label_point;
+		Rect     label_rect;
+		Polyline polyline;
+		Color    _color;
+		Action   action;
+
+		if (e->geometry_source_point) {
+			source_point = Point(e->geometry_source_point);
+		}
+		if (e->geometry_target_point) {
+			target_point = Point(e->geometry_target_point);
+		}
+		if (e->geometry_label_point) {
+			label_point = Point(e->geometry_label_point);
+		}
+		if (e->geometry_label_rect) {
+			label_rect = Rect(e->geometry_label_rect);
+		}
+		if (e->geometry_polyline) {
+			for (CyberiadaPolyline* pl = e->geometry_polyline; pl; pl = pl->next) {
+				polyline.push_back(Point(pl->point.x, pl->point.y));
 			}
-			CyberiadaAction* action = cyberiada_new_action(at,
-														   a.get_trigger().c_str(),
-														   a.get_guard().c_str(),
-														   a.get_behavior().c_str());
-			if (node_actions) {
-				CyberiadaAction* last_a = node_actions;
-				while (last_a->next) last_a = last_a->next;
-				last_a->next = action;
+		}
+		if (e->color) {
+			_color = Color(e->color);
+		}
+
+		// the transitions refer to their ends by ID, so the trusted import does not check them
+		Element* source_element = NULL;
+		Element* target_element = NULL;
+		if (!trusted || e->type == cybEdgeComment) {
+			source_element = find_element_by_id(e->source_id);
+			CYB_ASSERT(source_element);
+			target_element = find_element_by_id(e->target_id);
+			CYB_ASSERT(target_element);
+		}
+		Comment* comment = NULL;
+		
+		switch (e->type) {
+		case cybEdgeExternalTransition:
+		case cybEdgeLocalTransition:
+			if (e->action) {
+				action = Action(e->action->trigger, e->action->guard, e->action->behavior);
+			}
+	
+			element = new Transition(this, e->type == cybEdgeExternalTransition ? transitionExternal: transitionLocal, 
+									 e->id, e->source_id, e->target_id,
+									 action, polyline, source_point, target_point, label_point,
+									 label_rect, _color);
+			break;
+
+		case cybEdgeComment:
+			CYB_ASSERT(source_element->get_type() == elementComment ||
+					   source_element->get_type() == elementFormalComment);
+			CYB_ASSERT(e->comment_subject);
+
+			comment = static_cast<Comment*>(source_element);
+			
+			if (e->comment_subject->type == cybCommentSubjectNode) {
+				comment->add_subject(CommentSubject(e->id, target_element, source_point, target_point, polyline));
 			} else {
-				node_actions = action;
+				CommentSubjectType cst;
+				if (e->comment_subject->type == cybCommentSubjectNameFragment) {
+					cst = commentSubjectName;
+				} else if (e->comment_subject->type == cybCommentSubjectDataFragment) {
+					cst = commentSubjectData;
+				} else {
+					throw CybMLException("Unsupported comment subject type " + std::to_string(e->comment_subject->type));
+				}
+				CYB_ASSERT(e->comment_subject->fragment);
+				comment->add_subject(CommentSubject(e->id, target_element, cst, e->comment_subject->fragment,
+													source_point, target_point, polyline));
+			}			
+			break;
+			
+		default:
+			throw CybMLException("Unsupported edge type " + std::to_string(e->type));
+		}
+
+		add_element(element);
+	}	
+}
+
+void StateMachine::export_edges(CyberiadaEdge** edges, const CyberiadaSM* new_sm) const
+{
+	CyberiadaEdge* edge;
+	size_t c = 0;
+	std::vector<const Transition*> transitions = get_transitions();
+	for (std::vector<const Transition*>::const_iterator i = transitions.begin(); i != transitions.end(); i++) {
+		const Transition* t = *i;
+		edge = t->to_edge();
+		if (*edges) {
+			CyberiadaEdge* e = *edges;
+			while (e->next) e = e->next;
+			e->next = edge;
+		} else {
+			*edges = edge;
+		}
+		c++;
+	}
+	std::vector<const Comment*> comments = get_comments();
+	for (std::vector<const Comment*>::const_iterator j = comments.begin(); j != comments.end(); j++) {
+		const Comment* c = *j;
+		edge = c->subjects_to_edges();
+		if (*edges) {
+			CyberiadaEdge* e = *edges;
+			while (e->next) e = e->next;
+			e->next = edge;
+		} else {
+			*edges = edge;
+		}
+	}
+	edge = *edges;
+	while (edge) {
+		edge->source = cyberiada_graph_find_node_by_id(new_sm->nodes, edge->source_id);
+		edge->target = cyberiada_graph_find_node_by_id(new_sm->nodes, edge->target_id);		
+		edge = edge->next;
+	}
+}
+
+SMIsomorphismResult StateMachine::check_isomorphism(const StateMachine& sm,
+													bool ignore_comments, bool require_initial) const
+{
+	return check_isomorphism_details(sm, ignore_comments, require_initial);
+}
+
+SMIsomorphismResult StateMachine::check_isomorphism_details(const StateMachine& sm,
+															bool ignore_comments, bool require_initial,
+															ID* new_initial,
+															std::vector<ID>* diff_nodes_first,
+															std::vector<ID>* diff_nodes_second,
+															std::vector<SMIsomorphismFlagsResult>* diff_nodes_flags,
+															std::vector<ID>* new_nodes,
+															std::vector<ID>* missing_nodes,
+															std::vector<ID>* diff_edges_first,
+															std::vector<ID>* diff_edges_second,
+															std::vector<SMIsomorphismFlagsResult>* diff_edges_flags,
+															std::vector<ID>* new_edges,
+															std::vector<ID>* missing_edges) const
+{
+	TraceScope trace(tracePhaseCheckIsomorphism, this);
+	if (children_count() == 0 || sm.children_count() == 0) {
+		throw ParametersException("Empty state machines are not allowed for isomorphism check");
+	}
+
+	CyberiadaSM* sm1 = to_sm();
+	CyberiadaSM* sm2 = sm.to_sm();
+
+	try {
+		SMIsomorphismResult result = check_sm_isomorphism(sm1, sm2, ignore_comments, require_initial, new_initial,
+														  diff_nodes_first, diff_nodes_second, diff_nodes_flags,
+														  new_nodes, missing_nodes,
+														  diff_edges_first, diff_edges_second, diff_edges_flags,
+														  new_edges, missing_edges);
+		cyberiada_destroy_sm(sm1);
+		cyberiada_destroy_sm(sm2);
+		return result;
+	} catch (const Exception&) {
+		cyberiada_destroy_sm(sm1);
+		cyberiada_destroy_sm(sm2);
+		throw;
+	}
+}
+
+SMIsomorphismResult StateMachine::check_sm_isomorphism(CyberiadaSM* sm1, CyberiadaSM* sm2,
+													   bool ignore_comments, bool require_initial,
+													   ID* new_initial,
+													   std::vector<ID>* diff_nodes_first,
+													   std::vector<ID>* diff_nodes_second,
+													   std::vector<SMIsomorphismFlagsResult>* diff_nodes_flags,
+													   std::vector<ID>* new_nodes,
+													   std::vector<ID>* missing_nodes,
+													   std::vector<ID>* diff_edges_first,
+													   std::vector<ID>* diff_edges_second,
+													   std::vector<SMIsomorphismFlagsResult>* diff_edges_flags,
+													   std::vector<ID>* new_edges,
+													   std::vector<ID>* missing_edges) const
+{
+	int res;
+	int result_flags = 0;
+	size_t sm_diff_nodes_size = 0, sm2_new_nodes_size = 0, sm1_missing_nodes_size = 0,
+		sm_diff_edges_size = 0, sm2_new_edges_size = 0, sm1_missing_edges_size = 0;
+	CyberiadaNode *sm_new_initial = NULL, **sm1_missing_nodes = NULL, **sm2_new_nodes = NULL;
+	CyberiadaEdge **sm2_new_edges = NULL, **sm1_missing_edges = NULL;
+	CyberiadaNodePair *sm_diff_nodes = NULL;
+	CyberiadaEdgePair *sm_diff_edges = NULL;
+	size_t *sm_diff_nodes_flags = NULL, *sm_diff_edges_flags = NULL;
+	
+	res = cyberiada_check_isomorphism(sm1, sm2,
+									  ignore_comments, require_initial,
+									  &result_flags,
+									  new_initial ? &sm_new_initial: NULL,
+									  (diff_nodes_first || diff_nodes_second || diff_nodes_flags) ? &sm_diff_nodes_size: NULL,
+									  (diff_nodes_first || diff_nodes_second) ? &sm_diff_nodes: NULL,
+									  diff_nodes_flags ? &sm_diff_nodes_flags: NULL,
+									  new_nodes ? &sm2_new_nodes_size: NULL,
+									  new_nodes ? &sm2_new_nodes: NULL,
+									  missing_nodes ? &sm1_missing_nodes_size: NULL,
+									  missing_nodes ? &sm1_missing_nodes: NULL,
+									  (diff_edges_first || diff_edges_second || diff_edges_flags) ? &sm_diff_edges_size: NULL,
+									  (diff_edges_first || diff_edges_second) ? &sm_diff_edges: NULL,
+									  diff_edges_flags ? &sm_diff_edges_flags: NULL,
+									  new_edges ? &sm2_new_edges_size: NULL,
+									  new_edges ? &sm2_new_edges: NULL,
+									  missing_edges ? &sm1_missing_edges_size: NULL,
+									  missing_edges ? &sm1_missing_edges: NULL);
+	if (res == CYBERIADA_NO_ERROR) {
+
+		if (new_initial && sm_new_initial) {
+			*new_initial = ID(sm_new_initial->id);
+		}
+
+		if (diff_nodes_first || diff_nodes_second || diff_nodes_flags) {
+			if (diff_nodes_first) diff_nodes_first->clear();
+			if (diff_nodes_second) diff_nodes_second->clear();
+			if (diff_nodes_flags) diff_nodes_flags->clear();
+			for (size_t i = 0; i < sm_diff_nodes_size; i++) {
+				if (diff_nodes_first) {
+					diff_nodes_first->push_back(sm_diff_nodes[i].n1->id);
+				}
+				if (diff_nodes_second) {
+					diff_nodes_second->push_back(sm_diff_nodes[i].n2->id);
+				}
+				if (diff_nodes_flags) {
+					diff_nodes_flags->push_back(SMIsomorphismFlagsResult(sm_diff_nodes_flags[i]));
+				}
+			}
+		}
+
+		if (new_nodes) {
+			new_nodes->clear();
+			for (size_t i = 0; i < sm2_new_nodes_size; i++) {
+				new_nodes->push_back(sm2_new_nodes[i]->id);
+			}
+		}
+
+		if (missing_nodes) {
+			missing_nodes->clear();
+			for (size_t i = 0; i < sm1_missing_nodes_size; i++) {
+				missing_nodes->push_back(sm1_missing_nodes[i]->id);
+			}
+		}
+
+		if (diff_edges_first || diff_edges_second || diff_edges_flags) {
+			if (diff_edges_first) diff_edges_first->clear();
+			if (diff_edges_second) diff_edges_second->clear();
+			if (diff_edges_flags) diff_edges_flags->clear();
+			for (size_t i = 0; i < sm_diff_edges_size; i++) {
+				if (diff_edges_first) {
+					diff_edges_first->push_back(sm_diff_edges[i].e1->id);
+				}
+				if (diff_edges_second) {
+					diff_edges_second->push_back(sm_diff_edges[i].e2->id);
+				}
+				if (diff_edges_flags) {
+					diff_edges_flags->push_back(SMIsomorphismFlagsResult(sm_diff_edges_flags[i]));
+				}
+			}
+		}
+
+		if (new_edges) {
+			new_edges->clear();
+			for (size_t i = 0; i < sm2_new_edges_size; i++) {
+				new_edges->push_back(sm2_new_edges[i]->id);
 			}
 		}
+
+		if (missing_edges) {
+			missing_edges->clear();
+			for (size_t i = 0; i < sm1_missing_edges_size; i++) {
+				missing_edges->push_back(sm1_missing_edges[i]->id);
+			}
+		}		
 	}
-	return node_actions;
+	
+	if (sm_diff_nodes) free(sm_diff_nodes);
+	if (sm_diff_nodes_flags) free(sm_diff_nodes_flags);
+	if (sm1_missing_nodes) free(sm1_missing_nodes);
+	if (sm2_new_nodes) free(sm2_new_nodes);
+	if (sm_diff_edges) free(sm_diff_edges);
+	if (sm_diff_edges_flags) free(sm_diff_edges_flags);
+	if (sm2_new_edges) free(sm2_new_edges);
+	if (sm1_missing_edges) free(sm1_missing_edges);
+
+	CYB_CHECK_RESULT(res);
+
+	return SMIsomorphismResult(result_flags);
 }
 
-template<typename T>
-static
-ActionsDiffFlags compare_two_actions(const T& a1, const T& a2)
+static StructuralHash hash_multiset(std::vector<StructuralHash>& values, StructuralHash seed)
 {
-	CyberiadaAction* this_a = to_action(a1);
-	CyberiadaAction* comp_a = to_action(a2);
-
-	int flags = 0;
-	int result = cyberiada_compare_node_actions(this_a, comp_a, &flags);
-	if (result != CYBERIADA_NO_ERROR) {
-		if (this_a) cyberiada_destroy_action(this_a);
-		if (comp_a) cyberiada_destroy_action(comp_a);
-		throw CybMLException("Error while comparing actions, res: " +
-							 std::to_string(result));
+	std::sort(values.begin(), values.end());
+	for (std::vector<StructuralHash>::const_iterator i = values.begin(); i != values.end(); i++) {
+		seed = hash_mix(seed, *i);
 	}
-	if (this_a) cyberiada_destroy_action(this_a);
-	if (comp_a) cyberiada_destroy_action(comp_a);
-	return ActionsDiffFlags(flags);
+	return hash_mix(seed, values.size());
 }
 
-ActionsDiffFlags State::compare_actions(const State& s) const
+static size_t distinct_values(std::vector<StructuralHash> values)
 {
-	return compare_two_actions(actions, s.get_actions());
+	std::sort(values.begin(), values.end());
+	return size_t(std::unique(values.begin(), values.end()) - values.begin());
 }
 
-CyberiadaNode* State::to_node() const
+StructuralHash StateMachine::structural_hash(bool ignore_comments, bool require_initial, int flags) const
 {
-	CyberiadaNode* node = ElementCollection::to_node();
+	// the labeled edges of the hash graph
+	enum {
+		edgeChild = 1,
+		edgeTransition,
+		edgeCommentSubject
+	};
+	typedef std::pair<StructuralHash, size_t> HashEdge;
 
-	if (has_actions()) {
-		node->actions = to_action(actions);
+	ElementTypes types = { elementSimpleState,
+						   elementCompositeState,
+						   elementInitial,
+						   elementFinal,
+						   elementChoice,
+						   elementTerminate };
+	if (!ignore_comments) {
+		types.push_back(elementComment);
+		types.push_back(elementFormalComment);
 	}
+	ConstElementList elements = find_elements_by_types(types);
 
-	if (is_collapsed()) {
-		node->collapsed_flag = 1;
-	}
-	
-	if (node->children) {
-		std::string region_node_id = get_id() + REGION_NAME_SUFFIX;
-		CyberiadaNode* region_node = cyberiada_new_node(region_node_id.c_str());
-		region_node->type = cybNodeRegion;
-		region_node->children = node->children;
-		region_node->parent = node;
-		if (region_rect.valid) {
-			region_node->geometry_rect = region_rect.c_rect();
+	std::vector<const Element*> nodes;
+	std::map<const Element*, size_t> node_index;
+	std::map<ID, size_t> id_index;
+	for (ConstElementList::const_iterator i = elements.begin(); i != elements.end(); i++) {
+		const Element* e = *i;
+		if (!require_initial && e->get_type() == elementInitial && e->get_parent() == this) {
+			// the SM initial pseudostate may be different if it is not required
+			continue;
 		}
-		for (CyberiadaNode* n = region_node->children; n; n = n->next) {
-			n->parent = region_node;
+		node_index[e] = nodes.size();
+		id_index[e->get_id()] = nodes.size();
+		nodes.push_back(e);
+	}
+
+	size_t n = nodes.size();
+	std::vector<std::vector<HashEdge>> out_edges(n), in_edges(n);
+	std::vector<StructuralHash> labels(n);
+	for (size_t v = 0; v < n; v++) {
+		const Element* e = nodes[v];
+		StructuralHash h = hash_mix(0, StructuralHash(e->get_type()));
+		if (e->get_type() == elementComment || e->get_type() == elementFormalComment) {
+			const Comment* c = static_cast<const Comment*>(e);
+			if (flags & shNames) {
+				h = hash_mix(h, hash_string(c->get_body()));
+			}
+			const std::vector<CommentSubject>& subjects = c->get_subjects();
+			for (std::vector<CommentSubject>::const_iterator i = subjects.begin(); i != subjects.end(); i++) {
+				std::map<const Element*, size_t>::const_iterator s = node_index.find(i->get_element());
+				if (s != node_index.end()) {
+					StructuralHash l = hash_mix(edgeCommentSubject, StructuralHash(i->get_type()));
+					out_edges[v].push_back(HashEdge(l, s->second));
+					in_edges[s->second].push_back(HashEdge(l, v));
+				}
+			}
+		} else {
+			if (flags & shNames) {
+				h = hash_mix(h, hash_string(e->get_name()));
+			}
+			if ((flags & shActions) &&
+				(e->get_type() == elementSimpleState || e->get_type() == elementCompositeState)) {
+				const std::vector<Action>& actions = static_cast<const State*>(e)->get_actions();
+				for (std::vector<Action>::const_iterator i = actions.begin(); i != actions.end(); i++) {
+					h = hash_mix(h, hash_action(*i));
+				}
+			}
 		}
-		node->children = region_node;
+		std::map<const Element*, size_t>::const_iterator p = node_index.find(e->get_parent());
+		if (p != node_index.end()) {
+			out_edges[p->second].push_back(HashEdge(edgeChild, v));
+			in_edges[v].push_back(HashEdge(edgeChild, p->second));
+		}
+		labels[v] = h;
 	}
-	
-	return node;
-}
-
-Element* State::copy(Element* parent) const
-{
-	State* s = new State(parent, get_id(), get_name(), get_geometry_rect(), get_region_geometry_rect(), get_color());
-	s->copy_elements(*this);
-	s->actions = actions;
-	s->update_state_type();
-	return s;
-}
 
-std::ostream& State::dump(std::ostream& os) const
-{
-	Element::dump(os);
-	if (has_actions()) {
-		os << ", actions: {";
-		for (std::vector<Action>::const_iterator i = actions.begin(); i != actions.end(); i++) {
-			os << "a {" << *i << "}";
-			if (std::next(i) != actions.end()) {
-				os << ", ";
+	size_t transitions = 0;
+	ConstElementList transition_elements = find_elements_by_type(elementTransition);
+	for (ConstElementList::const_iterator i = transition_elements.begin(); i != transition_elements.end(); i++) {
+		const Transition* t = static_cast<const Transition*>(*i);
+		std::map<ID, size_t>::const_iterator s = id_index.find(t->source_element_id());
+		std::map<ID, size_t>::const_iterator d = id_index.find(t->target_element_id());
+		if (s == id_index.end() || d == id_index.end()) {
+			continue;
+		}
+		StructuralHash l = edgeTransition;
+		if (flags & shActions) {
+			l = hash_mix(l, hash_action(t->get_action()));
+		}
+		out_edges[s->second].push_back(HashEdge(l, d->second));
+		in_edges[d->second].push_back(HashEdge(l, s->second));
+		transitions++;
+	}
+
+	// refine the labels by the neighbourhoods until the partition becomes stable
+	size_t classes = distinct_values(labels);
+	std::vector<StructuralHash> new_labels(n), neighbours;
+	for (size_t iteration = 0; iteration < n; iteration++) {
+		for (size_t v = 0; v < n; v++) {
+			neighbours.clear();
+			for (std::vector<HashEdge>::const_iterator i = out_edges[v].begin(); i != out_edges[v].end(); i++) {
+				neighbours.push_back(hash_mix(i->first, labels[i->second]));
+			}
+			StructuralHash h = hash_multiset(neighbours, labels[v]);
+			neighbours.clear();
+			for (std::vector<HashEdge>::const_iterator i = in_edges[v].begin(); i != in_edges[v].end(); i++) {
+				neighbours.push_back(hash_mix(i->first, labels[i->second]));
 			}
+			new_labels[v] = hash_multiset(neighbours, h);
 		}
-		os << "}";
-	}
-	ElementCollection::dump(os);
-	if (region_rect.valid) {
-		os << ", region: " << region_rect;
+		labels.swap(new_labels);
+		size_t new_classes = distinct_values(labels);
+		if (new_classes == classes) {
+			break;
+		}
+		classes = new_classes;
 	}
-	os << "}";
-	return os;
+
+	StructuralHash result = hash_mix(StructuralHash(flags), transitions);
+	return hash_multiset(labels, result);
 }
 
 // -----------------------------------------------------------------------------
-// Transition
+// State Machine flattening
 // -----------------------------------------------------------------------------
 
-Transition::Transition(Element* _parent, TransitionType ttype,
-					   const ID& _id, const ID& _source_id, const ID& _target_id,
-					   const Action& _action, const Polyline& pl, const Point& sp, const Point& tp,
-					   const Point& label_p, const Rect& label_r, const Color& c):
-	Element(_parent, elementTransition, _id), transition_type(ttype), source_id(_source_id), target_id(_target_id), action(_action),
-	source_point(sp), target_point(tp), label_point(label_p), label_rect(label_r), polyline(pl), color(c)
-{
-}
-
-Transition::Transition(const Transition& t):
-	Element(t), transition_type(t.transition_type), source_id(t.source_id), target_id(t.target_id), action(t.action),
-	source_point(t.source_point), target_point(t.target_point), label_point(t.label_point),
-	label_rect(t.label_rect), polyline(t.polyline), color(t.color)
-{
-}
-
-CyberiadaEdge* Transition::to_edge() const
-{
-	CYB_ASSERT(!source_id.empty());
-	CYB_ASSERT(!target_id.empty());
-	CyberiadaEdge* edge = cyberiada_new_edge(get_id().c_str(),
-											 source_id.c_str(),
-											 target_id.c_str(),
-											 transition_type == transitionExternal);
-	edge->type = cybEdgeLocalTransition;
-	if (has_action()) {
-		edge->action = to_action(action);
-	}
-	if (has_geometry()) {
-		if (source_point.valid) {
-			edge->geometry_source_point = source_point.c_point();
-		}
-		if (target_point.valid) {
-			edge->geometry_target_point = target_point.c_point();
+// The vertices of the hierarchical SM are indexed in the document order (the SM itself is 0) with
+// the chains of their ancestors, so the scope of every flat transition is found in O(depth).
+// The leaf states keep their own actions and get the internal actions of the ancestors; the
+// entry/exit behaviors of the composite states crossed by a transition are added to its behavior.
+class StateMachineFlattener {
+public:
+	StateMachineFlattener(const StateMachine* _sm): sm(_sm) {}
+
+	StateMachine* flatten(Element* parent)
+	{
+		index_vertex(sm, NPOS, String());
+		for (std::vector<const Transition*>::const_iterator i = transitions.begin(); i != transitions.end(); i++) {
+			vertices[find_vertex((*i)->source_element_id())].outgoing.push_back(*i);
+			find_vertex((*i)->target_element_id());
 		}
-		if (label_point.valid) {
-			edge->geometry_label_point = label_point.c_point();
+
+		StateMachine* flat = new StateMachine(parent, sm->get_id(), sm->get_name());
+		try {
+			for (size_t v = 1; v < vertices.size(); v++) {
+				add_flat_vertex(flat, v);
+			}
+			for (size_t v = 1; v < vertices.size(); v++) {
+				add_flat_transitions(flat, v);
+			}
+		} catch (const Exception&) {
+			delete flat;
+			throw;
 		}
-		if (label_rect.valid) {
-			edge->geometry_label_rect = label_rect.c_rect();
+		return flat;
+	}
+
+private:
+	static const size_t NPOS = size_t(-1);
+
+	struct Vertex {
+		const Element*                  element;
+		size_t                          parent;
+		std::vector<size_t>             chain;          // the ancestors from the SM to the vertex itself
+		String                          path;           // the qualified name of the state inside the SM
+		bool                            leaf;           // the vertex is kept in the flat SM
+		size_t                          initial;        // the initial pseudostate of the composite state
+		String                          entry;
+		String                          exit;
+		std::vector<const Transition*>  outgoing;
+		// the default leaf of the composite state and the behaviors on the way to it
+		bool                            resolved;
+		size_t                          default_leaf;
+		String                          default_behavior;
+	};
+
+	static void append_behavior(String& behavior, const String& part)
+	{
+		if (part.empty()) {
+			return ;
 		}
-		if (has_polyline()) {
-			edge->geometry_polyline = polyline.c_polyline();
+		if (!behavior.empty()) {
+			behavior += "\n";
 		}
-		if (has_color()) {
-			cyberiada_copy_string(&(edge->color), &(edge->color_len), color.c_str());
-		}		
+		behavior += part;
 	}
-	return edge;
-}
 
-Rect Transition::get_bound_rect(const Document& d) const
-{
-	Rect r;
-	if (has_geometry() && has_polyline()) {
-		r.expand(polyline, d);
+	static bool is_vertex(const Element* e)
+	{
+		return e->get_type() != elementComment && e->get_type() != elementFormalComment &&
+			e->get_type() != elementTransition;
 	}
-	return r;
-}
 
-void Transition::update(const Point &source, const Point &target)
-{
-    source_point = source;
-    target_point = target;
-}
+	size_t depth(size_t v) const { return vertices[v].chain.size() - 1; }
 
-void Transition::update(const Polyline &pl)
-{
-    polyline = pl;
-}
+	bool is_state(size_t v) const
+	{
+		ElementType t = vertices[v].element->get_type();
+		return t == elementSimpleState || t == elementCompositeState;
+	}
 
-void Transition::update(const ID &source, const ID &target)
-{
-    source_id = source;
-    target_id = target;
-}
+	// the nested final states become the simple states to keep the inherited transitions
+	bool is_nested_final(size_t v) const
+	{
+		return vertices[v].element->get_type() == elementFinal && vertices[v].parent != 0;
+	}
 
-void Transition::clean_geometry()
-{
-	source_point = Point();
-	target_point = Point();
-	label_point = Point();
-	label_rect = Rect();
-	polyline.clear();
-	CYB_ASSERT(!has_geometry());
-}
+	void index_vertex(const Element* e, size_t parent, const String& parent_path)
+	{
+		size_t v = vertices.size();
+		vertices.push_back(Vertex());
+		Vertex& vertex = vertices.back();
+		vertex.element = e;
+		vertex.parent = parent;
+		if (parent != NPOS) {
+			vertex.chain = vertices[parent].chain;
+		}
+		vertex.chain.push_back(v);
+		vertex.initial = NPOS;
+		vertex.resolved = false;
+		vertex.default_leaf = NPOS;
+		if (parent != NPOS) {
+			if (e->has_name() || is_state(v) || is_nested_final(v)) {
+				String name = (is_nested_final(v) && !e->has_name()) ? String("final") : e->get_name();
+				vertex.path = parent_path.empty() ? name : parent_path + QUALIFIED_NAME_SEPARATOR + name;
+			}
+			id_index[e->get_id()] = v;
+		}
+		// the initial pseudostates inside the composite states only define their default leaves
+		vertex.leaf = parent != NPOS && !(e->get_type() == elementInitial && parent != 0);
+
+		if (is_state(v)) {
+			const std::vector<Action>& actions = static_cast<const State*>(e)->get_actions();
+			for (std::vector<Action>::const_iterator i = actions.begin(); i != actions.end(); i++) {
+				if (i->get_type() == actionEntry) {
+					append_behavior(vertex.entry, i->get_behavior());
+				} else if (i->get_type() == actionExit) {
+					append_behavior(vertex.exit, i->get_behavior());
+				}
+			}
+		}
+		if (!e->has_children()) {
+			return ;
+		}
+		String path = vertex.path;
+		ConstElementList children = static_cast<const ElementCollection*>(e)->get_children();
+		for (ConstElementList::const_iterator i = children.begin(); i != children.end(); i++) {
+			if ((*i)->get_type() == elementTransition) {
+				transitions.push_back(static_cast<const Transition*>(*i));
+			} else if (is_vertex(*i)) {
+				if (v != 0) {
+					vertices[v].leaf = false;
+				}
+				if ((*i)->get_type() == elementInitial && v != 0) {
+					vertices[v].initial = vertices.size();
+				}
+				index_vertex(*i, v, path);
+			}
+		}
+	}
 
-void Transition::round_geometry()
-{
-	if (has_geometry()) {
-		source_point.round();
-		target_point.round();
-		label_point.round();
-		label_rect.round();
-		polyline.round();
+	size_t find_vertex(const ID& id) const
+	{
+		std::unordered_map<ID, size_t>::const_iterator i = id_index.find(id);
+		if (i == id_index.end()) {
+			throw ParametersException("Transition end " + id + " is not a vertex of the state machine " + sm->get_id());
+		}
+		return i->second;
 	}
-}
 
-ActionsDiffFlags Transition::compare_actions(const Transition& t) const
-{
-	return compare_two_actions(action, t.get_action());
-}
+	size_t common_ancestor(size_t a, size_t b) const
+	{
+		const std::vector<size_t>& ca = vertices[a].chain;
+		const std::vector<size_t>& cb = vertices[b].chain;
+		size_t i = 0;
+		while (i + 1 < ca.size() && i + 1 < cb.size() && ca[i + 1] == cb[i + 1]) {
+			i++;
+		}
+		return ca[i];
+	}
 
-Element* Transition::copy(Element* parent) const
-{
-	return new Transition(parent, transition_type, get_id(), source_id, target_id, action,
-						  polyline, source_point, target_point, label_point,
-						  label_rect, get_color());
-}
+	// enter the composite states below the scope down to the target and then follow the initial
+	// transitions of the composite target; returns the flat target
+	size_t enter_target(size_t scope, size_t target, String& behavior)
+	{
+		const std::vector<size_t>& chain = vertices[target].chain;
+		for (size_t i = depth(scope) + 1; i < chain.size(); i++) {
+			if (!vertices[chain[i]].leaf) {
+				append_behavior(behavior, vertices[chain[i]].entry);
+			}
+		}
+		if (vertices[target].leaf) {
+			return target;
+		}
+		resolve_default_leaf(target);
+		append_behavior(behavior, vertices[target].default_behavior);
+		return vertices[target].default_leaf;
+	}
 
-std::ostream& Transition::dump(std::ostream& os) const
-{
-	Element::dump(os);
-	os << ", type: " << (transition_type == transitionExternal ? "ext" : "loc");
-	os << ", source: '" << source_id << "'";
-	os << ", target: '" << target_id << "'";
-	if (has_action()) {
-		os << ", action: {";
-		os << action;
-		os << "}";
+	void resolve_default_leaf(size_t v)
+	{
+		if (vertices[v].resolved) {
+			return ;
+		}
+		const ID& id = vertices[v].element->get_id();
+		size_t initial = vertices[v].initial;
+		if (initial == NPOS) {
+			throw ParametersException("The composite state " + id + " targeted by a transition has no initial pseudostate");
+		}
+		if (vertices[initial].outgoing.empty()) {
+			throw ParametersException("The initial pseudostate of the composite state " + id + " has no transition");
+		}
+		const Transition* t = vertices[initial].outgoing.front();
+		size_t target = find_vertex(t->target_element_id());
+		if (depth(target) <= depth(v) || vertices[target].chain[depth(v)] != v) {
+			throw ParametersException("The initial transition of the composite state " + id + " leaves the state");
+		}
+		String behavior = t->get_action().get_behavior();
+		// the target is deeper, so the recursion ends
+		size_t leaf = enter_target(v, target, behavior);
+		vertices[v].default_behavior = behavior;
+		vertices[v].default_leaf = leaf;
+		vertices[v].resolved = true;
+	}
+
+	void add_flat_vertex(StateMachine* flat, size_t v)
+	{
+		const Vertex& vertex = vertices[v];
+		if (!vertex.leaf) {
+			return ;
+		}
+		const Element* e = vertex.element;
+		const ID& id = e->get_id();
+		Element* element = NULL;
+		switch (e->get_type()) {
+		case elementSimpleState:
+		case elementCompositeState: {
+			State* state = new State(flat, id, vertex.path);
+			const std::vector<Action>& actions = static_cast<const State*>(e)->get_actions();
+			for (std::vector<Action>::const_iterator i = actions.begin(); i != actions.end(); i++) {
+				state->add_action(*i);
+			}
+			add_inherited_actions(state, v);
+			element = state;
+			break;
+		}
+		case elementFinal:
+			if (is_nested_final(v)) {
+				State* state = new State(flat, id, vertex.path);
+				add_inherited_actions(state, v);
+				element = state;
+			} else if (e->has_name()) {
+				element = new FinalState(flat, id, e->get_name());
+			} else {
+				element = new FinalState(flat, id);
+			}
+			break;
+		case elementInitial:
+			if (e->has_name()) {
+				element = new InitialPseudostate(flat, id, e->get_name());
+			} else {
+				element = new InitialPseudostate(flat, id);
+			}
+			break;
+		case elementChoice:
+			if (e->has_name()) {
+				element = new ChoicePseudostate(flat, id, e->get_name());
+			} else {
+				element = new ChoicePseudostate(flat, id);
+			}
+			break;
+		case elementTerminate:
+			if (e->has_name()) {
+				element = new TerminatePseudostate(flat, id, e->get_name());
+			} else {
+				element = new TerminatePseudostate(flat, id);
+			}
+			break;
+		default:
+			CYB_ASSERT(false);
+		}
+		flat->add_element(element);
 	}
-	if (has_geometry()) {
-		if (source_point.valid) {
-			os << ", sp: " << source_point;
+
+	// the internal transitions of the ancestors, the inner ones first
+	void add_inherited_actions(State* state, size_t v)
+	{
+		for (size_t a = vertices[v].parent; a != 0; a = vertices[a].parent) {
+			const std::vector<Action>& actions = static_cast<const State*>(vertices[a].element)->get_actions();
+			for (std::vector<Action>::const_iterator i = actions.begin(); i != actions.end(); i++) {
+				if (i->get_type() == actionTransition && i->has_trigger()) {
+					state->add_action(*i);
+				}
+			}
 		}
-		if (target_point.valid) {
-			os << ", tp: " << target_point;
+	}
+
+	// the own transitions of the leaf followed by the inherited ones, the inner ones first; the triggered
+	// transitions are inherited by all the leaf states of the composite state and the completion ones
+	// by its final states only
+	void add_flat_transitions(StateMachine* flat, size_t v)
+	{
+		if (!vertices[v].leaf) {
+			return ;
+		}
+		bool inherits = is_state(v) || is_nested_final(v);
+		for (size_t a = v; a != 0; a = vertices[a].parent) {
+			const std::vector<const Transition*>& outgoing = vertices[a].outgoing;
+			for (std::vector<const Transition*>::const_iterator i = outgoing.begin(); i != outgoing.end(); i++) {
+				const Transition* t = *i;
+				if (a == v || t->get_action().has_trigger() ||
+					(is_nested_final(v) && vertices[v].parent == a)) {
+					add_flat_transition(flat, v, a, t);
+				}
+			}
+			if (!inherits) {
+				break;
+			}
 		}
-		if (label_point.valid) {
-			os << ", label: " << label_point;
-		} else if (label_rect.valid) {
-			os << ", rect: " << label_rect;
+	}
+
+	void add_flat_transition(StateMachine* flat, size_t source, size_t owner, const Transition* t)
+	{
+		size_t target = find_vertex(t->target_element_id());
+		// the innermost composite state (or the SM) not exited by the transition
+		size_t scope = common_ancestor(owner, target);
+		if (t->get_transition_type() == transitionLocal && scope == owner && target != owner) {
+			// the local transition to the substate does not exit the source
+		} else if (scope == owner || scope == target) {
+			scope = vertices[scope].parent;
 		}
-		if (has_polyline()) {
-			os << ", polyline: " << polyline;
+
+		String behavior;
+		for (size_t a = vertices[source].parent; depth(a) > depth(scope); a = vertices[a].parent) {
+			append_behavior(behavior, vertices[a].exit);
 		}
-		if (has_color()) {
-			os << ", color: " << color;
+		append_behavior(behavior, t->get_action().get_behavior());
+		size_t flat_target = enter_target(scope, target, behavior);
+
+		ID id = t->get_id();
+		if (owner != source) {
+			id += QUALIFIED_NAME_SEPARATOR + vertices[source].element->get_id();
 		}
+		const Action& action = t->get_action();
+		flat->add_element(new Transition(flat, transitionExternal, id,
+										 vertices[source].element->get_id(), vertices[flat_target].element->get_id(),
+										 Action(action.get_trigger(), action.get_guard(), behavior)));
 	}
-	os << "}";
-	return os;
+
+	const StateMachine*                 sm;
+	std::vector<Vertex>                 vertices;
+	std::unordered_map<ID, size_t>      id_index;
+	std::vector<const Transition*>      transitions;
+};
+
+StateMachine* StateMachine::flatten(Element* parent) const
+{
+	StateMachineFlattener flattener(this);
+	return flattener.flatten(parent);
 }
 
 // -----------------------------------------------------------------------------
-// State Machine
+// State Machine interpreter
 // -----------------------------------------------------------------------------
-StateMachine::StateMachine(Element* _parent, const ID& _id, const Name& _name, const Rect& r):
-	ElementCollection(_parent, elementSM, _id, _name, r)
-{	
-}
 
-StateMachine::StateMachine(const StateMachine& sm):
-	ElementCollection(sm)
+// The vertices, the transitions, the triggers and the texts of the guards and behaviors are
+// numbered once. The transitions keep the scope (the innermost vertex they do not exit) and the
+// list of the vertices they enter, so the exit sequence is the walk from the active vertex up to the
+// scope. The dispatch table gives the candidate transitions of the active vertex for the trigger
+// including the inherited ones, so an event is dispatched with one hash lookup.
+
+StateMachineInterpreter::StateMachineInterpreter(const StateMachine& sm):
+	exit_first(false), propagate(false), active(-1), finished(false), terminated(false)
 {
+	const Element* parent = sm.get_parent();
+	if (parent && parent->get_type() == elementRoot) {
+		const DocumentMetainformation& meta = static_cast<const Document*>(parent)->meta();
+		exit_first = meta.transition_order_flag;
+		propagate = meta.event_propagation_flag;
+	}
+	compile(sm);
 }
 
-std::vector<const Comment*> StateMachine::get_comments() const
+StateMachineInterpreter::StateMachineInterpreter(const StateMachine& sm, const DocumentMetainformation& meta):
+	exit_first(meta.transition_order_flag), propagate(meta.event_propagation_flag),
+	active(-1), finished(false), terminated(false)
 {
-	ElementTypes types = { elementComment,
-						   elementFormalComment };
-	std::vector<const Comment*> result;
-	ConstElementList comments = find_elements_by_types(types);
-	for (ConstElementList::const_iterator i = comments.begin(); i != comments.end(); i++) {
-		result.push_back(static_cast<const Comment*>(*i));
-	}
-	return result;
+	compile(sm);
 }
 
-std::vector<Comment*> StateMachine::get_comments()
+int StateMachineInterpreter::trigger_id(const Event& trigger) const
 {
-	ElementTypes types = { elementComment,
-						   elementFormalComment };
-	std::vector<Comment*> result;
-	ElementList comments = find_elements_by_types(types);
-	for (ElementList::iterator i = comments.begin(); i != comments.end(); i++) {
-		result.push_back(static_cast<Comment*>(*i));
+	std::unordered_map<Event, int>::const_iterator i = trigger_index.find(trigger);
+	if (i == trigger_index.end()) {
+		return -1;
 	}
-	return result;
+	return i->second;
 }
 
-std::vector<const Transition*> StateMachine::get_transitions() const
+const Event& StateMachineInterpreter::trigger_name(int id) const
 {
-	std::vector<const Transition*> result;
-	ConstElementList transitions = find_elements_by_type(elementTransition);
-	for (ConstElementList::const_iterator i = transitions.begin(); i != transitions.end(); i++) {
-		result.push_back(static_cast<const Transition*>(*i));
+	if (id < 0 || size_t(id) >= trigger_names.size()) {
+		throw ParametersException("Bad trigger id " + std::to_string(id));
 	}
-	return result;
+	return trigger_names[id];
 }
 
-std::vector<Transition*> StateMachine::get_transitions()
+const ID& StateMachineInterpreter::active_state() const
 {
-	std::vector<Transition*> result;
-	ElementList transitions = find_elements_by_type(elementTransition);
-	for (ElementList::iterator i = transitions.begin(); i != transitions.end(); i++) {
-		result.push_back(static_cast<Transition*>(*i));
+	static const ID no_state;
+	if (active <= 0) {
+		return no_state;
 	}
-	return result;
+	return ids[active];
 }
 
-// Rect StateMachine::get_bound_rect(const Document& d) const
-// {
-// 	Rect r;
-// 	if (has_geometry()) {
-// 		r = ElementCollection::get_bound_rect(d);
-// 	} else if (has_children()) {
-// 		for (ElementList::const_iterator i = children.begin(); i != children.end(); i++) {
-// 			r.expand((*i)->get_bound_rect(d), d);
-// 		}
-// 	}
-// 	return r;
-// }
-
-void StateMachine::from_sm(const CyberiadaSM* sm, Element** metainfo_element)
+bool StateMachineInterpreter::is_active(const ID& state) const
 {
-	if (sm) {
-		if (sm->nodes && sm->nodes->children) {
-			import_nodes_recursively(sm->nodes->children, metainfo_element);
-		}
-		if (sm->edges) { 
-			import_edges(sm->edges);
+	std::unordered_map<ID, int>::const_iterator i = vertex_index.find(state);
+	if (i == vertex_index.end() || active <= 0) {
+		return false;
+	}
+	for (int v = active; v > 0; v = vertex_parent[v]) {
+		if (v == i->second) {
+			return true;
 		}
 	}
+	return false;
 }
 
-CyberiadaSM* StateMachine::to_sm() const
+void StateMachineInterpreter::start()
 {
-	CyberiadaSM* new_sm = cyberiada_new_sm();
-	new_sm->nodes = to_node(Point(0.0, 0.0)); // center_point ?
-	export_edges(&(new_sm->edges), new_sm);
-	return new_sm;
+	active = 0;
+	finished = terminated = false;
+	if (vertex_initial[0] < 0) {
+		active = -1;
+		throw ParametersException("The state machine has no initial transition");
+	}
+	take(vertex_initial[0]);
+	settle();
 }
 
-CyberiadaNode* StateMachine::to_node(const Point& center) const
+bool StateMachineInterpreter::dispatch(int trigger)
 {
-	CyberiadaNode* node = ElementCollection::to_node();
-	CYB_ASSERT(node != NULL);
-	if (node->geometry_rect) {
-		return node;
+	if (!is_running() || trigger < 0) {
+		return false;
 	}
-	// move center only if SM has no geometry
-	for (CyberiadaNode* n = node->children; n; n = n->next) {
-		if (n->geometry_point) {
-			n->geometry_point->x += center.x;
-			n->geometry_point->y += center.y;			
+	unsigned long long key = (static_cast<unsigned long long>(active) << 32) | static_cast<unsigned int>(trigger);
+	std::unordered_map<unsigned long long, std::pair<int, int>>::const_iterator range = dispatch_table.find(key);
+	if (range == dispatch_table.end()) {
+		return false;
+	}
+	bool handled = false;
+	int propagated = -1;
+	for (int i = range->second.first; i < range->second.second; i++) {
+		int t = handlers[i];
+		const CompiledTransition& ct = transitions[t];
+		if (ct.source == propagated || !guard(ct)) {
+			continue;
 		}
-		if (n->geometry_rect) {
-			n->geometry_rect->x += center.x;
-			n->geometry_rect->y += center.y;			
-		}		
+		if (ct.target < 0) {
+			// the internal transition passes the event to the parent states only if it is propagated
+			behavior(ct.behavior, ct.element);
+			handled = true;
+			if (!propagate) {
+				return true;
+			}
+			propagated = ct.source;
+			continue;
+		}
+		take(t);
+		settle();
+		return true;
 	}
-	return node;
+	return handled;
 }
 
-Element* StateMachine::copy(Element* parent) const
+bool StateMachineInterpreter::guard(const CompiledTransition& t) const
 {
-	 StateMachine* sm = new StateMachine(*this);
-	 sm->update_parent(parent);
-	 return sm;
+	if (t.guard < 0 || !guard_callback) {
+		return true;
+	}
+	return guard_callback(texts[t.guard], ids[t.element]);
 }
 
-std::ostream& StateMachine::dump(std::ostream& os) const
+void StateMachineInterpreter::behavior(int text, int element) const
 {
-	Element::dump(os);
-	ElementCollection::dump(os);
-	os << "}";
-	return os;
+	if (text >= 0 && behavior_callback) {
+		behavior_callback(texts[text], ids[element]);
+	}
 }
 
-void StateMachine::import_edges(CyberiadaEdge* edges)
+void StateMachineInterpreter::run_actions(const std::vector<int>& offsets, const std::vector<int>& list, int v) const
 {
-	for (CyberiadaEdge* e = edges; e; e = e->next) {
-		CYB_ASSERT(e->id);
-
-		Element* element = NULL;
-		Point    source_point, target_point, label_point;
-		Rect     label_rect;
-		Polyline polyline;
-		Color    _color;
-		Action   action;
+	for (int i = offsets[v]; i < offsets[v + 1]; i++) {
+		behavior(list[i], v);
+	}
+}
 
-		if (e->geometry_source_point) {
-			source_point = Point(e->geometry_source_point);
+void StateMachineInterpreter::take(int t)
+{
+	for (;;) {
+		const CompiledTransition& ct = transitions[t];
+		if (!exit_first) {
+			behavior(ct.behavior, ct.element);
 		}
-		if (e->geometry_target_point) {
-			target_point = Point(e->geometry_target_point);
+		for (int v = active; v != ct.scope; v = vertex_parent[v]) {
+			run_actions(exit_offsets, exit_texts, v);
 		}
-		if (e->geometry_label_point) {
-			label_point = Point(e->geometry_label_point);
+		if (exit_first) {
+			behavior(ct.behavior, ct.element);
 		}
-		if (e->geometry_label_rect) {
-			label_rect = Rect(e->geometry_label_rect);
+		for (int i = path_offsets[t]; i < path_offsets[t + 1]; i++) {
+			run_actions(entry_offsets, entry_texts, path_vertices[i]);
 		}
-		if (e->geometry_polyline) {
-			for (CyberiadaPolyline* pl = e->geometry_polyline; pl; pl = pl->next) {
-				polyline.push_back(Point(pl->point.x, pl->point.y));
+		active = ct.target;
+
+		switch (vertex_kind[active]) {
+		case vertexState:
+			if (vertex_initial[active] < 0) {
+				return ;
 			}
+			t = vertex_initial[active];
+			break;
+		case vertexChoice:
+			t = enabled_completion(active);
+			if (t < 0) {
+				throw ParametersException("No enabled transition from the choice pseudostate " + ids[active]);
+			}
+			break;
+		case vertexFinal:
+			finished = vertex_parent[active] == 0;
+			return ;
+		case vertexTerminate:
+			terminated = true;
+			return ;
+		default:
+			CYB_ASSERT(false);
 		}
-		if (e->color) {
-			_color = Color(e->color);
-		}
+	}
+}
 
-		Element* source_element = find_element_by_id(e->source_id);
-		CYB_ASSERT(source_element);
-		Element* target_element = find_element_by_id(e->target_id);
-		CYB_ASSERT(target_element);
-		Comment* comment = NULL;
-		
-		switch (e->type) {
-		case cybEdgeExternalTransition:
-		case cybEdgeLocalTransition:
-			if (e->action) {
-				action = Action(e->action->trigger, e->action->guard, e->action->behavior);
-			}
-	
-			element = new Transition(this, e->type == cybEdgeExternalTransition ? transitionExternal: transitionLocal, 
-									 e->id, e->source_id, e->target_id,
-									 action, polyline, source_point, target_point, label_point,
-									 label_rect, _color);
+void StateMachineInterpreter::settle()
+{
+	while (is_running()) {
+		// reaching the final state completes its parent state
+		int completed = vertex_kind[active] == vertexFinal ? vertex_parent[active] : active;
+		int t = enabled_completion(completed);
+		if (t < 0) {
 			break;
+		}
+		take(t);
+	}
+}
 
-		case cybEdgeComment:
-			CYB_ASSERT(source_element->get_type() == elementComment ||
-					   source_element->get_type() == elementFormalComment);
-			CYB_ASSERT(e->comment_subject);
+int StateMachineInterpreter::enabled_completion(int v) const
+{
+	for (int i = completion_offsets[v]; i < completion_offsets[v + 1]; i++) {
+		int t = completion_transitions[i];
+		if (guard(transitions[t])) {
+			return t;
+		}
+	}
+	return -1;
+}
 
-			comment = static_cast<Comment*>(source_element);
-			
-			if (e->comment_subject->type == cybCommentSubjectNode) {
-				comment->add_subject(CommentSubject(e->id, target_element, source_point, target_point, polyline));
-			} else {
-				CommentSubjectType cst;
-				if (e->comment_subject->type == cybCommentSubjectNameFragment) {
-					cst = commentSubjectName;
-				} else if (e->comment_subject->type == cybCommentSubjectDataFragment) {
-					cst = commentSubjectData;
-				} else {
-					throw CybMLException("Unsupported comment subject type " + std::to_string(e->comment_subject->type));
+int StateMachineInterpreter::add_text(const String& text)
+{
+	if (text.empty()) {
+		return -1;
+	}
+	std::unordered_map<String, int>::const_iterator i = text_index.find(text);
+	if (i != text_index.end()) {
+		return i->second;
+	}
+	int id = int(texts.size());
+	texts.push_back(text);
+	text_index[text] = id;
+	return id;
+}
+
+int StateMachineInterpreter::find_vertex(const ID& id) const
+{
+	std::unordered_map<ID, int>::const_iterator i = vertex_index.find(id);
+	if (i == vertex_index.end()) {
+		throw ParametersException("Transition end " + id + " is not a vertex of the state machine");
+	}
+	return i->second;
+}
+
+int StateMachineInterpreter::index_vertex(const Element* e, int parent, std::vector<const Transition*>& edges)
+{
+	int v = int(vertex_kind.size());
+	switch (e->get_type()) {
+	case elementSM: vertex_kind.push_back(vertexRoot); break;
+	case elementSimpleState:
+	case elementCompositeState: vertex_kind.push_back(vertexState); break;
+	case elementInitial: vertex_kind.push_back(vertexInitial); break;
+	case elementFinal: vertex_kind.push_back(vertexFinal); break;
+	case elementChoice: vertex_kind.push_back(vertexChoice); break;
+	case elementTerminate: vertex_kind.push_back(vertexTerminate); break;
+	default:
+		CYB_ASSERT(false);
+	}
+	vertex_parent.push_back(parent);
+	vertex_depth.push_back(parent < 0 ? 0 : vertex_depth[parent] + 1);
+	vertex_initial.push_back(-1);
+	ids.push_back(e->get_id());
+	if (parent >= 0) {
+		vertex_index[e->get_id()] = v;
+	}
+
+	entry_offsets.push_back(int(entry_texts.size()));
+	exit_offsets.push_back(int(exit_texts.size()));
+	if (vertex_kind[v] == vertexState) {
+		const std::vector<Action>& actions = static_cast<const State*>(e)->get_actions();
+		for (std::vector<Action>::const_iterator i = actions.begin(); i != actions.end(); i++) {
+			int text = add_text(i->get_behavior());
+			if (i->get_type() == actionEntry) {
+				if (text >= 0) entry_texts.push_back(text);
+			} else if (i->get_type() == actionExit) {
+				if (text >= 0) exit_texts.push_back(text);
+			} else if (i->has_trigger()) {
+				CompiledTransition t = { v, -1, 0, add_text(i->get_guard()), text, v, -1 };
+				std::pair<std::unordered_map<Event, int>::iterator, bool> r =
+					trigger_index.insert(std::make_pair(i->get_trigger(), int(trigger_names.size())));
+				if (r.second) {
+					trigger_names.push_back(i->get_trigger());
 				}
-				CYB_ASSERT(e->comment_subject->fragment);
-				comment->add_subject(CommentSubject(e->id, target_element, cst, e->comment_subject->fragment,
-													source_point, target_point, polyline));
-			}			
-			break;
-			
-		default:
-			throw CybMLException("Unsupported edge type " + std::to_string(e->type));
+				t.trigger = r.first->second;
+				path_offsets.push_back(int(path_vertices.size()));
+				transitions.push_back(t);
+			}
 		}
+	}
 
-		add_element(element);
-	}	
+	if (e->has_children()) {
+		ConstElementList children = static_cast<const ElementCollection*>(e)->get_children();
+		for (ConstElementList::const_iterator i = children.begin(); i != children.end(); i++) {
+			ElementType type = (*i)->get_type();
+			if (type == elementTransition) {
+				edges.push_back(static_cast<const Transition*>(*i));
+			} else if (type != elementComment && type != elementFormalComment) {
+				index_vertex(*i, v, edges);
+			}
+		}
+	}
+	return v;
 }
 
-void StateMachine::export_edges(CyberiadaEdge** edges, const CyberiadaSM* new_sm) const
+void StateMachineInterpreter::compile(const StateMachine& sm)
 {
-	CyberiadaEdge* edge;
-	size_t c = 0;
-	std::vector<const Transition*> transitions = get_transitions();
-	for (std::vector<const Transition*>::const_iterator i = transitions.begin(); i != transitions.end(); i++) {
-		const Transition* t = *i;
-		edge = t->to_edge();
-		if (*edges) {
-			CyberiadaEdge* e = *edges;
-			while (e->next) e = e->next;
-			e->next = edge;
+	std::vector<const Transition*> edges;
+	index_vertex(&sm, -1, edges);
+	int n = int(vertex_kind.size());
+	entry_offsets.push_back(int(entry_texts.size()));
+	exit_offsets.push_back(int(exit_texts.size()));
+
+	for (std::vector<const Transition*>::const_iterator i = edges.begin(); i != edges.end(); i++) {
+		const Transition* e = *i;
+		const Action& action = e->get_action();
+		CompiledTransition t = { find_vertex(e->source_element_id()), find_vertex(e->target_element_id()), -1,
+								 add_text(action.get_guard()), add_text(action.get_behavior()), int(ids.size()), 0 };
+		ids.push_back(e->get_id());
+		if (action.has_trigger()) {
+			std::pair<std::unordered_map<Event, int>::iterator, bool> r =
+				trigger_index.insert(std::make_pair(action.get_trigger(), int(trigger_names.size())));
+			if (r.second) {
+				trigger_names.push_back(action.get_trigger());
+			}
+			t.trigger = r.first->second;
+		}
+
+		// the common ancestor of the ends
+		int a = t.source, b = t.target;
+		while (vertex_depth[a] > vertex_depth[b]) a = vertex_parent[a];
+		while (vertex_depth[b] > vertex_depth[a]) b = vertex_parent[b];
+		while (a != b) {
+			a = vertex_parent[a];
+			b = vertex_parent[b];
+		}
+		if (e->get_transition_type() == transitionLocal && a == t.source && t.target != t.source) {
+			// the local transition to the substate does not exit the source
+			t.scope = a;
+		} else if (a == t.source || a == t.target) {
+			t.scope = vertex_parent[a];
 		} else {
-			*edges = edge;
+			t.scope = a;
+		}
+
+		path_offsets.push_back(int(path_vertices.size()));
+		size_t first = path_vertices.size();
+		for (int v = t.target; v != t.scope; v = vertex_parent[v]) {
+			path_vertices.push_back(v);
+		}
+		std::reverse(path_vertices.begin() + first, path_vertices.end());
+
+		if (vertex_kind[t.source] == vertexInitial && vertex_initial[vertex_parent[t.source]] < 0) {
+			vertex_initial[vertex_parent[t.source]] = int(transitions.size());
+		}
+		transitions.push_back(t);
+	}
+	path_offsets.push_back(int(path_vertices.size()));
+
+	// the triggerless transitions of the vertices and the triggered ones (the internal first)
+	std::vector<std::vector<int>> triggered(n);
+	std::vector<std::vector<int>> completions(n);
+	for (size_t i = 0; i < transitions.size(); i++) {
+		const CompiledTransition& t = transitions[i];
+		if (t.trigger >= 0) {
+			triggered[t.source].push_back(int(i));
+		} else if (vertex_kind[t.source] != vertexInitial) {
+			completions[t.source].push_back(int(i));
 		}
-		c++;
 	}
-	std::vector<const Comment*> comments = get_comments();
-	for (std::vector<const Comment*>::const_iterator j = comments.begin(); j != comments.end(); j++) {
-		const Comment* c = *j;
-		edge = c->subjects_to_edges();
-		if (*edges) {
-			CyberiadaEdge* e = *edges;
-			while (e->next) e = e->next;
-			e->next = edge;
-		} else {
-			*edges = edge;
+	for (int v = 0; v < n; v++) {
+		completion_offsets.push_back(int(completion_transitions.size()));
+		completion_transitions.insert(completion_transitions.end(), completions[v].begin(), completions[v].end());
+	}
+	completion_offsets.push_back(int(completion_transitions.size()));
+
+	// the candidates of every vertex that may be active grouped by the trigger, the inner ones first
+	std::vector<std::pair<int, int>> candidates;
+	for (int v = 1; v < n; v++) {
+		if (vertex_kind[v] != vertexState && vertex_kind[v] != vertexFinal) {
+			continue;
+		}
+		candidates.clear();
+		for (int a = v; a > 0; a = vertex_parent[a]) {
+			for (std::vector<int>::const_iterator i = triggered[a].begin(); i != triggered[a].end(); i++) {
+				candidates.push_back(std::make_pair(transitions[*i].trigger, *i));
+			}
+		}
+		std::stable_sort(candidates.begin(), candidates.end(),
+						 [](const std::pair<int, int>& x, const std::pair<int, int>& y) { return x.first < y.first; });
+		for (size_t i = 0; i < candidates.size(); i++) {
+			if (i == 0 || candidates[i].first != candidates[i - 1].first) {
+				unsigned long long key = (static_cast<unsigned long long>(v) << 32) |
+					static_cast<unsigned int>(candidates[i].first);
+				dispatch_table[key] = std::make_pair(int(handlers.size()), int(handlers.size()));
+			}
+			handlers.push_back(candidates[i].second);
+			unsigned long long key = (static_cast<unsigned long long>(v) << 32) |
+				static_cast<unsigned int>(candidates[i].first);
+			dispatch_table[key].second = int(handlers.size());
 		}
 	}
-	edge = *edges;
-	while (edge) {
-		edge->source = cyberiada_graph_find_node_by_id(new_sm->nodes, edge->source_id);
-		edge->target = cyberiada_graph_find_node_by_id(new_sm->nodes, edge->target_id);		
-		edge = edge->next;
+}
+
+// -----------------------------------------------------------------------------
+// State Machine isomorphism comparator
+// -----------------------------------------------------------------------------
+IsomorphismComparator::IsomorphismComparator(const StateMachine& _reference,
+											 bool _ignore_comments, bool _require_initial):
+	reference(_reference), ignore_comments(_ignore_comments), require_initial(_require_initial),
+	reference_sm(NULL), reference_hash(0)
+{
+}
+
+IsomorphismComparator::~IsomorphismComparator()
+{
+	invalidate();
+}
+
+void IsomorphismComparator::invalidate()
+{
+	if (reference_sm) {
+		cyberiada_destroy_sm(reference_sm);
+		reference_sm = NULL;
 	}
 }
 
-SMIsomorphismResult StateMachine::check_isomorphism(const StateMachine& sm,
-													bool ignore_comments, bool require_initial) const
+void IsomorphismComparator::prepare()
 {
-	return check_isomorphism_details(sm, ignore_comments, require_initial);
+	// the content hash follows the changes made through the mutable references as well
+	ContentHash hash = reference.content_hash();
+	if (reference_sm && reference_hash == hash) {
+		return ;
+	}
+	invalidate();
+	if (reference.children_count() == 0) {
+		throw ParametersException("Empty state machines are not allowed for isomorphism check");
+	}
+	reference_sm = reference.to_sm();
+	reference_hash = hash;
 }
 
-SMIsomorphismResult StateMachine::check_isomorphism_details(const StateMachine& sm,
-															bool ignore_comments, bool require_initial,
-															ID* new_initial,
-															std::vector<ID>* diff_nodes_first,
-															std::vector<ID>* diff_nodes_second,
-															std::vector<SMIsomorphismFlagsResult>* diff_nodes_flags,
-															std::vector<ID>* new_nodes,
-															std::vector<ID>* missing_nodes,
-															std::vector<ID>* diff_edges_first,
-															std::vector<ID>* diff_edges_second,
-															std::vector<SMIsomorphismFlagsResult>* diff_edges_flags,
-															std::vector<ID>* new_edges,
-															std::vector<ID>* missing_edges) const
+SMIsomorphismResult IsomorphismComparator::check_isomorphism(const StateMachine& sm)
 {
-	int res;
+	return check_isomorphism_details(sm);
+}
 
-	if (children_count() == 0 || sm.children_count() == 0) {
+SMIsomorphismResult IsomorphismComparator::check_isomorphism_details(const StateMachine& sm,
+																	 ID* new_initial,
+																	 std::vector<ID>* diff_nodes_first,
+																	 std::vector<ID>* diff_nodes_second,
+																	 std::vector<SMIsomorphismFlagsResult>* diff_nodes_flags,
+																	 std::vector<ID>* new_nodes,
+																	 std::vector<ID>* missing_nodes,
+																	 std::vector<ID>* diff_edges_first,
+																	 std::vector<ID>* diff_edges_second,
+																	 std::vector<SMIsomorphismFlagsResult>* diff_edges_flags,
+																	 std::vector<ID>* new_edges,
+																	 std::vector<ID>* missing_edges)
+{
+	prepare();
+	if (sm.children_count() == 0) {
 		throw ParametersException("Empty state machines are not allowed for isomorphism check");
 	}
 
-	CyberiadaSM* sm1 = to_sm();
 	CyberiadaSM* sm2 = sm.to_sm();
-	
-	int result_flags = 0;
-	size_t sm_diff_nodes_size = 0, sm2_new_nodes_size = 0, sm1_missing_nodes_size = 0,
-		sm_diff_edges_size = 0, sm2_new_edges_size = 0, sm1_missing_edges_size = 0;
-	CyberiadaNode *sm_new_initial = NULL, **sm1_missing_nodes = NULL, **sm2_new_nodes = NULL;
-	CyberiadaEdge **sm2_new_edges = NULL, **sm1_missing_edges = NULL;
-	CyberiadaNodePair *sm_diff_nodes = NULL;
-	CyberiadaEdgePair *sm_diff_edges = NULL;
-	size_t *sm_diff_nodes_flags = NULL, *sm_diff_edges_flags = NULL;
-	
-	res = cyberiada_check_isomorphism(sm1, sm2,
-									  ignore_comments, require_initial,
-									  &result_flags,
-									  new_initial ? &sm_new_initial: NULL,
-									  (diff_nodes_first || diff_nodes_second || diff_nodes_flags) ? &sm_diff_nodes_size: NULL,
-									  (diff_nodes_first || diff_nodes_second) ? &sm_diff_nodes: NULL,
-									  diff_nodes_flags ? &sm_diff_nodes_flags: NULL,
-									  new_nodes ? &sm2_new_nodes_size: NULL,
-									  new_nodes ? &sm2_new_nodes: NULL,
-									  missing_nodes ? &sm1_missing_nodes_size: NULL,
-									  missing_nodes ? &sm1_missing_nodes: NULL,
-									  (diff_edges_first || diff_edges_second || diff_edges_flags) ? &sm_diff_edges_size: NULL,
-									  (diff_edges_first || diff_edges_second) ? &sm_diff_edges: NULL,
-									  diff_edges_flags ? &sm_diff_edges_flags: NULL,
-									  new_edges ? &sm2_new_edges_size: NULL,
-									  new_edges ? &sm2_new_edges: NULL,
-									  missing_edges ? &sm1_missing_edges_size: NULL,
-									  missing_edges ? &sm1_missing_edges: NULL);
-	if (res == CYBERIADA_NO_ERROR) {
+	try {
+		SMIsomorphismResult result = reference.check_sm_isomorphism(reference_sm, sm2, ignore_comments, require_initial,
+																	new_initial,
+																	diff_nodes_first, diff_nodes_second, diff_nodes_flags,
+																	new_nodes, missing_nodes,
+																	diff_edges_first, diff_edges_second, diff_edges_flags,
+																	new_edges, missing_edges);
+		cyberiada_destroy_sm(sm2);
+		return result;
+	} catch (const Exception&) {
+		cyberiada_destroy_sm(sm2);
+		throw;
+	}
+}
 
-		if (new_initial && sm_new_initial) {
-			*new_initial = ID(sm_new_initial->id);
-		}
+static bool bigger_bucket(const std::vector<size_t>* b1, const std::vector<size_t>* b2)
+{
+	return b1->size() > b2->size();
+}
 
-		if (diff_nodes_first || diff_nodes_second || diff_nodes_flags) {
-			if (diff_nodes_first) diff_nodes_first->clear();
-			if (diff_nodes_second) diff_nodes_second->clear();
-			if (diff_nodes_flags) diff_nodes_flags->clear();
-			for (size_t i = 0; i < sm_diff_nodes_size; i++) {
-				if (diff_nodes_first) {
-					diff_nodes_first->push_back(sm_diff_nodes[i].n1->id);
-				}
-				if (diff_nodes_second) {
-					diff_nodes_second->push_back(sm_diff_nodes[i].n2->id);
-				}
-				if (diff_nodes_flags) {
-					diff_nodes_flags->push_back(SMIsomorphismFlagsResult(sm_diff_nodes_flags[i]));
-				}
-			}
-		}
+static bool first_member_less(const std::vector<size_t>& c1, const std::vector<size_t>& c2)
+{
+	return c1.front() < c2.front();
+}
 
-		if (new_nodes) {
-			new_nodes->clear();
-			for (size_t i = 0; i < sm2_new_nodes_size; i++) {
-				new_nodes->push_back(sm2_new_nodes[i]->id);
-			}
-		}
+IsomorphismClasses Cyberiada::partition_by_isomorphism(const ConstStateMachineList& sms,
+													   bool ignore_comments, bool require_initial,
+													   SMIsomorphismResult accepted,
+													   unsigned int threads)
+{
+	// the names and actions are hashed only if the plain isomorphism is not enough
+	int hash_flags = (accepted & smiIsomorphic) ? shStructure : (shNames | shActions);
 
-		if (missing_nodes) {
-			missing_nodes->clear();
-			for (size_t i = 0; i < sm1_missing_nodes_size; i++) {
-				missing_nodes->push_back(sm1_missing_nodes[i]->id);
-			}
+	// the empty SMs cannot be checked, they get a separate bucket
+	std::vector<std::pair<bool, StructuralHash>> keys(sms.size());
+	parallel_for(sms.size(), threads, [&](size_t i) {
+		CYB_ASSERT(sms[i]);
+		if (sms[i]->children_count() == 0) {
+			keys[i] = std::make_pair(false, StructuralHash(0));
+		} else {
+			keys[i] = std::make_pair(true, sms[i]->structural_hash(ignore_comments, require_initial, hash_flags));
 		}
-
-		if (diff_edges_first || diff_edges_second || diff_edges_flags) {
-			if (diff_edges_first) diff_edges_first->clear();
-			if (diff_edges_second) diff_edges_second->clear();
-			if (diff_edges_flags) diff_edges_flags->clear();
-			for (size_t i = 0; i < sm_diff_edges_size; i++) {
-				if (diff_edges_first) {
-					diff_edges_first->push_back(sm_diff_edges[i].e1->id);
-				}
-				if (diff_edges_second) {
-					diff_edges_second->push_back(sm_diff_edges[i].e2->id);
-				}
-				if (diff_edges_flags) {
-					diff_edges_flags->push_back(SMIsomorphismFlagsResult(sm_diff_edges_flags[i]));
+	});
+
+	std::map<std::pair<bool, StructuralHash>, std::vector<size_t>> buckets_map;
+	for (size_t i = 0; i < sms.size(); i++) {
+		buckets_map[keys[i]].push_back(i);
+	}
+	std::vector<const std::vector<size_t>*> buckets;
+	for (std::map<std::pair<bool, StructuralHash>, std::vector<size_t>>::const_iterator i = buckets_map.begin();
+		 i != buckets_map.end(); i++) {
+		buckets.push_back(&(i->second));
+	}
+	// start from the biggest buckets to balance the workers
+	std::stable_sort(buckets.begin(), buckets.end(), bigger_bucket);
+
+	std::vector<IsomorphismClasses> bucket_classes(buckets.size());
+	parallel_for(buckets.size(), threads, [&](size_t b) {
+		const std::vector<size_t>& bucket = *(buckets[b]);
+		IsomorphismClasses& classes = bucket_classes[b];
+		if (sms[bucket.front()]->children_count() == 0) {
+			// empty SMs cannot be checked but they are equal to each other
+			classes.push_back(bucket);
+			return ;
+		}
+		std::vector<std::unique_ptr<IsomorphismComparator>> representatives;
+		for (std::vector<size_t>::const_iterator i = bucket.begin(); i != bucket.end(); i++) {
+			const StateMachine* sm = sms[*i];
+			bool found = false;
+			for (size_t c = 0; c < representatives.size(); c++) {
+				if (representatives[c]->check_isomorphism(*sm) & accepted) {
+					classes[c].push_back(*i);
+					found = true;
+					break;
 				}
 			}
-		}
-
-		if (new_edges) {
-			new_edges->clear();
-			for (size_t i = 0; i < sm2_new_edges_size; i++) {
-				new_edges->push_back(sm2_new_edges[i]->id);
+			if (!found) {
+				classes.push_back(std::vector<size_t>(1, *i));
+				representatives.push_back(std::unique_ptr<IsomorphismComparator>(
+											  new IsomorphismComparator(*sm, ignore_comments, require_initial)));
 			}
 		}
+	});
 
-		if (missing_edges) {
-			missing_edges->clear();
-			for (size_t i = 0; i < sm1_missing_edges_size; i++) {
-				missing_edges->push_back(sm1_missing_edges[i]->id);
-			}
-		}		
+	IsomorphismClasses result;
+	for (std::vector<IsomorphismClasses>::const_iterator i = bucket_classes.begin(); i != bucket_classes.end(); i++) {
+		result.insert(result.end(), i->begin(), i->end());
 	}
-	
-	if (sm_diff_nodes) free(sm_diff_nodes);
-	if (sm_diff_nodes_flags) free(sm_diff_nodes_flags);
-	if (sm1_missing_nodes) free(sm1_missing_nodes);
-	if (sm2_new_nodes) free(sm2_new_nodes);
-	if (sm_diff_edges) free(sm_diff_edges);
-	if (sm_diff_edges_flags) free(sm_diff_edges_flags);
-	if (sm2_new_edges) free(sm2_new_edges);
-	if (sm1_missing_edges) free(sm1_missing_edges);
-	
-	cyberiada_destroy_sm(sm1);
-	cyberiada_destroy_sm(sm2);
-
-	CYB_CHECK_RESULT(res);
-
-	return SMIsomorphismResult(result_flags);
+	std::sort(result.begin(), result.end(), first_member_less);
+	return result;
 }
 
 // -----------------------------------------------------------------------------
 // Cyberiada-GraphML Document
 // -----------------------------------------------------------------------------
 Document::Document(DocumentGeometryFormat format):
-	ElementCollection(NULL, elementRoot, "", "")
+	ElementCollection(NULL, elementRoot, "", ""), threads(0), load_stats_enabled(false), lazy_load(false),
+	trusted_load(false)
 {
 	reset(format);
 }
 
 Document::Document(const Document& d):
 	ElementCollection(d),
-	geometry_format(d.geometry_format), metainfo(d.metainfo), metainfo_element(NULL), center_point(d.center_point)
+	geometry_format(d.geometry_format), metainfo(d.metainfo), metainfo_element(NULL), center_point(d.center_point),
+	threads(d.threads), load_stats_enabled(d.load_stats_enabled), load_stats(d.load_stats), lazy_load(d.lazy_load),
+	trusted_load(d.trusted_load), sm_selection(d.sm_selection), skipped_sms(d.skipped_sms)
 {
+	for (ElementList::const_iterator i = children.begin(); i != children.end(); i++) {
+		index_elements(*i, true);
+	}
 	update_metainfo_element();	
 }
 
@@ -2472,6 +6811,20 @@ void Document::reset(DocumentGeometryFormat format)
 		center_point = Point(0.0, 0.0);
 	}
 	clear();
+	lazy_document.reset();
+	skipped_sms.reset();
+	id_index.clear();
+	indexed_elements.clear();
+	id_hints.clear();
+}
+
+void Document::load_state_machines() const
+{
+	for (ElementList::const_iterator i = children.begin(); i != children.end(); i++) {
+		if ((*i)->get_type() == elementSM) {
+			static_cast<const ElementCollection*>(*i)->load_content();
+		}
+	}
 }
 
 StateMachine* Document::new_state_machine(const String& sm_name, const Rect& r)
@@ -2485,178 +6838,333 @@ StateMachine* Document::new_state_machine(const String& sm_name, const Rect& r)
 
 StateMachine* Document::new_state_machine(const ID& _id, const String& sm_name, const Rect& r)
 {
-	check_id_uniqueness(_id);
-	
-	StateMachine* sm = new StateMachine(this, _id, sm_name, r); 
+	StateMachine* sm = NULL;
+	throw_status(try_new_state_machine(sm, _id, sm_name, r));
+	return sm;
+}
+
+Status Document::try_new_state_machine(StateMachine*& sm, const ID& _id, const String& sm_name, const Rect& r)
+{
+	sm = NULL;
+	Status s = check_id_uniqueness(_id);
+	if (!s) {
+		return s;
+	}
+
+	sm = new StateMachine(this, _id, sm_name, r);
 	add_element(sm);
-	check_geometry_update(r);	
+	check_geometry_update(r);
 	update_metainfo_element();
-	return sm;
+	return s;
 }
 
 State* Document::new_state(ElementCollection* _parent, const String& state_name, const Action& a,
 						   const Rect& r, const Rect& region, const Color& _color)
 {
-	check_parent_element(_parent);
-	check_nonempty_string(state_name);
-	
-	State* state = new State(_parent, generate_vertex_id(_parent), state_name, r, region, _color);
+	State* state = NULL;
+	throw_status(try_new_state(state, _parent, state_name, a, r, region, _color));
+	return state;
+}
+
+Status Document::try_new_state(State*& state, ElementCollection* _parent, const String& state_name, const Action& a,
+							   const Rect& r, const Rect& region, const Color& _color)
+{
+	state = NULL;
+	Status s = check_new_vertex(_parent, &state_name, NULL);
+	if (!s) {
+		return s;
+	}
+
+	state = new State(_parent, generate_vertex_id(_parent), state_name, r, region, _color);
 	if (!a.is_empty_transition()) {
 		state->add_action(a);
 	}
 	_parent->add_element(state);
 	check_geometry_update(r);
-	return state;
+	return s;
 }
 
 State* Document::new_state(ElementCollection* _parent, const ID& state_id, const String& state_name, const Action& a,
 						   const Rect& r, const Rect& region, const Color& _color)
 {
-	check_parent_element(_parent);
-	check_nonempty_string(state_name);
-	check_id_uniqueness(state_id);
+	State* state = NULL;
+	throw_status(try_new_state(state, _parent, state_id, state_name, a, r, region, _color));
+	return state;
+}
+
+Status Document::try_new_state(State*& state, ElementCollection* _parent, const ID& state_id, const String& state_name,
+							   const Action& a, const Rect& r, const Rect& region, const Color& _color)
+{
+	state = NULL;
+	Status s = check_new_vertex(_parent, &state_name, &state_id);
+	if (!s) {
+		return s;
+	}
 
-	State* state = new State(_parent, state_id, state_name, r, region, _color);
+	state = new State(_parent, state_id, state_name, r, region, _color);
 	if (!a.is_empty_transition()) {
 		state->add_action(a);
 	}
 	_parent->add_element(state);
-	check_geometry_update(r);	
-	return state;
+	check_geometry_update(r);
+	return s;
 }
 
 InitialPseudostate* Document::new_initial(ElementCollection* _parent, const Point& p)
 {
-	check_parent_element(_parent);
-	check_single_initial(_parent);
+	InitialPseudostate* initial = NULL;
+	throw_status(try_new_initial(initial, _parent, p));
+	return initial;
+}
+
+Status Document::try_new_initial(InitialPseudostate*& initial, ElementCollection* _parent, const Point& p)
+{
+	initial = NULL;
+	Status s = check_new_vertex(_parent, NULL, NULL, true);
+	if (!s) {
+		return s;
+	}
 
-	InitialPseudostate* initial = new InitialPseudostate(_parent, generate_vertex_id(_parent), p);
+	initial = new InitialPseudostate(_parent, generate_vertex_id(_parent), p);
 	_parent->add_element(initial);
-	check_geometry_update(p);	
-	return initial;
+	check_geometry_update(p);
+	return s;
 }
 
 InitialPseudostate* Document::new_initial(ElementCollection* _parent, const Name& initial_name, const Point& p)
 {
-	check_parent_element(_parent);
-	check_nonempty_string(initial_name);
-	check_single_initial(_parent);
-	
-	InitialPseudostate* initial = new InitialPseudostate(_parent, generate_vertex_id(_parent), initial_name, p);
+	InitialPseudostate* initial = NULL;
+	throw_status(try_new_initial(initial, _parent, initial_name, p));
+	return initial;
+}
+
+Status Document::try_new_initial(InitialPseudostate*& initial, ElementCollection* _parent, const Name& initial_name,
+								 const Point& p)
+{
+	initial = NULL;
+	Status s = check_new_vertex(_parent, &initial_name, NULL, true);
+	if (!s) {
+		return s;
+	}
+
+	initial = new InitialPseudostate(_parent, generate_vertex_id(_parent), initial_name, p);
 	_parent->add_element(initial);
 	check_geometry_update(p);
-	return initial;
+	return s;
 }
 
 InitialPseudostate* Document::new_initial(ElementCollection* _parent, const ID& _id, const Name& initial_name, const Point& p)
 {
-	check_parent_element(_parent);
-	check_nonempty_string(initial_name);
-	check_single_initial(_parent);
-	check_id_uniqueness(_id);
-	
-	InitialPseudostate* initial = new InitialPseudostate(_parent, _id, initial_name, p);
+	InitialPseudostate* initial = NULL;
+	throw_status(try_new_initial(initial, _parent, _id, initial_name, p));
+	return initial;
+}
+
+Status Document::try_new_initial(InitialPseudostate*& initial, ElementCollection* _parent, const ID& _id,
+								 const Name& initial_name, const Point& p)
+{
+	initial = NULL;
+	Status s = check_new_vertex(_parent, &initial_name, &_id, true);
+	if (!s) {
+		return s;
+	}
+
+	initial = new InitialPseudostate(_parent, _id, initial_name, p);
 	_parent->add_element(initial);
 	check_geometry_update(p);
-	return initial;
+	return s;
 }
 
 FinalState* Document::new_final(ElementCollection* _parent, const Point& point)
 {
-	check_parent_element(_parent);
+	FinalState* fin = NULL;
+	throw_status(try_new_final(fin, _parent, point));
+	return fin;
+}
+
+Status Document::try_new_final(FinalState*& fin, ElementCollection* _parent, const Point& point)
+{
+	fin = NULL;
+	Status s = check_new_vertex(_parent, NULL, NULL);
+	if (!s) {
+		return s;
+	}
 
-	FinalState* fin = new FinalState(_parent, generate_vertex_id(_parent), point);
+	fin = new FinalState(_parent, generate_vertex_id(_parent), point);
 	_parent->add_element(fin);
-	return fin;
+	return s;
 }
 
 FinalState* Document::new_final(ElementCollection* _parent, const Name& _name, const Point& point)
 {
-	check_parent_element(_parent);
-	check_nonempty_string(_name);
+	FinalState* fin = NULL;
+	throw_status(try_new_final(fin, _parent, _name, point));
+	return fin;
+}
+
+Status Document::try_new_final(FinalState*& fin, ElementCollection* _parent, const Name& _name, const Point& point)
+{
+	fin = NULL;
+	Status s = check_new_vertex(_parent, &_name, NULL);
+	if (!s) {
+		return s;
+	}
 
-	FinalState* fin = new FinalState(_parent, generate_vertex_id(_parent), _name, point);
+	fin = new FinalState(_parent, generate_vertex_id(_parent), _name, point);
 	_parent->add_element(fin);
 	check_geometry_update(point);
-	return fin;
+	return s;
 }
 
 FinalState* Document::new_final(ElementCollection* _parent, const ID& _id, const Name& _name, const Point& point)
 {
-	check_parent_element(_parent);
-	check_nonempty_string(_name);
-	check_id_uniqueness(_id);
+	FinalState* fin = NULL;
+	throw_status(try_new_final(fin, _parent, _id, _name, point));
+	return fin;
+}
+
+Status Document::try_new_final(FinalState*& fin, ElementCollection* _parent, const ID& _id, const Name& _name,
+							   const Point& point)
+{
+	fin = NULL;
+	Status s = check_new_vertex(_parent, &_name, &_id);
+	if (!s) {
+		return s;
+	}
 
-	FinalState* fin = new FinalState(_parent, _id, _name, point);
+	fin = new FinalState(_parent, _id, _name, point);
 	_parent->add_element(fin);
-	check_geometry_update(point);	
-	return fin;	
+	check_geometry_update(point);
+	return s;
 }
 
 ChoicePseudostate* Document::new_choice(ElementCollection* _parent, const Rect& r, const Color& c)
 {
-	check_parent_element(_parent);
+	ChoicePseudostate* choice = NULL;
+	throw_status(try_new_choice(choice, _parent, r, c));
+	return choice;
+}
+
+Status Document::try_new_choice(ChoicePseudostate*& choice, ElementCollection* _parent, const Rect& r, const Color& c)
+{
+	choice = NULL;
+	Status s = check_new_vertex(_parent, NULL, NULL);
+	if (!s) {
+		return s;
+	}
 
-	ChoicePseudostate* choice = new ChoicePseudostate(_parent, generate_vertex_id(_parent), r, c);
+	choice = new ChoicePseudostate(_parent, generate_vertex_id(_parent), r, c);
 	_parent->add_element(choice);
 	check_geometry_update(r);
-	return choice;
+	return s;
 }
 
 ChoicePseudostate* Document::new_choice(ElementCollection* _parent, const Name& _name, const Rect& r, const Color& c)
 {
-	check_parent_element(_parent);
-	check_nonempty_string(_name);
+	ChoicePseudostate* choice = NULL;
+	throw_status(try_new_choice(choice, _parent, _name, r, c));
+	return choice;
+}
+
+Status Document::try_new_choice(ChoicePseudostate*& choice, ElementCollection* _parent, const Name& _name,
+								const Rect& r, const Color& c)
+{
+	choice = NULL;
+	Status s = check_new_vertex(_parent, &_name, NULL);
+	if (!s) {
+		return s;
+	}
 
-	ChoicePseudostate* choice = new ChoicePseudostate(_parent, generate_vertex_id(_parent), _name, r, c);
+	choice = new ChoicePseudostate(_parent, generate_vertex_id(_parent), _name, r, c);
 	_parent->add_element(choice);
 	check_geometry_update(r);
-	return choice;
+	return s;
 }
 
 ChoicePseudostate* Document::new_choice(ElementCollection* _parent, const ID& _id, const Name& _name, const Rect& r, const Color& c)
 {
-	check_parent_element(_parent);
-	check_nonempty_string(_name);
-	check_id_uniqueness(_id);
-	
-	ChoicePseudostate* choice = new ChoicePseudostate(_parent, generate_vertex_id(_parent), _name, r, c);
+	ChoicePseudostate* choice = NULL;
+	throw_status(try_new_choice(choice, _parent, _id, _name, r, c));
+	return choice;
+}
+
+Status Document::try_new_choice(ChoicePseudostate*& choice, ElementCollection* _parent, const ID& _id, const Name& _name,
+								const Rect& r, const Color& c)
+{
+	choice = NULL;
+	Status s = check_new_vertex(_parent, &_name, &_id);
+	if (!s) {
+		return s;
+	}
+
+	choice = new ChoicePseudostate(_parent, generate_vertex_id(_parent), _name, r, c);
 	_parent->add_element(choice);
 	check_geometry_update(r);
-	return choice;
+	return s;
+}
+
+TerminatePseudostate* Document::new_terminate(ElementCollection* _parent, const Point& p)
+{
+	TerminatePseudostate* term = NULL;
+	throw_status(try_new_terminate(term, _parent, p));
+	return term;
 }
 
-TerminatePseudostate* Document::new_terminate(ElementCollection* _parent, const Point& p)
+Status Document::try_new_terminate(TerminatePseudostate*& term, ElementCollection* _parent, const Point& p)
 {
-	check_parent_element(_parent);
+	term = NULL;
+	Status s = check_new_vertex(_parent, NULL, NULL);
+	if (!s) {
+		return s;
+	}
 
-	TerminatePseudostate* term = new TerminatePseudostate(_parent, generate_vertex_id(_parent), p);
+	term = new TerminatePseudostate(_parent, generate_vertex_id(_parent), p);
 	_parent->add_element(term);
 	check_geometry_update(p);
-	return term;
+	return s;
 }
 
 TerminatePseudostate* Document::new_terminate(ElementCollection* _parent, const Name& _name, const Point& p)
 {
-	check_parent_element(_parent);
-	check_nonempty_string(_name);
+	TerminatePseudostate* term = NULL;
+	throw_status(try_new_terminate(term, _parent, _name, p));
+	return term;
+}
+
+Status Document::try_new_terminate(TerminatePseudostate*& term, ElementCollection* _parent, const Name& _name, const Point& p)
+{
+	term = NULL;
+	Status s = check_new_vertex(_parent, &_name, NULL);
+	if (!s) {
+		return s;
+	}
 
-	TerminatePseudostate* term = new TerminatePseudostate(_parent, generate_vertex_id(_parent), _name, p);
+	term = new TerminatePseudostate(_parent, generate_vertex_id(_parent), _name, p);
 	_parent->add_element(term);
-	check_geometry_update(p);	
-	return term;
+	check_geometry_update(p);
+	return s;
 }
 
 TerminatePseudostate* Document::new_terminate(ElementCollection* _parent, const ID& _id, const Name& _name, const Point& p)
 {
-	check_parent_element(_parent);
-	check_nonempty_string(_name);
-	check_id_uniqueness(_id);
-	
-	TerminatePseudostate* term = new TerminatePseudostate(_parent, _id, _name, p);
+	TerminatePseudostate* term = NULL;
+	throw_status(try_new_terminate(term, _parent, _id, _name, p));
+	return term;
+}
+
+Status Document::try_new_terminate(TerminatePseudostate*& term, ElementCollection* _parent, const ID& _id, const Name& _name,
+								   const Point& p)
+{
+	term = NULL;
+	Status s = check_new_vertex(_parent, &_name, &_id);
+	if (!s) {
+		return s;
+	}
+
+	term = new TerminatePseudostate(_parent, _id, _name, p);
 	_parent->add_element(term);
 	check_geometry_update(p);
-	return term;
+	return s;
 }
 
 Transition* Document::new_transition(StateMachine* sm, TransitionType ttype, Element* source, Element* target,
@@ -2664,20 +7172,31 @@ Transition* Document::new_transition(StateMachine* sm, TransitionType ttype, Ele
 									 const Point& sp, const Point& tp,
 									 const Point& label_p, const Rect& label_r, const Color& c)
 {
-	check_parent_element(sm);
-	check_transition_source(source);
-	check_transition_target(target);
-	check_transition_action(action);
-	
-	Transition* t = new Transition(sm, ttype, generate_transition_id(source->get_id(), target->get_id()),
-								   source->get_id(), target->get_id(), action, pl, sp, tp, label_p, label_r, c);
+	Transition* t = NULL;
+	throw_status(try_new_transition(t, sm, ttype, source, target, action, pl, sp, tp, label_p, label_r, c));
+	return t;
+}
+
+Status Document::try_new_transition(Transition*& t, StateMachine* sm, TransitionType ttype, Element* source, Element* target,
+									const Action& action, const Polyline& pl,
+									const Point& sp, const Point& tp,
+									const Point& label_p, const Rect& label_r, const Color& c)
+{
+	t = NULL;
+	Status s = check_new_transition(sm, source, target, NULL, action);
+	if (!s) {
+		return s;
+	}
+
+	t = new Transition(sm, ttype, generate_transition_id(source->get_id(), target->get_id()),
+					   source->get_id(), target->get_id(), action, pl, sp, tp, label_p, label_r, c);
 	sm->add_element(t);
 	check_geometry_update(sp);
 	check_geometry_update(tp);
 	check_geometry_update(label_p);
-	check_geometry_update(label_r);	
+	check_geometry_update(label_r);
 	check_geometry_update(pl);
-	return t;
+	return s;
 }
 
 Transition* Document::new_transition(StateMachine* sm, TransitionType ttype, const ID& _id, Element* source, Element* target,
@@ -2685,178 +7204,325 @@ Transition* Document::new_transition(StateMachine* sm, TransitionType ttype, con
 									 const Point& sp, const Point& tp,
 									 const Point& label_p, const Rect& label_r, const Color& c)
 {
-	check_parent_element(sm);
-	check_transition_source(source);
-	check_transition_target(target);
-	check_id_uniqueness(_id);
-	check_transition_action(action);
+	Transition* t = NULL;
+	throw_status(try_new_transition(t, sm, ttype, _id, source, target, action, pl, sp, tp, label_p, label_r, c));
+	return t;
+}
+
+Status Document::try_new_transition(Transition*& t, StateMachine* sm, TransitionType ttype, const ID& _id,
+									Element* source, Element* target, const Action& action, const Polyline& pl,
+									const Point& sp, const Point& tp,
+									const Point& label_p, const Rect& label_r, const Color& c)
+{
+	t = NULL;
+	Status s = check_new_transition(sm, source, target, &_id, action);
+	if (!s) {
+		return s;
+	}
 
-	Transition* t = new Transition(sm, ttype, _id, source->get_id(), target->get_id(), action, pl, sp, tp, label_p, label_r, c);
+	t = new Transition(sm, ttype, _id, source->get_id(), target->get_id(), action, pl, sp, tp, label_p, label_r, c);
 	sm->add_element(t);
 	check_geometry_update(sp);
 	check_geometry_update(tp);
 	check_geometry_update(label_p);
 	check_geometry_update(label_r);
 	check_geometry_update(pl);
-	return t;
+	return s;
 }
 
 Comment* Document::new_comment(ElementCollection* _parent, const String& body, const Rect& r, const Color& c, const String& markup)
 {
-	check_parent_element(_parent);
+	Comment* comm = NULL;
+	throw_status(try_new_comment(comm, _parent, body, r, c, markup));
+	return comm;
+}
+
+Status Document::try_new_comment(Comment*& comm, ElementCollection* _parent, const String& body, const Rect& r, const Color& c,
+								 const String& markup)
+{
+	comm = NULL;
+	Status s = check_new_vertex(_parent, NULL, NULL);
+	if (!s) {
+		return s;
+	}
 
-	Comment* comm = new Comment(_parent, generate_vertex_id(_parent), body, true, markup, r, c);
+	comm = new Comment(_parent, generate_vertex_id(_parent), body, true, markup, r, c);
 	_parent->add_element(comm);
 	check_geometry_update(r);
-	return comm;
+	return s;
 }
 
 Comment* Document::new_comment(ElementCollection* _parent, const String& _name, const String& body, const Rect& r, const Color& c,
 							   const String& markup)
 {
-	check_parent_element(_parent);
-	check_nonempty_string(_name);
+	Comment* comm = NULL;
+	throw_status(try_new_comment(comm, _parent, _name, body, r, c, markup));
+	return comm;
+}
+
+Status Document::try_new_comment(Comment*& comm, ElementCollection* _parent, const String& _name, const String& body,
+								 const Rect& r, const Color& c, const String& markup)
+{
+	comm = NULL;
+	Status s = check_new_vertex(_parent, &_name, NULL);
+	if (!s) {
+		return s;
+	}
 
-	Comment* comm = new Comment(_parent, generate_vertex_id(_parent), body, _name, true, markup, r, c);
+	comm = new Comment(_parent, generate_vertex_id(_parent), body, _name, true, markup, r, c);
 	_parent->add_element(comm);
 	check_geometry_update(r);
-	return comm;
+	return s;
 }
 
 Comment* Document::new_comment(ElementCollection* _parent, const ID& _id, const String& _name, const String& body,
 							   const Rect& r, const Color& c, const String& markup)
 {
-	check_parent_element(_parent);
-	check_id_uniqueness(_id);
+	Comment* comm = NULL;
+	throw_status(try_new_comment(comm, _parent, _id, _name, body, r, c, markup));
+	return comm;
+}
+
+Status Document::try_new_comment(Comment*& comm, ElementCollection* _parent, const ID& _id, const String& _name,
+								 const String& body, const Rect& r, const Color& c, const String& markup)
+{
+	comm = NULL;
+	Status s = check_new_vertex(_parent, NULL, &_id);
+	if (!s) {
+		return s;
+	}
 
-	Comment* comm = new Comment(_parent, _id, body, _name, true, markup, r, c);
+	comm = new Comment(_parent, _id, body, _name, true, markup, r, c);
 	_parent->add_element(comm);
 	check_geometry_update(r);
-	return comm;
+	return s;
 }
 
 Comment* Document::new_formal_comment(ElementCollection* _parent, const String& body, const Rect& r, const Color& c, const String& markup)
 {
-	check_parent_element(_parent);
+	Comment* comm = NULL;
+	throw_status(try_new_formal_comment(comm, _parent, body, r, c, markup));
+	return comm;
+}
+
+Status Document::try_new_formal_comment(Comment*& comm, ElementCollection* _parent, const String& body, const Rect& r,
+										const Color& c, const String& markup)
+{
+	comm = NULL;
+	Status s = check_new_vertex(_parent, NULL, NULL);
+	if (!s) {
+		return s;
+	}
 
-	Comment* comm = new Comment(_parent, generate_vertex_id(_parent), body, false, markup, r, c);
+	comm = new Comment(_parent, generate_vertex_id(_parent), body, false, markup, r, c);
 	_parent->add_element(comm);
 	check_geometry_update(r);
-	return comm;
+	return s;
 }
 
 Comment* Document::new_formal_comment(ElementCollection* _parent, const String& _name, const String& body, const Rect& r, const Color& c,
 									  const String& markup)
 {
-	check_parent_element(_parent);
-	check_nonempty_string(_name);
+	Comment* comm = NULL;
+	throw_status(try_new_formal_comment(comm, _parent, _name, body, r, c, markup));
+	return comm;
+}
+
+Status Document::try_new_formal_comment(Comment*& comm, ElementCollection* _parent, const String& _name, const String& body,
+										const Rect& r, const Color& c, const String& markup)
+{
+	comm = NULL;
+	Status s = check_new_vertex(_parent, &_name, NULL);
+	if (!s) {
+		return s;
+	}
 
-	Comment* comm = new Comment(_parent, generate_vertex_id(_parent), body, _name, false, markup, r, c);
+	comm = new Comment(_parent, generate_vertex_id(_parent), body, _name, false, markup, r, c);
 	_parent->add_element(comm);
 	check_geometry_update(r);
-	return comm;
+	return s;
 }
 
 Comment* Document::new_formal_comment(ElementCollection* _parent, const ID& _id, const String& _name, const String& body,
 									  const Rect& r, const Color& c, const String& markup)
 {
-	check_parent_element(_parent);
-	check_id_uniqueness(_id);
+	Comment* comm = NULL;
+	throw_status(try_new_formal_comment(comm, _parent, _id, _name, body, r, c, markup));
+	return comm;
+}
+
+Status Document::try_new_formal_comment(Comment*& comm, ElementCollection* _parent, const ID& _id, const String& _name,
+										const String& body, const Rect& r, const Color& c, const String& markup)
+{
+	comm = NULL;
+	Status s = check_new_vertex(_parent, NULL, &_id);
+	if (!s) {
+		return s;
+	}
 
-	Comment* comm = new Comment(_parent, _id, body, _name, true, markup, r, c);
+	comm = new Comment(_parent, _id, body, _name, true, markup, r, c);
 	_parent->add_element(comm);
 	check_geometry_update(r);
-	return comm;
+	return s;
 }
 
 const CommentSubject& Document::add_comment_to_element(Comment* comment, Element* element,
 													   const Point& source, const Point& target, const Polyline& pl)
 {
-	check_parent_element(comment);
-	check_comment_subject_element(element);
+	const CommentSubject* subject = NULL;
+	throw_status(try_add_comment_to_element(subject, comment, element, source, target, pl));
+	return *subject;
+}
+
+Status Document::try_add_comment_to_element(const CommentSubject*& subject, Comment* comment, Element* element,
+											const Point& source, const Point& target, const Polyline& pl)
+{
+	subject = NULL;
+	Status s = check_new_comment_subject(comment, element, NULL, NULL);
+	if (!s) {
+		return s;
+	}
 
 	check_geometry_update(source);
 	check_geometry_update(target);
 	check_geometry_update(pl);
 
-	return comment->add_subject(CommentSubject(generate_transition_id(comment->get_id(), element->get_id()),
-											   element, source, target, pl));
+	subject = &(comment->add_subject(CommentSubject(generate_transition_id(comment->get_id(), element->get_id()),
+													element, source, target, pl)));
+	return s;
 }
 
 const CommentSubject& Document::add_comment_to_element(Comment* comment, Element* element, const ID& _id,
 													   const Point& source, const Point& target, const Polyline& pl)
 {
-	check_parent_element(comment);
-	check_comment_subject_element(element);
-	check_id_uniqueness(_id);
+	const CommentSubject* subject = NULL;
+	throw_status(try_add_comment_to_element(subject, comment, element, _id, source, target, pl));
+	return *subject;
+}
+
+Status Document::try_add_comment_to_element(const CommentSubject*& subject, Comment* comment, Element* element, const ID& _id,
+											const Point& source, const Point& target, const Polyline& pl)
+{
+	subject = NULL;
+	Status s = check_new_comment_subject(comment, element, NULL, &_id);
+	if (!s) {
+		return s;
+	}
 
 	check_geometry_update(source);
 	check_geometry_update(target);
 	check_geometry_update(pl);
-	
-	return comment->add_subject(CommentSubject(_id, element, source, target, pl));	
+
+	subject = &(comment->add_subject(CommentSubject(_id, element, source, target, pl)));
+	return s;
 }
 
 const CommentSubject& Document::add_comment_to_element_name(Comment* comment, Element* element, const String& fragment,
 															const Point& source, const Point& target, const Polyline& pl)
 {
-	check_parent_element(comment);
-	check_comment_subject_element(element);
-	check_nonempty_string(fragment);
+	const CommentSubject* subject = NULL;
+	throw_status(try_add_comment_to_element_name(subject, comment, element, fragment, source, target, pl));
+	return *subject;
+}
+
+Status Document::try_add_comment_to_element_name(const CommentSubject*& subject, Comment* comment, Element* element,
+												 const String& fragment, const Point& source, const Point& target,
+												 const Polyline& pl)
+{
+	subject = NULL;
+	Status s = check_new_comment_subject(comment, element, &fragment, NULL);
+	if (!s) {
+		return s;
+	}
 
 	check_geometry_update(source);
 	check_geometry_update(target);
 	check_geometry_update(pl);
-	
-	return comment->add_subject(CommentSubject(generate_transition_id(comment->get_id(), element->get_id()), element,
-											   commentSubjectName, fragment, source, target, pl));
+
+	subject = &(comment->add_subject(CommentSubject(generate_transition_id(comment->get_id(), element->get_id()), element,
+													commentSubjectName, fragment, source, target, pl)));
+	return s;
 }
 
 const CommentSubject& Document::add_comment_to_element_name(Comment* comment, Element* element, const String& fragment, const ID& _id,
 															const Point& source, const Point& target, const Polyline& pl)
 {
-	check_parent_element(comment);
-	check_comment_subject_element(element);
-	check_nonempty_string(fragment);
-	check_id_uniqueness(_id);
+	const CommentSubject* subject = NULL;
+	throw_status(try_add_comment_to_element_name(subject, comment, element, fragment, _id, source, target, pl));
+	return *subject;
+}
+
+Status Document::try_add_comment_to_element_name(const CommentSubject*& subject, Comment* comment, Element* element,
+												 const String& fragment, const ID& _id,
+												 const Point& source, const Point& target, const Polyline& pl)
+{
+	subject = NULL;
+	Status s = check_new_comment_subject(comment, element, &fragment, &_id);
+	if (!s) {
+		return s;
+	}
 
 	check_geometry_update(source);
 	check_geometry_update(target);
 	check_geometry_update(pl);
-	
-	return comment->add_subject(CommentSubject(_id, element,
-											   commentSubjectName, fragment, source, target, pl));
+
+	subject = &(comment->add_subject(CommentSubject(_id, element,
+													commentSubjectName, fragment, source, target, pl)));
+	return s;
 }
 
 const CommentSubject& Document::add_comment_to_element_body(Comment* comment, Element* element, const String& fragment,
 															const Point& source, const Point& target, const Polyline& pl)
 {
-	check_parent_element(comment);
-	check_comment_subject_element(element);
-	check_nonempty_string(fragment);
+	const CommentSubject* subject = NULL;
+	throw_status(try_add_comment_to_element_body(subject, comment, element, fragment, source, target, pl));
+	return *subject;
+}
+
+Status Document::try_add_comment_to_element_body(const CommentSubject*& subject, Comment* comment, Element* element,
+												 const String& fragment, const Point& source, const Point& target,
+												 const Polyline& pl)
+{
+	subject = NULL;
+	Status s = check_new_comment_subject(comment, element, &fragment, NULL);
+	if (!s) {
+		return s;
+	}
 
 	check_geometry_update(source);
 	check_geometry_update(target);
 	check_geometry_update(pl);
-	
-	return comment->add_subject(CommentSubject(generate_transition_id(comment->get_id(), element->get_id()), element,
-											   commentSubjectData, fragment, source, target, pl));
+
+	subject = &(comment->add_subject(CommentSubject(generate_transition_id(comment->get_id(), element->get_id()), element,
+													commentSubjectData, fragment, source, target, pl)));
+	return s;
 }
 
 const CommentSubject& Document::add_comment_to_element_body(Comment* comment, Element* element, const String& fragment, const ID& _id,
 															const Point& source, const Point& target, const Polyline& pl)
 {
-	check_parent_element(comment);
-	check_comment_subject_element(element);
-	check_nonempty_string(fragment);
-	check_id_uniqueness(_id);
+	const CommentSubject* subject = NULL;
+	throw_status(try_add_comment_to_element_body(subject, comment, element, fragment, _id, source, target, pl));
+	return *subject;
+}
+
+Status Document::try_add_comment_to_element_body(const CommentSubject*& subject, Comment* comment, Element* element,
+												 const String& fragment, const ID& _id,
+												 const Point& source, const Point& target, const Polyline& pl)
+{
+	subject = NULL;
+	Status s = check_new_comment_subject(comment, element, &fragment, &_id);
+	if (!s) {
+		return s;
+	}
 
 	check_geometry_update(source);
 	check_geometry_update(target);
 	check_geometry_update(pl);
-	
-	return comment->add_subject(CommentSubject(_id, element,
-											   commentSubjectData, fragment, source, target, pl));
+
+	subject = &(comment->add_subject(CommentSubject(_id, element,
+													commentSubjectData, fragment, source, target, pl)));
+	return s;
 }
 
 bool Document::update_metainfo_from_comment(const String& body)
@@ -2864,72 +7530,130 @@ bool Document::update_metainfo_from_comment(const String& body)
 	return false;
 }
 
-void Document::check_parent_element(const Element* _parent) const
+Status Document::check_new_vertex(const ElementCollection* _parent, const String* _name, const ID* _id, bool initial) const
+{
+	Status s = check_parent_element(_parent);
+	if (s && _name) {
+		s = check_nonempty_string(*_name);
+	}
+	if (s && initial) {
+		s = check_single_initial(_parent);
+	}
+	if (s && _id) {
+		s = check_id_uniqueness(*_id);
+	}
+	return s;
+}
+
+Status Document::check_new_transition(const StateMachine* sm, const Element* source, const Element* target,
+									  const ID* _id, const Action& action) const
+{
+	Status s = check_parent_element(sm);
+	if (s) {
+		s = check_transition_source(source);
+	}
+	if (s) {
+		s = check_transition_target(target);
+	}
+	if (s && _id) {
+		s = check_id_uniqueness(*_id);
+	}
+	if (s) {
+		s = check_transition_action(action);
+	}
+	return s;
+}
+
+Status Document::check_new_comment_subject(const Comment* comment, const Element* element,
+										   const String* fragment, const ID* _id) const
+{
+	Status s = check_parent_element(comment);
+	if (s) {
+		s = check_comment_subject_element(element);
+	}
+	if (s && fragment) {
+		s = check_nonempty_string(*fragment);
+	}
+	if (s && _id) {
+		s = check_id_uniqueness(*_id);
+	}
+	return s;
+}
+
+Status Document::check_parent_element(const Element* _parent) const
 {
 	if (!_parent) {
-		throw ParametersException("No parent element");
+		return Status(statusParametersError, "No parent element");
 	}
+	return Status();
 }
 
-void Document::check_nonempty_string(const String& s) const
+Status Document::check_nonempty_string(const String& s) const
 {
 	if (s.empty()) {
-		throw ParametersException(String("Empty string parameter"));
+		return Status(statusParametersError, "Empty string parameter");
 	}
+	return Status();
 }
 
-void Document::check_id_uniqueness(const ID& _id) const
+Status Document::check_id_uniqueness(const ID& _id) const
 {
-	if (find_element_by_id(_id)) {
-		throw ParametersException(String("New element id ") + _id + " is not unique");
+	if (is_id_used(_id)) {
+		return Status(statusParametersError, String("New element id ") + _id + " is not unique");
 	}
+	return Status();
 }
 
-void Document::check_single_initial(const ElementCollection* _parent) const
+Status Document::check_single_initial(const ElementCollection* _parent) const
 {
 	if (_parent->has_initial()) {
-		throw ParametersException("Parent already has initial element");
+		return Status(statusParametersError, "Parent already has initial element");
 	}
+	return Status();
 }
 
-void Document::check_transition_action(const Action& action) const
+Status Document::check_transition_action(const Action& action) const
 {
 	if (action.get_type() != actionTransition) {
-		throw ParametersException("Transitions cannot contain entry/exit activities");
+		return Status(statusParametersError, "Transitions cannot contain entry/exit activities");
 	}
+	return Status();
 }
 
-void Document::check_transition_source(const Element* element) const
+Status Document::check_transition_source(const Element* element) const
 {
 	if (!element) {
-		throw ParametersException("Empty element");
+		return Status(statusParametersError, "Empty element");
 	}
-	if (element->get_type() == elementRoot || 
+	if (element->get_type() == elementRoot ||
 		element->get_type() == elementSM ||
 		element->get_type() == elementComment ||
 		element->get_type() == elementFormalComment ||
 		element->get_type() == elementFinal ||
 		element->get_type() == elementTerminate ||
 		element->get_type() == elementTransition) {
-		throw ParametersException("Bad source for transition");
+		return Status(statusParametersError, "Bad source for transition");
 	}
+	return Status();
 }
 
-void Document::check_transition_target(const Element* element) const
+Status Document::check_transition_target(const Element* element) const
 {
 	if (!element) {
-		throw ParametersException("Empty element");
+		return Status(statusParametersError, "Empty element");
 	}
-	if (element->get_type() == elementRoot || 
+	if (element->get_type() == elementRoot ||
 		element->get_type() == elementSM ||
 		element->get_type() == elementComment ||
 		element->get_type() == elementFormalComment ||
 		element->get_type() == elementInitial ||
 		element->get_type() == elementTransition) {
-		throw ParametersException("Bad target for transition");
+		return Status(statusParametersError, "Bad target for transition");
 	} else if (element->get_type() == elementChoice) {
 		bool found = false;
-		ConstElementList transitions = find_elements_by_type(elementTransition);
+		// the transitions cannot cross the state machine borders
+		const StateMachine* sm = get_parent_sm(element);
+		ConstElementList transitions = sm ? sm->find_elements_by_type(elementTransition) : find_elements_by_type(elementTransition);
 		for (ConstElementList::const_iterator i = transitions.begin(); i != transitions.end(); i++) {
 			const Transition* t = static_cast<const Transition*>(*i);
 			if (t->target_element_id() == element->get_id()) {
@@ -2938,19 +7662,21 @@ void Document::check_transition_target(const Element* element) const
 			}
 		}
 		if (found) {
-			throw ParametersException("Choice pseudostate may have only one incoming transition");
+			return Status(statusParametersError, "Choice pseudostate may have only one incoming transition");
 		}
 	}
+	return Status();
 }
 
-void Document::check_comment_subject_element(const Element* element) const
+Status Document::check_comment_subject_element(const Element* element) const
 {
 	if (!element) {
-		throw ParametersException("Empty element");
+		return Status(statusParametersError, "Empty element");
 	}
 	if (element->get_type() == elementRoot || element->get_type() == elementSM) {
-		throw ParametersException("Bad element to comment");
+		return Status(statusParametersError, "Bad element to comment");
 	}
+	return Status();
 }
 
 void Document::check_geometry_update(const Rect& r)
@@ -2983,9 +7709,10 @@ void Document::set_geometry(DocumentGeometryFormat format)
 	if (format == geometryFormatNone) {
 		center_point = Point();		
 	}
+	modified();
 }
 
-String DocumentMetainformation::empty_string;
+const String DocumentMetainformation::empty_string;
 
 const String& DocumentMetainformation::get_string(const String& name) const
 {
@@ -3016,12 +7743,27 @@ void Document::set_name(const Name& _name)
 	update_metainfo_element();
 }
 
-void Document::update_from_document(DocumentGeometryFormat gf, CyberiadaDocument* doc)
+void Document::update_from_document(DocumentGeometryFormat gf, CyberiadaDocument* doc, bool select)
+{
+	TraceScope trace(tracePhaseUpdateFromDocument, trace_enabled() ? trace_document_size(doc) : 0);
+	import_document(gf, doc, select);
+	// the Qt geometry gets its center point from the check, so the partial loads keep it as well
+	bool partial = lazy_document || skipped_sms;
+	if (geometry_format == geometryFormatQt || (!partial && !trusted_load)) {
+		PhaseTimer timer(load_stats_timer(&LoadStats::bound_rect_ms));
+		check_bound_rect(doc);
+	} else if (!trusted_load) {
+		// the check of the other geometry formats only confirms the zero center point
+		center_point = Point(0.0, 0.0);
+	}
+}
+
+void Document::import_document(DocumentGeometryFormat gf, CyberiadaDocument* doc, bool select)
 {
 	reset();
 	
 	try {		
-
+		PhaseTimer meta_timer(load_stats_timer(&LoadStats::metainfo_ms));
 		CYB_ASSERT(doc->meta_info);
 		CYB_ASSERT(doc->meta_info->standard_version);
 		metainfo.standard_version = doc->meta_info->standard_version;
@@ -3037,7 +7779,14 @@ void Document::update_from_document(DocumentGeometryFormat gf, CyberiadaDocument
 		}
 		metainfo.transition_order_flag = doc->meta_info->transition_order_flag == 2;
 		metainfo.event_propagation_flag = doc->meta_info->event_propagation_flag == 2;
+		meta_timer.stop();
 		
+		// the SM shells are created serially, their content is imported in parallel
+		PhaseTimer import_timer(load_stats_timer(&LoadStats::import_ms));
+		if (select && !sm_selection.empty()) {
+			skip_state_machines(doc);
+		}
+		std::vector<std::pair<StateMachine*, const CyberiadaSM*>> shells;
 		for (CyberiadaSM* sm = doc->state_machines; sm; sm = sm->next) {
 			CyberiadaNode* root = sm->nodes;
 			CYB_ASSERT(root);
@@ -3045,32 +7794,350 @@ void Document::update_from_document(DocumentGeometryFormat gf, CyberiadaDocument
 			CYB_ASSERT(!root->next);
 			CYB_ASSERT(root->id);
 			StateMachine* new_sm;
-			if (root->title) {
-				new_sm = new_state_machine(root->id, root->title, root->geometry_rect);
+			String title = root->title ? root->title : "";
+			if (trusted_load) {
+				// the metainformation element is not updated for every new state machine
+				Rect r(root->geometry_rect);
+				new_sm = new StateMachine(this, root->id, title, r);
+				add_element(new_sm);
+				check_geometry_update(r);
 			} else {
-				new_sm = new_state_machine(root->id, "", root->geometry_rect);
+				new_sm = new_state_machine(root->id, title, root->geometry_rect);
 			}
 			CYB_ASSERT(new_sm);
-			Element* meta = metainfo_element;
-			new_sm->from_sm(sm, &meta);
-			if (meta) metainfo_element = static_cast<Comment*>(meta);
+			shells.push_back(std::make_pair(new_sm, sm));
+		}
+		if (lazy_load) {
+			import_lazy_state_machines(shells);
+		}
+
+		// the shells are detached while importing, so the changes do not reach the shared document
+		std::vector<Element*> metas(shells.size(), NULL);
+		for (size_t i = 0; i < shells.size(); i++) {
+			index_elements(shells[i].first, false);
+			shells[i].first->update_parent(NULL);
+		}
+		std::exception_ptr error;
+		try {
+			parallel_for(shells.size(), threads, [&](size_t i) {
+				shells[i].first->from_sm(shells[i].second, &(metas[i]), trusted_load);
+			});
+		} catch (...) {
+			error = std::current_exception();
+		}
+		for (size_t i = 0; i < shells.size(); i++) {
+			shells[i].first->update_parent(this);
+			index_elements(shells[i].first, true);
+		}
+		if (error) {
+			std::rethrow_exception(error);
+		}
+		modified();
+		import_timer.stop();
+
+		// merge the metainformation element in the SM order; the serial import updated it
+		// when the next state machine was created, so it is updated if one follows
+		meta_timer.start(load_stats_timer(&LoadStats::metainfo_ms));
+		bool update_meta = false;
+		for (size_t i = 0; i < metas.size(); i++) {
+			if (metas[i]) {
+				CYB_ASSERT(!metainfo_element);
+				metainfo_element = static_cast<Comment*>(metas[i]);
+				update_meta = !trusted_load && i + 1 < metas.size();
+			}
+		}
+		if (update_meta) {
+			update_metainfo_element();
 		}
 	} catch (const CybMLException& e) {
+		if (lazy_document) {
+			reset();
+		}
 		cyberiada_cleanup_sm_document(doc);
 		throw CybMLException(e.str());		
 	} catch (const Exception& e) {
+		if (lazy_document) {
+			reset();
+		}
 		cyberiada_cleanup_sm_document(doc);
 		throw AssertException("Internal load error: " + e.str());
 	}
-	
-	if (doc->node_coord_format == coordNone) {
-		geometry_format = geometryFormatNone;
-	} else {
-		geometry_format = gf;
+	
+	if (doc->node_coord_format == coordNone) {
+		geometry_format = geometryFormatNone;
+	} else {
+		geometry_format = gf;
+	}
+
+	if (skipped_sms) {
+		// the content of the skipped state machines does not change, so it is measured once
+		for (std::vector<SkippedStateMachines::Entry>::iterator i = skipped_sms->sms.begin();
+			 i != skipped_sms->sms.end(); i++) {
+			i->bound_rect = sm_bound_rect(i->sm);
+		}
+	}
+
+	if (lazy_document) {
+		// the lazily loaded state machines keep the C-level document
+		lazy_document->doc = *doc;
+		int res = cyberiada_init_sm_document(doc);
+		CYB_ASSERT(res == CYBERIADA_NO_ERROR);
+	}
+}
+
+void Document::import_lazy_state_machines(std::vector<std::pair<StateMachine*, const CyberiadaSM*>>& shells)
+{
+	std::shared_ptr<LazyDocument> lazy;
+	std::vector<std::pair<StateMachine*, const CyberiadaSM*>> eager;
+	for (size_t i = 0; i < shells.size(); i++) {
+		// the state machine with the metainformation node is imported at once
+		if (has_meta_node(shells[i].second)) {
+			eager.push_back(shells[i]);
+			continue;
+		}
+		if (!lazy) {
+			lazy = std::make_shared<LazyDocument>();
+		}
+		StateMachine* sm = shells[i].first;
+		sm->lazy_content = new LazyContent(lazy, sm, const_cast<CyberiadaSM*>(shells[i].second), trusted_load);
+		lazy->add(sm->lazy_content);
+	}
+	shells.swap(eager);
+	lazy_document = lazy;
+}
+
+// all the IDs of the C-level nodes, the regions included, are written back with the skipped state machine
+static void skipped_node_ids(const CyberiadaNode* nodes, std::unordered_set<ID>& ids)
+{
+	for (const CyberiadaNode* n = nodes; n; n = n->next) {
+		if (n->id) {
+			ids.insert(n->id);
+		}
+		skipped_node_ids(n->children, ids);
+	}
+}
+
+void Document::skip_state_machines(CyberiadaDocument* doc)
+{
+	std::shared_ptr<SkippedStateMachines> skipped = std::make_shared<SkippedStateMachines>();
+	// the first skipped state machine waiting for the next imported one
+	size_t waiting = 0;
+	CyberiadaSM** link = &(doc->state_machines);
+	while (*link) {
+		CyberiadaSM* sm = *link;
+		CyberiadaNode* root = sm->nodes;
+		CYB_ASSERT(root);
+		CYB_ASSERT(root->id);
+		if (sm_selection.count(root->id) > 0 ||
+			(root->title && sm_selection.count(root->title) > 0) ||
+			has_meta_node(sm)) {
+			for (; waiting < skipped->sms.size(); waiting++) {
+				skipped->sms[waiting].before = root->id;
+			}
+			link = &(sm->next);
+		} else {
+			// reserved before unlinking, so the state machine is never lost
+			skipped->sms.reserve(skipped->sms.size() + 1);
+			*link = sm->next;
+			sm->next = NULL;
+			skipped->sms.push_back(SkippedStateMachines::Entry{sm, ID(), Rect()});
+			skipped_node_ids(sm->nodes, skipped->ids);
+			for (const CyberiadaEdge* e = sm->edges; e; e = e->next) {
+				if (e->id) {
+					skipped->ids.insert(e->id);
+				}
+			}
+		}
+	}
+	if (!skipped->sms.empty()) {
+		skipped_sms = skipped;
+	}
+}
+
+std::vector<ID> Document::get_skipped_state_machines() const
+{
+	std::vector<ID> result;
+	if (skipped_sms) {
+		for (std::vector<SkippedStateMachines::Entry>::const_iterator i = skipped_sms->sms.begin();
+			 i != skipped_sms->sms.end(); i++) {
+			result.push_back(i->sm->nodes->id);
+		}
+	}
+	return result;
+}
+
+// The bound rect of the C-level state machine is found from the node and edge geometry the same
+// way the get_bound_rect() functions find it for the imported elements, so the lazy and the skipped
+// state machines are measured without building the C++ elements.
+struct CBoundRect {
+	CBoundRect(const Document& _d): d(_d) {}
+
+	Rect node(const CyberiadaNode* n) const;
+	Rect collection(const CyberiadaNode* n) const;
+	Rect comment(const CyberiadaNode* n) const;
+	void expand_child(Rect& r, const Rect& parent, const CyberiadaNode* child) const;
+	void add_geometry(const CyberiadaNode* nodes);
+
+	const Document&                                          d;
+	// the comment subjects by the comment ID and the IDs of the elements with the geometry
+	std::unordered_multimap<String, const CyberiadaEdge*>    subjects;
+	std::unordered_set<String>                               geometry;
+};
+
+static bool c_local_geometry(const Document& d)
+{
+	return d.get_geometry_format() == geometryFormatCyberiada10 || d.get_geometry_format() == geometryFormatQt;
+}
+
+Rect CBoundRect::node(const CyberiadaNode* n) const
+{
+	switch (n->type) {
+	case cybNodeSM:
+	case cybNodeSimpleState:
+	case cybNodeCompositeState:
+		return collection(n);
+	case cybNodeComment:
+	case cybNodeFormalComment:
+		return comment(n);
+	case cybNodeChoice:
+		return n->geometry_rect ? Rect(n->geometry_rect) : Rect();
+	case cybNodeInitial:
+	case cybNodeFinal:
+	case cybNodeTerminate: {
+		Rect r;
+		if (n->geometry_point) {
+			r.expand(Point(n->geometry_point), d);
+		}
+		return r;
+	}
+	default:
+		return Rect();
+	}
+}
+
+Rect CBoundRect::collection(const CyberiadaNode* n) const
+{
+	Rect r, parent;
+	if (n->geometry_rect) {
+		parent = Rect(n->geometry_rect);
+		r.expand(parent, d);
+	}
+	for (const CyberiadaNode* child = n->children; child; child = child->next) {
+		if (child->type == cybNodeRegion) {
+			// the content of the region is imported to the state itself
+			for (const CyberiadaNode* c = child->children; c; c = c->next) {
+				expand_child(r, parent, c);
+			}
+		} else {
+			expand_child(r, parent, child);
+		}
+	}
+	return r;
+}
+
+void CBoundRect::expand_child(Rect& r, const Rect& parent, const CyberiadaNode* child) const
+{
+	Rect ch_r = node(child);
+	if (c_local_geometry(d)) {
+		ch_r.x += parent.x;
+		ch_r.y += parent.y;
+	}
+	r.expand(ch_r, d);
+}
+
+Rect CBoundRect::comment(const CyberiadaNode* n) const
+{
+	Rect r, parent;
+	if (!n->geometry_rect) {
+		return r;
+	}
+	parent = r = Rect(n->geometry_rect);
+	std::pair<std::unordered_multimap<String, const CyberiadaEdge*>::const_iterator,
+			  std::unordered_multimap<String, const CyberiadaEdge*>::const_iterator> range = subjects.equal_range(n->id);
+	for (std::unordered_multimap<String, const CyberiadaEdge*>::const_iterator i = range.first; i != range.second; i++) {
+		const CyberiadaEdge* e = i->second;
+		if (!e->target_id || geometry.count(e->target_id) == 0) {
+			continue;
+		}
+		Rect ch_r;
+		for (CyberiadaPolyline* pl = e->geometry_polyline; pl; pl = pl->next) {
+			ch_r.expand(Point(pl->point.x, pl->point.y), d);
+		}
+		if (c_local_geometry(d)) {
+			ch_r.x += parent.x;
+			ch_r.y += parent.y;
+		}
+		r.expand(ch_r, d);
+	}
+	return r;
+}
+
+void CBoundRect::add_geometry(const CyberiadaNode* nodes)
+{
+	for (const CyberiadaNode* n = nodes; n; n = n->next) {
+		bool point = n->type == cybNodeInitial || n->type == cybNodeFinal || n->type == cybNodeTerminate;
+		if (n->type != cybNodeRegion && (point ? n->geometry_point != NULL : n->geometry_rect != NULL)) {
+			geometry.insert(n->id);
+		}
+		add_geometry(n->children);
+	}
+}
+
+Rect Document::sm_bound_rect(const CyberiadaSM* sm) const
+{
+	CBoundRect b(*this);
+	CYB_ASSERT(sm->nodes && sm->nodes->id);
+	for (const CyberiadaEdge* e = sm->edges; e; e = e->next) {
+		if (e->type == cybEdgeComment && e->source_id) {
+			b.subjects.insert(std::make_pair(String(e->source_id), e));
+		}
+	}
+	// the geometry of the subject targets matters only for the comments with subjects
+	if (!b.subjects.empty()) {
+		b.add_geometry(sm->nodes);
+		for (const CyberiadaEdge* e = sm->edges; e; e = e->next) {
+			if ((e->type == cybEdgeExternalTransition || e->type == cybEdgeLocalTransition) &&
+				(e->geometry_source_point || e->geometry_target_point || e->geometry_label_point ||
+				 e->geometry_label_rect || e->geometry_polyline)) {
+				b.geometry.insert(e->id);
+			}
+		}
+	}
+	return b.node(sm->nodes);
+}
+
+Rect Document::partial_load_bound_rect() const
+{
+	Rect r;
+	if (has_geometry()) {
+		for (ElementList::const_iterator i = children.begin(); i != children.end(); i++) {
+			const CyberiadaSM* sm = NULL;
+			if ((*i)->get_type() == elementSM) {
+				sm = static_cast<const StateMachine*>(*i)->lazy_source();
+			}
+			r.expand(sm ? sm_bound_rect(sm) : (*i)->get_bound_rect(*this), *this);
+		}
+		if (skipped_sms) {
+			for (std::vector<SkippedStateMachines::Entry>::const_iterator i = skipped_sms->sms.begin();
+				 i != skipped_sms->sms.end(); i++) {
+				r.expand(i->bound_rect, *this);
+			}
+		}
+	}
+	if (r.valid && center_point.valid) {
+		r.x += center_point.x;
+		r.y += center_point.y;
 	}
+	return r;
+}
 
-	Rect r1 = Rect(doc->bounding_rect);
-	Rect r2 = get_bound_rect(); 
+void Document::check_bound_rect(CyberiadaDocument* doc)
+{
+	// the lazily loaded state machines keep the C-level document with the bounding rect, the lazy
+	// and the skipped state machines are measured by their C-level geometry without the import
+	bool partial = lazy_document || skipped_sms;
+	Rect r1 = Rect(lazy_document ? lazy_document->doc.bounding_rect : doc->bounding_rect);
+	Rect r2 = partial ? partial_load_bound_rect() : get_bound_rect();
 	if (r1.almost_equal(r2)) {
 		center_point = Point(0.0, 0.0);
 	} else if (geometry_format == geometryFormatQt &&
@@ -3080,6 +8147,9 @@ void Document::update_from_document(DocumentGeometryFormat gf, CyberiadaDocument
 	} else {
 		std::ostringstream s;
 		s << "lib " << r1 << " lib++ " << r2 << " doc: " << *this;
+		if (lazy_document) {
+			reset();
+		}
 		cyberiada_cleanup_sm_document(doc);
 		throw AssertException("Bounding rectangles mismatch: " + s.str());
 	}	
@@ -3095,7 +8165,140 @@ void Document::decode(const String& buffer,
 					  bool simplify_ids,
 					  bool skip_meta_format)
 {
+	TraceScope trace(tracePhaseDecode, buffer.length());
 	int flags = 0;
+	throw_status(decode_flags(flags, gf, reconstruct, reconstruct_sm, skip_empty_events, simplify_ids, skip_meta_format));
+
+	CyberiadaDocument doc;
+	throw_status(decode_document(&doc, buffer, format, format_str, flags));
+	
+	update_from_document(gf, &doc, true);
+
+	cyberiada_cleanup_sm_document(&doc);
+
+	if (load_stats_enabled) {
+		for (ElementList::const_iterator i = children.begin(); i != children.end(); i++) {
+			count_load_elements(*i, 1);
+		}
+	}
+}
+
+Status Document::try_decode(const String& buffer,
+							DocumentFormat& format,
+							String& format_str,
+							DocumentGeometryFormat gf,
+							bool reconstruct,
+							bool reconstruct_sm,
+							bool skip_empty_events,
+							bool simplify_ids,
+							bool skip_meta_format)
+{
+	TraceScope trace(tracePhaseDecode, buffer.length());
+	int flags = 0;
+	Status s = decode_flags(flags, gf, reconstruct, reconstruct_sm, skip_empty_events, simplify_ids, skip_meta_format);
+	if (!s) {
+		reset();
+		return s;
+	}
+
+	CyberiadaDocument doc;
+	s = decode_document(&doc, buffer, format, format_str, flags);
+	if (!s) {
+		reset();
+		return s;
+	}
+
+	// the import of the decoded document fails only on the rare semantic errors
+	try {
+		update_from_document(gf, &doc, true);
+	} catch (const Exception& e) {
+		reset();
+		return exception_status(e);
+	}
+
+	cyberiada_cleanup_sm_document(&doc);
+
+	if (load_stats_enabled) {
+		for (ElementList::const_iterator i = children.begin(); i != children.end(); i++) {
+			count_load_elements(*i, 1);
+		}
+	}
+	return s;
+}
+
+Status Document::decode_document(CyberiadaDocument* doc, const String& buffer,
+								 DocumentFormat& format, String& format_str, int flags)
+{
+	if (buffer.length() == 0) {
+		return Status(statusParametersError, "Empty buffer to decode");
+	}
+	
+	reset();
+	if (load_stats_enabled) {
+		load_stats = LoadStats();
+		load_stats.bytes = buffer.length();
+	}
+	int res = cyberiada_init_sm_document(doc);
+	CYB_ASSERT(res == CYBERIADA_NO_ERROR);
+	
+	PhaseTimer timer(load_stats_timer(&LoadStats::decode_ms));
+	res = cyberiada_decode_sm_document(doc, buffer.c_str(), buffer.length(),
+									   CyberiadaXMLFormat(format), flags);
+	timer.stop();
+	if (res != CYBERIADA_NO_ERROR) {
+		cyberiada_cleanup_sm_document(doc);
+		// the unknown error codes leave no document format to check
+		StatusCode code = cyberiada_status_code(res);
+		return Status(code != statusOK ? code : statusAssert, std::string(__FILE__) + ":" + std::to_string(__LINE__));
+	}
+
+	if (!doc->format) {
+		cyberiada_cleanup_sm_document(doc);
+		return Status(statusAssert, std::string(__FILE__) + ":" + std::to_string(__LINE__));
+	}
+	format_str = doc->format;
+	if (format == formatDetect) {
+		if (format_str == DEFAULT_GRAPHML_FORMAT) {
+			format = formatCyberiada10;
+		} else {
+			format = formatLegacyYED;
+		}
+	}
+	return Status();
+}
+
+double* Document::load_stats_timer(double LoadStats::* field)
+{
+	if (load_stats_enabled) {
+		return &(load_stats.*field);
+	} else {
+		return NULL;
+	}
+}
+
+void Document::count_load_elements(const Element* e, size_t depth)
+{
+	load_stats.elements[e->get_type()]++;
+	if (depth > load_stats.max_depth) {
+		load_stats.max_depth = depth;
+	}
+	if (!is_lazy(e) && e->has_children()) {
+		ConstElementList content = static_cast<const ElementCollection*>(e)->get_children();
+		for (ConstElementList::const_iterator i = content.begin(); i != content.end(); i++) {
+			count_load_elements(*i, depth + 1);
+		}
+	}
+}
+
+Status Document::decode_flags(int& flags,
+							  DocumentGeometryFormat gf,
+							  bool reconstruct,
+							  bool reconstruct_sm,
+							  bool skip_empty_events,
+							  bool simplify_ids,
+							  bool skip_meta_format)
+{
+	flags = 0;
 
 	switch(gf) {
 	case geometryFormatNone:
@@ -3120,7 +8323,7 @@ void Document::decode(const String& buffer,
 				  CYBERIADA_FLAG_BORDER_EDGE_GEOMETRY);
 		break;
 	default:
-		throw ParametersException("Bad geometry format " + std::to_string(int(gf)));
+		return Status(statusParametersError, "Bad geometry format " + std::to_string(int(gf)));
 	}
 
 	if (reconstruct) {
@@ -3138,36 +8341,8 @@ void Document::decode(const String& buffer,
 	if (skip_meta_format) {
 		flags |= CYBERIADA_FLAG_SKIP_META;
 	}
-	
-	if (buffer.length() == 0) {
-		throw ParametersException("Empty buffer to decode");
-	}
-	
-	reset();
-	CyberiadaDocument doc;
-	int res = cyberiada_init_sm_document(&doc);
-	CYB_ASSERT(res == CYBERIADA_NO_ERROR);
-	
-	res = cyberiada_decode_sm_document(&doc, buffer.c_str(), buffer.length(),
-									   CyberiadaXMLFormat(format), flags);
-	if (res != CYBERIADA_NO_ERROR) {
-		cyberiada_cleanup_sm_document(&doc);
-		CYB_CHECK_RESULT(res);
-	}
 
-	CYB_ASSERT(doc.format);
-	format_str = doc.format;
-	if (format == formatDetect) {
-		if (format_str == DEFAULT_GRAPHML_FORMAT) {
-			format = formatCyberiada10;
-		} else {
-			format = formatLegacyYED;
-		}
-	}
-	
-	update_from_document(gf, &doc);
-
-	cyberiada_cleanup_sm_document(&doc);
+	return Status();
 }
 
 void Document::update_metainfo_element()
@@ -3236,6 +8411,7 @@ CyberiadaMetainformation* Document::export_meta() const
 
 void Document::to_document(CyberiadaDocument* doc) const
 {
+	TraceScope trace(tracePhaseToDocument, this);
 	CYB_ASSERT(doc);
 	cyberiada_init_sm_document(doc);
 
@@ -3263,7 +8439,7 @@ void Document::to_document(CyberiadaDocument* doc) const
 	}
 
 	ConstStateMachineList state_machines = get_state_machines();
-	if (state_machines.empty()) {
+	if (state_machines.empty() && !skipped_sms) {
 		throw ParametersException("At least one state machine required");
 	}
 	
@@ -3271,30 +8447,57 @@ void Document::to_document(CyberiadaDocument* doc) const
 		
 		doc->meta_info = export_meta();
 
-		for (ConstStateMachineList::const_iterator i = state_machines.begin(); i != state_machines.end(); i++) {
-			const StateMachine* orig_sm = *i;
-			CYB_ASSERT(orig_sm);
-			CyberiadaSM* new_sm = orig_sm->to_sm();
-			if (doc->state_machines) {
-				CyberiadaSM* sm = doc->state_machines;
-				while(sm->next) sm = sm->next;
-				sm->next = new_sm;
+		// the state machines are independent, so they are converted in parallel
+		// unless the document is too small to pay for the worker threads
+		unsigned int workers = threads_number(threads);
+		if (workers > 1) {
+			size_t elements = 0;
+			for (ConstStateMachineList::const_iterator i = state_machines.begin(); i != state_machines.end(); i++) {
+				elements += (*i)->elements_count();
+			}
+			workers = threads_for_elements(workers, elements);
+		}
+		std::vector<CyberiadaSM*> new_sms(state_machines.size(), NULL);
+		try {
+			parallel_for(state_machines.size(), workers, [&](size_t i) {
+				const StateMachine* orig_sm = state_machines[i];
+				CYB_ASSERT(orig_sm);
+				new_sms[i] = orig_sm->to_sm();
+			});
+		} catch (...) {
+			// std::bad_alloc from a worker too
+			for (std::vector<CyberiadaSM*>::iterator i = new_sms.begin(); i != new_sms.end(); i++) {
+				if (*i) cyberiada_destroy_sm(*i);
+			}
+			throw;
+		}
+
+		// link the results in the document order
+		CyberiadaSM* last_sm = NULL;
+		for (std::vector<CyberiadaSM*>::iterator i = new_sms.begin(); i != new_sms.end(); i++) {
+			if (last_sm) {
+				last_sm->next = *i;
 			} else {
-				doc->state_machines = new_sm;
+				doc->state_machines = *i;
 			}
-		}	
+			last_sm = *i;
+		}
 	} catch (const Exception& e) {
 		cyberiada_cleanup_sm_document(doc);
 		throw AssertException("Internal convertion to SM document error: " + e.str());
+	} catch (...) {
+		cyberiada_cleanup_sm_document(doc);
+		throw;
 	}
 
 	if (geometry_format == geometryFormatQt) {
-		doc->bounding_rect = get_bound_rect().c_rect();
+		doc->bounding_rect = (skipped_sms ? partial_load_bound_rect() : get_bound_rect()).c_rect();
 	}
 }
 
 void Document::encode(String& res_buffer, DocumentFormat f, bool round) const
 {
+	TraceScope trace(tracePhaseEncode, this);
 	CyberiadaDocument doc;
 	int res;
 	char* buffer = NULL;
@@ -3303,7 +8506,7 @@ void Document::encode(String& res_buffer, DocumentFormat f, bool round) const
 	if (f == formatDetect) {
 		throw ParametersException("Bad save format " + std::to_string(f));
 	} else if (f == formatLegacyYED) {
-		if (children_count() != 1) {
+		if (children_count() + (skipped_sms ? skipped_sms->sms.size() : 0) != 1) {
 			throw ParametersException("Legacy Berloga-YED format supports single-SM documents only");
 		}
 	}
@@ -3324,7 +8527,17 @@ void Document::encode(String& res_buffer, DocumentFormat f, bool round) const
 		flags |= CYBERIADA_FLAG_ROUND_GEOMETRY;
 	}
 
+	// the skipped state machines are linked to the document only while encoding
+	std::unique_lock<std::mutex> skipped_lock;
+	if (skipped_sms) {
+		skipped_lock = std::unique_lock<std::mutex>(skipped_sms->mutex);
+		skipped_sms->link(&doc);
+	}
 	res = cyberiada_encode_sm_document(&doc, &buffer, &buffer_size, CyberiadaXMLFormat(f), flags);
+	if (skipped_sms) {
+		skipped_sms->unlink(&doc);
+		skipped_lock.unlock();
+	}
 	if (res != CYBERIADA_NO_ERROR) {
 		cyberiada_cleanup_sm_document(&doc);
 		if (buffer) free(buffer);
@@ -3391,94 +8604,289 @@ StateMachine* Document::get_parent_sm(const Element* element)
 	}
 }
 
-std::ostream& Document::dump(std::ostream& os) const
+ContentHash Document::own_content_hash() const
+{
+	ContentHash h = ElementCollection::own_content_hash();
+	h = hash_mix(h, geometry_format);
+	h = hash_mix(h, hash_string(metainfo.standard_version));
+	h = hash_mix(h, metainfo.transition_order_flag);
+	h = hash_mix(h, metainfo.event_propagation_flag);
+	h = hash_mix(h, metainfo.strings.size());
+	for (std::vector<std::pair<String, String>>::const_iterator i = metainfo.strings.begin();
+		 i != metainfo.strings.end(); i++) {
+		h = hash_mix(h, hash_string(i->first));
+		h = hash_mix(h, hash_string(i->second));
+	}
+	return h;
+}
+
+void Document::add_memory_usage(MemoryUsage& usage) const
+{
+	ElementCollection::add_memory_usage(usage);
+	usage.strings += string_heap_bytes(metainfo.standard_version);
+	usage.objects += metainfo.strings.capacity() * sizeof(std::pair<String, String>);
+	for (std::vector<std::pair<String, String>>::const_iterator i = metainfo.strings.begin();
+		 i != metainfo.strings.end(); i++) {
+		usage.strings += string_heap_bytes(i->first) + string_heap_bytes(i->second);
+	}
+	add_geometry_usage(usage, sizeof(center_point));
+
+	// the hash table nodes keep the value, the next pointer and the cached hash
+	typedef std::unordered_map<ID, std::pair<Element*, size_t>>::value_type IndexEntry;
+	usage.index += id_index.bucket_count() * sizeof(void*);
+	usage.index += id_index.size() * (sizeof(IndexEntry) + sizeof(void*) + sizeof(size_t));
+	for (std::unordered_map<ID, std::pair<Element*, size_t>>::const_iterator i = id_index.begin(); i != id_index.end(); i++) {
+		usage.index += string_heap_bytes(i->first);
+	}
+	usage.index += indexed_elements.bucket_count() * sizeof(void*);
+	usage.index += indexed_elements.size() * 2 * sizeof(void*);
+	// the tree nodes keep the value, the color and three pointers
+	usage.index += id_hints.size() * (sizeof(std::pair<const String, size_t>) + 4 * sizeof(void*));
+	for (std::map<String, size_t>::const_iterator i = id_hints.begin(); i != id_hints.end(); i++) {
+		usage.index += string_heap_bytes(i->first);
+	}
+}
+
+static void add_subtree_memory_usage(const Element* e, MemoryUsage& usage)
 {
-	Element::dump(os);
-	os << ", geometry format: "; 
+	size_t total = usage.total() - usage.index;
+	e->add_memory_usage(usage);
+	usage.elements[e->get_type()] += usage.total() - usage.index - total;
+	// the content of the lazily loaded state machines is not imported to measure it
+	if (!is_lazy(e) && e->has_children()) {
+		ConstElementList content = static_cast<const ElementCollection*>(e)->get_children();
+		for (ConstElementList::const_iterator i = content.begin(); i != content.end(); i++) {
+			add_subtree_memory_usage(*i, usage);
+		}
+	}
+}
+
+MemoryUsage Document::memory_usage() const
+{
+	MemoryUsage usage;
+	add_subtree_memory_usage(this, usage);
+	return usage;
+}
+
+void Document::print(DumpBuffer& b) const
+{
+	Element::print(b);
+	b << ", geometry format: "; 
 	switch(geometry_format) {
-	case geometryFormatNone:        os << "none"; break;
-	case geometryFormatLegacyYED:   os << "yed"; break;
-	case geometryFormatCyberiada10: os << "cyb"; break;
-	case geometryFormatQt:          os << "qt"; break;
+	case geometryFormatNone:        b << "none"; break;
+	case geometryFormatLegacyYED:   b << "yed"; break;
+	case geometryFormatCyberiada10: b << "cyb"; break;
+	case geometryFormatQt:          b << "qt"; break;
 	}
-	os << ", meta: {";
-	std::vector<String> params;
+	// the metainformation parameters are written in place, the flags are always present
+	b << ", meta: {";
 	if (!metainfo.standard_version.empty()) {
-		params.push_back("standard version: '" + metainfo.standard_version + "'");
+		b << "standard version: '" << metainfo.standard_version << "', ";
 	}
 	for (std::vector<std::pair<String, String>>::const_iterator i = metainfo.strings.begin();
 		 i != metainfo.strings.end();
 		 i++) {
-		params.push_back(i->first + ": '" + i->second + "'");	
+		b << i->first << ": '" << i->second << "', ";
 	}
-	params.push_back(String("transition order: ") + (metainfo.transition_order_flag ? "exit first": "transition first"));
-	params.push_back(String("event propagation: ") +  (metainfo.event_propagation_flag ? "propagate events": "block events"));
-	for (std::vector<String>::const_iterator i = params.begin(); i != params.end(); i++) {
-		os << *i;
-		if (std::next(i) != params.end()) {
-			os << ", ";
-		}
-	}
-	os << "}";
-	ElementCollection::dump(os);
+	b << "transition order: " << (metainfo.transition_order_flag ? "exit first": "transition first");
+	b << ", event propagation: " << (metainfo.event_propagation_flag ? "propagate events": "block events");
+	b << "}";
+	ElementCollection::print(b);
 	if (has_geometry()) {
-		os << ", bounding rect: " << get_bound_rect();
+		b << ", bounding rect: " << get_bound_rect();
 	}
-	os << "}";
-	return os;
+	b << "}";
 }
 
-ID Document::generate_sm_id() const
+ID Document::generate_id(const String& prefix, size_t first) const
 {
-	ConstStateMachineList sm = get_state_machines();
-	size_t id_num = sm.size();
+	// the numbers from the first one up to the hint are taken while no ID was released
+	size_t id_num = first;
+	std::map<String, size_t>::const_iterator hint = id_hints.find(prefix);
+	if (hint != id_hints.end() && hint->second > id_num) {
+		id_num = hint->second;
+	}
 	ID result;
-	do {
+	for (;;) {
 		std::ostringstream s;
-		s << SM_ID_PREFIX << id_num;
+		s << prefix << id_num;
 		result = ID(s.str());
+		if (!is_id_used(result)) {
+			break;
+		}
 		id_num++;
-	} while(find_element_by_id(result));	
+	}
+	id_hints[prefix] = id_num;
 	return result;
 }
 
+ID Document::generate_sm_id() const
+{
+	ConstStateMachineList sm = get_state_machines();
+	return generate_id(SM_ID_PREFIX, sm.size() + (skipped_sms ? skipped_sms->sms.size() : 0));
+}
+
 ID Document::generate_vertex_id(const Element* p) const
 {
-	size_t id_num = 0;
-	ID result;
-	String base_name;
+	std::ostringstream prefix;
 	if (p != NULL && p->get_type() != elementRoot && p->get_type() != elementSM) {
-		base_name = p->get_id();
+		prefix << p->get_id() << QUALIFIED_NAME_SEPARATOR;
 	}
-	do {
-		std::ostringstream s;
-		if (base_name.empty()) {
-			s << VERTEX_ID_PREFIX << id_num;
-		} else {
-			s << base_name << QUALIFIED_NAME_SEPARATOR << VERTEX_ID_PREFIX << id_num;
-		}
-		result = ID(s.str());
-		id_num++;
-	} while(find_element_by_id(result));	
-	return result;
+	prefix << VERTEX_ID_PREFIX;
+	return generate_id(prefix.str(), 0);
 }
 
 ID Document::generate_transition_id(const String& source_id, const String& target_id) const
 {
 	std::ostringstream s;
-	size_t id_num = 0;
 	String base_name;
 	s << source_id << TRANTISION_ID_SEP << target_id;
 	base_name = s.str();
 	
-	String result = ID(base_name);
-	while (find_element_by_id(result)) {
-		std::ostringstream s2;
-		s2 << base_name << TRANTISION_ID_NUM_SEP << id_num;
-		result = ID(s2.str());
-		id_num++;
-	}	
-	return result;
+	if (!is_id_used(base_name)) {
+		return ID(base_name);
+	}
+	return generate_id(base_name + TRANTISION_ID_NUM_SEP, 0);
+}
+
+bool Document::is_id_used(const ID& _id) const
+{
+	// the elements of the skipped state machines are not imported, but their IDs are saved
+	return find_element_by_id(_id) || (skipped_sms && skipped_sms->ids.count(_id) > 0);
+}
+
+const Element* Document::find_element_by_id(const ID& _id) const
+{
+	CYB_COUNT_SCOPE(countFindElementById);
+	CYB_COUNT_VISIT(countFindElementById);
+	std::pair<Element*, size_t> entry = find_index_entry(_id);
+	if (entry.second == 0 && load_lazy_element(_id)) {
+		entry = find_index_entry(_id);
+	}
+	if (entry.second == 0) {
+		return NULL;
+	} else if (entry.first) {
+		return entry.first;
+	} else {
+		// several elements with the same ID, the first one in the tree order is returned
+		return ElementCollection::find_element_by_id(_id);
+	}
+}
+
+Element* Document::find_element_by_id(const ID& _id)
+{
+	CYB_COUNT_SCOPE(countFindElementById);
+	CYB_COUNT_VISIT(countFindElementById);
+	std::pair<Element*, size_t> entry = find_index_entry(_id);
+	if (entry.second == 0 && load_lazy_element(_id)) {
+		entry = find_index_entry(_id);
+	}
+	if (entry.second == 0) {
+		return NULL;
+	} else if (entry.first) {
+		return entry.first;
+	} else {
+		Element* e = ElementCollection::find_element_by_id(_id);
+		if (entry.second == 1) {
+			std::unique_lock<std::mutex> lock = lock_index();
+			id_index[_id].first = e;
+		}
+		return e;
+	}
+}
+
+std::pair<Element*, size_t> Document::find_index_entry(const ID& _id) const
+{
+	std::unique_lock<std::mutex> lock = lock_index();
+	std::unordered_map<ID, std::pair<Element*, size_t>>::const_iterator i = id_index.find(_id);
+	if (i == id_index.end()) {
+		return std::make_pair((Element*)NULL, size_t(0));
+	}
+	return i->second;
+}
+
+// import the lazily loaded state machines with the elements with the ID
+bool Document::load_lazy_element(const ID& _id) const
+{
+	if (!lazy_document || lazy_document->pending.load(std::memory_order_acquire) == 0) {
+		return false;
+	}
+	std::vector<const ElementCollection*> owners;
+	{
+		std::lock_guard<std::mutex> lock(lazy_document->mutex);
+		lazy_document->find(_id, owners);
+	}
+	for (std::vector<const ElementCollection*>::const_iterator i = owners.begin(); i != owners.end(); i++) {
+		(*i)->load_content();
+	}
+	return !owners.empty();
+}
+
+std::unique_lock<std::mutex> Document::lock_index() const
+{
+	if (lazy_document && lazy_document->pending.load(std::memory_order_acquire) > 0) {
+		return std::unique_lock<std::mutex>(lazy_document->mutex);
+	}
+	return std::unique_lock<std::mutex>();
+}
+
+void Document::index_elements(Element* e, bool attached)
+{
+	CYB_ASSERT(e);
+	if (attached) {
+		// the subtree built apart from the document is indexed when its top element is added
+		const Element* p = e->get_parent();
+		if (p != this && indexed_elements.find(p) == indexed_elements.end()) {
+			return ;
+		}
+	} else if (indexed_elements.find(e) == indexed_elements.end()) {
+		return ;
+	}
+	index_subtree(e, attached);
+}
+
+void Document::index_subtree(Element* e, bool attached)
+{
+	if (attached) {
+		indexed_elements.insert(e);
+	} else {
+		indexed_elements.erase(e);
+	}
+	index_id(e, e->get_id(), attached);
+	// the content of the lazily loaded state machine is indexed on its import
+	if (!is_lazy(e) && e->has_children()) {
+		const ElementList& content = static_cast<ElementCollection*>(e)->get_children();
+		for (ElementList::const_iterator i = content.begin(); i != content.end(); i++) {
+			index_subtree(*i, attached);
+		}
+	}
+}
+
+void Document::index_id_changed(Element* e, const ID& old_id)
+{
+	if (indexed_elements.find(e) != indexed_elements.end()) {
+		index_id(e, old_id, false);
+		index_id(e, e->get_id(), true);
+	}
+}
+
+void Document::index_id(Element* e, const ID& _id, bool attached)
+{
+	if (attached) {
+		std::pair<Element*, size_t>& entry = id_index[_id];
+		entry.first = entry.second == 0 ? e : NULL;
+		entry.second++;
+	} else {
+		std::unordered_map<ID, std::pair<Element*, size_t>>::iterator i = id_index.find(_id);
+		CYB_ASSERT(i != id_index.end());
+		if (--(i->second.second) == 0) {
+			id_index.erase(i);
+		} else {
+			i->second.first = NULL;
+		}
+		// the released ID may be generated again
+		id_hints.clear();
+	}
 }
 
 void Document::clean_geometry()
@@ -3490,12 +8898,16 @@ void Document::clean_geometry()
 
 void Document::convert_geometry(DocumentGeometryFormat geom_format)
 {
+	TraceScope trace(tracePhaseConvertGeometry, this);
 	CyberiadaDocument doc;
 
 	CyberiadaGeometryCoordFormat new_node_coord_format, new_edge_coord_format, new_edge_pl_coord_format;
 	CyberiadaGeometryEdgeFormat new_edge_geom_format;
 
 	if (geometry_format == geom_format) return ;
+	if (skipped_sms) {
+		throw ParametersException("Cannot convert the geometry of the document with skipped state machines");
+	}
 
 	switch (geom_format) {
 	case geometryFormatNone:
@@ -3537,7 +8949,11 @@ void Document::convert_geometry(DocumentGeometryFormat geom_format)
 
 void Document::reconstruct_geometry(bool reconstruct_sm)
 {
+	TraceScope trace(tracePhaseReconstructGeometry, this);
 	CyberiadaDocument doc;
+	if (skipped_sms) {
+		throw ParametersException("Cannot reconstruct the geometry of the document with skipped state machines");
+	}
 	cyberiada_init_sm_document(&doc);
 	to_document(&doc);
 
@@ -3565,6 +8981,7 @@ Rect Document::get_bound_rect() const
 
 Rect Document::get_bound_rect(const Document& d) const
 {
+	CYB_COUNT_SCOPE(countGetBoundRect);
 	Rect r;
 	if (has_geometry()) {
 		for (ElementList::const_iterator i = children.begin(); i != children.end(); i++) {
@@ -3578,21 +8995,53 @@ Rect Document::get_bound_rect(const Document& d) const
 	return r;
 }
 
+// the gzip streams are read and written by the chunks of this size
+static const unsigned int GZIP_CHUNK_SIZE = 128 * 1024;
+static const String GZIP_EXTENSION = ".gz";
+
+static DocumentCompression path_compression(const String& path)
+{
+	if (path.length() > GZIP_EXTENSION.length() &&
+		path.compare(path.length() - GZIP_EXTENSION.length(), GZIP_EXTENSION.length(), GZIP_EXTENSION) == 0) {
+		return compressionGzip;
+	} else {
+		return compressionNone;
+	}
+}
+
+static String gzip_error(gzFile file)
+{
+	int code = Z_OK;
+	const char* message = gzerror(file, &code);
+	if (code == Z_ERRNO) {
+		return strerror(errno);
+	}
+	return message ? message : "";
+}
+
 LocalDocument::LocalDocument():
-	Document(), file_format(formatCyberiada10), file_format_str(DEFAULT_GRAPHML_FORMAT)
+	Document(), file_format(formatCyberiada10), file_format_str(DEFAULT_GRAPHML_FORMAT),
+	file_compression(compressionNone)
 {
 }
 
 LocalDocument::LocalDocument(const Document& d, const String& path, DocumentFormat f):
-	Document(d), file_path(path), file_format(f)
+	Document(d), file_path(path), file_format(f), file_compression(path_compression(path))
 {
 	file_format_str = get_file_format_str();
 }
 
 LocalDocument::LocalDocument(const LocalDocument& ld):
 	Document(ld), file_path(ld.file_path), file_format(ld.file_format),
-	file_format_str(ld.file_format_str)  
+	file_format_str(ld.file_format_str), file_compression(ld.file_compression)
+{
+}
+
+void LocalDocument::add_memory_usage(MemoryUsage& usage) const
 {
+	Document::add_memory_usage(usage);
+	usage.objects += sizeof(LocalDocument) - sizeof(Document);
+	usage.strings += string_heap_bytes(file_path) + string_heap_bytes(file_format_str);
 }
 
 void LocalDocument::reset()
@@ -3601,6 +9050,18 @@ void LocalDocument::reset()
 	file_format = formatCyberiada10;
 	file_format_str = DEFAULT_GRAPHML_FORMAT;
 	file_path = "";
+	file_compression = compressionNone;
+}
+
+void LocalDocument::set_file_compression(DocumentCompression c)
+{
+	if (c == compressionDetect) {
+		c = path_compression(file_path);
+	}
+	if (c != compressionNone && c != compressionGzip) {
+		throw ParametersException("Bad file compression");
+	}
+	file_compression = c;
 }
 
 String LocalDocument::get_file_format_str() const
@@ -3613,23 +9074,26 @@ String LocalDocument::get_file_format_str() const
 	}
 }
 
-std::ostream& LocalDocument::dump(std::ostream& os) const
+void LocalDocument::print(DumpBuffer& b) const
 {
-	os << "LocalDocument: {";
-	Document::dump(os);
+	b << "LocalDocument: {";
+	Document::print(b);
 	if (!file_path.empty()) {
-		os << ", file: '" << file_path << "'";
+		b << ", file: '" << file_path << "'";
 	}
-	os << ", format: ";
+	b << ", format: ";
 	if (file_format == formatCyberiada10) {
-		os << "cyberiada";
+		b << "cyberiada";
 	} else if (file_format == formatLegacyYED) {
-		os << "yed";
+		b << "yed";
 	} else {
-		os << "unknown";
+		b << "unknown";
 	}
-	os << ", " << "format_str: '" << file_format_str << "'}";
-	return os;
+	b << ", " << "format_str: '" << file_format_str << "'";
+	if (file_compression == compressionGzip) {
+		b << ", compression: gzip";
+	}
+	b << "}";
 }
 
 void LocalDocument::open(const String& path,
@@ -3641,14 +9105,36 @@ void LocalDocument::open(const String& path,
 						 bool simplify_ids,
 						 bool skip_meta_format)
 {
-	std::ifstream file(path);
-	if (!file.is_open()) {
+	TraceScope trace(tracePhaseOpen, trace_enabled() ? trace_file_size(path) : 0);
+	double read_ms = 0;
+	PhaseTimer timer(get_load_stats_enabled() ? &read_ms : NULL);
+	// zlib reads the files without the gzip header as is
+	gzFile file = gzopen(path.c_str(), "rb");
+	if (!file) {
 		throw FileException("Cannot open file " + path);
 	}
-	std::string content((std::istreambuf_iterator<char>(file)), 
-						std::istreambuf_iterator<char>());
-
-	file.close();
+	gzbuffer(file, GZIP_CHUNK_SIZE);
+	std::string content;
+	for (;;) {
+		size_t size = content.size();
+		content.resize(size + GZIP_CHUNK_SIZE);
+		int read = gzread(file, &content[size], GZIP_CHUNK_SIZE);
+		int code = Z_OK;
+		// the truncated stream is reported at the end of file
+		gzerror(file, &code);
+		if (read < 0 || code != Z_OK) {
+			String error = gzip_error(file);
+			gzclose(file);
+			throw FileException("Cannot read file " + path + ": " + error);
+		}
+		content.resize(size + size_t(read));
+		if (read == 0) {
+			break;
+		}
+	}
+	DocumentCompression compression = gzdirect(file) ? compressionNone : compressionGzip;
+	gzclose(file);
+	timer.stop();
 	if (content.length() == 0) {
 		throw FileException("File " + path + " is empty");
 	}
@@ -3657,30 +9143,59 @@ void LocalDocument::open(const String& path,
 	file_format = f;
 	decode(content, file_format, file_format_str, gf, reconstruct, reconstruct_sm, skip_empty_events, simplify_ids, skip_meta_format);
 	file_path = path;
+	file_compression = compression;
+	// decode starts the new statistics, so the read time is added after it
+	double* read_stats = load_stats_timer(&LoadStats::read_ms);
+	if (read_stats) {
+		*read_stats = read_ms;
+	}
 }
 
 void LocalDocument::save(bool round)
 {
+	TraceScope trace(tracePhaseSave, this);
 	String buffer;
 	encode(buffer, file_format, round);
 
-	std::ofstream file(file_path);
-	if (!file.is_open()) {
+	if (file_compression != compressionGzip) {
+		std::ofstream file(file_path);
+		if (!file.is_open()) {
+			throw FileException("Cannot open file " + file_path);
+		}
+		file << buffer.c_str();
+		file.close();
+		return ;
+	}
+
+	gzFile file = gzopen(file_path.c_str(), "wb");
+	if (!file) {
 		throw FileException("Cannot open file " + file_path);
 	}
-	file << buffer.c_str();
-	file.close();
+	gzbuffer(file, GZIP_CHUNK_SIZE);
+	for (size_t pos = 0; pos < buffer.size(); pos += GZIP_CHUNK_SIZE) {
+		unsigned int size = (unsigned int)std::min(buffer.size() - pos, size_t(GZIP_CHUNK_SIZE));
+		if (gzwrite(file, buffer.data() + pos, size) != int(size)) {
+			String error = gzip_error(file);
+			gzclose(file);
+			throw FileException("Cannot write file " + file_path + ": " + error);
+		}
+	}
+	if (gzclose(file) != Z_OK) {
+		throw FileException("Cannot write file " + file_path);
+	}
 }
 
 void LocalDocument::save_as(const String& path,
 							DocumentFormat f,
-							bool round)
+							bool round,
+							DocumentCompression c)
 {
 	file_path = path;
 	if (f != formatDetect) {
 		file_format = f;
 		file_format_str = get_file_format_str();
 	}
+	set_file_compression(c);
 	save(round);
 }
 
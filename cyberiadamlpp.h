@@ -25,11 +25,23 @@
 
 #include <string>
 #include <vector>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
 #include <ostream>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <functional>
 #include <cyberiada/cyberiadaml.h>
 
 // -----------------------------------------------------------------------------
 // The Cyberiada GraphML classes
+//
+// Thread safety: all const member functions (dumps, lookups, bound rects, hashes,
+// isomorphism checks, encoding) may be called concurrently on the same document
+// from different threads as long as no thread modifies the document at the same
+// time. Non-const member functions require exclusive access to the document.
 // -----------------------------------------------------------------------------
 
 namespace Cyberiada {
@@ -74,6 +86,12 @@ namespace Cyberiada {
 		formatDetect = 99                           // Format is not specified and will be detected while loading
 	};
 
+	enum DocumentCompression {
+		compressionNone = 0,                        // Plain GraphML file
+		compressionGzip = 1,                        // Gzip-compressed GraphML file
+		compressionDetect = 99                      // Detected by the content on open and by the .gz extension on save
+	};
+
 	enum DocumentGeometryFormat {
 		geometryFormatNone,                         // No geometry
 		geometryFormatLegacyYED,                    // Legacy YED geometry: absolute coordinates, edges with local center source/target poins 
@@ -82,6 +100,13 @@ namespace Cyberiada {
 	};
 
 	class Document;
+	class DumpBuffer;
+	struct LazyContent;
+	class LazyDocument;
+	class SkippedStateMachines;
+	struct Status;
+
+	typedef unsigned long long ContentHash;
 	
 // -----------------------------------------------------------------------------
 // Geometry
@@ -137,13 +162,29 @@ namespace Cyberiada {
 	std::ostream& operator<<(std::ostream& os, const Point& p);
 	std::ostream& operator<<(std::ostream& os, const Rect& r);
 	std::ostream& operator<<(std::ostream& os, const Polyline& pl);
+
+	// The heap memory used by the elements in bytes (without the allocator overhead)
+	struct MemoryUsage {
+		MemoryUsage(): objects(0), strings(0), geometry(0), polylines(0), children(0), index(0) {}
+
+		size_t                        objects;   // the element objects without their geometry, the action and subject lists
+		size_t                        strings;   // the string payloads: IDs, names, actions, comment bodies, metainformation
+		size_t                        geometry;  // the points and rectangles of the elements
+		size_t                        polylines; // the polylines of the transitions and the comment subjects
+		size_t                        children;  // the child element lists
+		size_t                        index;     // the ID index of the document
+		std::map<ElementType, size_t> elements;  // the bytes of the elements by type (all but the index)
+
+		size_t                        total() const { return objects + strings + geometry + polylines + children + index; }
+	};
 	
 // -----------------------------------------------------------------------------
 // Base Element
 // -----------------------------------------------------------------------------
 	class Element {
 	public:
-		Element(): type(elementRoot), name_is_set(false), parent(NULL) {}
+		Element(): type(elementRoot), name_is_set(false), formal_name_is_set(false), parent(NULL), revision(0),
+			content_exposed(false), content_hash_cache(0), content_hash_revision(0) {}
 		Element(Element* parent, ElementType type, const ID& id);
 		Element(Element* parent, ElementType type, const ID& id, const Name& name);
 		Element(const Element& e);
@@ -172,6 +213,13 @@ namespace Cyberiada {
 		virtual size_t         children_count() const { return 0; }
 		virtual size_t         elements_count() const { return 1; }
 		int                    index() const;
+		unsigned long          get_revision() const { return revision; }
+		// hash of the element content including IDs and children, cached until the next change
+		ContentHash            content_hash() const;
+		// collect the IDs of the deepest elements of the subtree with different content
+		virtual void           content_diff(const Element& e, std::vector<ID>& ids) const;
+		// add the heap memory of the element itself (the children are not included)
+		virtual void           add_memory_usage(MemoryUsage& usage) const;
 
 		virtual bool           has_geometry() const = 0;
 		virtual bool           has_point_geometry() const = 0;
@@ -189,8 +237,23 @@ namespace Cyberiada {
 	protected:		
 		Element*               find_root();
 		void                   set_type(ElementType t) { type = t; };
+		void                   modified();
+		// the content is given away by a mutable reference and may change without modified(),
+		// so the content hashes of the element and its ancestors are not cached any more
+		void                   exposed();
+		// notify the root about the subtree added to / removed from the element tree
+		void                   elements_attached(Element* e);
+		void                   elements_detached(Element* e);
+		// the text dump by operator<< is printed by print() unless dump() is overridden;
+		// the numbers follow the precision, flags and locale of the stream
 		virtual std::ostream&  dump(std::ostream& os) const;
+		virtual void           print(DumpBuffer& b) const;
+		friend class DumpBuffer;
 		void                   check_cyberiada_error(int res, const String& msg = "") const;
+		virtual ContentHash    own_content_hash() const;
+		virtual ContentHash    children_content_hash(ContentHash h, bool&) const { return h; }
+		ContentHash            content_hash(bool& cacheable) const;
+		friend class ElementCollection;
 
 	private:		
 		ElementType            type;
@@ -200,6 +263,15 @@ namespace Cyberiada {
 		Name                   formal_name;
 		bool                   formal_name_is_set;
 		Element*               parent;
+		unsigned long          revision;             // grows on every change of the element or its children
+		bool                   content_exposed;
+		// the content hash cache is shared by the concurrent readers
+		mutable std::atomic<ContentHash>   content_hash_cache;
+		mutable std::atomic<unsigned long> content_hash_revision; // revision + 1 of the cached hash, 0 - no cache
+
+		// the root document keeps the ID index of the attached elements
+		virtual void           index_elements(Element*, bool) {}
+		virtual void           index_id_changed(Element*, const ID&) {}
 	};
 
 	std::ostream& operator<<(std::ostream& os, const Element& e);
@@ -244,8 +316,9 @@ namespace Cyberiada {
 		String                 to_str() const;
 
 	protected:
-		std::ostream&          dump(std::ostream& os) const;
+		void                   print(DumpBuffer& b) const;
 		friend std::ostream&   operator<<(std::ostream& os, const CommentSubject& cs);
+		friend class DumpBuffer;
 		
 	private:
 		CommentSubjectType     type;
@@ -273,7 +346,7 @@ namespace Cyberiada {
 
 		bool                             has_body() const { return !body.empty(); }
 		const String&                    get_body() const { return body; }
-		void                             set_body(const String& b) { body = b; }
+		void                             set_body(const String& b) { body = b; modified(); }
 		
 		bool                             has_subjects() const { return !subjects.empty(); }
 		const std::vector<CommentSubject>& get_subjects() const { return subjects; }
@@ -285,7 +358,7 @@ namespace Cyberiada {
 		bool                             has_rect_geometry() const override { return true; }
 		const Rect&                      get_geometry_rect() const { return geometry_rect; }
 		Rect                             get_bound_rect(const Document& d) const override;
-		void                             update_geometry(const Rect& rect) { geometry_rect = rect; }
+		void                             update_geometry(const Rect& rect) { geometry_rect = rect; modified(); }
 		void                             clean_geometry() override;
 		void                             round_geometry() override;
 		
@@ -300,9 +373,11 @@ namespace Cyberiada {
 		CyberiadaNode*                   to_node() const override;
 		CyberiadaEdge*                   subjects_to_edges() const;
 		Element*                         copy(Element* parent) const override;
+		void                             add_memory_usage(MemoryUsage& usage) const override;
 
 	protected:
-	    std::ostream&                    dump(std::ostream& os) const override;
+	    void                             print(DumpBuffer& b) const override;
+		ContentHash                      own_content_hash() const override;
 	
 	private:
 		void                             update_comment_type();
@@ -329,16 +404,18 @@ namespace Cyberiada {
 		bool                   has_rect_geometry() const override { return false; }
 		const Point&           get_geometry_point() const { return geometry_point; }
 		Rect                   get_bound_rect(const Document& d) const override;
-		void                   update_geometry(const Point& point) { geometry_point = point; }
+		void                   update_geometry(const Point& point) { geometry_point = point; modified(); }
 		void                   clean_geometry() override;
 		void                   round_geometry() override;
 		
 		bool                   has_children() const override { return false; }
 
 		CyberiadaNode*         to_node() const override;
+		void                   add_memory_usage(MemoryUsage& usage) const override;
 		
 	protected:
-	    std::ostream&          dump(std::ostream& os) const override;
+	    void                   print(DumpBuffer& b) const override;
+		ContentHash            own_content_hash() const override;
 		
 	private:
 		Point                  geometry_point;
@@ -359,11 +436,14 @@ namespace Cyberiada {
 		ElementCollection(const ElementCollection& ec);
 		virtual ~ElementCollection();
 
-		bool                     has_children() const override { return !children.empty(); } 
-		size_t                   children_count() const override { return children.size(); }
+		bool                     has_children() const override { load_content(); return !children.empty(); } 
+		size_t                   children_count() const override { load_content(); return children.size(); }
 		virtual size_t           elements_count() const override;
 		ConstElementList         get_children() const;
-		const ElementList&       get_children() { return children; };
+		const ElementList&       get_children() { load_content(); return children; };
+		// the content of the lazily loaded state machine is imported on the first access
+		bool                     is_loaded() const;
+		void                     load_content() const { if (lazy_content) import_lazy_content(); }
 		const Element*           first_element() const;
 		Element*                 first_element();
 		const Element*           get_element(int index) const;
@@ -390,26 +470,40 @@ namespace Cyberiada {
 		bool                     has_rect_geometry() const override { return true; }
 		const Rect&              get_geometry_rect() const { return geometry_rect; }
 		Rect                     get_bound_rect(const Document& d) const override;
-		void                     update_geometry(const Rect& rect) { geometry_rect = rect; }
+		void                     update_geometry(const Rect& rect) { geometry_rect = rect; modified(); }
 		void                     clean_geometry() override;
 		void                     round_geometry() override;
 		
         bool                     has_color() const { return !color.empty(); }
 		const Color&             get_color() const { return color; }
+		void                     update_color(const Color& c) { color = c; modified(); }
 
 		CyberiadaNode*           to_node() const override;
+		void                     content_diff(const Element& e, std::vector<ID>& ids) const override;
+		void                     add_memory_usage(MemoryUsage& usage) const override;
 		
 	protected:
 		void                     import_nodes_recursively(CyberiadaNode* nodes, Element** metainfo_element = NULL);
+		// the C-level content of the lazily loaded state machine not imported yet (NULL if imported)
+		const CyberiadaSM*       lazy_source() const;
 
-		std::ostream&            dump(std::ostream& os) const override;
+		void                     print(DumpBuffer& b) const override;
+		ContentHash              own_content_hash() const override;
+		ContentHash              children_content_hash(ContentHash h, bool& cacheable) const override;
 		void                     copy_elements(const ElementCollection& source);
 
 		ElementList              children;
 		
 	private:
+		void                     import_lazy_content() const;
+		void                     drop_lazy_content();
+
 		Rect                     geometry_rect;
 		Color                    color;
+		// the C-level content of the state machine not imported yet (NULL if not loaded lazily)
+		LazyContent*             lazy_content;
+
+		friend class Document;
 	};
 
 // -----------------------------------------------------------------------------
@@ -456,9 +550,11 @@ namespace Cyberiada {
 
 		CyberiadaNode*         to_node() const override;
 		Element*               copy(Element* parent) const override;
+		void                   add_memory_usage(MemoryUsage& usage) const override;
 		
 	protected:
-	    std::ostream&          dump(std::ostream& os) const override;
+	    void                   print(DumpBuffer& b) const override;
+		ContentHash            own_content_hash() const override;
 
 		Rect                   geometry_rect;
 		Color                  color;
@@ -532,8 +628,9 @@ namespace Cyberiada {
 		void                   clear();
 
 	protected:
-		std::ostream&          dump(std::ostream& os) const;
+		void                   print(DumpBuffer& b) const;
 		friend std::ostream&   operator<<(std::ostream& os, const Action& a);
+		friend class DumpBuffer;
 		
 	private:
 		ActionType             type;
@@ -561,25 +658,27 @@ namespace Cyberiada {
 
 		bool                       has_region_geometry() const { return region_rect.valid; }
 		const Rect&                get_region_geometry_rect() const { return region_rect; }
-		void                       update_region_geometry_rect(const Rect& r) { region_rect = r; }
+		void                       update_region_geometry_rect(const Rect& r) { region_rect = r; modified(); }
 
 		bool                       is_collapsed() const { return collapsed; }
-		void                       set_collapsed(bool flag) { collapsed = flag; }
+		void                       set_collapsed(bool flag) { collapsed = flag; modified(); }
 
 		std::vector<const State*>  get_substates() const;
 		std::vector<State*>        get_substates();
 
 		bool                       has_actions() const { return !actions.empty(); }
 		const std::vector<Action>& get_actions() const { return actions; }
-		std::vector<Action>&       get_actions() { return actions; }
+		std::vector<Action>&       get_actions() { exposed(); return actions; }
 		void                       add_action(const Action& a);
 		ActionsDiffFlags           compare_actions(const State& s) const;
 		
 		CyberiadaNode*             to_node() const override;
 		Element*                   copy(Element* parent) const override;
+		void                       add_memory_usage(MemoryUsage& usage) const override;
 		
 	protected:
-		std::ostream&              dump(std::ostream& os) const override;
+		void                       print(DumpBuffer& b) const override;
+		ContentHash                own_content_hash() const override;
 		void                       update_state_type();
 
 		bool                       collapsed;
@@ -607,7 +706,7 @@ namespace Cyberiada {
 														   action.has_guard() ||
 														   action.has_behavior()); }
 		const Action&          get_action() const { return action; }
-		Action&                get_action() { return action; }
+		Action&                get_action() { exposed(); return action; }
 		ActionsDiffFlags       compare_actions(const Transition& t) const;
 		
 		bool                   has_geometry() const override { return (source_point.valid ||
@@ -639,9 +738,11 @@ namespace Cyberiada {
 
 		virtual CyberiadaEdge* to_edge() const;
 		Element*       copy(Element* parent) const override;
+		void           add_memory_usage(MemoryUsage& usage) const override;
 		
 	protected:
-		std::ostream&  dump(std::ostream& os) const override;
+		void           print(DumpBuffer& b) const override;
+		ContentHash    own_content_hash() const override;
 
 	private:
 		TransitionType         transition_type;
@@ -682,6 +783,13 @@ namespace Cyberiada {
 	} SMIsomorphismFlags;
 	typedef unsigned int SMIsomorphismFlagsResult;
 
+	typedef enum {
+		shStructure = 0,              // vertex types and the graph structure only
+		shNames = 1,                  // + vertex names and comment bodies
+		shActions = 2                 // + state actions and transition triggers, guards and behaviors
+	} StructuralHashFlags;
+	typedef unsigned long long StructuralHash;
+
 	class StateMachine: public ElementCollection {
 	public:
 		StateMachine(Element* parent, const ID& id, const Name& name = "", const Rect& r = Rect());
@@ -707,25 +815,109 @@ namespace Cyberiada {
 																 std::vector<SMIsomorphismFlagsResult>* diff_edges_flags = NULL,
 																 std::vector<ID>* new_edges = NULL,
 																 std::vector<ID>* missing_edges = NULL) const;
+		// ID- and order-independent fingerprint built by Weisfeiler-Lehman refinement;
+		// different hashes with the same options prove the SMs are not isomorphic
+		StructuralHash                 structural_hash(bool ignore_comments = true, bool require_initial = false,
+													   int flags = shStructure) const;
+		// the flat equivalent for the code generators with the leaf vertices only (the IDs are kept):
+		// the leaf states inherit the internal and the triggered transitions of the composite states
+		// (the inner ones first), the final states inherit the completion transitions of their parents,
+		// the transitions to the composite states follow the initial ones and the entry/exit behaviors
+		// of the crossed composite states are added to the transition behaviors; the new SM with the
+		// given parent is not added to it, the comments and the geometry are not kept
+		StateMachine*                  flatten(Element* parent = NULL) const;
 
 		//virtual Rect                 get_bound_rect(const Document& d) const;
 
-		void                           from_sm(const CyberiadaSM* sm, Element** metainfo_element = NULL);
+		// the trusted import does not look up the ends of the transitions
+		void                           from_sm(const CyberiadaSM* sm, Element** metainfo_element = NULL,
+											   bool trusted = false);
 		CyberiadaSM*                   to_sm() const;
 		CyberiadaNode*                 to_node(const Point& center) const;
 		
 		Element*                       copy(Element* parent) const override;
 		
 	protected:
-		void                           import_edges(CyberiadaEdge* edges);
+		void                           import_edges(CyberiadaEdge* edges, bool trusted = false);
 		void                           export_edges(CyberiadaEdge** edges, const CyberiadaSM* new_sm) const;
-
-		std::ostream&                dump(std::ostream& os) const override;
+		SMIsomorphismResult            check_sm_isomorphism(CyberiadaSM* sm1, CyberiadaSM* sm2,
+															bool ignore_comments, bool require_initial,
+															ID* new_initial,
+															std::vector<ID>* diff_nodes_first,
+															std::vector<ID>* diff_nodes_second,
+															std::vector<SMIsomorphismFlagsResult>* diff_nodes_flags,
+															std::vector<ID>* new_nodes,
+															std::vector<ID>* missing_nodes,
+															std::vector<ID>* diff_edges_first,
+															std::vector<ID>* diff_edges_second,
+															std::vector<SMIsomorphismFlagsResult>* diff_edges_flags,
+															std::vector<ID>* new_edges,
+															std::vector<ID>* missing_edges) const;
+
+		void                         print(DumpBuffer& b) const override;
+
+		friend class IsomorphismComparator;
 	};
 
 	typedef std::vector<StateMachine*>       StateMachineList;
 	typedef std::vector<const StateMachine*> ConstStateMachineList;	
 
+// -----------------------------------------------------------------------------
+// State Machine isomorphism comparator
+// (keeps the C-level form of the reference SM to check many SMs against it)
+// -----------------------------------------------------------------------------
+	class IsomorphismComparator {
+	public:
+		IsomorphismComparator(const StateMachine& reference,
+							  bool ignore_comments = true, bool require_initial = false);
+		~IsomorphismComparator();
+
+		const StateMachine&            get_reference() const { return reference; }
+		bool                           is_prepared() const { return reference_sm != NULL; }
+		// build the C-level form of the reference SM; it is rebuilt automatically
+		// when the reference SM has been changed since the last preparation
+		void                           prepare();
+		void                           invalidate();
+
+		// the result is the same as reference.check_isomorphism(sm, ...)
+		SMIsomorphismResult            check_isomorphism(const StateMachine& sm);
+		SMIsomorphismResult            check_isomorphism_details(const StateMachine& sm,
+																 ID* new_initial = NULL,
+																 std::vector<ID>* diff_nodes_first = NULL,
+																 std::vector<ID>* diff_nodes_second = NULL,
+																 std::vector<SMIsomorphismFlagsResult>* diff_nodes_flags = NULL,
+																 std::vector<ID>* new_nodes = NULL,
+																 std::vector<ID>* missing_nodes = NULL,
+																 std::vector<ID>* diff_edges_first = NULL,
+																 std::vector<ID>* diff_edges_second = NULL,
+																 std::vector<SMIsomorphismFlagsResult>* diff_edges_flags = NULL,
+																 std::vector<ID>* new_edges = NULL,
+																 std::vector<ID>* missing_edges = NULL);
+
+	private:
+		IsomorphismComparator(const IsomorphismComparator&);
+		IsomorphismComparator&         operator=(const IsomorphismComparator&);
+
+		const StateMachine&            reference;
+		bool                           ignore_comments;
+		bool                           require_initial;
+		CyberiadaSM*                   reference_sm;
+		ContentHash                    reference_hash;
+	};
+
+	// Isomorphism classes of a state machines list (indexes in the list).
+	// The classes are ordered by their first member, the members are sorted.
+	typedef std::vector<std::vector<size_t>> IsomorphismClasses;
+
+	// Partition the state machines into the isomorphism classes. Two SMs are in the same
+	// class if their check_isomorphism result has any of the accepted flags. The SMs are
+	// bucketed by the structural hash first, the full check runs inside the buckets only
+	// using the given number of threads (0 = the number of CPU cores).
+	IsomorphismClasses partition_by_isomorphism(const ConstStateMachineList& sms,
+												bool ignore_comments = true, bool require_initial = false,
+												SMIsomorphismResult accepted = smiIdentical | smiEqual | smiIsomorphic,
+												unsigned int threads = 0);
+
 // -----------------------------------------------------------------------------
 // Cyberiada-GraphML document
 // -----------------------------------------------------------------------------
@@ -740,7 +932,22 @@ namespace Cyberiada {
 		void                                   set_string(const String& name, const String& value);
 
 	private:
-		static String                          empty_string;
+		static const String                    empty_string;
+	};
+
+	// The statistics of the last document load (decode or open), the times are in ms
+	struct LoadStats {
+		LoadStats(): read_ms(0), decode_ms(0), import_ms(0), metainfo_ms(0), bound_rect_ms(0),
+			bytes(0), max_depth(0) {}
+
+		double                                 read_ms;               // file read (LocalDocument::open only)
+		double                                 decode_ms;             // the C library decode
+		double                                 import_ms;             // the C++ elements import
+		double                                 metainfo_ms;           // the metainformation processing
+		double                                 bound_rect_ms;         // the bounding rect validation
+		size_t                                 bytes;                 // the size of the decoded buffer
+		size_t                                 max_depth;             // the maximal nesting level (SM = 1)
+		std::map<ElementType, size_t>          elements;              // the number of elements by type
 	};
 
 	class Document: public ElementCollection {
@@ -818,6 +1025,85 @@ namespace Cyberiada {
 		const CommentSubject&          add_comment_to_element_body(Comment* comment, Element* element, const String& fragment, const ID& id,
 																   const Point& source = Point(), const Point& target = Point(),
 																   const Polyline& pl = Polyline());
+		// the try_ variants of the factories return the failed status instead of throwing the exception
+		// (the new element is NULL then) and keep the document unchanged on the validation failure
+		Status                         try_new_state_machine(StateMachine*& sm, const ID& id, const String& sm_name,
+															 const Rect& r = Rect());
+		Status                         try_new_state(State*& state, ElementCollection* parent, const String& state_name,
+													 const Action& a = Action(), const Rect& r = Rect(),
+													 const Rect& region = Rect(), const Color& color = Color());
+		Status                         try_new_state(State*& state, ElementCollection* parent, const ID& id,
+													 const String& state_name, const Action& a = Action(), const Rect& r = Rect(),
+													 const Rect& region = Rect(), const Color& color = Color());
+		Status                         try_new_initial(InitialPseudostate*& initial, ElementCollection* parent,
+													   const Point& p = Point());
+		Status                         try_new_initial(InitialPseudostate*& initial, ElementCollection* parent, const Name& name,
+													   const Point& p = Point());
+		Status                         try_new_initial(InitialPseudostate*& initial, ElementCollection* parent, const ID& id,
+													   const Name& name, const Point& p = Point());
+		Status                         try_new_final(FinalState*& fin, ElementCollection* parent, const Point& point = Point());
+		Status                         try_new_final(FinalState*& fin, ElementCollection* parent, const Name& name,
+													 const Point& point = Point());
+		Status                         try_new_final(FinalState*& fin, ElementCollection* parent, const ID& id, const Name& name,
+													 const Point& point = Point());
+		Status                         try_new_choice(ChoicePseudostate*& choice, ElementCollection* parent,
+													  const Rect& r = Rect(), const Color& color = Color());
+		Status                         try_new_choice(ChoicePseudostate*& choice, ElementCollection* parent, const Name& name,
+													  const Rect& r = Rect(), const Color& color = Color());
+		Status                         try_new_choice(ChoicePseudostate*& choice, ElementCollection* parent, const ID& id,
+													  const Name& name, const Rect& r = Rect(), const Color& color = Color());
+		Status                         try_new_terminate(TerminatePseudostate*& term, ElementCollection* parent,
+														 const Point& p = Point());
+		Status                         try_new_terminate(TerminatePseudostate*& term, ElementCollection* parent, const Name& name,
+														 const Point& p = Point());
+		Status                         try_new_terminate(TerminatePseudostate*& term, ElementCollection* parent, const ID& id,
+														 const Name& name, const Point& p = Point());
+		Status                         try_new_transition(Transition*& transition, StateMachine* sm, TransitionType ttype,
+														  Element* source, Element* target, const Action& action,
+														  const Polyline& pl = Polyline(), const Point& sp = Point(),
+														  const Point& tp = Point(), const Point& label_point = Point(),
+														  const Rect& label_rect = Rect(), const Color& color = Color());
+		Status                         try_new_transition(Transition*& transition, StateMachine* sm, TransitionType ttype,
+														  const ID& id, Element* source, Element* target, const Action& action,
+														  const Polyline& pl = Polyline(), const Point& sp = Point(),
+														  const Point& tp = Point(), const Point& label_point = Point(),
+														  const Rect& label_rect = Rect(), const Color& color = Color());
+		Status                         try_new_comment(Comment*& comment, ElementCollection* parent, const String& body,
+													   const Rect& rect = Rect(), const Color& color = Color(),
+													   const String& markup = String());
+		Status                         try_new_comment(Comment*& comment, ElementCollection* parent, const String& name,
+													   const String& body, const Rect& rect = Rect(),
+													   const Color& color = Color(), const String& markup = String());
+		Status                         try_new_comment(Comment*& comment, ElementCollection* parent, const ID& id,
+													   const String& name, const String& body, const Rect& rect = Rect(),
+													   const Color& color = Color(), const String& markup = String());
+		Status                         try_new_formal_comment(Comment*& comment, ElementCollection* parent, const String& body,
+															  const Rect& rect = Rect(), const Color& color = Color(),
+															  const String& markup = String());
+		Status                         try_new_formal_comment(Comment*& comment, ElementCollection* parent, const String& name,
+															  const String& body, const Rect& rect = Rect(),
+															  const Color& color = Color(), const String& markup = String());
+		Status                         try_new_formal_comment(Comment*& comment, ElementCollection* parent, const ID& id,
+															  const String& name, const String& body, const Rect& rect = Rect(),
+															  const Color& color = Color(), const String& markup = String());
+		Status                         try_add_comment_to_element(const CommentSubject*& subject, Comment* comment, Element* element,
+																  const Point& source = Point(),
+																  const Point& target = Point(), const Polyline& pl = Polyline());
+		Status                         try_add_comment_to_element(const CommentSubject*& subject, Comment* comment, Element* element,
+																  const ID& id, const Point& source = Point(),
+																  const Point& target = Point(), const Polyline& pl = Polyline());
+		Status                         try_add_comment_to_element_name(const CommentSubject*& subject, Comment* comment, Element* element,
+																	   const String& fragment, const Point& source = Point(),
+																	   const Point& target = Point(), const Polyline& pl = Polyline());
+		Status                         try_add_comment_to_element_name(const CommentSubject*& subject, Comment* comment, Element* element,
+																	   const String& fragment, const ID& id, const Point& source = Point(),
+																	   const Point& target = Point(), const Polyline& pl = Polyline());
+		Status                         try_add_comment_to_element_body(const CommentSubject*& subject, Comment* comment, Element* element,
+																	   const String& fragment, const Point& source = Point(),
+																	   const Point& target = Point(), const Polyline& pl = Polyline());
+		Status                         try_add_comment_to_element_body(const CommentSubject*& subject, Comment* comment, Element* element,
+																	   const String& fragment, const ID& id, const Point& source = Point(),
+																	   const Point& target = Point(), const Polyline& pl = Polyline());
 		void                           update_metainfo_element();
 		bool                           update_metainfo_from_comment(const String& new_body);
 		
@@ -830,20 +1116,68 @@ namespace Cyberiada {
 											  bool skip_empty_events = false,
 											  bool simplify_ids = false,
 											  bool skip_meta_format = false);
+		// the decode returning the failed status instead of throwing; the document is empty after the failure
+		Status                         try_decode(const String& buffer,
+												  DocumentFormat& format,
+												  String& format_str,
+												  DocumentGeometryFormat gf = geometryFormatQt,
+												  bool reconstruct = false,
+												  bool reconstruct_sm = false,
+												  bool skip_empty_events = false,
+												  bool simplify_ids = false,
+												  bool skip_meta_format = false);
 		void                           encode(String& buffer,
 											  DocumentFormat f = formatCyberiada10,
 											  bool round = false) const;
 
 		void                           set_name(const Name& name) override;
 		const DocumentMetainformation& meta() const { return metainfo; }
-		DocumentMetainformation&       meta() { return metainfo; }
+		DocumentMetainformation&       meta() { exposed(); return metainfo; }
 		const Comment*                 get_meta_element() const { return metainfo_element; }
 		DocumentGeometryFormat         get_geometry_format() const { return geometry_format; }
+		// the number of worker threads used to export the state machines (0 = the number of CPU cores);
+		// the documents below 2048 elements are exported serially, each worker gets 1024 at least
+		unsigned int                   get_threads() const { return threads; }
+		void                           set_threads(unsigned int n) { threads = n; }
+		// the load statistics are collected by decode and open only if enabled
+		bool                           get_load_stats_enabled() const { return load_stats_enabled; }
+		void                           set_load_stats_enabled(bool enabled) { load_stats_enabled = enabled; }
+		const LoadStats&               last_load_stats() const { return load_stats; }
+		// the lazy decode and open import the content of the state machines on the first access
+		// (except the one with the metainformation) and skip the bounding rect check
+		bool                           get_lazy_load() const { return lazy_load; }
+		void                           set_lazy_load(bool enabled) { lazy_load = enabled; }
+		void                           load_state_machines() const;
+		// the trusted decode and open skip the checks of the input produced by this library: the ID
+		// uniqueness of the state machines, the transition ends lookup and the bounding rect check
+		// (the latter is kept for the Qt geometry where it finds the center point)
+		bool                           get_trusted_load() const { return trusted_load; }
+		void                           set_trusted_load(bool enabled) { trusted_load = enabled; }
+		// decode and open import only the state machines with the IDs or names from the selection
+		// (all of them if it is empty) and the one with the metainformation; the rest are kept
+		// in the C-level form and written back by encode and save in the original order
+		const std::unordered_set<String>& get_state_machine_selection() const { return sm_selection; }
+		void                           set_state_machine_selection(const std::unordered_set<String>& ids_or_names) { sm_selection = ids_or_names; }
+		std::vector<ID>                get_skipped_state_machines() const;
+		// the heap memory of the document and its elements computed in one traversal
+		MemoryUsage                    memory_usage() const;
+		// the compact binary form of the document read in place without XML parsing (the document
+		// with the skipped state machines cannot be saved); the buffer may be a mapped file
+		void                           save_snapshot(String& buffer) const;
+		void                           load_snapshot(const char* data, size_t size);
+		void                           load_snapshot(const String& buffer) { load_snapshot(buffer.data(), buffer.size()); }
+		// the JSON form of the complete document for the web clients; the writer puts the children
+		// of the element objects after their other keys, the parser accepts the keys in any order
+		void                           encode_json(String& buffer) const;
+		void                           decode_json(const String& buffer);
 		
 		ConstStateMachineList          get_state_machines() const;
 		StateMachineList               get_state_machines();
 		const StateMachine*            get_parent_sm(const Element* element) const;
 		StateMachine*                  get_parent_sm(const Element* element);
+		// the lookup by ID uses the document index instead of the tree traversal
+		const Element*                 find_element_by_id(const ID& id) const;
+		Element*                       find_element_by_id(const ID& id);
 
 		bool                           has_geometry() const override { return geometry_format != geometryFormatNone; }
 		Rect                           get_bound_rect() const;
@@ -853,28 +1187,71 @@ namespace Cyberiada {
 		void                           clean_geometry() override;
 		
 		Element*                       copy(Element* parent) const override;
+		void                           add_memory_usage(MemoryUsage& usage) const override;
 		
 	protected:
-		std::ostream&                  dump(std::ostream& os) const override;
+		void                           print(DumpBuffer& b) const override;
+		ContentHash                    own_content_hash() const override;
 		void                           update_from_document(DocumentGeometryFormat gf,
-															CyberiadaDocument* doc);
+															CyberiadaDocument* doc,
+															bool select = false);
+		// the phases of update_from_document: the C++ elements import and the bounding rect check
+		void                           import_document(DocumentGeometryFormat gf, CyberiadaDocument* doc,
+													   bool select = false);
+		void                           check_bound_rect(CyberiadaDocument* doc);
+		static Status                  decode_flags(int& flags,
+													DocumentGeometryFormat gf,
+													bool reconstruct = false,
+													bool reconstruct_sm = false,
+													bool skip_empty_events = false,
+													bool simplify_ids = false,
+													bool skip_meta_format = false);
+		// the checks and the C-level decode of the buffer before the import of the elements
+		Status                         decode_document(CyberiadaDocument* doc, const String& buffer,
+													   DocumentFormat& format, String& format_str, int flags);
 		void                           to_document(CyberiadaDocument* doc) const;
+		// the load statistics field to add the phase time to (NULL if disabled)
+		double*                        load_stats_timer(double LoadStats::* field);
 		
 	private:
+		void                           index_elements(Element* e, bool attached) override;
+		void                           index_id_changed(Element* e, const ID& old_id) override;
+		void                           index_subtree(Element* e, bool attached);
+		void                           index_id(Element* e, const ID& id, bool attached);
+		void                           count_load_elements(const Element* e, size_t depth);
+		void                           import_lazy_state_machines(std::vector<std::pair<StateMachine*, const CyberiadaSM*>>& shells);
+		bool                           load_lazy_element(const ID& id) const;
+		void                           skip_state_machines(CyberiadaDocument* doc);
+		// the bound rect of the C-level state machine and of the whole partially loaded document
+		Rect                           sm_bound_rect(const CyberiadaSM* sm) const;
+		Rect                           partial_load_bound_rect() const;
+		std::pair<Element*, size_t>    find_index_entry(const ID& id) const;
+		// the index is locked only while the lazily loaded content may be imported concurrently
+		std::unique_lock<std::mutex>   lock_index() const;
+		// the ID belongs to an element or to the skipped state machines
+		bool                           is_id_used(const ID& id) const;
+		ID                             generate_id(const String& prefix, size_t first) const;
 		ID                             generate_sm_id() const;
 		ID                             generate_vertex_id(const Element* parent) const;
 		ID                             generate_transition_id(const String& source_id, const String& target_id) const;
 		CyberiadaMetainformation*      export_meta() const;
 		void                           set_geometry(DocumentGeometryFormat format);
 
-		void                           check_nonempty_string(const String& s) const;
-		void                           check_parent_element(const Element* parent) const;
-		void                           check_id_uniqueness(const ID& id) const;
-		void                           check_single_initial(const ElementCollection* parent) const;
-		void                           check_transition_source(const Element* element) const;
-		void                           check_transition_target(const Element* element) const;
-		void                           check_comment_subject_element(const Element* element) const;
-		void                           check_transition_action(const Action& action) const;
+		// the checks shared by the throwing and the try_ factories (the optional parameters are NULL)
+		Status                         check_new_vertex(const ElementCollection* parent, const String* name,
+														const ID* id, bool initial = false) const;
+		Status                         check_new_transition(const StateMachine* sm, const Element* source, const Element* target,
+															const ID* id, const Action& action) const;
+		Status                         check_new_comment_subject(const Comment* comment, const Element* element,
+																 const String* fragment, const ID* id) const;
+		Status                         check_nonempty_string(const String& s) const;
+		Status                         check_parent_element(const Element* parent) const;
+		Status                         check_id_uniqueness(const ID& id) const;
+		Status                         check_single_initial(const ElementCollection* parent) const;
+		Status                         check_transition_source(const Element* element) const;
+		Status                         check_transition_target(const Element* element) const;
+		Status                         check_comment_subject_element(const Element* element) const;
+		Status                         check_transition_action(const Action& action) const;
 		void                           check_geometry_update(const Rect& r);
 		void                           check_geometry_update(const Point& p);
 		void                           check_geometry_update(const Polyline& pl);
@@ -883,6 +1260,22 @@ namespace Cyberiada {
 		DocumentMetainformation        metainfo;
 		Comment*                       metainfo_element;
 		Point                          center_point;
+		unsigned int                   threads;
+		bool                           load_stats_enabled;
+		LoadStats                      load_stats;
+		bool                           lazy_load;
+		bool                           trusted_load;
+		// the decoded document keeping the content of the lazily loaded state machines
+		std::shared_ptr<LazyDocument>  lazy_document;
+		std::unordered_set<String>     sm_selection;
+		// the state machines skipped by the selective load, shared by the copies of the document
+		std::shared_ptr<SkippedStateMachines> skipped_sms;
+		// ID -> the element with the ID (NULL if there are several of them) and the number of such elements
+		std::unordered_map<ID, std::pair<Element*, size_t>> id_index;
+		// the elements in the tree of the document (the index is not affected by the detached subtrees)
+		std::unordered_set<const Element*> indexed_elements;
+		// ID prefix -> the number to start the search of a free generated ID, reset when an ID is released
+		mutable std::map<String, size_t> id_hints;
 	};
 
 	class LocalDocument: public Document {
@@ -903,23 +1296,211 @@ namespace Cyberiada {
 		void                           save(bool round = false);
 		void                           save_as(const String& path,
 											   DocumentFormat f,
-											   bool round = false);
+											   bool round = false,
+											   DocumentCompression c = compressionDetect);
 
 		DocumentFormat                 get_file_format() const { return file_format; }
 		String                         get_file_format_str() const;
 		String                         get_file_path() const { return file_path; }
+		DocumentCompression            get_file_compression() const { return file_compression; }
+		void                           set_file_compression(DocumentCompression c);
 
 		Element*                       copy(Element* parent) const override;
+		void                           add_memory_usage(MemoryUsage& usage) const override;
 		
 	protected:
-		std::ostream&                  dump(std::ostream& os) const override;
+		void                           print(DumpBuffer& b) const override;
 		
 	private:
 		String                         file_path;
 		DocumentFormat                 file_format;
 		String                         file_format_str;
+		DocumentCompression            file_compression;
 	};
 
+// -----------------------------------------------------------------------------
+// State Machine interpreter
+// (the state machine compiled into the integer tables and run with the run-to-completion semantics)
+// -----------------------------------------------------------------------------
+	// the guard callback gets the guard text and the ID of the transition (of the state for the
+	// internal transitions); the empty guards and all guards without the callback are true
+	typedef std::function<bool(const Guard& guard, const ID& element)> GuardCallback;
+	// the behavior callback gets the behavior text and the ID of the transition or the state
+	// (the entry/exit behaviors and the internal transitions); the empty behaviors are not passed
+	typedef std::function<void(const Behavior& behavior, const ID& element)> BehaviorCallback;
+
+	class StateMachineInterpreter {
+	public:
+		// the semantic flags are taken from the metainformation of the document of the SM
+		// (the defaults for the detached SM)
+		StateMachineInterpreter(const StateMachine& sm);
+		StateMachineInterpreter(const StateMachine& sm, const DocumentMetainformation& meta);
+
+		void                           set_guard_callback(const GuardCallback& callback) { guard_callback = callback; }
+		void                           set_behavior_callback(const BehaviorCallback& callback) { behavior_callback = callback; }
+
+		// the triggers of the SM are numbered in the order of appearance (-1 for the unknown trigger)
+		size_t                         triggers_count() const { return trigger_names.size(); }
+		int                            trigger_id(const Event& trigger) const;
+		const Event&                   trigger_name(int id) const;
+
+		// enter the SM by its initial transition (the running SM is restarted)
+		void                           start();
+		// process the event up to the stable configuration; false if the event was not handled
+		// or the SM is not running
+		bool                           dispatch(int trigger);
+		bool                           dispatch(const Event& trigger) { return dispatch(trigger_id(trigger)); }
+
+		bool                           is_running() const { return active >= 0 && !finished && !terminated; }
+		// the top-level final state has been reached
+		bool                           is_finished() const { return finished; }
+		// the terminate pseudostate has been reached
+		bool                           is_terminated() const { return terminated; }
+		// the innermost active state (the empty ID before the start)
+		const ID&                      active_state() const;
+		// the state is the active one or its ancestor
+		bool                           is_active(const ID& state) const;
+
+	private:
+		enum VertexKind {
+			vertexRoot = 0,
+			vertexState,
+			vertexInitial,
+			vertexFinal,
+			vertexChoice,
+			vertexTerminate
+		};
+
+		// the transitions and the internal transitions (target -1) of the states
+		struct CompiledTransition {
+			int                        source;
+			int                        target;
+			int                        trigger;         // -1 - no trigger
+			int                        guard;           // the text index, -1 - no guard
+			int                        behavior;        // the text index, -1 - no behavior
+			int                        element;         // the ID index
+			int                        scope;           // the innermost vertex not exited and entered
+		};
+
+		void                           compile(const StateMachine& sm);
+		int                            index_vertex(const Element* e, int parent,
+													std::vector<const Transition*>& edges);
+		int                            add_text(const String& text);
+		int                            find_vertex(const ID& id) const;
+		bool                           guard(const CompiledTransition& t) const;
+		void                           behavior(int text, int element) const;
+		void                           run_actions(const std::vector<int>& offsets, const std::vector<int>& list, int v) const;
+		// take the transition from the active vertex through the initial transitions and the choices
+		void                           take(int t);
+		// take the enabled completion transitions of the active vertex
+		void                           settle();
+		int                            enabled_completion(int v) const;
+
+		StateMachineInterpreter(const StateMachineInterpreter&);
+		StateMachineInterpreter&       operator=(const StateMachineInterpreter&);
+
+		bool                           exit_first;      // transition_order_flag
+		bool                           propagate;       // event_propagation_flag
+		GuardCallback                  guard_callback;
+		BehaviorCallback               behavior_callback;
+
+		std::vector<ID>                ids;             // the vertices first, then the transitions
+		std::vector<String>            texts;
+		std::unordered_map<String, int> text_index;
+		std::vector<Event>             trigger_names;
+		std::unordered_map<Event, int> trigger_index;
+
+		// the vertices in the document order (the SM is 0)
+		std::unordered_map<ID, int>    vertex_index;
+		std::vector<int>               vertex_kind;
+		std::vector<int>               vertex_parent;
+		std::vector<int>               vertex_depth;
+		std::vector<int>               vertex_initial;  // the initial transition of the SM and the composite states
+		// the lists per vertex: the offsets of the vertex v are [offsets[v], offsets[v + 1])
+		std::vector<int>               entry_offsets;
+		std::vector<int>               entry_texts;
+		std::vector<int>               exit_offsets;
+		std::vector<int>               exit_texts;
+		std::vector<int>               completion_offsets;
+		std::vector<int>               completion_transitions;
+
+		std::vector<CompiledTransition> transitions;
+		// the vertices entered by the transition from its scope down to its target
+		std::vector<int>               path_offsets;
+		std::vector<int>               path_vertices;
+		// (vertex, trigger) -> the range of the candidate transitions of the active vertex in the
+		// handlers list, the inner ones first
+		std::unordered_map<unsigned long long, std::pair<int, int>> dispatch_table;
+		std::vector<int>               handlers;
+
+		int                            active;          // the active vertex, -1 before the start
+		bool                           finished;
+		bool                           terminated;
+	};
+
+// -----------------------------------------------------------------------------
+// Tracing
+// -----------------------------------------------------------------------------
+	enum TracePhase {
+		tracePhaseDecode = 0,         // Document::decode
+		tracePhaseEncode,             // Document::encode
+		tracePhaseToDocument,         // Document::to_document
+		tracePhaseUpdateFromDocument, // Document::update_from_document
+		tracePhaseConvertGeometry,    // Document::convert_geometry
+		tracePhaseReconstructGeometry,// Document::reconstruct_geometry
+		tracePhaseCheckIsomorphism,   // StateMachine::check_isomorphism_details
+		tracePhaseOpen,               // LocalDocument::open
+		tracePhaseSave                // LocalDocument::save
+	};
+
+	enum TraceEvent {
+		traceBegin = 0,
+		traceEnd
+	};
+
+	// The trace callback gets the phase, the event and the size: the length of the decoded buffer
+	// for decode, the file size for open, the number of the C-level nodes and edges for
+	// update_from_document (the same for both events) and the number of the document elements
+	// (of the state machine for the isomorphism check) at the moment of the event for the rest.
+	typedef std::function<void(TracePhase phase, TraceEvent event, size_t size)> TraceCallback;
+
+	// Install the process-wide trace callback (the empty callback disables tracing). The callback
+	// is called from the threads running the phases and must not throw; install it before the
+	// documents are used. The library built with CYBERIADAMLPP_USDT also fires the USDT probes
+	// cyberiadamlpp:phase__begin and cyberiadamlpp:phase__end with the phase name and the size.
+	void        set_trace_callback(const TraceCallback& callback);
+	const char* trace_phase_name(TracePhase phase);
+
+// -----------------------------------------------------------------------------
+// Operation counters
+// -----------------------------------------------------------------------------
+	enum CountedOperation {
+		countFindElementById = 0,     // find_element_by_id
+		countFindElementsByType,      // find_elements_by_type / find_elements_by_types
+		countGetBoundRect,            // get_bound_rect
+		countQualifiedName,           // qualified_name
+		countToNode,                  // to_node
+		countToSM,                    // StateMachine::to_sm
+		countToEdge,                  // Transition::to_edge
+		countOperationsNumber
+	};
+
+	struct OperationCounter {
+		OperationCounter(): calls(0), visited(0), time_ms(0) {}
+
+		size_t calls;                 // the outermost calls (the recursive calls are not counted)
+		size_t visited;               // the elements visited by the traversal
+		double time_ms;               // the total time of the outermost calls
+	};
+
+	// The process-wide counters of the hot internal routines are collected only by the library
+	// built with CYBERIADAMLPP_COUNTERS, otherwise operation_counters_enabled() returns false and
+	// the counters stay zero.
+	bool             operation_counters_enabled();
+	OperationCounter get_operation_counter(CountedOperation op);
+	void             reset_operation_counters();
+	const char*      counted_operation_name(CountedOperation op);
+
 // -----------------------------------------------------------------------------
 // Exceptions
 // -----------------------------------------------------------------------------
@@ -995,6 +1576,37 @@ namespace Cyberiada {
 			Exception(msg, e) {}
 	};
 // -----------------------------------------------------------------------------
+// Status of the non-throwing methods
+// -----------------------------------------------------------------------------
+	enum StatusCode {
+		statusOK = 0,
+		statusXMLError,                             // XMLException
+		statusFormatError,                          // CybMLException and other FormatExceptions
+		statusActionError,                          // ActionException
+		statusMetainformationError,                 // MetainformationException
+		statusNotFound,                             // NotFoundException
+		statusParametersError,                      // ParametersException
+		statusAssert,                               // AssertException
+		statusNotImplemented,                       // NotImplementedException
+		statusFileError,                            // FileException
+		statusError                                 // generic Exception
+	};
+
+	// the result of the try_ methods: the code of the exception the throwing method would raise
+	// and its message; the validation checks are shared, so the failures are the same
+	struct Status {
+		Status(StatusCode c = statusOK, const String& msg = ""): code(c), message(msg) {}
+
+		bool          ok() const { return code == statusOK; }
+		explicit      operator bool() const { return ok(); }
+
+		StatusCode    code;
+		String        message;
+	};
+
+	// raise the exception of the failed status (nothing if the status is OK)
+	void throw_status(const Status& s);
+// -----------------------------------------------------------------------------
 
 };
 
@@ -20,7 +20,20 @@
  * ----------------------------------------------------------------------------- */
 
 #include <iostream>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <map>
 #include <stdlib.h>
+#include <math.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/resource.h>
 #include "cyberiadamlpp.h"
 
 using namespace Cyberiada;
@@ -29,13 +42,342 @@ using namespace std;
 void usage(const char* program)
 {
 	cerr << program << " <print|convert> [[-f <cyberiada|yed>] -o <path-to-output-graphml-file>] <path-to-input-graphml-file>" << endl;
+	cerr << program << " convert-batch [-j <threads>] [-f <cyberiada|yed>] -o <output-dir> <input-files-or-dirs...>" << endl;
+	cerr << program << " bench [-n <iterations>] <path-to-input-graphml-file>" << endl;
 	cerr << "\tprint\tPrint the graphml SM structure of the file <path-to-input-graphml-file>" << endl;
 	cerr << "\tconvert\tConvert the graphml SM file from <path-to-input-graphml-file> to <path-to-output-graphml-file> using format:" << endl;
 	cerr << "\t\t\tcyberiada   Cyberiada-GraphML 1.0 format" << endl;
 	cerr << "\t\t\tyed         Legacy Berloga-YED format" << endl;
+	cerr << "\tconvert-batch\tConvert the graphml files (the *.graphml files in the directories) to <output-dir>" << endl;
+	cerr << "\t\t\tusing <threads> workers (the number of CPU cores by default)" << endl;
+	cerr << "\tbench\tMeasure the processing phases of the file <path-to-input-graphml-file> <iterations> times (10 by default)" << endl;
 	exit(1);
 }
 
+static bool is_directory(const string& path)
+{
+	struct stat st;
+	return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+static size_t file_size(const string& path)
+{
+	struct stat st;
+	if (stat(path.c_str(), &st) != 0) {
+		return 0;
+	}
+	return size_t(st.st_size);
+}
+
+static string base_name(const string& path)
+{
+	size_t pos = path.find_last_of('/');
+	if (pos == string::npos) {
+		return path;
+	}
+	return path.substr(pos + 1);
+}
+
+static bool has_graphml_extension(const string& name)
+{
+	const string ext = ".graphml";
+	return name.size() > ext.size() && name.compare(name.size() - ext.size(), ext.size(), ext) == 0;
+}
+
+static void collect_directory_files(const string& dir, vector<string>& files)
+{
+	DIR* d = opendir(dir.c_str());
+	if (!d) {
+		cerr << "Cannot open directory " << dir << endl;
+		return ;
+	}
+	vector<string> dir_files;
+	for (struct dirent* entry = readdir(d); entry; entry = readdir(d)) {
+		string name = entry->d_name;
+		string path = dir[dir.size() - 1] == '/' ? dir + name : dir + "/" + name;
+		if (has_graphml_extension(name) && !is_directory(path)) {
+			dir_files.push_back(path);
+		}
+	}
+	closedir(d);
+	sort(dir_files.begin(), dir_files.end());
+	files.insert(files.end(), dir_files.begin(), dir_files.end());
+}
+
+int convert_batch(int argc, char** argv)
+{
+	DocumentFormat format = formatCyberiada10;
+	unsigned int threads = 0;
+	string out_dir;
+	vector<string> inputs;
+
+	for (int i = 2; i < argc; i++) {
+		string arg = argv[i];
+		if (arg == "-j" && i + 1 < argc) {
+			int n = atoi(argv[++i]);
+			if (n <= 0) {
+				usage(argv[0]);
+			}
+			threads = (unsigned int)n;
+		} else if (arg == "-f" && i + 1 < argc) {
+			string format_str = argv[++i];
+			if (format_str == "cyberiada") {
+				format = formatCyberiada10;
+			} else if (format_str == "yed") {
+				format = formatLegacyYED;
+			} else {
+				usage(argv[0]);
+			}
+		} else if (arg == "-o" && i + 1 < argc) {
+			out_dir = argv[++i];
+		} else {
+			inputs.push_back(arg);
+		}
+	}
+	if (out_dir.empty() || inputs.empty()) {
+		usage(argv[0]);
+	}
+	if (!is_directory(out_dir) && mkdir(out_dir.c_str(), 0755) != 0) {
+		cerr << "Cannot create output directory " << out_dir << endl;
+		return 2;
+	}
+
+	vector<string> files;
+	for (vector<string>::const_iterator i = inputs.begin(); i != inputs.end(); i++) {
+		if (is_directory(*i)) {
+			collect_directory_files(*i, files);
+		} else {
+			files.push_back(*i);
+		}
+	}
+
+	if (threads == 0) {
+		threads = thread::hardware_concurrency();
+		if (threads == 0) {
+			threads = 1;
+		}
+	}
+	if (threads > files.size() && !files.empty()) {
+		threads = (unsigned int)files.size();
+	}
+
+	vector<string> errors(files.size());
+	atomic<size_t> next(0), failed(0), bytes(0);
+
+	// the inputs with the same name from different directories would overwrite each other
+	vector<string> outputs(files.size());
+	map<string, size_t> output_sources;
+	for (size_t i = 0; i < files.size(); i++) {
+		outputs[i] = out_dir + "/" + base_name(files[i]);
+		map<string, size_t>::const_iterator same = output_sources.find(outputs[i]);
+		if (same != output_sources.end()) {
+			errors[i] = "output file " + outputs[i] + " is already written for " + files[same->second];
+			failed++;
+		} else {
+			output_sources[outputs[i]] = i;
+		}
+	}
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+	vector<thread> workers;
+	for (unsigned int t = 0; t < threads; t++) {
+		workers.push_back(thread([&]() {
+			// every worker reuses its own document; the files are already processed
+			// in parallel, so the documents convert their SMs serially
+			LocalDocument d;
+			d.set_threads(1);
+			for (size_t i = next++; i < files.size(); i = next++) {
+				if (!errors[i].empty()) {
+					continue;
+				}
+				try {
+					d.open(files[i]);
+					d.save_as(outputs[i], format);
+					bytes += file_size(files[i]);
+				} catch (const Cyberiada::Exception& e) {
+					errors[i] = e.str();
+					failed++;
+				} catch (const std::exception& e) {
+					// an exception escaping the worker would terminate the whole batch
+					errors[i] = e.what();
+					failed++;
+				}
+			}
+		}));
+	}
+	for (vector<thread>::iterator t = workers.begin(); t != workers.end(); t++) {
+		t->join();
+	}
+
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	for (size_t i = 0; i < files.size(); i++) {
+		if (!errors[i].empty()) {
+			cerr << "Error while processing graphml file " << files[i] << ": " << errors[i] << endl;
+		}
+	}
+	size_t converted = files.size() - failed;
+	cout << "Files: " << files.size() << ", converted: " << converted << ", failed: " << failed << endl;
+	cout << "Threads: " << threads << ", time: " << seconds << " s";
+	if (seconds > 0) {
+		cout << ", " << converted / seconds << " files/s, " << bytes / seconds / (1024 * 1024) << " MB/s";
+	}
+	cout << endl;
+
+	return failed ? 2 : 0;
+}
+
+// the access to the separate phases of the document loading
+class BenchDocument: public Document {
+public:
+	static int flags(DocumentGeometryFormat gf)
+	{
+		int f = 0;
+		throw_status(decode_flags(f, gf));
+		return f;
+	}
+	void import(DocumentGeometryFormat gf, CyberiadaDocument* doc) { import_document(gf, doc); }
+	void check(CyberiadaDocument* doc) { check_bound_rect(doc); }
+};
+
+class BenchTimings {
+public:
+	void start() { started = chrono::steady_clock::now(); }
+	void stop(const string& phase)
+	{
+		double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - started).count();
+		for (vector<pair<string, vector<double>>>::iterator i = phases.begin(); i != phases.end(); i++) {
+			if (i->first == phase) {
+				i->second.push_back(ms);
+				return ;
+			}
+		}
+		phases.push_back(make_pair(phase, vector<double>(1, ms)));
+	}
+	void print(ostream& os) const
+	{
+		os << left << setw(24) << "phase" << right << setw(12) << "min, ms" << setw(12) << "median, ms" << setw(12) << "p99, ms" << endl;
+		for (vector<pair<string, vector<double>>>::const_iterator i = phases.begin(); i != phases.end(); i++) {
+			vector<double> t = i->second;
+			sort(t.begin(), t.end());
+			size_t p99 = size_t(ceil(0.99 * t.size())) - 1;
+			os << left << setw(24) << i->first << right << fixed << setprecision(3)
+			   << setw(12) << t.front() << setw(12) << t[t.size() / 2] << setw(12) << t[p99] << endl;
+		}
+	}
+
+private:
+	chrono::steady_clock::time_point       started;
+	vector<pair<string, vector<double>>>   phases;
+};
+
+static const char* geometry_format_name(DocumentGeometryFormat gf)
+{
+	switch (gf) {
+	case geometryFormatNone: return "none";
+	case geometryFormatLegacyYED: return "yed";
+	case geometryFormatCyberiada10: return "cyberiada";
+	case geometryFormatQt: return "qt";
+	default: return "unknown";
+	}
+}
+
+int bench(int argc, char** argv)
+{
+	string from_file;
+	int iterations = 10;
+
+	for (int i = 2; i < argc; i++) {
+		string arg = argv[i];
+		if (arg == "-n" && i + 1 < argc) {
+			iterations = atoi(argv[++i]);
+			if (iterations <= 0) {
+				usage(argv[0]);
+			}
+		} else if (from_file.empty()) {
+			from_file = arg;
+		} else {
+			usage(argv[0]);
+		}
+	}
+	if (from_file.empty()) {
+		usage(argv[0]);
+	}
+
+	const DocumentGeometryFormat gf = geometryFormatQt;
+	const DocumentGeometryFormat convert_formats[] = { geometryFormatNone, geometryFormatLegacyYED,
+													   geometryFormatCyberiada10, geometryFormatQt };
+	BenchTimings timings;
+	try {
+		for (int n = 0; n < iterations; n++) {
+			timings.start();
+			ifstream file(from_file);
+			if (!file.is_open()) {
+				throw FileException("Cannot open file " + from_file);
+			}
+			string content((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+			file.close();
+			timings.stop("read");
+
+			CyberiadaDocument doc;
+			cyberiada_init_sm_document(&doc);
+			timings.start();
+			int res = cyberiada_decode_sm_document(&doc, content.c_str(), content.length(),
+												   CyberiadaXMLFormat(formatDetect), BenchDocument::flags(gf));
+			timings.stop("decode");
+			if (res != CYBERIADA_NO_ERROR) {
+				cyberiada_cleanup_sm_document(&doc);
+				throw CybMLException("Cannot decode file " + from_file + ": error " + to_string(res));
+			}
+
+			BenchDocument d;
+			timings.start();
+			d.import(gf, &doc);
+			timings.stop("import");
+			timings.start();
+			d.check(&doc);
+			timings.stop("bound-rect");
+			cyberiada_cleanup_sm_document(&doc);
+
+			String buffer;
+			timings.start();
+			d.encode(buffer);
+			timings.stop("encode");
+
+			for (size_t i = 0; i < sizeof(convert_formats) / sizeof(convert_formats[0]); i++) {
+				if (convert_formats[i] == d.get_geometry_format()) {
+					continue;
+				}
+				Document converted(d);
+				timings.start();
+				converted.convert_geometry(convert_formats[i]);
+				timings.stop(string("convert-") + geometry_format_name(convert_formats[i]));
+			}
+
+			timings.start();
+			Document copy(d);
+			timings.stop("copy");
+
+			ConstStateMachineList sms = static_cast<const Document&>(d).get_state_machines();
+			timings.start();
+			for (ConstStateMachineList::const_iterator i = sms.begin(); i != sms.end(); i++) {
+				(*i)->check_isomorphism(**i);
+			}
+			timings.stop("isomorphism");
+		}
+	} catch (const Cyberiada::Exception& e) {
+		cerr << "Error while processing graphml file: " << e.str() << endl;
+		return 2;
+	}
+
+	cout << "File: " << from_file << ", iterations: " << iterations << endl;
+	timings.print(cout);
+	struct rusage ru;
+	if (getrusage(RUSAGE_SELF, &ru) == 0) {
+		cout << "Peak RSS: " << ru.ru_maxrss << " KB" << endl;
+	}
+	return 0;
+}
+
 int main(int argc, char** argv)
 {
 	LocalDocument d;
@@ -47,7 +389,11 @@ int main(int argc, char** argv)
 	}
 
 	command = argv[1];
-	if (command == "print" && argc == 3) {
+	if (command == "convert-batch") {
+		return convert_batch(argc, argv);
+	} else if (command == "bench") {
+		return bench(argc, argv);
+	} else if (command == "print" && argc == 3) {
 		from_file = argv[2];
 	} else if (command == "convert" && (argc == 5 || argc == 7)) {
 		if (argc == 5 && string(argv[2]) == "-o") {
@@ -0,0 +1,48 @@
+#!/bin/bash
+
+cmake -DCMAKE_BUILD_TYPE=Debug -DCYBERIADAMLPP_TSAN=ON ..
+make
+if [ $? != 0 ]
+then
+    echo "make test failed!"
+    exit 1
+fi
+
+echo
+echo "tests ready!"
+echo
+
+limit=$1
+
+if [ "$limit" == "" ]
+then
+    limit="99"
+fi
+
+i=-1
+
+export TSAN_OPTIONS="halt_on_error=1 second_deadlock_stack=1"
+
+for t in $(ls tests/*.test); do
+    i=$((i + 1))
+    if [ "$i" == "$limit" ]
+    then
+	break
+    fi
+    num=$(echo $t | grep -Poe '\d\d')
+    echo -n "$num $t... "
+    if [ -f "$t-input.graphml" -o -f "tests/$num-output.txt" ]
+    then
+	$t > "$t.txt"
+    else
+	$t
+    fi
+    if [ $? != 0 ]
+    then
+	echo "tsan test $num run failed!"
+	exit 1
+    fi
+    echo "ok"
+done
+
+exit 0
@@ -0,0 +1,100 @@
+/* -----------------------------------------------------------------------------
+ * The Cyberiada GraphML C++ library implemention
+ *
+ * The cached isomorhism comparator test
+ *
+ * Copyright (C) 2025 Alexey Fedoseev <aleksey@fedoseev.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see https://www.gnu.org/licenses/
+ * ----------------------------------------------------------------------------- */
+
+#include <iostream>
+#include <vector>
+#include "cyberiadamlpp.h"
+#include "testutils.h"
+
+using namespace Cyberiada;
+using namespace std;
+
+static StateMachine* build_sm(Document& d, const String& second_state, bool extra_transition)
+{
+	StateMachine* sm = d.new_state_machine("SM");
+	InitialPseudostate* init = d.new_initial(sm);
+	State* s1 = d.new_state(sm, "State 0", Action(actionEntry, "on();"));
+	State* s2 = d.new_state(sm, second_state);
+	d.new_transition(sm, transitionExternal, init, s1, Action());
+	d.new_transition(sm, transitionExternal, s1, s2, Action("GO"));
+	if (extra_transition) {
+		d.new_transition(sm, transitionExternal, s2, s1, Action("BACK"));
+	}
+	return sm;
+}
+
+int main(int argc, char** argv)
+{
+	try {
+		Document d1, d2, d3, d4;
+		StateMachine* reference = build_sm(d1, "State 1", false);
+		vector<const StateMachine*> candidates;
+		candidates.push_back(build_sm(d2, "State 1", false));
+		candidates.push_back(build_sm(d3, "Another State", false));
+		candidates.push_back(build_sm(d4, "State 1", true));
+
+		IsomorphismComparator comparator(*reference);
+		CYB_ASSERT(!comparator.is_prepared());
+		for (vector<const StateMachine*>::const_iterator i = candidates.begin(); i != candidates.end(); i++) {
+			CYB_ASSERT(comparator.check_isomorphism(**i) == reference->check_isomorphism(**i));
+		}
+		CYB_ASSERT(comparator.is_prepared());
+		CYB_ASSERT(comparator.check_isomorphism(*candidates[0]) == smiIdentical);
+
+		vector<ID> new_nodes, missing_nodes;
+		comparator.check_isomorphism_details(*candidates[0], NULL, NULL, NULL, NULL, &new_nodes, &missing_nodes);
+		CYB_ASSERT(new_nodes.empty());
+		CYB_ASSERT(missing_nodes.empty());
+
+		// the cached C-level form should be rebuilt after the reference modification
+		unsigned long revision = reference->get_revision();
+		d1.new_state(reference, "State 2");
+		CYB_ASSERT(reference->get_revision() != revision);
+		CYB_ASSERT(comparator.check_isomorphism(*candidates[0]) != smiIdentical);
+		for (vector<const StateMachine*>::const_iterator i = candidates.begin(); i != candidates.end(); i++) {
+			CYB_ASSERT(comparator.check_isomorphism(**i) == reference->check_isomorphism(**i));
+		}
+
+		comparator.invalidate();
+		CYB_ASSERT(!comparator.is_prepared());
+
+		// the changes made through the mutable references rebuild it as well
+		Transition* go = reference->get_transitions().back();
+		Action& action = go->get_action();
+		CYB_ASSERT(comparator.check_isomorphism(*candidates[0]) == reference->check_isomorphism(*candidates[0]));
+		action = Action("STOP");
+		for (vector<const StateMachine*>::const_iterator i = candidates.begin(); i != candidates.end(); i++) {
+			CYB_ASSERT(comparator.check_isomorphism(**i) == reference->check_isomorphism(**i));
+		}
+
+		Document empty;
+		StateMachine* empty_sm = empty.new_state_machine("Empty");
+		try {
+			comparator.check_isomorphism(*empty_sm);
+			return 1;
+		} catch (const Cyberiada::ParametersException&) {
+		}
+	} catch (const Cyberiada::Exception& e) {
+		cerr << e.str() << endl;
+		return 1;
+	}
+	return 0;
+}
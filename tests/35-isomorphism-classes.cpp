@@ -0,0 +1,112 @@
+/* -----------------------------------------------------------------------------
+ * The Cyberiada GraphML C++ library implemention
+ *
+ * The isomorhism classes partition test
+ *
+ * Copyright (C) 2025 Alexey Fedoseev <aleksey@fedoseev.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see https://www.gnu.org/licenses/
+ * ----------------------------------------------------------------------------- */
+
+#include <iostream>
+#include <vector>
+#include "cyberiadamlpp.h"
+#include "testutils.h"
+
+using namespace Cyberiada;
+using namespace std;
+
+static StateMachine* build_sm(Document& d, const String& second_state, bool extra_transition)
+{
+	StateMachine* sm = d.new_state_machine("SM");
+	InitialPseudostate* init = d.new_initial(sm);
+	State* s1 = d.new_state(sm, "State 0", Action(actionEntry, "on();"));
+	State* s2 = d.new_state(sm, second_state);
+	d.new_transition(sm, transitionExternal, init, s1, Action());
+	d.new_transition(sm, transitionExternal, s1, s2, Action("GO"));
+	if (extra_transition) {
+		d.new_transition(sm, transitionExternal, s2, s1, Action("BACK"));
+	}
+	return sm;
+}
+
+static bool same_class(const IsomorphismClasses& classes, size_t i, size_t j)
+{
+	for (IsomorphismClasses::const_iterator c = classes.begin(); c != classes.end(); c++) {
+		bool has_i = false, has_j = false;
+		for (vector<size_t>::const_iterator k = c->begin(); k != c->end(); k++) {
+			if (*k == i) has_i = true;
+			if (*k == j) has_j = true;
+		}
+		if (has_i || has_j) {
+			return has_i && has_j;
+		}
+	}
+	return false;
+}
+
+int main(int argc, char** argv)
+{
+	try {
+		const size_t n = 12;
+		vector<Document> docs(n);
+		ConstStateMachineList sms;
+		for (size_t i = 0; i < n; i++) {
+			if (i % 4 == 3) {
+				sms.push_back(docs[i].new_state_machine("Empty"));
+			} else {
+				sms.push_back(build_sm(docs[i], i % 2 ? "State 1" : "Another State", i % 3 == 0));
+			}
+		}
+
+		SMIsomorphismResult accepted = smiIdentical | smiEqual | smiIsomorphic;
+		IsomorphismClasses serial = partition_by_isomorphism(sms, true, false, accepted, 1);
+		IsomorphismClasses parallel = partition_by_isomorphism(sms, true, false, accepted, 4);
+		CYB_ASSERT(serial == parallel);
+
+		size_t total = 0;
+		for (size_t c = 0; c < serial.size(); c++) {
+			CYB_ASSERT(!serial[c].empty());
+			if (c > 0) {
+				CYB_ASSERT(serial[c - 1].front() < serial[c].front());
+			}
+			for (size_t k = 1; k < serial[c].size(); k++) {
+				CYB_ASSERT(serial[c][k - 1] < serial[c][k]);
+			}
+			total += serial[c].size();
+		}
+		CYB_ASSERT(total == n);
+
+		// the partition should agree with the pairwise checks
+		for (size_t i = 0; i < n; i++) {
+			for (size_t j = i + 1; j < n; j++) {
+				bool i_empty = sms[i]->children_count() == 0;
+				bool j_empty = sms[j]->children_count() == 0;
+				bool expected;
+				if (i_empty || j_empty) {
+					expected = i_empty && j_empty;
+				} else {
+					expected = (sms[i]->check_isomorphism(*(sms[j])) & accepted) != 0;
+				}
+				CYB_ASSERT(same_class(serial, i, j) == expected);
+			}
+		}
+
+		CYB_ASSERT(partition_by_isomorphism(ConstStateMachineList()).empty());
+	} catch (const Cyberiada::Exception& e) {
+		cerr << e.str() << endl;
+		return 1;
+	}
+	return 0;
+}
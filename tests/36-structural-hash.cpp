@@ -0,0 +1,82 @@
+/* -----------------------------------------------------------------------------
+ * The Cyberiada GraphML C++ library implemention
+ *
+ * The structural hash test
+ *
+ * Copyright (C) 2025 Alexey Fedoseev <aleksey@fedoseev.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see https://www.gnu.org/licenses/
+ * ----------------------------------------------------------------------------- */
+
+#include <iostream>
+#include "cyberiadamlpp.h"
+#include "testutils.h"
+
+using namespace Cyberiada;
+using namespace std;
+
+int main(int argc, char** argv)
+{
+	try {
+		Document d1, d2, d3;
+
+		StateMachine* sm1 = d1.new_state_machine("SM");
+		InitialPseudostate* init1 = d1.new_initial(sm1);
+		State* a1 = d1.new_state(sm1, "A", Action(actionEntry, "on();"));
+		State* b1 = d1.new_state(sm1, "B");
+		State* c1 = d1.new_state(b1, "C");
+		d1.new_transition(sm1, transitionExternal, init1, a1, Action());
+		d1.new_transition(sm1, transitionExternal, a1, b1, Action("GO"));
+		d1.new_transition(sm1, transitionExternal, c1, a1, Action("BACK"));
+
+		// the same graph with other IDs, the other children order and the other names
+		StateMachine* sm2 = d2.new_state_machine("SM");
+		State* b2 = d2.new_state(sm2, "b-state", "Second");
+		State* c2 = d2.new_state(b2, "c-state", "Third");
+		State* a2 = d2.new_state(sm2, "a-state", "First", Action(actionEntry, "on();"));
+		InitialPseudostate* init2 = d2.new_initial(sm2);
+		d2.new_transition(sm2, transitionExternal, "t1", c2, a2, Action("BACK"));
+		d2.new_transition(sm2, transitionExternal, "t2", a2, b2, Action("GO"));
+		d2.new_transition(sm2, transitionExternal, "t3", init2, a2, Action());
+
+		CYB_ASSERT(sm1->structural_hash() == sm2->structural_hash());
+		CYB_ASSERT(sm1->structural_hash(true, false, shActions) == sm2->structural_hash(true, false, shActions));
+		CYB_ASSERT(sm1->structural_hash(true, false, shNames) != sm2->structural_hash(true, false, shNames));
+
+		d2.new_state(sm2, "D");
+		CYB_ASSERT(sm1->structural_hash() != sm2->structural_hash());
+
+		// the reversed transition direction changes the structure
+		StateMachine* sm3 = d3.new_state_machine("SM");
+		InitialPseudostate* init3 = d3.new_initial(sm3);
+		State* a3 = d3.new_state(sm3, "A", Action(actionEntry, "on();"));
+		State* b3 = d3.new_state(sm3, "B");
+		State* c3 = d3.new_state(b3, "C");
+		d3.new_transition(sm3, transitionExternal, init3, a3, Action());
+		d3.new_transition(sm3, transitionExternal, b3, a3, Action("GO"));
+		d3.new_transition(sm3, transitionExternal, a3, c3, Action("BACK"));
+		CYB_ASSERT(sm1->structural_hash() != sm3->structural_hash());
+
+		// the comments are hashed only if they are not ignored
+		StructuralHash h = sm1->structural_hash(false);
+		StructuralHash hc = sm1->structural_hash();
+		d1.new_comment(sm1, "comment");
+		CYB_ASSERT(sm1->structural_hash() == hc);
+		CYB_ASSERT(sm1->structural_hash(false) != h);
+	} catch (const Cyberiada::Exception& e) {
+		cerr << e.str() << endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,100 @@
+/* -----------------------------------------------------------------------------
+ * The Cyberiada GraphML C++ library implemention
+ *
+ * The content hash test
+ *
+ * Copyright (C) 2025 Alexey Fedoseev <aleksey@fedoseev.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see https://www.gnu.org/licenses/
+ * ----------------------------------------------------------------------------- */
+
+#include <iostream>
+#include <vector>
+#include "cyberiadamlpp.h"
+#include "testutils.h"
+
+using namespace Cyberiada;
+using namespace std;
+
+int main(int argc, char** argv)
+{
+	try {
+		Document d1;
+		StateMachine* sm = d1.new_state_machine("SM");
+		InitialPseudostate* init = d1.new_initial(sm);
+		State* a = d1.new_state(sm, "A", Action(actionEntry, "on();"));
+		State* b = d1.new_state(sm, "B");
+		State* c = d1.new_state(b, "C");
+		d1.new_transition(sm, transitionExternal, init, a, Action());
+		d1.new_transition(sm, transitionExternal, a, c, Action("GO"));
+		d1.new_comment(sm, "comment");
+
+		Document d2(d1);
+		CYB_ASSERT(d1.content_hash() == d2.content_hash());
+		CYB_ASSERT(d1.content_hash() == d1.content_hash());
+		vector<ID> diff;
+		d1.content_diff(d2, diff);
+		CYB_ASSERT(diff.empty());
+
+		// the change of a nested element is located by the path to it
+		StateMachine* sm2 = d2.get_state_machines().front();
+		State* c2 = static_cast<State*>(sm2->find_element_by_id(c->get_id()));
+		CYB_ASSERT(c2);
+		c2->set_name("Changed");
+		CYB_ASSERT(d1.content_hash() != d2.content_hash());
+		CYB_ASSERT(sm->content_hash() != sm2->content_hash());
+		d1.content_diff(d2, diff);
+		CYB_ASSERT(diff.size() == 1);
+		CYB_ASSERT(diff.front() == c->get_id());
+
+		c2->set_name("C");
+		CYB_ASSERT(d1.content_hash() == d2.content_hash());
+
+		// the IDs are part of the content
+		c2->set_id("other-id");
+		CYB_ASSERT(d1.content_hash() != d2.content_hash());
+		c2->set_id(c->get_id());
+		CYB_ASSERT(d1.content_hash() == d2.content_hash());
+
+		// the actions too
+		c2->add_action(Action(actionExit, "off();"));
+		diff.clear();
+		d1.content_diff(d2, diff);
+		CYB_ASSERT(diff.size() == 1 && diff.front() == c->get_id());
+
+		Document d3(d1);
+		d3.new_state(d3.get_state_machines().front(), "D");
+		diff.clear();
+		d1.content_diff(d3, diff);
+		CYB_ASSERT(diff.size() == 1 && diff.front() == sm->get_id());
+
+		// the changes made through the mutable references are not hidden by the cache
+		Document d4(d1);
+		State* a4 = static_cast<State*>(d4.find_element_by_id(a->get_id()));
+		vector<Action>& actions = a4->get_actions();
+		ContentHash h4 = d4.content_hash();
+		CYB_ASSERT(h4 == d1.content_hash());
+		actions.push_back(Action(actionExit, "off();"));
+		CYB_ASSERT(d4.content_hash() != h4);
+		CYB_ASSERT(d4.content_hash() == Document(d4).content_hash());
+		DocumentMetainformation& meta = d4.meta();
+		h4 = d4.content_hash();
+		meta.transition_order_flag = !meta.transition_order_flag;
+		CYB_ASSERT(d4.content_hash() != h4);
+	} catch (const Cyberiada::Exception& e) {
+		cerr << e.str() << endl;
+		return 1;
+	}
+	return 0;
+}
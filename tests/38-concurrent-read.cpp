@@ -0,0 +1,123 @@
+/* -----------------------------------------------------------------------------
+ * The Cyberiada GraphML C++ library implemention
+ *
+ * The concurrent read access stress test (run it under ThreadSanitizer
+ * using run-tsan-tests.sh)
+ *
+ * Copyright (C) 2025 Alexey Fedoseev <aleksey@fedoseev.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see https://www.gnu.org/licenses/
+ * ----------------------------------------------------------------------------- */
+
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include "cyberiadamlpp.h"
+#include "testutils.h"
+
+using namespace Cyberiada;
+using namespace std;
+
+static const size_t THREADS = 8;
+static const size_t ITERATIONS = 50;
+
+struct Snapshot {
+	String       buffer;
+	String       dump;
+	Rect         bound_rect;
+	ContentHash  content;
+	std::vector<StructuralHash> structure;
+};
+
+static void take_snapshot(const Document& d, Snapshot& s)
+{
+	d.encode(s.buffer);
+	s.dump = d.dump_to_str();
+	s.bound_rect = d.get_bound_rect();
+	s.content = d.content_hash();
+	s.structure.clear();
+	ConstStateMachineList sms = d.get_state_machines();
+	for (ConstStateMachineList::const_iterator i = sms.begin(); i != sms.end(); i++) {
+		s.structure.push_back((*i)->structural_hash());
+	}
+}
+
+int main(int argc, char** argv)
+{
+	try {
+		Document d(geometryFormatQt);
+		vector<ID> ids;
+		for (size_t n = 0; n < 4; n++) {
+			StateMachine* sm = d.new_state_machine("SM " + to_string(n), Rect(0, 0, 400, 400));
+			InitialPseudostate* init = d.new_initial(sm, Point(10, 10));
+			State* prev = d.new_state(sm, "State 0", Action(actionEntry, "on();"), Rect(20, 20, 50, 30));
+			d.new_transition(sm, transitionExternal, init, prev, Action());
+			for (size_t i = 1; i <= n + 2; i++) {
+				State* s = d.new_state(sm, "State " + to_string(i), Action(), Rect(20 + i * 60, 20, 50, 30));
+				d.new_transition(sm, transitionExternal, prev, s, Action("EV" + to_string(i)));
+				prev = s;
+			}
+			ElementList elements = sm->find_elements_by_types({elementSimpleState, elementInitial, elementTransition});
+			for (ElementList::const_iterator i = elements.begin(); i != elements.end(); i++) {
+				ids.push_back((*i)->get_id());
+			}
+		}
+
+		const Document& cd = d;
+		Snapshot expected;
+		take_snapshot(cd, expected);
+
+		atomic<size_t> failures(0);
+		vector<thread> workers;
+		for (size_t t = 0; t < THREADS; t++) {
+			workers.push_back(thread([&cd, &ids, &expected, &failures]() {
+				try {
+					for (size_t i = 0; i < ITERATIONS; i++) {
+						Snapshot s;
+						take_snapshot(cd, s);
+						if (s.buffer != expected.buffer ||
+							s.dump != expected.dump ||
+							s.bound_rect != expected.bound_rect ||
+							s.content != expected.content ||
+							s.structure != expected.structure) {
+							failures++;
+						}
+						for (vector<ID>::const_iterator id = ids.begin(); id != ids.end(); id++) {
+							const Element* e = cd.find_element_by_id(*id);
+							if (!e || e->get_id() != *id) {
+								failures++;
+							}
+						}
+						ConstStateMachineList sms = cd.get_state_machines();
+						if (sms[0]->check_isomorphism(*(sms[0])) != smiIdentical) {
+							failures++;
+						}
+					}
+				} catch (const Cyberiada::Exception& e) {
+					cerr << e.str() << endl;
+					failures++;
+				}
+			}));
+		}
+		for (vector<thread>::iterator t = workers.begin(); t != workers.end(); t++) {
+			t->join();
+		}
+		CYB_ASSERT(failures == 0);
+	} catch (const Cyberiada::Exception& e) {
+		cerr << e.str() << endl;
+		return 1;
+	}
+	return 0;
+}
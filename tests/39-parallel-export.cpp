@@ -0,0 +1,75 @@
+/* -----------------------------------------------------------------------------
+ * The Cyberiada GraphML C++ library implemention
+ *
+ * The parallel state machines export test
+ *
+ * Copyright (C) 2025 Alexey Fedoseev <aleksey@fedoseev.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see https://www.gnu.org/licenses/
+ * ----------------------------------------------------------------------------- */
+
+#include <iostream>
+#include "cyberiadamlpp.h"
+#include "testutils.h"
+
+using namespace Cyberiada;
+using namespace std;
+
+// 16 state machines with the chains of the given length and more
+static void build_document(Document& d, size_t states)
+{
+	for (size_t n = 0; n < 16; n++) {
+		StateMachine* sm = d.new_state_machine("SM " + to_string(n));
+		InitialPseudostate* init = d.new_initial(sm);
+		State* prev = d.new_state(sm, "State 0", Action(actionEntry, "on();"));
+		d.new_transition(sm, transitionExternal, init, prev, Action());
+		for (size_t i = 1; i <= n % 5 + states; i++) {
+			State* s = d.new_state(sm, "State " + to_string(i));
+			d.new_transition(sm, transitionExternal, prev, s, Action("EV" + to_string(i)));
+			prev = s;
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	try {
+		// the small document is exported serially, the big one by the worker threads
+		const size_t states[] = {1, 160};
+		for (size_t k = 0; k < sizeof(states) / sizeof(states[0]); k++) {
+			Document d;
+			build_document(d, states[k]);
+
+			CYB_ASSERT(d.get_threads() == 0);
+			d.set_threads(1);
+			String serial;
+			d.encode(serial);
+
+			const unsigned int threads[] = {2, 4, 7, 0};
+			for (size_t i = 0; i < sizeof(threads) / sizeof(threads[0]); i++) {
+				d.set_threads(threads[i]);
+				String parallel;
+				d.encode(parallel);
+				CYB_ASSERT(parallel == serial);
+			}
+
+			Document copy(d);
+			CYB_ASSERT(copy.get_threads() == d.get_threads());
+		}
+	} catch (const Cyberiada::Exception& e) {
+		cerr << e.str() << endl;
+		return 1;
+	}
+	return 0;
+}
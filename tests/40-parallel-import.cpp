@@ -0,0 +1,118 @@
+/* -----------------------------------------------------------------------------
+ * The Cyberiada GraphML C++ library implemention
+ *
+ * The parallel state machines import test
+ *
+ * Copyright (C) 2025 Alexey Fedoseev <aleksey@fedoseev.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see https://www.gnu.org/licenses/
+ * ----------------------------------------------------------------------------- */
+
+#include <iostream>
+#include "cyberiadamlpp.h"
+#include "testutils.h"
+
+using namespace Cyberiada;
+using namespace std;
+
+// the access to the C-level document conversion
+class ConvertingDocument: public Document {
+public:
+	void export_to(CyberiadaDocument* doc) const { to_document(doc); }
+	void import_from(CyberiadaDocument* doc) { update_from_document(geometryFormatNone, doc); }
+};
+
+// the metainformation element with the body in the other form than the library writes
+static void add_meta_node(CyberiadaDocument* doc)
+{
+	CyberiadaNode* root = doc->state_machines->nodes;
+	CyberiadaNode* meta = cyberiada_new_node("meta");
+	meta->type = cybNodeFormalComment;
+	cyberiada_copy_string(&(meta->title), &(meta->title_len), "CGML_META");
+	meta->comment_data = cyberiada_new_comment_data();
+	cyberiada_copy_string(&(meta->comment_data->body), &(meta->comment_data->body_len), "standardVersion/ 1.0");
+	meta->parent = root;
+	meta->next = root->children;
+	root->children = meta;
+}
+
+int main(int argc, char** argv)
+{
+	try {
+		ConvertingDocument source;
+		for (size_t n = 0; n < 12; n++) {
+			StateMachine* sm = source.new_state_machine("SM " + to_string(n));
+			InitialPseudostate* init = source.new_initial(sm);
+			State* prev = source.new_state(sm, "State 0", Action(actionEntry, "on();"));
+			source.new_transition(sm, transitionExternal, init, prev, Action());
+			for (size_t i = 1; i <= n % 4 + 1; i++) {
+				State* s = source.new_state(prev, "State " + to_string(i));
+				source.new_transition(sm, transitionExternal, prev, s, Action("EV" + to_string(i)));
+				prev = s;
+			}
+			source.new_comment(sm, "Comment " + to_string(n));
+		}
+
+		ConvertingDocument serial;
+		serial.set_threads(1);
+		CyberiadaDocument doc;
+		source.export_to(&doc);
+		serial.import_from(&doc);
+		cyberiada_cleanup_sm_document(&doc);
+		CYB_ASSERT(serial.get_state_machines().size() == source.get_state_machines().size());
+		CYB_ASSERT(serial.elements_count() >= source.elements_count());
+
+		const unsigned int threads[] = {2, 5, 0};
+		for (size_t i = 0; i < sizeof(threads) / sizeof(threads[0]); i++) {
+			ConvertingDocument parallel;
+			parallel.set_threads(threads[i]);
+			source.export_to(&doc);
+			parallel.import_from(&doc);
+			cyberiada_cleanup_sm_document(&doc);
+			CYB_ASSERT(parallel.content_hash() == serial.content_hash());
+			CYB_ASSERT(parallel.dump_to_str() == serial.dump_to_str());
+			StateMachineList sms = parallel.get_state_machines();
+			for (StateMachineList::const_iterator sm = sms.begin(); sm != sms.end(); sm++) {
+				CYB_ASSERT((*sm)->get_parent() == &parallel);
+			}
+		}
+
+		// the multi-SM document is encoded the same with and without the parallel import
+		String encoded[2];
+		const unsigned int meta_threads[] = {1, 0};
+		for (size_t i = 0; i < 2; i++) {
+			ConvertingDocument d;
+			d.set_threads(meta_threads[i]);
+			source.export_to(&doc);
+			add_meta_node(&doc);
+			d.import_from(&doc);
+			cyberiada_cleanup_sm_document(&doc);
+			CYB_ASSERT(d.get_meta_element());
+			CYB_ASSERT(d.get_meta_element()->get_parent() == d.get_state_machines().front());
+			d.encode(encoded[i]);
+			// the import keeps the metainformation element updated as the serial one did
+			String body = d.get_meta_element()->get_body();
+			d.update_metainfo_element();
+			CYB_ASSERT(d.get_meta_element()->get_body() == body);
+			String updated;
+			d.encode(updated);
+			CYB_ASSERT(updated == encoded[i]);
+		}
+		CYB_ASSERT(encoded[0] == encoded[1]);
+	} catch (const Cyberiada::Exception& e) {
+		cerr << e.str() << endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,111 @@
+/* -----------------------------------------------------------------------------
+ * The Cyberiada GraphML C++ library implemention
+ *
+ * The document ID index test
+ *
+ * Copyright (C) 2025 Alexey Fedoseev <aleksey@fedoseev.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see https://www.gnu.org/licenses/
+ * ----------------------------------------------------------------------------- */
+
+#include <iostream>
+#include "cyberiadamlpp.h"
+#include "testutils.h"
+
+using namespace Cyberiada;
+using namespace std;
+
+int main(int argc, char** argv)
+{
+	try {
+		Document d;
+		StateMachine* sm = d.new_state_machine("SM");
+		State* s0 = d.new_state(sm, "S0");
+		State* s1 = d.new_state(sm, "S1");
+		State* s2 = d.new_state(sm, "S2");
+		CYB_ASSERT(s0->get_id() == "n0" && s1->get_id() == "n1" && s2->get_id() == "n2");
+		State* nested = d.new_state(s0, "Nested");
+		CYB_ASSERT(nested->get_id() == "n0::n0");
+		CYB_ASSERT(d.find_element_by_id("n0::n0") == nested);
+
+		// the released ID is generated again
+		sm->remove_element(s1->get_id());
+		delete s1;
+		CYB_ASSERT(!d.find_element_by_id("n1"));
+		State* s3 = d.new_state(sm, "S3");
+		CYB_ASSERT(s3->get_id() == "n1");
+		CYB_ASSERT(d.new_state(sm, "S4")->get_id() == "n3");
+
+		// the transitions are kept after the other elements
+		Transition* t1 = d.new_transition(sm, transitionExternal, s0, s2, Action("A"));
+		Transition* t2 = d.new_transition(sm, transitionExternal, s0, s2, Action("B"));
+		CYB_ASSERT(t1->get_id() == "n0-n2" && t2->get_id() == "n0-n2#0");
+		Comment* comment = d.new_comment(sm, "comment");
+		CYB_ASSERT(sm->get_children().back() == t2);
+		CYB_ASSERT(sm->element_index(comment) < sm->element_index(t1));
+
+		// the renamed elements
+		s2->set_id("renamed");
+		CYB_ASSERT(!d.find_element_by_id("n2"));
+		CYB_ASSERT(d.find_element_by_id("renamed") == s2);
+		CYB_ASSERT(d.new_state(sm, "S5")->get_id() == "n2");
+		try {
+			d.new_state(sm, "renamed", "S6");
+			return 1;
+		} catch (const Cyberiada::ParametersException&) {
+		}
+
+		// the subtree added at once
+		State* detached = new State(sm, "detached", "Detached");
+		detached->add_element(new State(detached, "detached-child", "Child"));
+		CYB_ASSERT(!d.find_element_by_id("detached-child"));
+		sm->add_element(detached);
+		CYB_ASSERT(d.find_element_by_id("detached-child"));
+		sm->remove_element("detached");
+		CYB_ASSERT(!d.find_element_by_id("detached-child"));
+		delete detached;
+
+		// the duplicated IDs are found in the tree order
+		State* duplicate = new State(s0, "n3", "Duplicate");
+		s0->add_element(duplicate);
+		const Element* first = static_cast<const ElementCollection&>(d).ElementCollection::find_element_by_id("n3");
+		CYB_ASSERT(d.find_element_by_id("n3") == first);
+		s0->remove_element("n3");
+		delete duplicate;
+		CYB_ASSERT(d.find_element_by_id("n3") && d.find_element_by_id("n3") != duplicate);
+
+		// the copy has its own index
+		Document copy(d);
+		const Element* copied = copy.find_element_by_id("n0::n0");
+		CYB_ASSERT(copied && copied != nested);
+		CYB_ASSERT(copied->get_name() == "Nested");
+
+		// the only incoming transition of a choice
+		ChoicePseudostate* choice = d.new_choice(sm);
+		d.new_transition(sm, transitionExternal, s0, choice, Action());
+		try {
+			d.new_transition(sm, transitionExternal, s3, choice, Action());
+			return 1;
+		} catch (const Cyberiada::ParametersException&) {
+		}
+
+		d.reset();
+		CYB_ASSERT(!d.find_element_by_id("n0"));
+		CYB_ASSERT(copy.find_element_by_id("n0"));
+	} catch (const Cyberiada::Exception& e) {
+		cerr << e.str() << endl;
+		return 1;
+	}
+	return 0;
+}
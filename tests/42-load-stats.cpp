@@ -0,0 +1,73 @@
+/* -----------------------------------------------------------------------------
+ * The Cyberiada GraphML C++ library implemention
+ *
+ * The load statistics test
+ *
+ * Copyright (C) 2025 Alexey Fedoseev <aleksey@fedoseev.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see https://www.gnu.org/licenses/
+ * ----------------------------------------------------------------------------- */
+
+#include <iostream>
+#include <fstream>
+#include "cyberiadamlpp.h"
+#include "testutils.h"
+
+using namespace Cyberiada;
+using namespace std;
+
+int main(int argc, char** argv)
+{
+	String input = string(argv[0]) + "-input.graphml";
+	try {
+		LocalDocument disabled;
+		disabled.open(input, formatCyberiada10);
+		CYB_ASSERT(!disabled.get_load_stats_enabled());
+		CYB_ASSERT(disabled.last_load_stats().bytes == 0);
+		CYB_ASSERT(disabled.last_load_stats().elements.empty());
+
+		LocalDocument d;
+		d.set_load_stats_enabled(true);
+		d.open(input, formatCyberiada10);
+		const LoadStats& stats = d.last_load_stats();
+
+		ifstream file(input, ios::binary | ios::ate);
+		CYB_ASSERT(stats.bytes == size_t(file.tellg()));
+		CYB_ASSERT(stats.read_ms >= 0 && stats.decode_ms >= 0 && stats.import_ms >= 0 &&
+				   stats.metainfo_ms >= 0 && stats.bound_rect_ms >= 0);
+
+		size_t total = 0;
+		for (map<ElementType, size_t>::const_iterator i = stats.elements.begin(); i != stats.elements.end(); i++) {
+			CYB_ASSERT(i->first != elementRoot);
+			if (i->first == elementSM) {
+				CYB_ASSERT(i->second == d.get_state_machines().size());
+			} else {
+				CYB_ASSERT(i->second == d.find_elements_by_type(i->first).size());
+			}
+			total += i->second;
+		}
+		CYB_ASSERT(total + 1 == d.elements_count());
+		CYB_ASSERT(stats.max_depth >= 2);
+
+		// the statistics are replaced by the next load
+		LoadStats first = stats;
+		d.open(input, formatCyberiada10);
+		CYB_ASSERT(d.last_load_stats().bytes == first.bytes);
+		CYB_ASSERT(d.last_load_stats().elements == first.elements);
+	} catch (const Cyberiada::Exception& e) {
+		cerr << e.str() << endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,81 @@
+/* -----------------------------------------------------------------------------
+ * The Cyberiada GraphML C++ library implemention
+ *
+ * The document memory usage test
+ *
+ * Copyright (C) 2025 Alexey Fedoseev <aleksey@fedoseev.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see https://www.gnu.org/licenses/
+ * ----------------------------------------------------------------------------- */
+
+#include <iostream>
+#include "cyberiadamlpp.h"
+#include "testutils.h"
+
+using namespace Cyberiada;
+using namespace std;
+
+static size_t elements_total(const MemoryUsage& usage)
+{
+	size_t total = 0;
+	for (map<ElementType, size_t>::const_iterator i = usage.elements.begin(); i != usage.elements.end(); i++) {
+		total += i->second;
+	}
+	return total;
+}
+
+int main(int argc, char** argv)
+{
+	try {
+		Document d;
+		MemoryUsage empty = d.memory_usage();
+		CYB_ASSERT(empty.objects + empty.geometry >= sizeof(Document));
+		CYB_ASSERT(empty.polylines == 0);
+		CYB_ASSERT(elements_total(empty) + empty.index == empty.total());
+
+		StateMachine* sm = d.new_state_machine("SM");
+		State* a = d.new_state(sm, "A");
+		State* b = d.new_state(sm, String(1000, 'B'), Action(actionEntry, String(500, 'x')));
+		MemoryUsage states = d.memory_usage();
+		CYB_ASSERT(states.strings >= empty.strings + 1500);
+		CYB_ASSERT(states.elements[elementSimpleState] >= 2 * sizeof(State) + 1500);
+		CYB_ASSERT(states.children >= 2 * sizeof(Element*));
+		CYB_ASSERT(states.index > empty.index);
+
+		Polyline pl;
+		for (int i = 0; i < 100; i++) {
+			pl.push_back(Point(i, i));
+		}
+		d.new_transition(sm, transitionExternal, a, b, Action("GO"), pl);
+		MemoryUsage transitions = d.memory_usage();
+		CYB_ASSERT(transitions.polylines >= 100 * sizeof(Point));
+		CYB_ASSERT(transitions.geometry > states.geometry);
+		CYB_ASSERT(transitions.elements[elementTransition] >= sizeof(Transition) + 100 * sizeof(Point));
+		CYB_ASSERT(elements_total(transitions) + transitions.index == transitions.total());
+
+		// the copy has the same payload
+		Document copy(d);
+		MemoryUsage copied = copy.memory_usage();
+		CYB_ASSERT(copied.polylines == transitions.polylines);
+		CYB_ASSERT(copied.geometry == transitions.geometry);
+		CYB_ASSERT(copied.elements[elementSimpleState] >= states.elements[elementSimpleState]);
+
+		d.reset();
+		CYB_ASSERT(d.memory_usage().polylines == 0);
+	} catch (const Cyberiada::Exception& e) {
+		cerr << e.str() << endl;
+		return 1;
+	}
+	return 0;
+}
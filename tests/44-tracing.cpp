@@ -0,0 +1,127 @@
+/* -----------------------------------------------------------------------------
+ * The Cyberiada GraphML C++ library implemention
+ *
+ * The tracing callback test
+ *
+ * Copyright (C) 2025 Alexey Fedoseev <aleksey@fedoseev.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see https://www.gnu.org/licenses/
+ * ----------------------------------------------------------------------------- */
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include "cyberiadamlpp.h"
+#include "testutils.h"
+
+using namespace Cyberiada;
+using namespace std;
+
+struct TraceRecord {
+	TracePhase phase;
+	TraceEvent event;
+	size_t     size;
+};
+
+static vector<TraceRecord> events;
+
+static void record(TracePhase phase, TraceEvent event, size_t size)
+{
+	events.push_back({phase, event, size});
+}
+
+int main(int argc, char** argv)
+{
+	try {
+		Document d;
+		StateMachine* sm = d.new_state_machine("SM");
+		State* s0 = d.new_state(sm, "S0");
+		State* s1 = d.new_state(sm, "S1");
+		d.new_transition(sm, transitionExternal, s0, s1, Action("GO"));
+		size_t size = d.elements_count();
+
+		set_trace_callback(record);
+
+		// the document conversion is nested into the encoding
+		String buffer;
+		d.encode(buffer, formatCyberiada10);
+		CYB_ASSERT(events.size() == 4);
+		CYB_ASSERT(events[0].phase == tracePhaseEncode && events[0].event == traceBegin);
+		CYB_ASSERT(events[1].phase == tracePhaseToDocument && events[1].event == traceBegin);
+		CYB_ASSERT(events[2].phase == tracePhaseToDocument && events[2].event == traceEnd);
+		CYB_ASSERT(events[3].phase == tracePhaseEncode && events[3].event == traceEnd);
+		for (vector<TraceRecord>::const_iterator e = events.begin(); e != events.end(); e++) {
+			CYB_ASSERT(e->size == size);
+		}
+		CYB_ASSERT(String(trace_phase_name(tracePhaseEncode)) == "encode");
+
+		// the isomorphism check reports the size of the state machine
+		events.clear();
+		Document copy(d);
+		sm->check_isomorphism(*(copy.get_state_machines().front()));
+		CYB_ASSERT(events.size() == 2);
+		CYB_ASSERT(events[0].phase == tracePhaseCheckIsomorphism && events[0].event == traceBegin);
+		CYB_ASSERT(events[1].phase == tracePhaseCheckIsomorphism && events[1].event == traceEnd);
+		CYB_ASSERT(events[0].size == sm->elements_count());
+
+		// the end event is fired on the error too
+		events.clear();
+		try {
+			Document broken;
+			DocumentFormat format = formatDetect;
+			String format_str;
+			broken.decode("", format, format_str);
+			return 1;
+		} catch (const Cyberiada::Exception&) {
+		}
+		CYB_ASSERT(events.size() >= 2);
+		CYB_ASSERT(events.front().phase == tracePhaseDecode && events.front().event == traceBegin);
+		CYB_ASSERT(events.back().phase == tracePhaseDecode && events.back().event == traceEnd);
+
+		// the load phases report the size of the input, not of the replaced document
+		events.clear();
+		Document replaced(d);
+		DocumentFormat format = formatCyberiada10;
+		String format_str;
+		replaced.decode(buffer, format, format_str);
+		size_t decode_events = 0;
+		for (vector<TraceRecord>::const_iterator e = events.begin(); e != events.end(); e++) {
+			if (e->phase == tracePhaseDecode) {
+				CYB_ASSERT(e->size == buffer.length());
+				decode_events++;
+			}
+		}
+		CYB_ASSERT(decode_events == 2);
+		String path = string(argv[0]) + ".graphml";
+		{
+			ofstream file(path, ios::binary);
+			file << buffer;
+		}
+		events.clear();
+		LocalDocument opened;
+		opened.open(path, formatCyberiada10);
+		CYB_ASSERT(events.front().phase == tracePhaseOpen && events.front().size == buffer.length());
+		CYB_ASSERT(events.back().phase == tracePhaseOpen && events.back().size == buffer.length());
+
+		// the empty callback disables tracing
+		set_trace_callback(TraceCallback());
+		events.clear();
+		d.encode(buffer, formatCyberiada10);
+		CYB_ASSERT(events.empty());
+	} catch (const Cyberiada::Exception& e) {
+		cerr << e.str() << endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,79 @@
+/* -----------------------------------------------------------------------------
+ * The Cyberiada GraphML C++ library implemention
+ *
+ * The operation counters test
+ *
+ * Copyright (C) 2025 Alexey Fedoseev <aleksey@fedoseev.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see https://www.gnu.org/licenses/
+ * ----------------------------------------------------------------------------- */
+
+#include <iostream>
+#include "cyberiadamlpp.h"
+#include "testutils.h"
+
+using namespace Cyberiada;
+using namespace std;
+
+int main(int argc, char** argv)
+{
+	try {
+		Document d;
+		StateMachine* sm = d.new_state_machine("SM");
+		State* s0 = d.new_state(sm, "S0");
+		State* s1 = d.new_state(sm, "S1");
+		State* nested = d.new_state(s0, "Nested");
+		d.new_transition(sm, transitionExternal, s0, s1, Action("GO"));
+
+		reset_operation_counters();
+		CYB_ASSERT(d.find_element_by_id(nested->get_id()) == nested);
+		CYB_ASSERT(nested->qualified_name() == "S0::Nested");
+		ConstElementList states = static_cast<const Document&>(d).find_elements_by_type(elementSimpleState);
+		CYB_ASSERT(states.size() == 2);
+		OperationCounter find = get_operation_counter(countFindElementById);
+		OperationCounter types = get_operation_counter(countFindElementsByType);
+		OperationCounter name = get_operation_counter(countQualifiedName);
+
+		reset_operation_counters();
+		String buffer;
+		d.encode(buffer, formatCyberiada10);
+		OperationCounter sms = get_operation_counter(countToSM);
+		OperationCounter nodes = get_operation_counter(countToNode);
+		OperationCounter edges = get_operation_counter(countToEdge);
+
+		if (operation_counters_enabled()) {
+			// the element is found by the document index
+			CYB_ASSERT(find.calls == 1 && find.visited == 1);
+			// the recursive calls are counted as the visited elements
+			CYB_ASSERT(name.calls == 1 && name.visited == 2);
+			CYB_ASSERT(types.calls == 1 && types.visited == d.elements_count() - 1);
+			CYB_ASSERT(sms.calls == 1 && sms.visited == 1);
+			CYB_ASSERT(nodes.visited >= 4);
+			CYB_ASSERT(edges.calls == 1 && edges.visited == 1);
+			CYB_ASSERT(find.time_ms >= 0 && sms.time_ms >= 0);
+
+			reset_operation_counters();
+			CYB_ASSERT(get_operation_counter(countToSM).calls == 0);
+			CYB_ASSERT(get_operation_counter(countToNode).visited == 0);
+		} else {
+			CYB_ASSERT(find.calls == 0 && name.calls == 0 && types.visited == 0);
+			CYB_ASSERT(sms.calls == 0 && nodes.visited == 0 && edges.time_ms == 0);
+		}
+		CYB_ASSERT(String(counted_operation_name(countGetBoundRect)) == "get_bound_rect");
+	} catch (const Cyberiada::Exception& e) {
+		cerr << e.str() << endl;
+		return 1;
+	}
+	return 0;
+}
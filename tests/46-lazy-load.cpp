@@ -0,0 +1,189 @@
+/* -----------------------------------------------------------------------------
+ * The Cyberiada GraphML C++ library implemention
+ *
+ * The lazy state machine loading test
+ *
+ * Copyright (C) 2025 Alexey Fedoseev <aleksey@fedoseev.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see https://www.gnu.org/licenses/
+ * ----------------------------------------------------------------------------- */
+
+#include <iostream>
+#include <fstream>
+#include "cyberiadamlpp.h"
+#include "testutils.h"
+
+using namespace Cyberiada;
+using namespace std;
+
+static size_t loaded_count(const Document& d)
+{
+	size_t count = 0;
+	ConstStateMachineList sms = d.get_state_machines();
+	for (ConstStateMachineList::const_iterator i = sms.begin(); i != sms.end(); i++) {
+		if ((*i)->is_loaded()) {
+			count++;
+		}
+	}
+	return count;
+}
+
+static void decode(Document& d, const String& buffer, DocumentGeometryFormat gf = geometryFormatNone)
+{
+	DocumentFormat format = formatCyberiada10;
+	String format_str;
+	d.decode(buffer, format, format_str, gf);
+}
+
+int main(int argc, char** argv)
+{
+	try {
+		Document source;
+		for (int i = 0; i < 3; i++) {
+			StateMachine* sm = source.new_state_machine("SM" + to_string(i));
+			State* s0 = source.new_state(sm, "S0");
+			State* s1 = source.new_state(sm, "S1");
+			source.new_state(s1, "Nested");
+			source.new_transition(sm, transitionExternal, s0, s1, Action("GO"));
+		}
+		String buffer;
+		source.encode(buffer, formatCyberiada10);
+
+		Document eager;
+		decode(eager, buffer);
+		Document lazy;
+		lazy.set_lazy_load(true);
+		decode(lazy, buffer);
+
+		// only the state machine with the metainformation is imported
+		StateMachineList eager_sms = eager.get_state_machines();
+		StateMachineList lazy_sms = lazy.get_state_machines();
+		CYB_ASSERT(eager_sms.size() == lazy_sms.size());
+		for (size_t i = 0; i < lazy_sms.size(); i++) {
+			CYB_ASSERT(lazy_sms[i]->get_id() == eager_sms[i]->get_id());
+			CYB_ASSERT(lazy_sms[i]->get_name() == eager_sms[i]->get_name());
+		}
+		size_t loaded = loaded_count(lazy);
+		CYB_ASSERT(loaded <= 1 && loaded < lazy_sms.size());
+
+		// the elements are counted without the import
+		CYB_ASSERT(lazy.elements_count() == eager.elements_count());
+		CYB_ASSERT(loaded_count(lazy) == loaded);
+		CYB_ASSERT(!lazy.find_element_by_id("missing element"));
+		CYB_ASSERT(loaded_count(lazy) == loaded);
+
+		// the lookup imports the state machine with the element
+		const Element* last = eager_sms.back()->first_element();
+		CYB_ASSERT(last);
+		const Element* found = lazy.find_element_by_id(last->get_id());
+		CYB_ASSERT(found && found->get_name() == last->get_name());
+		CYB_ASSERT(lazy_sms.back()->is_loaded());
+		CYB_ASSERT(found->get_parent() == lazy_sms.back() || lazy_sms.back()->find_element_by_id(found->get_id()));
+
+		// the access to the content imports it
+		CYB_ASSERT(lazy_sms.front()->children_count() == eager_sms.front()->children_count());
+		CYB_ASSERT(lazy_sms.front()->is_loaded());
+
+		// the import is not a modification, the content is the same as the eager one
+		unsigned long revision = lazy.get_revision();
+		lazy.load_state_machines();
+		CYB_ASSERT(loaded_count(lazy) == lazy_sms.size());
+		CYB_ASSERT(lazy.get_revision() == revision);
+		CYB_ASSERT(lazy.content_hash() == eager.content_hash());
+		String eager_buffer, lazy_buffer;
+		eager.encode(eager_buffer, formatCyberiada10);
+		lazy.encode(lazy_buffer, formatCyberiada10);
+		CYB_ASSERT(eager_buffer == lazy_buffer);
+
+		// the copy and the editing of the lazily loaded document
+		Document edited;
+		edited.set_lazy_load(true);
+		decode(edited, buffer);
+		Document copy(edited);
+		CYB_ASSERT(loaded_count(copy) == copy.get_state_machines().size());
+		CYB_ASSERT(copy.content_hash() == Document(eager).content_hash());
+		StateMachine* sm = edited.get_state_machines().back();
+		State* added = edited.new_state(sm, "Added");
+		CYB_ASSERT(sm->is_loaded());
+		CYB_ASSERT(edited.find_element_by_id(added->get_id()) == added);
+		CYB_ASSERT(edited.elements_count() == eager.elements_count() + 1);
+
+		// the state machines are released without the import
+		Document released;
+		released.set_lazy_load(true);
+		decode(released, buffer);
+		size_t before = loaded_count(released);
+		released.reset();
+		CYB_ASSERT(released.get_state_machines().empty());
+		decode(released, buffer);
+		CYB_ASSERT(loaded_count(released) == before);
+
+		// the center point of the Qt geometry is found without the import
+		Document qt_source(geometryFormatQt);
+		for (int i = 0; i < 3; i++) {
+			StateMachine* sm = qt_source.new_state_machine("SM" + to_string(i));
+			State* s0 = qt_source.new_state(sm, "S0", Action(), Rect(i * 300.0, 0.0, 100.0, 50.0));
+			State* s1 = qt_source.new_state(sm, "S1", Action(), Rect(i * 300.0 + 150.0, 100.0, 120.0, 80.0));
+			qt_source.new_transition(sm, transitionExternal, s0, s1, Action("GO"));
+		}
+		String qt_buffer;
+		qt_source.encode(qt_buffer, formatCyberiada10);
+		Document qt_eager, qt_lazy;
+		decode(qt_eager, qt_buffer, geometryFormatQt);
+		qt_lazy.set_lazy_load(true);
+		decode(qt_lazy, qt_buffer, geometryFormatQt);
+		size_t qt_loaded = loaded_count(qt_lazy);
+		CYB_ASSERT(qt_lazy.get_bound_rect() == qt_eager.get_bound_rect());
+		String qt_eager_json, qt_lazy_json;
+		qt_eager.encode_json(qt_eager_json);
+		qt_lazy.encode_json(qt_lazy_json);
+		CYB_ASSERT(qt_lazy_json == qt_eager_json);
+		CYB_ASSERT(qt_lazy.dump_to_str() == qt_eager.dump_to_str());
+		Document qt_unloaded;
+		qt_unloaded.set_lazy_load(true);
+		decode(qt_unloaded, qt_buffer, geometryFormatQt);
+		CYB_ASSERT(loaded_count(qt_unloaded) == qt_loaded);
+
+		// the lazy open with the default Qt geometry measures the state machines without the import
+		String qt_path = string(argv[0]) + "-qt.graphml";
+		{
+			ofstream file(qt_path, ios::binary);
+			file << qt_buffer;
+		}
+		LocalDocument qt_opened;
+		qt_opened.set_lazy_load(true);
+		reset_operation_counters();
+		qt_opened.open(qt_path);
+		OperationCounter measured = get_operation_counter(countGetBoundRect);
+		ConstStateMachineList qt_opened_sms = static_cast<const Document&>(qt_opened).get_state_machines();
+		CYB_ASSERT(qt_opened_sms.size() == 3);
+		CYB_ASSERT(qt_opened_sms.front()->is_loaded());
+		for (size_t i = 1; i < qt_opened_sms.size(); i++) {
+			CYB_ASSERT(!qt_opened_sms[i]->is_loaded());
+		}
+		if (operation_counters_enabled()) {
+			// only the state machine with the metainformation is visited
+			CYB_ASSERT(measured.visited == qt_opened_sms.front()->elements_count());
+		}
+		String qt_opened_buffer;
+		qt_opened.encode(qt_opened_buffer, formatCyberiada10);
+		String qt_eager_buffer;
+		qt_eager.encode(qt_eager_buffer, formatCyberiada10);
+		CYB_ASSERT(qt_opened_buffer == qt_eager_buffer);
+	} catch (const Cyberiada::Exception& e) {
+		cerr << e.str() << endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,204 @@
+/* -----------------------------------------------------------------------------
+ * The Cyberiada GraphML C++ library implemention
+ *
+ * The selective state machine loading test
+ *
+ * Copyright (C) 2025 Alexey Fedoseev <aleksey@fedoseev.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see https://www.gnu.org/licenses/
+ * ----------------------------------------------------------------------------- */
+
+#include <iostream>
+#include <algorithm>
+#include "cyberiadamlpp.h"
+#include "testutils.h"
+
+using namespace Cyberiada;
+using namespace std;
+
+static void decode(Document& d, const String& buffer, DocumentGeometryFormat gf = geometryFormatNone)
+{
+	DocumentFormat format = formatCyberiada10;
+	String format_str;
+	d.decode(buffer, format, format_str, gf);
+}
+
+static vector<ID> sm_ids(const Document& d)
+{
+	vector<ID> ids;
+	ConstStateMachineList sms = d.get_state_machines();
+	for (ConstStateMachineList::const_iterator i = sms.begin(); i != sms.end(); i++) {
+		ids.push_back((*i)->get_id());
+	}
+	return ids;
+}
+
+static void collect_ids(const Element* e, vector<ID>& ids)
+{
+	ids.push_back(e->get_id());
+	if (e->has_children()) {
+		ConstElementList children = static_cast<const ElementCollection*>(e)->get_children();
+		for (ConstElementList::const_iterator i = children.begin(); i != children.end(); i++) {
+			collect_ids(*i, ids);
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	try {
+		Document source;
+		for (int i = 0; i < 3; i++) {
+			StateMachine* sm = source.new_state_machine("SM" + to_string(i));
+			State* s0 = source.new_state(sm, "S0");
+			State* s1 = source.new_state(sm, "S1");
+			source.new_state(s1, "Nested");
+			source.new_transition(sm, transitionExternal, s0, s1, Action("GO"));
+		}
+		String buffer;
+		source.encode(buffer, formatCyberiada10);
+
+		Document full;
+		decode(full, buffer);
+		ConstStateMachineList full_sms = static_cast<const Document&>(full).get_state_machines();
+		const StateMachine* selected = full_sms.back();
+
+		// the selected state machine is imported, the rest except the metainformation one are skipped
+		Document part;
+		part.set_state_machine_selection({selected->get_id()});
+		decode(part, buffer);
+		CYB_ASSERT(part.find_element_by_id(selected->get_id()));
+		CYB_ASSERT(sm_ids(part) == vector<ID>({full_sms[0]->get_id(), selected->get_id()}));
+		vector<ID> skipped = part.get_skipped_state_machines();
+		CYB_ASSERT(skipped == vector<ID>({full_sms[1]->get_id()}));
+		for (vector<ID>::const_iterator i = skipped.begin(); i != skipped.end(); i++) {
+			CYB_ASSERT(full.find_element_by_id(*i));
+			CYB_ASSERT(!part.find_element_by_id(*i));
+		}
+
+		// the selection by name
+		Document by_name;
+		by_name.set_state_machine_selection({selected->get_name()});
+		decode(by_name, buffer);
+		CYB_ASSERT(by_name.find_element_by_id(selected->get_id()));
+		CYB_ASSERT(sm_ids(by_name) == sm_ids(part));
+		CYB_ASSERT(by_name.get_skipped_state_machines() == skipped);
+
+		// the skipped state machines are written back in the original order
+		String part_buffer;
+		part.encode(part_buffer, formatCyberiada10);
+		Document restored;
+		decode(restored, part_buffer);
+		CYB_ASSERT(sm_ids(restored) == sm_ids(full));
+		CYB_ASSERT(restored.elements_count() == full.elements_count());
+		CYB_ASSERT(restored.content_hash() == full.content_hash());
+		String full_buffer;
+		full.encode(full_buffer, formatCyberiada10);
+		CYB_ASSERT(part_buffer == full_buffer);
+
+		// the copy keeps the skipped state machines as well
+		Document copy(part);
+		CYB_ASSERT(copy.get_skipped_state_machines() == skipped);
+		String copy_buffer;
+		copy.encode(copy_buffer, formatCyberiada10);
+		CYB_ASSERT(copy_buffer == part_buffer);
+
+		try {
+			part.reconstruct_geometry(false);
+			return 1;
+		} catch (const Cyberiada::ParametersException&) {
+		}
+
+		// the IDs of the skipped state machines are not given to the new elements
+		Document edited;
+		edited.set_state_machine_selection({"missing"});
+		decode(edited, buffer);
+		CYB_ASSERT(sm_ids(edited) == vector<ID>({full_sms[0]->get_id()}));
+		CYB_ASSERT(edited.get_skipped_state_machines() == vector<ID>({full_sms[1]->get_id(), full_sms[2]->get_id()}));
+		StateMachine* added_sm = edited.new_state_machine("Added");
+		StateMachine* first = edited.get_state_machines().front();
+		State* added_s0 = edited.new_state(first, "Added0");
+		State* added_s1 = edited.new_state(first, "Added1");
+		Transition* added_t = edited.new_transition(first, transitionExternal, added_s0, added_s1, Action("ADDED"));
+		vector<const Element*> added = {added_sm, added_s0, added_s1, added_t};
+		for (vector<const Element*>::const_iterator i = added.begin(); i != added.end(); i++) {
+			CYB_ASSERT(!full.find_element_by_id((*i)->get_id()));
+		}
+		try {
+			edited.new_state_machine(full_sms[1]->get_id(), "Clash");
+			return 1;
+		} catch (const Cyberiada::ParametersException&) {
+		}
+		String edited_buffer;
+		edited.encode(edited_buffer, formatCyberiada10);
+		Document edited_restored;
+		decode(edited_restored, edited_buffer);
+		CYB_ASSERT(edited_restored.elements_count() == full.elements_count() + added.size());
+		vector<ID> restored_ids;
+		collect_ids(&edited_restored, restored_ids);
+		sort(restored_ids.begin(), restored_ids.end());
+		CYB_ASSERT(adjacent_find(restored_ids.begin(), restored_ids.end()) == restored_ids.end());
+		for (vector<const Element*>::const_iterator i = added.begin(); i != added.end(); i++) {
+			const Element* e = edited_restored.find_element_by_id((*i)->get_id());
+			CYB_ASSERT(e && e->get_type() == (*i)->get_type() && e->get_name() == (*i)->get_name());
+		}
+
+		// the empty selection imports everything
+		Document all;
+		all.set_state_machine_selection({});
+		decode(all, buffer);
+		CYB_ASSERT(all.get_skipped_state_machines().empty());
+		CYB_ASSERT(sm_ids(all) == sm_ids(full));
+
+		part.reset();
+		CYB_ASSERT(part.get_skipped_state_machines().empty());
+		CYB_ASSERT(copy.get_skipped_state_machines() == skipped);
+
+		// the center point of the Qt geometry takes the skipped state machines into account
+		Document qt_source(geometryFormatQt);
+		for (int i = 0; i < 3; i++) {
+			StateMachine* sm = qt_source.new_state_machine("SM" + to_string(i));
+			State* s0 = qt_source.new_state(sm, "S0", Action(), Rect(i * 300.0, 0.0, 100.0, 50.0));
+			State* s1 = qt_source.new_state(sm, "S1", Action(), Rect(i * 300.0 + 150.0, 100.0, 120.0, 80.0));
+			qt_source.new_transition(sm, transitionExternal, s0, s1, Action("GO"));
+		}
+		String qt_buffer;
+		qt_source.encode(qt_buffer, formatCyberiada10);
+		Document qt_full, qt_part;
+		decode(qt_full, qt_buffer, geometryFormatQt);
+		qt_part.set_state_machine_selection({qt_full.get_state_machines().back()->get_id()});
+		decode(qt_part, qt_buffer, geometryFormatQt);
+		vector<ID> qt_skipped = qt_part.get_skipped_state_machines();
+		CYB_ASSERT(qt_skipped == vector<ID>({qt_full.get_state_machines()[1]->get_id()}));
+		for (vector<ID>::const_iterator i = qt_skipped.begin(); i != qt_skipped.end(); i++) {
+			Element* sm = qt_full.find_element_by_id(*i);
+			CYB_ASSERT(sm);
+			qt_full.remove_element(*i);
+			delete sm;
+		}
+		CYB_ASSERT(qt_part.get_bound_rect() == qt_full.get_bound_rect());
+
+		// the imported state machines are saved with the center point
+		String qt_part_buffer;
+		qt_part.encode(qt_part_buffer, formatCyberiada10);
+		Document qt_whole, qt_restored;
+		decode(qt_whole, qt_buffer, geometryFormatQt);
+		decode(qt_restored, qt_part_buffer, geometryFormatQt);
+		CYB_ASSERT(qt_restored.get_bound_rect().almost_equal(qt_whole.get_bound_rect()));
+	} catch (const Cyberiada::Exception& e) {
+		cerr << e.str() << endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,101 @@
+/* -----------------------------------------------------------------------------
+ * The Cyberiada GraphML C++ library implemention
+ *
+ * The trusted input loading test
+ *
+ * Copyright (C) 2025 Alexey Fedoseev <aleksey@fedoseev.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see https://www.gnu.org/licenses/
+ * ----------------------------------------------------------------------------- */
+
+#include <iostream>
+#include "cyberiadamlpp.h"
+#include "testutils.h"
+
+using namespace Cyberiada;
+using namespace std;
+
+static void decode(Document& d, const String& buffer, DocumentGeometryFormat gf = geometryFormatNone)
+{
+	DocumentFormat format = formatCyberiada10;
+	String format_str;
+	d.decode(buffer, format, format_str, gf);
+}
+
+int main(int argc, char** argv)
+{
+	try {
+		Document source;
+		for (int i = 0; i < 2; i++) {
+			StateMachine* sm = source.new_state_machine("SM" + to_string(i), Rect(0, 0, 300, 200));
+			State* s0 = source.new_state(sm, "S0", Action(actionEntry, "x = 1;"), Rect(10, 10, 100, 50));
+			State* s1 = source.new_state(sm, "S1", Action(), Rect(150, 10, 100, 100));
+			State* nested = source.new_state(s1, "Nested", Action(), Rect(10, 30, 50, 30));
+			source.new_transition(sm, transitionExternal, s0, s1, Action("GO"));
+			source.new_transition(sm, transitionExternal, nested, s0, Action("BACK"));
+			Comment* c = source.new_comment(sm, "comment", Rect(10, 150, 80, 30));
+			c->add_subject(CommentSubject("subject", s0));
+		}
+		String buffer;
+		source.encode(buffer, formatCyberiada10);
+
+		// the trusted load gives the same document as the strict one
+		Document strict;
+		decode(strict, buffer, geometryFormatCyberiada10);
+		Document trusted;
+		trusted.set_trusted_load(true);
+		decode(trusted, buffer, geometryFormatCyberiada10);
+		CYB_ASSERT(trusted.get_trusted_load());
+		CYB_ASSERT(trusted.content_hash() == strict.content_hash());
+		CYB_ASSERT(trusted.get_meta_element() != NULL || strict.get_meta_element() == NULL);
+		String strict_buffer, trusted_buffer;
+		strict.encode(strict_buffer, formatCyberiada10);
+		trusted.encode(trusted_buffer, formatCyberiada10);
+		CYB_ASSERT(trusted_buffer == strict_buffer);
+
+		// the transitions are resolved by ID after the trusted import
+		ConstStateMachineList sms = static_cast<const Document&>(trusted).get_state_machines();
+		for (ConstStateMachineList::const_iterator i = sms.begin(); i != sms.end(); i++) {
+			vector<const Transition*> transitions = (*i)->get_transitions();
+			for (vector<const Transition*>::const_iterator t = transitions.begin(); t != transitions.end(); t++) {
+				CYB_ASSERT(trusted.find_element_by_id((*t)->source_element_id()));
+				CYB_ASSERT(trusted.find_element_by_id((*t)->target_element_id()));
+			}
+		}
+
+		// the Qt geometry keeps the center point check
+		Document qt;
+		qt.set_trusted_load(true);
+		decode(qt, buffer, geometryFormatQt);
+		Document strict_qt;
+		decode(strict_qt, buffer, geometryFormatQt);
+		CYB_ASSERT(qt.get_bound_rect() == strict_qt.get_bound_rect());
+
+		// the trusted lazy load
+		Document lazy;
+		lazy.set_trusted_load(true);
+		lazy.set_lazy_load(true);
+		decode(lazy, buffer, geometryFormatCyberiada10);
+		lazy.load_state_machines();
+		CYB_ASSERT(lazy.content_hash() == strict.content_hash());
+
+		// the flag is kept by the copy
+		Document copy(trusted);
+		CYB_ASSERT(copy.get_trusted_load());
+	} catch (const Cyberiada::Exception& e) {
+		cerr << e.str() << endl;
+		return 1;
+	}
+	return 0;
+}
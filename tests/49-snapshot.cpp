@@ -0,0 +1,147 @@
+/* -----------------------------------------------------------------------------
+ * The Cyberiada GraphML C++ library implemention
+ *
+ * The binary snapshot test
+ *
+ * Copyright (C) 2025 Alexey Fedoseev <aleksey@fedoseev.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see https://www.gnu.org/licenses/
+ * ----------------------------------------------------------------------------- */
+
+#include <iostream>
+#include <sstream>
+#include "cyberiadamlpp.h"
+#include "testutils.h"
+
+using namespace Cyberiada;
+using namespace std;
+
+static String dump(const Document& d)
+{
+	ostringstream s;
+	s << d;
+	return s.str();
+}
+
+static void check_round_trip(const Document& d)
+{
+	String snapshot;
+	d.save_snapshot(snapshot);
+	Document loaded;
+	loaded.load_snapshot(snapshot);
+	CYB_ASSERT(dump(loaded) == dump(d));
+	CYB_ASSERT(loaded.content_hash() == d.content_hash());
+	CYB_ASSERT(loaded.elements_count() == d.elements_count());
+	CYB_ASSERT((loaded.get_meta_element() == NULL) == (d.get_meta_element() == NULL));
+	String buffer, loaded_buffer;
+	d.encode(buffer, formatCyberiada10);
+	loaded.encode(loaded_buffer, formatCyberiada10);
+	CYB_ASSERT(loaded_buffer == buffer);
+
+	// the snapshot of the loaded document is the same
+	String second;
+	loaded.save_snapshot(second);
+	CYB_ASSERT(second == snapshot);
+}
+
+static void check_bad_snapshot(const String& snapshot)
+{
+	Document d;
+	try {
+		d.load_snapshot(snapshot);
+	} catch (const Cyberiada::FormatException&) {
+		CYB_ASSERT(d.get_state_machines().empty());
+		return ;
+	}
+	CYB_ASSERT(false);
+}
+
+int main(int argc, char** argv)
+{
+	try {
+		Document d;
+		d.set_name("Snapshot");
+		d.meta().set_string("author", "tester");
+		d.meta().transition_order_flag = true;
+		StateMachine* sm = d.new_state_machine("SM", Rect(0, 0, 400, 300));
+		InitialPseudostate* init = d.new_initial(sm, Point(5, 5));
+		State* parent = d.new_state(sm, "Parent", Action(actionEntry, "enter();"), Rect(10, 20, 200, 150),
+									Rect(0, 20, 200, 130), "#ff0000");
+		parent->add_action(Action("EVENT", "x > 0", "handle();"));
+		parent->add_action(Action(actionExit, "leave();"));
+		State* child = d.new_state(parent, "Child", Action(), Rect(10, 30, 50, 30));
+		child->set_collapsed(true);
+		child->set_formal_name("child_state");
+		ChoicePseudostate* choice = d.new_choice(sm, "Choice", Rect(250, 20, 20, 20), "#00ff00");
+		FinalState* final = d.new_final(sm, Point(300, 200));
+		d.new_terminate(sm, "Stop", Point(350, 200));
+		Polyline pl;
+		pl.push_back(Point(100, 100));
+		pl.push_back(Point(150, 120));
+		d.new_transition(sm, transitionExternal, init, parent, Action());
+		d.new_transition(sm, transitionLocal, parent, child, Action("GO"), pl, Point(1, 2), Point(3, 4),
+						 Point(5, 6), Rect(7, 8, 9, 10), "#0000ff");
+		d.new_transition(sm, transitionExternal, parent, choice, Action("CHECK"));
+		d.new_transition(sm, transitionExternal, choice, final, Action("", "ready"));
+		Comment* comment = d.new_comment(sm, "Note", "Comment\nwith two lines", Rect(10, 200, 80, 40), "#cccccc", "markdown");
+		d.add_comment_to_element(comment, child);
+		d.add_comment_to_element_name(comment, parent, "Par", Point(-1, -2), Point(3, 4));
+		d.add_comment_to_element_body(comment, parent, "enter", Point(), Point(), pl);
+		d.new_formal_comment(sm, "Formal", "formal body");
+		StateMachine* sm2 = d.new_state_machine("Second");
+		d.new_state(sm2, "Alone");
+		check_round_trip(d);
+
+		// the decoded document keeps the metainformation element
+		String buffer;
+		d.encode(buffer, formatCyberiada10);
+		Document decoded;
+		DocumentFormat format = formatCyberiada10;
+		String format_str;
+		decoded.decode(buffer, format, format_str, geometryFormatQt);
+		check_round_trip(decoded);
+
+		// the lazily loaded document is saved completely
+		Document lazy;
+		lazy.set_lazy_load(true);
+		lazy.decode(buffer, format, format_str, geometryFormatQt);
+		String lazy_snapshot;
+		lazy.save_snapshot(lazy_snapshot);
+		Document lazy_loaded;
+		lazy_loaded.load_snapshot(lazy_snapshot);
+		CYB_ASSERT(lazy_loaded.content_hash() == decoded.content_hash());
+		CYB_ASSERT(lazy_loaded.elements_count() == decoded.elements_count());
+
+		// the broken snapshots are rejected
+		String snapshot;
+		d.save_snapshot(snapshot);
+		check_bad_snapshot(String());
+		check_bad_snapshot(snapshot.substr(0, snapshot.size() / 2));
+		check_bad_snapshot(snapshot.substr(0, snapshot.size() - 4));
+		String bad_magic = snapshot;
+		bad_magic[0] = 'X';
+		check_bad_snapshot(bad_magic);
+
+		// the loaded document is editable
+		Document edited;
+		edited.load_snapshot(snapshot);
+		CYB_ASSERT(edited.find_element_by_id(child->get_id()));
+		State* added = edited.new_state(edited.get_state_machines().front(), "Added");
+		CYB_ASSERT(edited.find_element_by_id(added->get_id()) == added);
+	} catch (const Cyberiada::Exception& e) {
+		cerr << e.str() << endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,102 @@
+/* -----------------------------------------------------------------------------
+ * The Cyberiada GraphML C++ library implemention
+ *
+ * The gzip-compressed files test
+ *
+ * Copyright (C) 2025 Alexey Fedoseev <aleksey@fedoseev.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see https://www.gnu.org/licenses/
+ * ----------------------------------------------------------------------------- */
+
+#include <iostream>
+#include <fstream>
+#include "cyberiadamlpp.h"
+#include "testutils.h"
+
+using namespace Cyberiada;
+using namespace std;
+
+static String read_file(const String& path)
+{
+	ifstream file(path, ios::binary);
+	return String((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+}
+
+static bool is_gzip(const String& path)
+{
+	String content = read_file(path);
+	return content.size() > 2 && (unsigned char)content[0] == 0x1f && (unsigned char)content[1] == 0x8b;
+}
+
+int main(int argc, char** argv)
+{
+	String plain = string(argv[0]) + ".graphml";
+	String compressed = string(argv[0]) + ".graphml.gz";
+	String forced = string(argv[0]) + "-forced.graphml";
+	try {
+		LocalDocument d;
+		StateMachine* sm = d.new_state_machine("SM");
+		State* s0 = d.new_state(sm, "S0");
+		State* s1 = d.new_state(sm, "S1");
+		d.new_transition(sm, transitionExternal, s0, s1, Action("GO"));
+
+		// the compression is selected by the extension
+		d.save_as(plain, formatCyberiada10);
+		CYB_ASSERT(d.get_file_compression() == compressionNone);
+		CYB_ASSERT(!is_gzip(plain));
+		d.save_as(compressed, formatCyberiada10);
+		CYB_ASSERT(d.get_file_compression() == compressionGzip);
+		CYB_ASSERT(is_gzip(compressed));
+
+		// or explicitly
+		d.save_as(forced, formatCyberiada10, false, compressionGzip);
+		CYB_ASSERT(is_gzip(forced));
+
+		// the compression is detected by the content on open
+		LocalDocument plain_doc, compressed_doc, forced_doc;
+		plain_doc.open(plain);
+		compressed_doc.open(compressed);
+		forced_doc.open(forced);
+		CYB_ASSERT(plain_doc.get_file_compression() == compressionNone);
+		CYB_ASSERT(compressed_doc.get_file_compression() == compressionGzip);
+		CYB_ASSERT(forced_doc.get_file_compression() == compressionGzip);
+		CYB_ASSERT(compressed_doc.content_hash() == plain_doc.content_hash());
+		CYB_ASSERT(forced_doc.content_hash() == plain_doc.content_hash());
+
+		// save keeps the compression of the opened file
+		forced_doc.save();
+		CYB_ASSERT(is_gzip(forced));
+		forced_doc.set_file_compression(compressionDetect);
+		CYB_ASSERT(forced_doc.get_file_compression() == compressionNone);
+		forced_doc.save();
+		CYB_ASSERT(!is_gzip(forced));
+
+		// the truncated file is not decoded
+		String content = read_file(compressed);
+		{
+			ofstream file(forced, ios::binary);
+			file << content.substr(0, content.size() / 2);
+		}
+		try {
+			LocalDocument truncated;
+			truncated.open(forced);
+			return 1;
+		} catch (const Cyberiada::Exception&) {
+		}
+	} catch (const Cyberiada::Exception& e) {
+		cerr << e.str() << endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,214 @@
+/* -----------------------------------------------------------------------------
+ * The Cyberiada GraphML C++ library implemention
+ *
+ * The JSON encoding and decoding test
+ *
+ * Copyright (C) 2025 Alexey Fedoseev <aleksey@fedoseev.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see https://www.gnu.org/licenses/
+ * ----------------------------------------------------------------------------- */
+
+#include <iostream>
+#include <sstream>
+#include "cyberiadamlpp.h"
+#include "testutils.h"
+
+using namespace Cyberiada;
+using namespace std;
+
+struct Fixture {
+	const char*            file;
+	DocumentFormat         format;
+	DocumentGeometryFormat geometry;
+};
+
+static const Fixture fixtures[] = {
+	{"20-cyb-geometry.test-input.graphml",      formatDetect,    geometryFormatCyberiada10},
+	{"24-find-elements.test-input.graphml",     formatLegacyYED, geometryFormatQt},
+	{"25-geometry.test-input.graphml",          formatDetect,    geometryFormatQt},
+	{"27-isomorphism.test-graph1.graphml",      formatDetect,    geometryFormatQt},
+	{"28-cyb-graph-editor-1.test-input.graphml", formatDetect,   geometryFormatNone},
+	{"29-flattened-graph.test-input.graphml",   formatDetect,    geometryFormatNone},
+	{"30-orbita.test-input.graphml",            formatLegacyYED, geometryFormatQt},
+	{"31-new-apiary.test-input.graphml",        formatDetect,    geometryFormatNone}
+};
+
+static String dump(const Document& d)
+{
+	ostringstream s;
+	s << d;
+	return s.str();
+}
+
+static void check_round_trip(const Document& d)
+{
+	String json;
+	d.encode_json(json);
+	Document decoded;
+	decoded.decode_json(json);
+	CYB_ASSERT(dump(decoded) == dump(d));
+	CYB_ASSERT(decoded.content_hash() == d.content_hash());
+	CYB_ASSERT(decoded.elements_count() == d.elements_count());
+	CYB_ASSERT((decoded.get_meta_element() == NULL) == (d.get_meta_element() == NULL));
+	String buffer, decoded_buffer;
+	d.encode(buffer, formatCyberiada10);
+	decoded.encode(decoded_buffer, formatCyberiada10);
+	CYB_ASSERT(decoded_buffer == buffer);
+
+	// the JSON of the decoded document is the same
+	String second;
+	decoded.encode_json(second);
+	CYB_ASSERT(second == json);
+}
+
+static void check_bad_json(const String& json)
+{
+	Document d;
+	try {
+		d.decode_json(json);
+	} catch (const Cyberiada::FormatException&) {
+		CYB_ASSERT(d.get_state_machines().empty());
+		return ;
+	}
+	CYB_ASSERT(false);
+}
+
+int main(int argc, char** argv)
+{
+	try {
+		Document d;
+		d.set_name("JSON \"document\"");
+		d.meta().set_string("author", "tester");
+		d.meta().event_propagation_flag = true;
+		StateMachine* sm = d.new_state_machine("SM", Rect(0, 0, 400, 300));
+		InitialPseudostate* init = d.new_initial(sm, Point(5.25, 5));
+		State* parent = d.new_state(sm, "Parent", Action(actionEntry, "enter();"), Rect(10, 20, 200, 150),
+									Rect(0, 20, 200, 130), "#ff0000");
+		parent->add_action(Action("EVENT", "x > 0", "handle();\n\tdone();"));
+		parent->add_action(Action(actionExit, "leave();"));
+		State* child = d.new_state(parent, "Child\\Состояние", Action(), Rect(10, 30, 50.125, 30));
+		child->set_collapsed(true);
+		child->set_formal_name("child_state");
+		ChoicePseudostate* choice = d.new_choice(sm, "Choice", Rect(250, 20, 20, 20), "#00ff00");
+		FinalState* final = d.new_final(sm, Point(300, 200));
+		d.new_terminate(sm, "Stop", Point(350, 200));
+		Polyline pl;
+		pl.push_back(Point(100, 100));
+		pl.push_back(Point(-150.5, 0.1f));
+		d.new_transition(sm, transitionExternal, init, parent, Action());
+		d.new_transition(sm, transitionLocal, parent, child, Action("GO"), pl, Point(1, 2), Point(3, 4),
+						 Point(5, 6), Rect(7, 8, 9, 10), "#0000ff");
+		d.new_transition(sm, transitionExternal, parent, choice, Action("CHECK"));
+		d.new_transition(sm, transitionExternal, choice, final, Action("", "ready"));
+		Comment* comment = d.new_comment(sm, "Note", "Comment\nwith \x01 two lines", Rect(10, 200, 80, 40), "#cccccc", "markdown");
+		d.add_comment_to_element(comment, child);
+		d.add_comment_to_element_name(comment, parent, "Par", Point(-1, -2), Point(3, 4));
+		d.add_comment_to_element_body(comment, parent, "enter", Point(), Point(), pl);
+		d.new_formal_comment(sm, "Formal", "formal body");
+		StateMachine* sm2 = d.new_state_machine("Second");
+		d.new_state(sm2, "Alone");
+		check_round_trip(d);
+
+		// the decoded GraphML document keeps the metainformation element
+		String buffer;
+		d.encode(buffer, formatCyberiada10);
+		Document decoded;
+		DocumentFormat format = formatCyberiada10;
+		String format_str;
+		decoded.decode(buffer, format, format_str, geometryFormatQt);
+		check_round_trip(decoded);
+
+		// the test fixtures
+		String dir = argv[0];
+		size_t slash = dir.rfind('/');
+		dir = slash == String::npos ? String() : dir.substr(0, slash + 1);
+		for (size_t i = 0; i < sizeof(fixtures) / sizeof(fixtures[0]); i++) {
+			LocalDocument ld;
+			ld.open(dir + fixtures[i].file, fixtures[i].format, fixtures[i].geometry);
+			check_round_trip(Document(ld));
+		}
+
+		// the keys of the hand-written JSON are read in any order
+		Document written;
+		written.decode_json("{ \"stateMachines\": [ { \"id\": \"G0\", \"type\": \"stateMachine\", \"children\": ["
+							"  { \"name\": \"A\", \"type\": \"simpleState\", \"id\": \"a\", \"unknown\": [1, {\"x\": null}] },"
+							"  { \"type\": \"formalComment\", \"id\": \"c\", \"body\": \"\\u0436\\ud83d\\ude00\" },"
+							"  { \"type\": \"transition\", \"id\": \"a-a\", \"source\": \"a\", \"target\": \"a\","
+							"    \"action\": { \"trigger\": \"TICK\" } } ] } ],"
+							"  \"geometryFormat\": \"none\" }");
+		CYB_ASSERT(written.find_element_by_id("a") && written.find_element_by_id("a")->get_name() == "A");
+		const Element* formal = written.find_element_by_id("c");
+		CYB_ASSERT(formal && formal->get_type() == elementFormalComment);
+		CYB_ASSERT(static_cast<const Comment*>(formal)->get_body() == "\xd0\xb6\xf0\x9f\x98\x80");
+		CYB_ASSERT(written.find_element_by_id("a-a")->get_type() == elementTransition);
+
+		// the keys after the children and the children before the type give the same document
+		const char* ordered =
+			"{ \"geometryFormat\": \"qt\", \"stateMachines\": [ { \"type\": \"stateMachine\", \"id\": \"G0\","
+			"  \"name\": \"SM\", \"rect\": { \"x\": 0, \"y\": 0, \"width\": 400, \"height\": 300 }, \"children\": ["
+			"  { \"type\": \"compositeState\", \"id\": \"p\", \"name\": \"P\", \"formalName\": \"p_state\","
+			"    \"rect\": { \"x\": 10, \"y\": 20, \"width\": 200, \"height\": 150 },"
+			"    \"region\": { \"x\": 0, \"y\": 20, \"width\": 200, \"height\": 130 }, \"color\": \"#ff0000\","
+			"    \"collapsed\": true, \"actions\": [ { \"type\": \"entry\", \"behavior\": \"enter();\" },"
+			"    { \"type\": \"transition\", \"trigger\": \"GO\", \"behavior\": \"go();\" } ], \"children\": ["
+			"    { \"type\": \"simpleState\", \"id\": \"c\", \"name\": \"C\" } ] } ] } ] }";
+		const char* reordered =
+			"{ \"stateMachines\": [ { \"children\": ["
+			"  { \"children\": [ { \"type\": \"simpleState\", \"id\": \"c\", \"name\": \"C\" } ],"
+			"    \"actions\": [ { \"type\": \"entry\", \"behavior\": \"enter();\" } ], \"id\": \"p\","
+			"    \"region\": { \"x\": 0, \"y\": 20, \"width\": 200, \"height\": 130 }, \"type\": \"compositeState\","
+			"    \"rect\": { \"x\": 10, \"y\": 20, \"width\": 200, \"height\": 150 }, \"formalName\": \"p_state\","
+			"    \"color\": \"#ff0000\", \"collapsed\": true, \"name\": \"P\","
+			"    \"actions\": [ { \"type\": \"transition\", \"trigger\": \"GO\", \"behavior\": \"go();\" } ] } ],"
+			"  \"name\": \"SM\", \"type\": \"stateMachine\", \"id\": \"G0\","
+			"  \"rect\": { \"x\": 0, \"y\": 0, \"width\": 400, \"height\": 300 } } ], \"geometryFormat\": \"qt\" }";
+		Document ordered_doc, reordered_doc;
+		ordered_doc.decode_json(ordered);
+		reordered_doc.decode_json(reordered);
+		CYB_ASSERT(dump(reordered_doc) == dump(ordered_doc));
+		CYB_ASSERT(reordered_doc.content_hash() == ordered_doc.content_hash());
+		const Element* renamed = reordered_doc.find_element_by_id("p");
+		CYB_ASSERT(renamed && renamed->get_name() == "P" && renamed->get_formal_name() == "p_state");
+		CYB_ASSERT(reordered_doc.find_element_by_id("c") && reordered_doc.find_element_by_id("c")->get_parent() == renamed);
+		CYB_ASSERT(static_cast<const State*>(renamed)->get_actions().size() == 2);
+		check_round_trip(reordered_doc);
+
+		// the broken JSON is rejected
+		String json;
+		d.encode_json(json);
+		check_bad_json(String());
+		check_bad_json(json.substr(0, json.size() / 2));
+		check_bad_json(json + "{}");
+		check_bad_json("{\"version\": 2}");
+		check_bad_json("{\"stateMachines\": [{\"type\": \"simpleState\", \"id\": \"s\"}]}");
+		check_bad_json("{\"stateMachines\": [{\"id\": \"G0\", \"children\": []}]}");
+		check_bad_json("{\"stateMachines\": [{\"children\": [], \"type\": \"simpleState\", \"id\": \"s\"}]}");
+		check_bad_json("{\"stateMachines\": [{\"type\": \"stateMachine\", \"id\": \"G0\", \"children\": ["
+					   "{\"children\": [], \"type\": \"initial\", \"id\": \"i\"}]}]}");
+		check_bad_json("{\"stateMachines\": [{\"type\": \"stateMachine\", \"id\": \"G0\", \"children\": [], \"children\": []}]}");
+		check_bad_json("{\"stateMachines\": [{\"type\": \"stateMachine\", \"id\": \"G0\", \"children\": ["
+					   "{\"type\": \"comment\", \"id\": \"c\", \"subjects\": [{\"id\": \"s\", \"element\": \"missing\"}]}]}]}");
+
+		// the decoded document is editable
+		Document edited;
+		edited.decode_json(json);
+		CYB_ASSERT(edited.find_element_by_id(child->get_id()));
+		State* added = edited.new_state(edited.get_state_machines().front(), "Added");
+		CYB_ASSERT(edited.find_element_by_id(added->get_id()) == added);
+	} catch (const Cyberiada::Exception& e) {
+		cerr << e.str() << endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,96 @@
+/* -----------------------------------------------------------------------------
+ * The Cyberiada GraphML C++ library implemention
+ *
+ * The text dump test
+ *
+ * Copyright (C) 2025 Alexey Fedoseev <aleksey@fedoseev.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see https://www.gnu.org/licenses/
+ * ----------------------------------------------------------------------------- */
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include "cyberiadamlpp.h"
+#include "testutils.h"
+
+using namespace Cyberiada;
+using namespace std;
+
+// the element dump extended by the derived class
+class TaggedState: public State {
+public:
+	TaggedState(Element* parent, const ID& id, const Name& name): State(parent, id, name) {}
+
+protected:
+	std::ostream& dump(std::ostream& os) const override
+	{
+		State::dump(os);
+		return os << ", tag: " << 0.5f;
+	}
+};
+
+int main(int argc, char** argv)
+{
+	try {
+		Document d;
+		StateMachine* sm = d.new_state_machine("SM");
+		InitialPseudostate* init = d.new_initial(sm, Point(-0.0f, 1e6f));
+		State* s = d.new_state(sm, "S", Action(actionEntry, "enter();"), Rect(0.1f, -2.5f, 999999, 123456789));
+		Polyline pl;
+		pl.push_back(Point(-999999, 1e-5f));
+		Transition* t = d.new_transition(sm, transitionExternal, init, s, Action("GO", "x > 0", "go();"), pl);
+
+		// the numbers are formatted as the default stream does
+		CYB_ASSERT(init->dump_to_str() == "Initial: {id: '" + init->get_id() + "', geometry: (-0; 1e+06)}");
+		ostringstream rect;
+		rect << Rect(0.1f, -2.5f, 999999, 123456789);
+		CYB_ASSERT(rect.str() == "(0.1; -2.5; 999999; 1.23457e+08)");
+		CYB_ASSERT(s->dump_to_str().find("geometry: " + rect.str()) != String::npos);
+		CYB_ASSERT(t->dump_to_str().find("polyline: [ (-999999; 1e-05) ]") != String::npos);
+		CYB_ASSERT(t->get_action().to_str() == "trigger: 'GO', guard: 'x > 0', behavior: 'go();'");
+
+		// the stream output is the same as the string dump
+		ostringstream os;
+		os << d;
+		CYB_ASSERT(os.str() == d.dump_to_str());
+		CYB_ASSERT(os.str().find("meta: {standard version: '1.0', transition order: transition first, "
+								 "event propagation: block events}") != String::npos);
+
+		// the numbers follow the stream format
+		ostringstream precise;
+		precise << setprecision(3) << *s;
+		CYB_ASSERT(precise.str().find("geometry: (0.1; -2.5; 1e+06; 1.23e+08)") != String::npos);
+		CYB_ASSERT(precise.str() == s->dump_to_str().replace(precise.str().find("geometry: ") + 10,
+															 rect.str().length(), "(0.1; -2.5; 1e+06; 1.23e+08)"));
+		ostringstream fixed_point;
+		fixed_point << fixed << setprecision(1) << *init;
+		CYB_ASSERT(fixed_point.str() == "Initial: {id: '" + init->get_id() + "', geometry: (-0.0; 1000000.0)}");
+
+		// the dump() overrides are called for the nested elements
+		sm->add_element(new TaggedState(sm, "tagged", "T"));
+		ostringstream tagged;
+		tagged << *sm;
+		CYB_ASSERT(tagged.str() == sm->dump_to_str());
+		CYB_ASSERT(tagged.str().find("Simple State: {id: 'tagged', name: 'T'") != String::npos);
+		CYB_ASSERT(tagged.str().find(", tag: 0.5") != String::npos);
+		ostringstream tagged_precise;
+		tagged_precise << setprecision(2) << scientific << *sm;
+		CYB_ASSERT(tagged_precise.str().find(", tag: 5.00e-01") != String::npos);
+	} catch (const Cyberiada::Exception& e) {
+		cerr << e.str() << endl;
+		return 1;
+	}
+	return 0;
+}
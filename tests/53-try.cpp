@@ -0,0 +1,106 @@
+/* -----------------------------------------------------------------------------
+ * The Cyberiada GraphML C++ library implemention
+ *
+ * The test of the non-throwing factories and decode
+ *
+ * Copyright (C) 2025 Alexey Fedoseev <aleksey@fedoseev.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see https://www.gnu.org/licenses/
+ * ----------------------------------------------------------------------------- */
+
+
+#include <iostream>
+#include "cyberiadamlpp.h"
+#include "testutils.h"
+
+using namespace Cyberiada;
+using namespace std;
+
+int main(int argc, char** argv)
+{
+	try {
+		Document d;
+		StateMachine* sm = d.new_state_machine("SM");
+		State* s = NULL;
+		CYB_ASSERT(d.try_new_state(s, sm, "S"));
+		CYB_ASSERT(s && s->get_parent() == sm);
+
+		// the failed checks keep the document unchanged
+		String before = d.dump_to_str();
+		State* bad = s;
+		Status st = d.try_new_state(bad, sm, "");
+		CYB_ASSERT(!st && st.code == statusParametersError && st.message == "Empty string parameter" && !bad);
+		st = d.try_new_state(bad, sm, s->get_id(), "T");
+		CYB_ASSERT(st.code == statusParametersError && st.message == "New element id " + s->get_id() + " is not unique");
+		InitialPseudostate* init = NULL;
+		CYB_ASSERT(d.try_new_initial(init, sm));
+		CYB_ASSERT(d.try_new_initial(init, sm).message == "Parent already has initial element" && !init);
+		init = static_cast<InitialPseudostate*>(sm->find_elements_by_type(elementInitial).front());
+		Transition* t = NULL;
+		CYB_ASSERT(d.try_new_transition(t, sm, transitionExternal, s, init, Action("GO")).message == "Bad target for transition");
+		CYB_ASSERT(d.try_new_transition(t, NULL, transitionExternal, init, s, Action()).message == "No parent element");
+		CYB_ASSERT(d.try_new_transition(t, sm, transitionExternal, init, s, Action(actionEntry)).message ==
+				   "Transitions cannot contain entry/exit activities");
+		ChoicePseudostate* choice = NULL;
+		CYB_ASSERT(d.try_new_choice(choice, sm));
+		CYB_ASSERT(d.try_new_transition(t, sm, transitionExternal, s, choice, Action("GO")) && t);
+		CYB_ASSERT(d.try_new_transition(t, sm, transitionExternal, init, choice, Action()).message ==
+				   "Choice pseudostate may have only one incoming transition");
+		Comment* comment = NULL;
+		CYB_ASSERT(d.try_new_comment(comment, sm, "note"));
+		const CommentSubject* subject = NULL;
+		CYB_ASSERT(d.try_add_comment_to_element_name(subject, comment, s, "").message == "Empty string parameter" && !subject);
+		CYB_ASSERT(d.try_add_comment_to_element(subject, comment, sm).message == "Bad element to comment");
+		CYB_ASSERT(d.try_add_comment_to_element(subject, comment, s) && subject->get_element() == s);
+		CYB_ASSERT(d.dump_to_str() != before);
+		before = d.dump_to_str();
+		FinalState* fin = NULL;
+		CYB_ASSERT(!d.try_new_final(fin, NULL) && !fin);
+		CYB_ASSERT(d.dump_to_str() == before);
+
+		// the throwing factories raise the same failures
+		try {
+			d.new_state(sm, s->get_id(), "T");
+			CYB_ASSERT(false);
+		} catch (const ParametersException& e) {
+			CYB_ASSERT(e.str() == ParametersException("New element id " + s->get_id() + " is not unique").str());
+		}
+		try {
+			throw_status(Status(statusNotFound, "missing"));
+			CYB_ASSERT(false);
+		} catch (const NotFoundException& e) {
+			CYB_ASSERT(e.str() == NotFoundException("missing").str());
+		}
+		throw_status(Status());
+
+		// the failed decode leaves the empty document
+		Document d2;
+		DocumentFormat f = formatDetect;
+		String format_str;
+		st = d2.try_decode("", f, format_str);
+		CYB_ASSERT(st.code == statusParametersError && st.message == "Empty buffer to decode");
+		st = d2.try_decode("<nothing/>", f, format_str);
+		CYB_ASSERT(!st && st.code != statusParametersError && d2.get_state_machines().empty());
+		st = d2.try_decode("<nothing/>", f, format_str, DocumentGeometryFormat(100));
+		CYB_ASSERT(st.code == statusParametersError && st.message == "Bad geometry format 100");
+		String buffer;
+		d.encode(buffer);
+		CYB_ASSERT(d2.try_decode(buffer, f, format_str, geometryFormatNone));
+		CYB_ASSERT(f == formatCyberiada10 && !d2.get_state_machines().empty());
+	} catch (const Cyberiada::Exception& e) {
+		cerr << e.str() << endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,128 @@
+/* -----------------------------------------------------------------------------
+ * The Cyberiada GraphML C++ library implemention
+ *
+ * The test of the state machine flattening
+ *
+ * Copyright (C) 2025 Alexey Fedoseev <aleksey@fedoseev.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see https://www.gnu.org/licenses/
+ * ----------------------------------------------------------------------------- */
+
+
+#include <iostream>
+#include "cyberiadamlpp.h"
+#include "testutils.h"
+
+using namespace Cyberiada;
+using namespace std;
+
+static const Transition* flat_transition(const StateMachine* sm, const ID& id)
+{
+	const Element* e = sm->find_element_by_id(id);
+	CYB_ASSERT(e && e->get_type() == elementTransition);
+	return static_cast<const Transition*>(e);
+}
+
+static void check_transition(const StateMachine* sm, const ID& id, const ID& source, const ID& target,
+							 const String& trigger, const String& behavior)
+{
+	const Transition* t = flat_transition(sm, id);
+	CYB_ASSERT(t->source_element_id() == source);
+	CYB_ASSERT(t->target_element_id() == target);
+	CYB_ASSERT(t->get_action().get_trigger() == trigger);
+	CYB_ASSERT(t->get_action().get_behavior() == behavior);
+}
+
+int main(int argc, char** argv)
+{
+	try {
+		Document d;
+		StateMachine* sm = d.new_state_machine("SM");
+		InitialPseudostate* init = d.new_initial(sm);
+		State* a = d.new_state(sm, "A", Action(actionEntry, "a_in"));
+		a->add_action(Action(actionExit, "a_out"));
+		a->add_action(Action("TICK", "", "tick()"));
+		InitialPseudostate* init_a = d.new_initial(a);
+		State* a1 = d.new_state(a, "A1");
+		State* a2 = d.new_state(a, "A2");
+		FinalState* fin_a = d.new_final(a);
+		State* b = d.new_state(sm, "B", Action(actionEntry, "b_in"));
+
+		d.new_transition(sm, transitionExternal, init, a, Action());
+		d.new_transition(sm, transitionExternal, init_a, a1, Action("", "", "init_a"));
+		Transition* go12 = d.new_transition(sm, transitionExternal, a1, a2, Action("E1", "", "go12"));
+		Transition* a2b = d.new_transition(sm, transitionExternal, a, b, Action("E2", "", "a2b"));
+		Transition* done = d.new_transition(sm, transitionExternal, a, b, Action("", "", "done"));
+		Transition* b2a = d.new_transition(sm, transitionExternal, b, a, Action("E3", "", "b2a"));
+		Transition* x = d.new_transition(sm, transitionExternal, a2, b, Action("E4", "", "x"));
+		Transition* reset = d.new_transition(sm, transitionExternal, a, a, Action("E5", "", "reset"));
+		Transition* local = d.new_transition(sm, transitionLocal, a, a2, Action("E6", "", "loc"));
+
+		Document flat_doc;
+		StateMachine* flat = sm->flatten(&flat_doc);
+		flat_doc.add_element(flat);
+		CYB_ASSERT(flat->get_id() == sm->get_id());
+
+		// the composite state and its initial pseudostate are dissolved
+		CYB_ASSERT(flat->get_vertexes().size() == 5);
+		CYB_ASSERT(!flat->find_element_by_id(a->get_id()) && !flat->find_element_by_id(init_a->get_id()));
+		CYB_ASSERT(flat->find_elements_by_type(elementCompositeState).empty());
+		const Element* flat_a1 = flat_doc.find_element_by_id(a1->get_id());
+		CYB_ASSERT(flat_a1 && flat_a1->get_name() == "A::A1" && flat_a1->get_parent() == flat);
+		const State* flat_fin = static_cast<const State*>(flat->find_element_by_id(fin_a->get_id()));
+		CYB_ASSERT(flat_fin->get_type() == elementSimpleState && flat_fin->get_name() == "A::final");
+		CYB_ASSERT(flat->find_element_by_id(init->get_id())->get_type() == elementInitial);
+
+		// the internal transitions of the composite state are inherited
+		const vector<Action>& actions = static_cast<const State*>(flat_a1)->get_actions();
+		CYB_ASSERT(actions.size() == 1 && actions[0].get_trigger() == "TICK");
+
+		// the leaf states inherit the triggered transitions, the final state the completion one as well
+		CYB_ASSERT(flat->get_transitions().size() == 14);
+		String sep = QUALIFIED_NAME_SEPARATOR;
+		check_transition(flat, go12->get_id(), a1->get_id(), a2->get_id(), "E1", "go12");
+		check_transition(flat, a2b->get_id() + sep + a1->get_id(), a1->get_id(), b->get_id(), "E2", "a_out\na2b");
+		check_transition(flat, a2b->get_id() + sep + fin_a->get_id(), fin_a->get_id(), b->get_id(), "E2", "a_out\na2b");
+		check_transition(flat, done->get_id() + sep + fin_a->get_id(), fin_a->get_id(), b->get_id(), "", "a_out\ndone");
+		CYB_ASSERT(!flat->find_element_by_id(done->get_id() + sep + a1->get_id()));
+		check_transition(flat, x->get_id(), a2->get_id(), b->get_id(), "E4", "a_out\nx");
+
+		// the transitions to the composite state follow its initial transition
+		check_transition(flat, b2a->get_id(), b->get_id(), a1->get_id(), "E3", "b2a\na_in\ninit_a");
+		const Transition* start = flat->get_transitions().front();
+		CYB_ASSERT(start->source_element_id() == init->get_id() && start->target_element_id() == a1->get_id());
+		CYB_ASSERT(start->get_action().get_behavior() == "a_in\ninit_a");
+
+		// the external self-transition exits the composite state, the local one does not
+		check_transition(flat, reset->get_id() + sep + a2->get_id(), a2->get_id(), a1->get_id(), "E5",
+						 "a_out\nreset\na_in\ninit_a");
+		check_transition(flat, local->get_id() + sep + a1->get_id(), a1->get_id(), a2->get_id(), "E6", "loc");
+
+		// the composite state without the initial pseudostate cannot be entered
+		Document bad;
+		StateMachine* bad_sm = bad.new_state_machine("SM");
+		State* c = bad.new_state(bad_sm, "C");
+		bad.new_state(c, "C1");
+		bad.new_transition(bad_sm, transitionExternal, bad.new_state(bad_sm, "D"), c, Action("E"));
+		try {
+			delete bad_sm->flatten();
+			CYB_ASSERT(false);
+		} catch (const ParametersException&) {
+		}
+	} catch (const Cyberiada::Exception& e) {
+		cerr << e.str() << endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,152 @@
+/* -----------------------------------------------------------------------------
+ * The Cyberiada GraphML C++ library implemention
+ *
+ * The test of the state machine interpreter
+ *
+ * Copyright (C) 2025 Alexey Fedoseev <aleksey@fedoseev.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see https://www.gnu.org/licenses/
+ * ----------------------------------------------------------------------------- */
+
+
+#include <iostream>
+#include "cyberiadamlpp.h"
+#include "testutils.h"
+
+using namespace Cyberiada;
+using namespace std;
+
+static String trace;
+
+static void record(const Behavior& behavior, const ID&)
+{
+	if (!trace.empty()) {
+		trace += ",";
+	}
+	trace += behavior;
+}
+
+static String take_trace()
+{
+	String s = trace;
+	trace.clear();
+	return s;
+}
+
+int main(int argc, char** argv)
+{
+	try {
+		Document d;
+		StateMachine* sm = d.new_state_machine("SM");
+		InitialPseudostate* init = d.new_initial(sm);
+		State* a = d.new_state(sm, "A", Action(actionEntry, "a_in"));
+		a->add_action(Action(actionExit, "a_out"));
+		a->add_action(Action("TICK", "", "tick"));
+		InitialPseudostate* init_a = d.new_initial(a);
+		State* a1 = d.new_state(a, "A1", Action(actionEntry, "a1_in"));
+		a1->add_action(Action(actionExit, "a1_out"));
+		a1->add_action(Action("TICK", "", "a1_tick"));
+		State* a2 = d.new_state(a, "A2");
+		FinalState* fin_a = d.new_final(a);
+		State* b = d.new_state(sm, "B", Action(actionEntry, "b_in"));
+		ChoicePseudostate* c = d.new_choice(sm);
+		FinalState* fin = d.new_final(sm);
+		TerminatePseudostate* term = d.new_terminate(sm);
+
+		d.new_transition(sm, transitionExternal, init, a, Action());
+		d.new_transition(sm, transitionExternal, init_a, a1, Action("", "", "init_a"));
+		d.new_transition(sm, transitionExternal, a1, a2, Action("E1", "", "go12"));
+		d.new_transition(sm, transitionExternal, a2, fin_a, Action("E2", "", "fin"));
+		d.new_transition(sm, transitionExternal, a, b, Action("", "", "done"));
+		d.new_transition(sm, transitionExternal, b, c, Action("E3", "", "to_c"));
+		Transition* pos = d.new_transition(sm, transitionExternal, c, a, Action("", "x > 0", "pos"));
+		d.new_transition(sm, transitionExternal, c, fin, Action("", "", "neg"));
+		d.new_transition(sm, transitionExternal, b, term, Action("E4"));
+		d.new_transition(sm, transitionExternal, a, a, Action("E5", "", "reset"));
+
+		// transition first, the events are blocked by the internal transitions
+		StateMachineInterpreter run(*sm);
+		run.set_behavior_callback(record);
+		ID guarded;
+		int x = 1;
+		run.set_guard_callback([&](const Guard& g, const ID& id) { guarded = id; return g == "x > 0" && x > 0; });
+
+		CYB_ASSERT(run.triggers_count() == 6);
+		CYB_ASSERT(run.trigger_name(0) == "TICK" && run.trigger_id("E1") == 1 && run.trigger_id("E6") == -1);
+		CYB_ASSERT(!run.is_running() && run.active_state().empty());
+		CYB_ASSERT(!run.dispatch("E1"));
+
+		run.start();
+		CYB_ASSERT(take_trace() == "a_in,init_a,a1_in");
+		CYB_ASSERT(run.active_state() == a1->get_id() && run.is_active(a->get_id()) && !run.is_active(b->get_id()));
+		CYB_ASSERT(run.dispatch("TICK") && take_trace() == "a1_tick");
+		CYB_ASSERT(run.dispatch("E1") && take_trace() == "go12,a1_out");
+		CYB_ASSERT(run.dispatch("TICK") && take_trace() == "tick");
+		// the nested final state completes the composite state
+		CYB_ASSERT(run.dispatch("E2") && take_trace() == "fin,done,a_out,b_in");
+		CYB_ASSERT(run.active_state() == b->get_id());
+		CYB_ASSERT(!run.dispatch("E1") && !run.dispatch("E6") && take_trace().empty());
+		// the choice pseudostate follows the enabled transition
+		CYB_ASSERT(run.dispatch("E3") && take_trace() == "to_c,pos,a_in,init_a,a1_in");
+		CYB_ASSERT(guarded == pos->get_id() && run.active_state() == a1->get_id());
+		CYB_ASSERT(run.dispatch("E5") && take_trace() == "reset,a1_out,a_out,a_in,init_a,a1_in");
+
+		// exit first, the events are propagated to the parent states
+		DocumentMetainformation meta;
+		meta.transition_order_flag = true;
+		meta.event_propagation_flag = true;
+		StateMachineInterpreter prop(*sm, meta);
+		prop.set_behavior_callback(record);
+		prop.start();
+		CYB_ASSERT(take_trace() == "a_in,init_a,a1_in");
+		CYB_ASSERT(prop.dispatch("TICK") && take_trace() == "a1_tick,tick");
+		CYB_ASSERT(prop.dispatch("E1") && take_trace() == "a1_out,go12");
+		CYB_ASSERT(prop.dispatch("E2") && take_trace() == "fin,a_out,done,b_in");
+		// without the guard callback all guards are true
+		CYB_ASSERT(prop.dispatch("E3") && take_trace() == "to_c,pos,a_in,init_a,a1_in");
+
+		// the top-level final state finishes the SM
+		x = 0;
+		run.start();
+		run.dispatch("E1");
+		run.dispatch("E2");
+		take_trace();
+		CYB_ASSERT(run.dispatch("E3") && take_trace() == "to_c,neg");
+		CYB_ASSERT(run.is_finished() && !run.is_running() && run.active_state() == fin->get_id());
+		CYB_ASSERT(!run.dispatch("E1"));
+
+		// the terminate pseudostate stops the SM
+		run.start();
+		run.dispatch("E1");
+		run.dispatch("E2");
+		CYB_ASSERT(run.dispatch("E4") && run.is_terminated() && !run.is_finished() && !run.is_running());
+		take_trace();
+
+		// the SM cannot be started without the initial transition
+		Document bad;
+		StateMachine* bad_sm = bad.new_state_machine("SM");
+		bad.new_state(bad_sm, "S");
+		StateMachineInterpreter bad_run(*bad_sm);
+		try {
+			bad_run.start();
+			CYB_ASSERT(false);
+		} catch (const ParametersException&) {
+		}
+		CYB_ASSERT(!bad_run.is_running());
+	} catch (const Cyberiada::Exception& e) {
+		cerr << e.str() << endl;
+		return 1;
+	}
+	return 0;
+}